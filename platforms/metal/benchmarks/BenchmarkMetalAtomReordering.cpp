@@ -0,0 +1,125 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This times the nonbonded kernel after reordering atoms along each space-filling curve, and
+ * reports how many tiles per atom block the neighbor list contains.  The atoms start in a random
+ * order, at roughly the density of water.  TestMetalAtomReordering checks that every order finds
+ * the same pairs on a smaller system.
+ *
+ * Usage: BenchmarkMetalAtomReordering [--output=file] [--atoms=n] [--iterations=n]
+ *            [--precision=single|mixed|double] [--platform-index=n] [--device-index=n]
+ */
+
+#include "MetalBenchmarkUtilities.h"
+#include "MetalNonbondedUtilities.h"
+#include "sfmt/SFMT.h"
+#include <cmath>
+#include <iostream>
+
+using namespace OpenMM;
+using namespace std;
+
+int main(int argc, char* argv[]) {
+    try {
+        int numAtoms = 24000;
+        int iterations = 20;
+        MetalBenchmarkOptions options("BenchmarkMetalAtomReordering.json");
+        options.addOption("--atoms", numAtoms);
+        options.addOption("--iterations", iterations);
+        options.parse(argc, argv);
+        MetalBenchmarkOptions::checkAtLeast("--atoms", numAtoms, 1);
+        MetalBenchmarkOptions::checkAtLeast("--iterations", iterations, 1);
+
+        // Place atoms randomly in a box, and create a context with an interaction that counts pairs.
+
+        const double cutoff = 1.0;
+        const double width = pow(numAtoms/100.0, 1.0/3.0);
+        System system;
+        for (int i = 0; i < numAtoms; i++)
+            system.addParticle(1.0);
+        system.setDefaultPeriodicBoxVectors(Vec3(width, 0, 0), Vec3(0, width, 0), Vec3(0, 0, width));
+        MetalPlatform::PlatformData platformData(system, options.platformIndex, options.deviceIndex, options.precision, "false", "false", 1, NULL);
+        MetalContext& context = *platformData.contexts[0];
+        context.setPeriodicBoxVectors(Vec3(width, 0, 0), Vec3(0, width, 0), Vec3(0, 0, width));
+        vector<vector<int> > exclusions(numAtoms);
+        for (int i = 0; i < numAtoms; i++)
+            exclusions[i].push_back(i);
+        string source = "tempEnergy += (!isExcluded && r2 < MAX_CUTOFF*MAX_CUTOFF ? 1.0f : 0.0f);\n";
+        MetalNonbondedUtilities& nb = context.getNonbondedUtilities();
+        nb.addInteraction(true, true, true, cutoff, exclusions, source, 0, true);
+        context.initialize();
+        OpenMM_SFMT::SFMT sfmt;
+        init_gen_rand(0, sfmt);
+        vector<mm_float4> posq(context.getPaddedNumAtoms(), mm_float4(0, 0, 0, 0));
+        for (int i = 0; i < numAtoms; i++)
+            posq[i] = mm_float4((float) (genrand_real2(sfmt)*width), (float) (genrand_real2(sfmt)*width), (float) (genrand_real2(sfmt)*width), 0);
+        context.getPosq().upload(posq);
+
+        // Time the nonbonded kernel in the original order and after each reordering.
+
+        MetalBenchmarkWriter out(options.outputFile);
+        out.add("precision", options.precision);
+        out.add("units", "microseconds");
+        out.add("atoms", numAtoms);
+        out.beginArray("orders");
+        const char* names[] = {"random", "molecule", "hilbert", "morton"};
+        const MetalContext::AtomOrder orders[] = {MetalContext::MoleculeOrder, MetalContext::MoleculeOrder, MetalContext::HilbertOrder, MetalContext::MortonOrder};
+        for (int i = 0; i < 4; i++) {
+            if (i > 0) {
+                context.setAtomOrder(orders[i]);
+                context.forceReorder();
+                context.reorderAtoms();
+            }
+
+            // Build the neighbor list.  The first evaluation may enlarge it, so do it twice.
+
+            for (int j = 0; j < 2; j++) {
+                context.clearAutoclearBuffers();
+                nb.prepareInteractions(1);
+                nb.computeInteractions(1, false, true);
+            }
+            vector<cl_uint> count;
+            nb.getInteractionCount().download(count);
+            double tilesPerBlock = count[0]/(double) context.getNumAtomBlocks();
+            double time = timeMicroseconds(context, iterations, [&] () {nb.computeInteractions(1, false, true);});
+            out.beginObject();
+            out.add("order", names[i]);
+            out.add("tilesPerBlock", tilesPerBlock);
+            out.add("time", time);
+            out.endObject();
+            cout << names[i] << " order: " << tilesPerBlock << " tiles per block, " << time << " us per nonbonded evaluation" << endl;
+        }
+        out.endArray();
+        out.close();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
@@ -0,0 +1,180 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This benchmarks CCMA on a large constrained system, comparing the host polling for
+ * convergence with the device deciding on its own when to stop.  The system is a set of
+ * protein-like chains with every bond constrained, so all the constraints in a chain are
+ * coupled and are handled by the multiple kernel version of CCMA.  For each mode it reports
+ * the wall clock time of one position constraint application, one velocity constraint
+ * application, and one Verlet step, which applies both.
+ *
+ * Usage: BenchmarkMetalConstraints [--output=file] [--precision=single|mixed|double]
+ *            [--repeats=n] [--chains=n] [--chain-length=n] [--platform-index=n] [--device-index=n]
+ */
+
+#include "MetalBenchmarkUtilities.h"
+#include "MetalTrackingPlatform.h"
+#include "openmm/Context.h"
+#include "openmm/HarmonicAngleForce.h"
+#include "openmm/VerletIntegrator.h"
+#include <cmath>
+#include <iostream>
+
+using namespace OpenMM;
+using namespace std;
+
+/**
+ * Create chains of heavy atoms, each with one hydrogen.  Every bond is constrained, and angles
+ * along the backbone keep the chains from folding up.
+ */
+System* createSystem(int numChains, int chainLength, vector<Vec3>& positions) {
+    System* system = new System();
+    HarmonicAngleForce* angles = new HarmonicAngleForce();
+    for (int chain = 0; chain < numChains; chain++) {
+        Vec3 start(0, 0.5*(chain%10), 0.5*(chain/10));
+        vector<int> heavy;
+        for (int i = 0; i < chainLength; i++) {
+            int atom = system->addParticle(12.0);
+            int hydrogen = system->addParticle(1.008);
+            heavy.push_back(atom);
+            Vec3 pos = start+Vec3(0.125*i, 0.08*(i%2), 0.0);
+            positions.push_back(pos);
+            positions.push_back(pos+Vec3(0.0, (i%2 == 0 ? -0.109 : 0.109), 0.0));
+            system->addConstraint(atom, hydrogen, 0.109);
+            if (i > 0) {
+                Vec3 delta = positions[heavy[i]]-positions[heavy[i-1]];
+                system->addConstraint(heavy[i-1], heavy[i], sqrt(delta.dot(delta)));
+            }
+            if (i > 1) {
+                Vec3 v1 = positions[heavy[i-2]]-positions[heavy[i-1]];
+                Vec3 v2 = positions[heavy[i]]-positions[heavy[i-1]];
+                angles->addAngle(heavy[i-2], heavy[i-1], heavy[i], acos(v1.dot(v2)/sqrt(v1.dot(v1)*v2.dot(v2))), 400.0);
+            }
+        }
+    }
+    system->addForce(angles);
+    return system;
+}
+
+/**
+ * Measure the time per constraint application with one convergence mode.
+ */
+map<string, double> runBenchmark(MetalTrackingPlatform& platform, const map<string, string>& properties, System& system,
+            const vector<Vec3>& positions, int repeats, bool deviceConvergence) {
+    // The mode is read when the context is created.
+
+    setenv("OPENMM_METAL_CCMA_DEVICE_CONVERGENCE", deviceConvergence ? "1" : "0", 1);
+    VerletIntegrator integrator(0.002);
+    integrator.setConstraintTolerance(1e-5);
+    Context context(system, integrator, platform, properties);
+    MetalContext& cl = platform.getMetalContext();
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+
+    // Create perturbed positions and random velocities, so every application has real work to do.
+
+    int numParticles = system.getNumParticles();
+    vector<Vec3> perturbed(numParticles), velocities(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        perturbed[i] = positions[i]+Vec3(genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5)*0.005;
+        velocities[i] = Vec3(genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5);
+    }
+    map<string, double> times;
+    double positionTime = 0, velocityTime = 0;
+    for (int i = 0; i < repeats+5; i++) {
+        context.setPositions(perturbed);
+        context.setVelocities(velocities);
+        double position = timeMicroseconds(cl, 1, [&] () {context.applyConstraints(1e-5);});
+        double velocity = timeMicroseconds(cl, 1, [&] () {context.applyVelocityConstraints(1e-5);});
+
+        // The first few applications are not timed, since they compile kernels and give the
+        // device mode a chance to estimate how many iterations are needed.
+
+        if (i >= 5) {
+            positionTime += position;
+            velocityTime += velocity;
+        }
+    }
+    times["applyPositionConstraints"] = positionTime/repeats;
+    times["applyVelocityConstraints"] = velocityTime/repeats;
+
+    // Time integration, which applies both kinds of constraints every step.
+
+    context.setPositions(positions);
+    context.setVelocitiesToTemperature(300.0);
+    times["step"] = timeSteps(cl, integrator, 20, repeats);
+    return times;
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        int repeats = 200;
+        int numChains = 50;
+        int chainLength = 200;
+        MetalBenchmarkOptions options("BenchmarkMetalConstraints.json");
+        options.addOption("--repeats", repeats);
+        options.addOption("--chains", numChains);
+        options.addOption("--chain-length", chainLength);
+        options.parse(argc, argv);
+        MetalBenchmarkOptions::checkAtLeast("--repeats", repeats, 1);
+        MetalBenchmarkOptions::checkAtLeast("--chains", numChains, 1);
+        MetalBenchmarkOptions::checkAtLeast("--chain-length", chainLength, 2);
+        MetalTrackingPlatform platform;
+        vector<Vec3> positions;
+        System* system = createSystem(numChains, chainLength, positions);
+        map<string, double> hostTimes = runBenchmark(platform, options.getProperties(), *system, positions, repeats, false);
+        map<string, double> deviceTimes = runBenchmark(platform, options.getProperties(), *system, positions, repeats, true);
+
+        // Write the results.  Times are in microseconds.
+
+        MetalBenchmarkWriter out(options.outputFile);
+        out.add("precision", options.precision);
+        out.add("units", "microseconds");
+        out.add("atoms", system->getNumParticles());
+        out.add("constraints", system->getNumConstraints());
+        out.add("repeats", repeats);
+        const char* modes[] = {"hostPolling", "deviceConvergence"};
+        map<string, double>* results[] = {&hostTimes, &deviceTimes};
+        for (int i = 0; i < 2; i++) {
+            out.beginObject(modes[i]);
+            for (auto& time : *results[i])
+                out.add(time.first, time.second);
+            out.endObject();
+        }
+        out.close();
+        cout << system->getNumParticles() << " atoms, " << system->getNumConstraints() << " constraints" << endl;
+        for (auto& time : hostTimes)
+            cout << "    " << time.first << ": " << time.second << " us (host polling), " << deviceTimes[time.first] << " us (device convergence)" << endl;
+        delete system;
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
@@ -0,0 +1,115 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This times building the nonbonded exclusion tiles for a system of three atom molecules, first
+ * with one CPU thread and then with every thread of the pool, and writes the results as JSON.
+ * TestMetalExclusionTiles checks that the results agree on a smaller system.
+ *
+ * Usage: BenchmarkMetalExclusionTiles [--output=file] [--atoms=n] [--precision=single|mixed|double]
+ *            [--platform-index=n] [--device-index=n]
+ */
+
+#include "MetalBenchmarkUtilities.h"
+#include "MetalNonbondedUtilities.h"
+#include "openmm/internal/hardware.h"
+#include <iostream>
+
+using namespace OpenMM;
+using namespace std;
+
+/**
+ * Create exclusions for a system of three atom molecules.  Every hundredth molecule is also
+ * excluded from an atom half way through the system, as in TestMetalExclusionTiles.
+ */
+vector<vector<int> > createExclusions(int numAtoms) {
+    vector<vector<int> > exclusions(numAtoms);
+    for (int i = 0; i < numAtoms; i++) {
+        int first = i-i%3;
+        for (int j = first; j < first+3 && j < numAtoms; j++)
+            exclusions[i].push_back(j);
+    }
+    for (int i = 0; i < numAtoms/2; i += 300) {
+        exclusions[i].push_back(i+numAtoms/2);
+        exclusions[i+numAtoms/2].push_back(i);
+    }
+    return exclusions;
+}
+
+/**
+ * Return the time in seconds to initialize a MetalContext whose only work is building the
+ * exclusion tiles, and the number of tiles it created.
+ */
+double timeInitialize(int numAtoms, int numThreads, const MetalBenchmarkOptions& options, int& numTiles) {
+    System system;
+    for (int i = 0; i < numAtoms; i++)
+        system.addParticle(1.0);
+    MetalPlatform::PlatformData platformData(system, options.platformIndex, options.deviceIndex, options.precision, "false", "false", numThreads, NULL);
+    MetalContext& context = *platformData.contexts[0];
+    context.getNonbondedUtilities().requestExclusions(createExclusions(numAtoms));
+    double seconds = 1e-6*timeMicroseconds(context, 1, [&] () {context.initialize();});
+    numTiles = context.getNonbondedUtilities().getExclusionTiles().getSize();
+    return seconds;
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        int numAtoms = 1050000;
+        MetalBenchmarkOptions options("BenchmarkMetalExclusionTiles.json");
+        options.addOption("--atoms", numAtoms);
+        options.parse(argc, argv);
+        MetalBenchmarkOptions::checkAtLeast("--atoms", numAtoms, 1);
+        int numThreads = getNumProcessors();
+        int numTiles;
+        double serialSeconds = timeInitialize(numAtoms, 1, options, numTiles);
+        double parallelSeconds = timeInitialize(numAtoms, numThreads, options, numTiles);
+        MetalBenchmarkWriter out(options.outputFile);
+        out.add("precision", options.precision);
+        out.add("units", "seconds");
+        out.add("atoms", numAtoms);
+        out.add("exclusionTiles", numTiles);
+        out.beginArray("initialize");
+        int threadCounts[] = {1, numThreads};
+        double times[] = {serialSeconds, parallelSeconds};
+        for (int i = 0; i < 2; i++) {
+            out.beginObject();
+            out.add("threads", threadCounts[i]);
+            out.add("time", times[i]);
+            out.endObject();
+        }
+        out.endArray();
+        out.close();
+        cout << numAtoms << " atoms, " << numTiles << " exclusion tiles" << endl;
+        cout << "Initialization with 1 thread: " << serialSeconds << " s" << endl;
+        cout << "Initialization with " << numThreads << " threads: " << parallelSeconds << " s" << endl;
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
@@ -0,0 +1,419 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This benchmarks the kernels of the Metal platform on a set of standard systems.  Each
+ * system is simulated for a number of steps with kernel profiling enabled, and the time spent
+ * in every kernel is grouped into subsystems (neighbor list, nonbonded, PME, bonded,
+ * constraints, reductions, etc.).  The results are written as JSON, so runs can be compared
+ * to detect performance regressions.
+ *
+ * Usage: BenchmarkMetalKernels [--output=file] [--precision=single|mixed|double] [--steps=n]
+ *            [--systems=name,name,...] [--platform-index=n] [--device-index=n]
+ *
+ * Selecting a CPU OpenCL device with --platform-index and --device-index allows changes to be
+ * compared on machines without Apple hardware.  Times measured this way are only meaningful
+ * relative to other runs on the same device.
+ */
+
+#include "MetalContext.h"
+#include "MetalFFT3D.h"
+#include "MetalKernelProfiler.h"
+#include "MetalPlatform.h"
+#include "MetalTrackingPlatform.h"
+#include "openmm/Context.h"
+#include "openmm/GBSAOBCForce.h"
+#include "openmm/HarmonicAngleForce.h"
+#include "openmm/HarmonicBondForce.h"
+#include "openmm/NonbondedForce.h"
+#include "openmm/PeriodicTorsionForce.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "openmm/OpenMMException.h"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+/**
+ * A system to benchmark, along with its initial positions.
+ */
+struct BenchmarkSystem {
+    string name;
+    System* system;
+    vector<Vec3> positions;
+};
+
+const double WaterSpacing = 0.31;
+const double Cutoff = 0.9;
+
+/**
+ * Add a linear chain of heavy atoms, each with one hydrogen, to a system.  The chain zigzags
+ * along the x axis and has bonds, angles, torsions, and constraints, so it exercises the same
+ * kernels as a protein.  Bonds to hydrogen are constrained, which uses SHAKE, and bonds along
+ * the backbone are constrained too, which uses CCMA.  Equilibrium values are taken from the
+ * starting geometry.
+ */
+void addChain(System& system, vector<Vec3>& positions, NonbondedForce& nonbonded, HarmonicBondForce& bonds, HarmonicAngleForce& angles,
+            PeriodicTorsionForce& torsions, vector<pair<int, int> >& bondPairs, Vec3 start, int length) {
+    vector<int> heavy;
+    for (int i = 0; i < length; i++) {
+        int atom = system.addParticle(12.0);
+        int hydrogen = system.addParticle(1.008);
+        heavy.push_back(atom);
+        Vec3 pos = start+Vec3(0.125*i, 0.08*(i%2), 0.0);
+        positions.push_back(pos);
+        positions.push_back(pos+Vec3(0.0, (i%2 == 0 ? -0.109 : 0.109), 0.0));
+        double charge = (i%2 == 0 ? -0.2 : 0.2);
+        nonbonded.addParticle(charge-0.1, 0.34, 0.36);
+        nonbonded.addParticle(0.1, 0.25, 0.06);
+        system.addConstraint(atom, hydrogen, 0.109);
+        bondPairs.push_back(make_pair(atom, hydrogen));
+    }
+    for (int i = 1; i < length; i++) {
+        Vec3 delta = positions[heavy[i]]-positions[heavy[i-1]];
+        double distance = sqrt(delta.dot(delta));
+        bonds.addBond(heavy[i-1], heavy[i], distance, 250000.0);
+        if (i%4 == 0)
+            system.addConstraint(heavy[i-1], heavy[i], distance);
+        bondPairs.push_back(make_pair(heavy[i-1], heavy[i]));
+    }
+    for (int i = 2; i < length; i++) {
+        Vec3 v1 = positions[heavy[i-2]]-positions[heavy[i-1]];
+        Vec3 v2 = positions[heavy[i]]-positions[heavy[i-1]];
+        angles.addAngle(heavy[i-2], heavy[i-1], heavy[i], acos(v1.dot(v2)/sqrt(v1.dot(v1)*v2.dot(v2))), 400.0);
+    }
+    for (int i = 3; i < length; i++)
+        torsions.addTorsion(heavy[i-3], heavy[i-2], heavy[i-1], heavy[i], 3, 0.0, 1.0);
+}
+
+/**
+ * Add a rigid three site water molecule.
+ */
+void addWater(System& system, vector<Vec3>& positions, NonbondedForce& nonbonded, vector<pair<int, int> >& bondPairs, Vec3 oxygenPos) {
+    int oxygen = system.addParticle(15.999);
+    int hydrogen1 = system.addParticle(1.008);
+    int hydrogen2 = system.addParticle(1.008);
+    positions.push_back(oxygenPos);
+    positions.push_back(oxygenPos+Vec3(0.09572, 0.0, 0.0));
+    positions.push_back(oxygenPos+Vec3(-0.023999, 0.092663, 0.0));
+    nonbonded.addParticle(-0.834, 0.315061, 0.6364);
+    nonbonded.addParticle(0.417, 1.0, 0.0);
+    nonbonded.addParticle(0.417, 1.0, 0.0);
+    system.addConstraint(oxygen, hydrogen1, 0.09572);
+    system.addConstraint(oxygen, hydrogen2, 0.09572);
+    system.addConstraint(hydrogen1, hydrogen2, 0.15139);
+    bondPairs.push_back(make_pair(oxygen, hydrogen1));
+    bondPairs.push_back(make_pair(oxygen, hydrogen2));
+}
+
+/**
+ * Create a periodic box of water with PME, optionally with chains of solute in the middle.
+ * Water molecules that would overlap the solute are left out.
+ */
+BenchmarkSystem createSolvatedSystem(const string& name, int watersPerSide, int numChains, int chainLength) {
+    BenchmarkSystem result;
+    result.name = name;
+    System* system = new System();
+    result.system = system;
+    double boxSize = watersPerSide*WaterSpacing;
+    system->setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::PME);
+    nonbonded->setCutoffDistance(Cutoff);
+    nonbonded->setEwaldErrorTolerance(5e-4);
+    vector<pair<int, int> > bondPairs;
+    if (numChains > 0) {
+        HarmonicBondForce* bonds = new HarmonicBondForce();
+        HarmonicAngleForce* angles = new HarmonicAngleForce();
+        PeriodicTorsionForce* torsions = new PeriodicTorsionForce();
+        double chainWidth = 0.125*chainLength;
+        int chainsPerSide = (int) ceil(sqrt((double) numChains));
+        for (int i = 0; i < numChains; i++) {
+            Vec3 start(0.5*(boxSize-chainWidth), 0.5*boxSize+0.5*((i%chainsPerSide)-0.5*chainsPerSide), 0.5*boxSize+0.5*((i/chainsPerSide)-0.5*chainsPerSide));
+            addChain(*system, result.positions, *nonbonded, *bonds, *angles, *torsions, bondPairs, start, chainLength);
+        }
+        system->addForce(bonds);
+        system->addForce(angles);
+        system->addForce(torsions);
+    }
+    int numSolute = result.positions.size();
+    for (int i = 0; i < watersPerSide; i++)
+        for (int j = 0; j < watersPerSide; j++)
+            for (int k = 0; k < watersPerSide; k++) {
+                Vec3 pos = Vec3(i+0.5, j+0.5, k+0.5)*WaterSpacing;
+                bool overlaps = false;
+                for (int m = 0; m < numSolute && !overlaps; m++) {
+                    Vec3 delta = pos-result.positions[m];
+                    overlaps = (delta.dot(delta) < 0.3*0.3);
+                }
+                if (!overlaps)
+                    addWater(*system, result.positions, *nonbonded, bondPairs, pos);
+            }
+    nonbonded->createExceptionsFromBonds(bondPairs, 0.8333, 0.5);
+    system->addForce(nonbonded);
+    return result;
+}
+
+/**
+ * Create chains of solute in implicit solvent.
+ */
+BenchmarkSystem createImplicitSystem(const string& name, int numChains, int chainLength) {
+    BenchmarkSystem result;
+    result.name = name;
+    System* system = new System();
+    result.system = system;
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::CutoffNonPeriodic);
+    nonbonded->setCutoffDistance(2.0);
+    HarmonicBondForce* bonds = new HarmonicBondForce();
+    HarmonicAngleForce* angles = new HarmonicAngleForce();
+    PeriodicTorsionForce* torsions = new PeriodicTorsionForce();
+    vector<pair<int, int> > bondPairs;
+    int chainsPerSide = (int) ceil(sqrt((double) numChains));
+    for (int i = 0; i < numChains; i++)
+        addChain(*system, result.positions, *nonbonded, *bonds, *angles, *torsions, bondPairs, Vec3(0, 0.5*(i%chainsPerSide), 0.5*(i/chainsPerSide)), chainLength);
+    GBSAOBCForce* gbsa = new GBSAOBCForce();
+    gbsa->setNonbondedMethod(GBSAOBCForce::CutoffNonPeriodic);
+    gbsa->setCutoffDistance(2.0);
+    for (int i = 0; i < system->getNumParticles(); i++) {
+        double charge, sigma, epsilon;
+        nonbonded->getParticleParameters(i, charge, sigma, epsilon);
+        gbsa->addParticle(charge, (i%2 == 0 ? 0.17 : 0.12), (i%2 == 0 ? 0.72 : 0.85));
+    }
+    nonbonded->createExceptionsFromBonds(bondPairs, 0.8333, 0.5);
+    system->addForce(bonds);
+    system->addForce(angles);
+    system->addForce(torsions);
+    system->addForce(nonbonded);
+    system->addForce(gbsa);
+    return result;
+}
+
+/**
+ * Get the subsystem a kernel belongs to.
+ */
+string getSubsystem(const string& kernel) {
+    static map<string, string> subsystems;
+    if (subsystems.size() == 0) {
+        for (const char* name : {"findBlockBounds", "sortBoxData", "findBlocksWithInteractions"})
+            subsystems[name] = "neighborList";
+        for (const char* name : {"computeNonbonded", "computeExclusionParameters", "computeParameters"})
+            subsystems[name] = "nonbonded";
+        for (const char* name : {"findAtomGridIndex", "gridSpreadCharge", "finishSpreadCharge"})
+            subsystems[name] = "pmeSpread";
+        for (const char* name : {"execFFT", "packForwardData", "unpackForwardData", "packBackwardData", "unpackBackwardData"})
+            subsystems[name] = "pmeFFT";
+        for (const char* name : {"reciprocalConvolution", "gridEvaluateEnergy"})
+            subsystems[name] = "pmeConvolution";
+        subsystems["gridInterpolateForce"] = "pmeInterpolate";
+        subsystems["computeBondedForces"] = "bonded";
+        for (const char* name : {"computeBornSum", "reduceBornSum", "computeGBSAForce1", "reduceBornForce"})
+            subsystems[name] = "implicitSolvent";
+        for (const char* name : {"applySettleToPositions", "applySettleToVelocities", "applyShakeToPositions", "applyShakeToVelocities",
+                "computeCCMAConstraintDirectionsKernel", "computeCCMAPositionConstraintForceKernel", "computeCCMAVelocityConstraintForceKernel",
+                "multiplyByCCMAConstraintMatrixKernel", "updateCCMAAtomPositionsKernel", "runCCMA"})
+            subsystems[name] = "constraints";
+        for (const char* name : {"reduceForces", "reduceEnergy", "reduceReal4Buffer", "computeFloatSum", "computeDoubleSum"})
+            subsystems[name] = "reductions";
+        for (const char* name : {"sortShortList", "sortShortList2", "computeRange", "assignElementsToBuckets", "assignElementsToBuckets2",
+                "computeBucketPositions", "copyDataToBuckets", "sortBuckets", "computeDigitHistograms", "computeDigitOffsets", "scatterByDigit"})
+            subsystems[name] = "sort";
+        for (const char* name : {"clearBuffer", "clearTwoBuffers", "clearThreeBuffers", "clearFourBuffers", "clearFiveBuffers", "clearSixBuffers"})
+            subsystems[name] = "clear";
+    }
+    map<string, string>::const_iterator subsystem = subsystems.find(kernel);
+    if (subsystem != subsystems.end())
+        return subsystem->second;
+    if (kernel.compare(0, 9, "integrate") == 0)
+        return "integration";
+    return "other";
+}
+
+/**
+ * Simulate a system, and write the time spent in each kernel and subsystem.
+ */
+void runBenchmark(MetalTrackingPlatform& platform, const map<string, string>& properties, BenchmarkSystem& benchmark, int steps, ostream& out, bool first) {
+    VerletIntegrator integrator(0.001);
+    Context context(*benchmark.system, integrator, platform, properties);
+    context.setPositions(benchmark.positions);
+    MetalContext& cl = platform.getMetalContext();
+    MetalKernelProfiler& profiler = cl.getKernelProfiler();
+    if (!profiler.isAvailable())
+        throw OpenMMException("Kernel profiling is not available");
+
+    // The first steps compile kernels, build the neighbor list, and may run autotuning, so
+    // they are not timed.
+
+    integrator.step(10);
+    context.getState(State::Energy);
+    profiler.flush();
+    profiler.clear();
+    auto start = chrono::steady_clock::now();
+    integrator.step(steps);
+    context.getState(State::Energy);
+    double wallTime = chrono::duration<double>(chrono::steady_clock::now()-start).count();
+    profiler.flush();
+
+    // Sum the kernel times for each subsystem.
+
+    vector<MetalKernelProfiler::Statistics> stats = profiler.getStatistics();
+    map<string, double> subsystemTime;
+    double totalKernelTime = 0;
+    for (const MetalKernelProfiler::Statistics& kernel : stats) {
+        subsystemTime[getSubsystem(kernel.name)] += kernel.totalTime;
+        totalKernelTime += kernel.totalTime;
+    }
+
+    // VkFFT launches its own kernels, which the profiler does not see, so time the FFT separately.
+
+    double fftTime = -1;
+    for (int i = 0; i < benchmark.system->getNumForces(); i++) {
+        NonbondedForce* nonbonded = dynamic_cast<NonbondedForce*>(&benchmark.system->getForce(i));
+        if (nonbonded != NULL && nonbonded->getNonbondedMethod() == NonbondedForce::PME) {
+            double alpha;
+            int nx, ny, nz;
+            nonbonded->getPMEParametersInContext(context, alpha, nx, ny, nz);
+            fftTime = MetalFFT3D::timePlan(cl, nx, ny, nz, true, MetalFFT3D::getDefaultPlan(cl, nx, ny, nz, true));
+        }
+    }
+
+    // Write the results.  Times are in microseconds per step.
+
+    out << (first ? "" : ",\n");
+    out << "    {\n";
+    out << "      \"name\": \"" << benchmark.name << "\",\n";
+    out << "      \"device\": \"" << cl.getDevice().getInfo<CL_DEVICE_NAME>() << "\",\n";
+    out << "      \"atoms\": " << benchmark.system->getNumParticles() << ",\n";
+    out << "      \"steps\": " << steps << ",\n";
+    out << "      \"wallTimePerStep\": " << 1e6*wallTime/steps << ",\n";
+    out << "      \"kernelTimePerStep\": " << 1e-3*totalKernelTime/steps << ",\n";
+    if (fftTime >= 0)
+        out << "      \"fftTimePerStep\": " << 1e6*fftTime << ",\n";
+    out << "      \"subsystems\": {";
+    bool firstEntry = true;
+    for (map<string, double>::const_iterator iter = subsystemTime.begin(); iter != subsystemTime.end(); ++iter) {
+        out << (firstEntry ? "\n" : ",\n") << "        \"" << iter->first << "\": " << 1e-3*iter->second/steps;
+        firstEntry = false;
+    }
+    out << "\n      },\n";
+    out << "      \"kernels\": [";
+    firstEntry = true;
+    for (const MetalKernelProfiler::Statistics& kernel : stats) {
+        out << (firstEntry ? "\n" : ",\n") << "        { \"name\": \"" << kernel.name << "\", \"subsystem\": \"" << getSubsystem(kernel.name) << "\", \"count\": " << kernel.count;
+        out << ", \"timePerStep\": " << 1e-3*kernel.totalTime/steps << ", \"median\": " << 1e-3*kernel.medianTime << ", \"p99\": " << 1e-3*kernel.p99Time << " }";
+        firstEntry = false;
+    }
+    out << "\n      ]\n";
+    out << "    }";
+
+    cout << benchmark.name << " (" << benchmark.system->getNumParticles() << " atoms): " << 1e6*wallTime/steps << " us/step" << endl;
+    for (map<string, double>::const_iterator iter = subsystemTime.begin(); iter != subsystemTime.end(); ++iter)
+        cout << "    " << iter->first << ": " << 1e-3*iter->second/steps << " us/step" << endl;
+    if (fftTime >= 0)
+        cout << "    FFT (measured separately): " << 1e6*fftTime << " us/step" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        string outputFile = "BenchmarkMetalKernels.json";
+        string precision = "single";
+        int steps = 200;
+        set<string> selectedSystems;
+        map<string, string> properties;
+        for (int i = 1; i < argc; i++) {
+            string arg = argv[i];
+            size_t separator = arg.find('=');
+            string key = arg.substr(0, separator);
+            string value = (separator == string::npos ? "" : arg.substr(separator+1));
+            if (key == "--output")
+                outputFile = value;
+            else if (key == "--precision")
+                precision = value;
+            else if (key == "--steps")
+                steps = atoi(value.c_str());
+            else if (key == "--platform-index")
+                properties[MetalPlatform::MetalPlatformIndex()] = value;
+            else if (key == "--device-index")
+                properties[MetalPlatform::MetalDeviceIndex()] = value;
+            else if (key == "--systems") {
+                stringstream names(value);
+                string name;
+                while (getline(names, name, ','))
+                    selectedSystems.insert(name);
+            }
+            else
+                throw OpenMMException("Unknown argument: "+arg);
+        }
+        if (steps < 1)
+            throw OpenMMException("The number of steps must be positive");
+        properties[MetalPlatform::MetalPrecision()] = precision;
+
+        // Kernel profiling must be enabled before a context is created.  The trace itself is not
+        // needed, since the results are read through the profiler.
+
+        if (getenv("OPENMM_METAL_PROFILE_OUTPUT") == NULL && getenv("OPENMM_METAL_PROFILE_KERNELS") == NULL)
+            setenv("OPENMM_METAL_PROFILE_OUTPUT", "/dev/null", 1);
+        MetalTrackingPlatform platform;
+        vector<BenchmarkSystem> benchmarks;
+        benchmarks.push_back(createSolvatedSystem("waterBoxSmall", 12, 0, 0));
+        benchmarks.push_back(createSolvatedSystem("waterBoxLarge", 28, 0, 0));
+        benchmarks.push_back(createSolvatedSystem("solvatedChains", 20, 9, 40));
+        benchmarks.push_back(createImplicitSystem("implicitChains", 16, 40));
+        ofstream out(outputFile.c_str());
+        if (!out.is_open())
+            throw OpenMMException("Could not open "+outputFile+" for writing");
+        out << "{\n";
+        out << "  \"precision\": \"" << precision << "\",\n";
+        out << "  \"units\": \"microseconds per step\",\n";
+        out << "  \"systems\": [\n";
+        bool first = true;
+        for (BenchmarkSystem& benchmark : benchmarks) {
+            if (selectedSystems.size() == 0 || selectedSystems.find(benchmark.name) != selectedSystems.end()) {
+                runBenchmark(platform, properties, benchmark, steps, out, first);
+                first = false;
+            }
+            delete benchmark.system;
+        }
+        out << "\n  ]\n";
+        out << "}\n";
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
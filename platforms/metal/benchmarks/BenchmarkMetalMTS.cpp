@@ -0,0 +1,135 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This benchmarks a RESPA multiple time step integrator with and without a declared force group
+ * schedule.  PME reciprocal space is in a slow force group evaluated once per outer step, and
+ * everything else is evaluated on every inner step.  With the schedule, the last inner step of
+ * each outer step also computes reciprocal space in a pass that shares its cleared buffers and
+ * neighbor list, and the integrator's request for the slow forces is served from the device.
+ * It reports the time per outer step both ways and the largest difference in the final
+ * positions.
+ *
+ * Usage: BenchmarkMetalMTS [--output=file] [--precision=single|mixed|double] [--steps=n]
+ *            [--inner-steps=n] [--atoms=n] [--platform-index=n] [--device-index=n]
+ */
+
+#include "MetalBenchmarkUtilities.h"
+#include "MetalForceGroupSchedule.h"
+#include "MetalTrackingPlatform.h"
+#include "openmm/Context.h"
+#include "openmm/CustomIntegrator.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+
+using namespace OpenMM;
+using namespace std;
+
+/**
+ * Create a RESPA integrator that evaluates force group 1 once per outer step and force group 0
+ * on each of innerSteps inner steps.  This is the same sequence of operations MTSIntegrator uses.
+ */
+CustomIntegrator* createIntegrator(double stepSize, int innerSteps) {
+    CustomIntegrator* integrator = new CustomIntegrator(stepSize);
+    stringstream inner;
+    inner << "(dt/" << innerSteps << ")";
+    integrator->addComputePerDof("v", "v+0.5*dt*f1/m");
+    for (int i = 0; i < innerSteps; i++) {
+        integrator->addComputePerDof("v", "v+0.5*"+inner.str()+"*f0/m");
+        integrator->addComputePerDof("x", "x+"+inner.str()+"*v");
+        integrator->addComputePerDof("v", "v+0.5*"+inner.str()+"*f0/m");
+    }
+    integrator->addComputePerDof("v", "v+0.5*dt*f1/m");
+    return integrator;
+}
+
+/**
+ * Time a number of outer steps, and return the final positions.
+ */
+double runBenchmark(MetalTrackingPlatform& platform, const map<string, string>& properties, System& system, const vector<Vec3>& positions,
+            int steps, int innerSteps, bool useSchedule, vector<Vec3>& finalPositions) {
+    CustomIntegrator* integrator = createIntegrator(0.004, innerSteps);
+    Context context(system, *integrator, platform, properties);
+    MetalContext& cl = platform.getMetalContext();
+    cl.getForceGroupSchedule().setSchedule(useSchedule ? 1<<1 : 0, innerSteps);
+    context.setPositions(positions);
+    context.setVelocitiesToTemperature(300.0, 1);
+    double stepTime = timeSteps(cl, *integrator, 20, steps);
+    finalPositions = context.getState(State::Positions).getPositions();
+    delete integrator;
+    return stepTime;
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        int steps = 100;
+        int innerSteps = 4;
+        int numAtoms = 30000;
+        MetalBenchmarkOptions options("BenchmarkMetalMTS.json");
+        options.addOption("--steps", steps);
+        options.addOption("--inner-steps", innerSteps);
+        options.addOption("--atoms", numAtoms);
+        options.parse(argc, argv);
+        MetalBenchmarkOptions::checkAtLeast("--steps", steps, 1);
+        MetalBenchmarkOptions::checkAtLeast("--inner-steps", innerSteps, 1);
+        MetalBenchmarkOptions::checkAtLeast("--atoms", numAtoms, 10000);
+        MetalTrackingPlatform platform;
+        vector<Vec3> positions, withoutPositions, withPositions;
+        System system;
+        createDimerBox(system, numAtoms/2, 0.9, positions);
+        double without = runBenchmark(platform, options.getProperties(), system, positions, steps, innerSteps, false, withoutPositions);
+        double with = runBenchmark(platform, options.getProperties(), system, positions, steps, innerSteps, true, withPositions);
+        double maxDifference = 0.0;
+        for (int i = 0; i < (int) positions.size(); i++) {
+            Vec3 delta = withPositions[i]-withoutPositions[i];
+            maxDifference = max(maxDifference, sqrt(delta.dot(delta)));
+        }
+
+        // Write the results.  Times are in microseconds.
+
+        MetalBenchmarkWriter out(options.outputFile);
+        out.add("precision", options.precision);
+        out.add("units", "microseconds");
+        out.add("atoms", system.getNumParticles());
+        out.add("steps", steps);
+        out.add("innerSteps", innerSteps);
+        out.add("stepWithoutSchedule", without);
+        out.add("stepWithSchedule", with);
+        out.add("maxPositionDifference", maxDifference);
+        out.close();
+        cout << system.getNumParticles() << " atoms, " << innerSteps << " inner steps per outer step" << endl;
+        cout << "    outer step without schedule: " << without << " us, with schedule: " << with << " us" << endl;
+        cout << "    largest difference in final positions: " << maxDifference << " nm" << endl;
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
@@ -0,0 +1,122 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This benchmarks the sub-tile masks of the neighbor list.  Each neighbor list tile pairs 32 atoms
+ * with up to 32 neighbors, but many of those pairs are beyond the cutoff.  For a box of charged
+ * particles with PME, it reports the fraction of computed pairs that are within the cutoff, both
+ * for whole tiles and for the sub-tiles the interaction kernel computes when masks are used.  It
+ * also reports the time per step with and without masks.
+ *
+ * Usage: BenchmarkMetalNeighborList [--output=file] [--precision=single|mixed|double]
+ *            [--steps=n] [--atoms=n] [--cutoff=x] [--platform-index=n] [--device-index=n]
+ */
+
+#include "MetalBenchmarkUtilities.h"
+#include "MetalNonbondedUtilities.h"
+#include "MetalTrackingPlatform.h"
+#include "openmm/Context.h"
+#include "openmm/VerletIntegrator.h"
+#include <iostream>
+
+using namespace OpenMM;
+using namespace std;
+
+struct Result {
+    long long pairsWithinCutoff, pairsInTiles, pairsInSubtiles;
+    double stepTime;
+};
+
+/**
+ * Time a number of steps, and count the pairs in the neighbor list.
+ */
+Result runBenchmark(MetalTrackingPlatform& platform, const map<string, string>& properties, System& system, const vector<Vec3>& positions,
+            int steps, bool useMasks) {
+    setenv("OPENMM_METAL_SUBTILE_MASKS", useMasks ? "1" : "0", 1);
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform, properties);
+    unsetenv("OPENMM_METAL_SUBTILE_MASKS");
+    MetalContext& cl = platform.getMetalContext();
+    if (useMasks && !cl.getNonbondedUtilities().getUseSubtileMasks())
+        throw OpenMMException("Sub-tile masks are not supported on this device");
+    context.setPositions(positions);
+    context.setVelocitiesToTemperature(300.0, 1);
+    Result result;
+    result.stepTime = timeSteps(cl, integrator, 50, steps);
+    context.getState(State::Forces);
+    cl.getNonbondedUtilities().getNeighborListPairCounts(result.pairsWithinCutoff, result.pairsInTiles, result.pairsInSubtiles);
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        int steps = 200;
+        int numAtoms = 60000;
+        double cutoff = 1.0;
+        MetalBenchmarkOptions options("BenchmarkMetalNeighborList.json");
+        options.addOption("--steps", steps);
+        options.addOption("--atoms", numAtoms);
+        options.addOption("--cutoff", cutoff);
+        options.parse(argc, argv);
+        MetalBenchmarkOptions::checkAtLeast("--steps", steps, 1);
+        MetalBenchmarkOptions::checkAtLeast("--atoms", numAtoms, 10000);
+        MetalBenchmarkOptions::checkAtLeast("--cutoff", cutoff, 0.1);
+        MetalTrackingPlatform platform;
+        vector<Vec3> positions;
+        System system;
+        createChargedBox(system, numAtoms, 0.31, cutoff, positions);
+        Result without = runBenchmark(platform, options.getProperties(), system, positions, steps, false);
+        Result with = runBenchmark(platform, options.getProperties(), system, positions, steps, true);
+        double fractionBefore = (double) with.pairsWithinCutoff/with.pairsInTiles;
+        double fractionAfter = (double) with.pairsWithinCutoff/with.pairsInSubtiles;
+
+        // Write the results.  Times are in microseconds.
+
+        MetalBenchmarkWriter out(options.outputFile);
+        out.add("precision", options.precision);
+        out.add("units", "microseconds");
+        out.add("atoms", numAtoms);
+        out.add("cutoff", cutoff);
+        out.add("steps", steps);
+        out.add("pairsWithinCutoff", with.pairsWithinCutoff);
+        out.add("pairsInTiles", with.pairsInTiles);
+        out.add("pairsInSubtiles", with.pairsInSubtiles);
+        out.add("fractionWithinCutoffBefore", fractionBefore);
+        out.add("fractionWithinCutoffAfter", fractionAfter);
+        out.add("stepWithoutMasks", without.stepTime);
+        out.add("stepWithMasks", with.stepTime);
+        out.close();
+        cout << numAtoms << " atoms, cutoff " << cutoff << " nm" << endl;
+        cout << "    pairs within cutoff: " << 100*fractionBefore << "% of tiles, " << 100*fractionAfter << "% of computed sub-tiles" << endl;
+        cout << "    step without masks: " << without.stepTime << " us, with masks: " << with.stepTime << " us" << endl;
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
@@ -0,0 +1,127 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This benchmarks NonbondedForce::updateParametersInContext() when only some particles change,
+ * as in alchemical and constant pH simulations.  The system is a box of charged particles with
+ * PME.  For 1, 100, and 10000 changed particles, and for all of them, it reports the wall clock
+ * time of the update itself and of the step that follows it, which recomputes the changed
+ * parameters.  The time of a step with no update is reported for comparison.
+ *
+ * Usage: BenchmarkMetalParameterUpdates [--output=file] [--precision=single|mixed|double]
+ *            [--repeats=n] [--atoms=n] [--platform-index=n] [--device-index=n]
+ */
+
+#include "MetalBenchmarkUtilities.h"
+#include "MetalTrackingPlatform.h"
+#include "openmm/Context.h"
+#include "openmm/VerletIntegrator.h"
+#include <iostream>
+
+using namespace OpenMM;
+using namespace std;
+
+/**
+ * Measure the time of a step with no update, and of updates that change each number of particles.
+ */
+void runBenchmark(MetalTrackingPlatform& platform, const map<string, string>& properties, System& system, NonbondedForce& nonbonded,
+            const vector<Vec3>& positions, int repeats, const vector<int>& counts, double& stepTime, vector<double>& updateTimes,
+            vector<double>& updatedStepTimes) {
+    int numAtoms = system.getNumParticles();
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform, properties);
+    MetalContext& cl = platform.getMetalContext();
+    context.setPositions(positions);
+    stepTime = timeSteps(cl, integrator, 10, repeats);
+
+    // Scale the charges of a contiguous set of particles, alternating between two values so
+    // every update changes them.
+
+    for (int count : counts) {
+        double updateTime = 0, updatedStepTime = 0;
+        for (int i = 0; i < repeats; i++) {
+            double scale = (i%2 == 0 ? 0.9 : 1.0);
+            for (int j = 0; j < count; j++) {
+                int particle = (numAtoms/2+j)%numAtoms;
+                nonbonded.setParticleParameters(particle, scale*(particle%2 == 0 ? 0.5 : -0.5), 0.3, 0.5);
+            }
+            updateTime += timeMicroseconds(cl, 1, [&] () {nonbonded.updateParametersInContext(context);});
+            updatedStepTime += timeMicroseconds(cl, 1, [&] () {integrator.step(1);});
+        }
+        updateTimes.push_back(updateTime/repeats);
+        updatedStepTimes.push_back(updatedStepTime/repeats);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        int repeats = 100;
+        int numAtoms = 60000;
+        MetalBenchmarkOptions options("BenchmarkMetalParameterUpdates.json");
+        options.addOption("--repeats", repeats);
+        options.addOption("--atoms", numAtoms);
+        options.parse(argc, argv);
+        MetalBenchmarkOptions::checkAtLeast("--repeats", repeats, 1);
+        MetalBenchmarkOptions::checkAtLeast("--atoms", numAtoms, 10000);
+        MetalTrackingPlatform platform;
+        vector<Vec3> positions;
+        System system;
+        createChargedBox(system, numAtoms, 0.31, 1.0, positions);
+        NonbondedForce& nonbonded = dynamic_cast<NonbondedForce&>(system.getForce(0));
+        vector<int> counts = {1, 100, 10000, numAtoms};
+        double stepTime;
+        vector<double> updateTimes, updatedStepTimes;
+        runBenchmark(platform, options.getProperties(), system, nonbonded, positions, repeats, counts, stepTime, updateTimes, updatedStepTimes);
+
+        // Write the results.  Times are in microseconds.
+
+        MetalBenchmarkWriter out(options.outputFile);
+        out.add("precision", options.precision);
+        out.add("units", "microseconds");
+        out.add("atoms", numAtoms);
+        out.add("repeats", repeats);
+        out.add("step", stepTime);
+        out.beginArray("updates");
+        for (int i = 0; i < (int) counts.size(); i++) {
+            out.beginObject();
+            out.add("particles", counts[i]);
+            out.add("update", updateTimes[i]);
+            out.add("stepAfterUpdate", updatedStepTimes[i]);
+            out.endObject();
+        }
+        out.endArray();
+        out.close();
+        cout << numAtoms << " atoms, step with no update: " << stepTime << " us" << endl;
+        for (int i = 0; i < (int) counts.size(); i++)
+            cout << "    " << counts[i] << " particles: update " << updateTimes[i] << " us, step after update " << updatedStepTimes[i] << " us" << endl;
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
@@ -0,0 +1,210 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This benchmarks the utility kernels of the Metal platform on a MetalContext constructed
+ * directly, without a Context or any forces, as TestMetalSort does.  It times sorting with each
+ * engine on uniform, clustered, and presorted keys, force reduction, buffer clearing, and 3D FFTs over a range of sizes, and writes the
+ * results as JSON.  Force kernels need a ContextImpl to run, so BenchmarkMetalKernels times those
+ * on complete systems instead.
+ *
+ * Usage: BenchmarkMetalUtilities [--output=file] [--precision=single|mixed|double] [--repeats=n]
+ *            [--platform-index=n] [--device-index=n]
+ */
+
+#include "MetalArray.h"
+#include "MetalBenchmarkUtilities.h"
+#include "MetalFFT3D.h"
+#include "MetalSort.h"
+#include <iostream>
+
+using namespace OpenMM;
+using namespace std;
+
+class SortTrait : public MetalSort::SortTrait {
+    int getDataSize() const {return 4;}
+    int getKeySize() const {return 4;}
+    const char* getDataType() const {return "float";}
+    const char* getKeyType() const {return "float";}
+    const char* getMinKey() const {return "-MAXFLOAT";}
+    const char* getMaxKey() const {return "MAXFLOAT";}
+    const char* getMaxValue() const {return "MAXFLOAT";}
+    const char* getSortKey() const {return "value";}
+};
+
+/**
+ * A MetalContext for a System of noninteracting particles, created the same way the tests do.
+ */
+struct BenchmarkContext {
+    BenchmarkContext(int numParticles, const MetalBenchmarkOptions& options) {
+        for (int i = 0; i < numParticles; i++)
+            system.addParticle(1.0);
+        platformData = new MetalPlatform::PlatformData(system, options.platformIndex, options.deviceIndex, options.precision, "false", "false", 1, NULL);
+        platformData->contexts[0]->initialize();
+    }
+    ~BenchmarkContext() {
+        delete platformData;
+    }
+    MetalContext& getContext() {
+        return *platformData->contexts[0];
+    }
+    System system;
+    MetalPlatform::PlatformData* platformData;
+};
+
+/**
+ * Create keys to sort.  The distribution is "uniform" (spread evenly over a range), "clustered"
+ * (packed into a few narrow clusters, with a handful of outliers), or "presorted".
+ */
+vector<float> createSortKeys(int length, const string& distribution) {
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<float> values(length);
+    for (int i = 0; i < length; i++) {
+        if (distribution == "uniform")
+            values[i] = (float) genrand_real2(sfmt);
+        else if (distribution == "clustered") {
+            if (genrand_real2(sfmt) < 0.001)
+                values[i] = (float) (1000*genrand_real2(sfmt));
+            else
+                values[i] = (float) ((int) (8*genrand_real2(sfmt)) + 1e-4*genrand_real2(sfmt));
+        }
+        else
+            values[i] = (float) i;
+    }
+    return values;
+}
+
+/**
+ * Return the average time in microseconds of sorting an array with one engine.
+ */
+double timeSort(MetalContext& cl, const vector<float>& values, bool uniform, MetalSort::SortEngine engine, int repeats) {
+    int length = values.size();
+    MetalArray data(cl, length, sizeof(float), "sortData");
+    MetalSort sort(cl, new SortTrait(), length, uniform, engine);
+    data.upload(values);
+    sort.sort(data);
+    double time = 0.0;
+    for (int i = 0; i < repeats; i++) {
+        data.upload(values);
+        time += timeMicroseconds(cl, 1, [&] () {sort.sort(data);});
+    }
+    return time/repeats;
+}
+
+/**
+ * Return the average time in microseconds of reducing the force buffers.
+ */
+double timeReduceForces(MetalContext& cl, int repeats) {
+    cl.reduceForces();
+    return timeMicroseconds(cl, repeats, [&] () {cl.reduceForces();});
+}
+
+/**
+ * Return the average time in microseconds of clearing the force buffers.
+ */
+double timeClearBuffer(MetalContext& cl, int repeats) {
+    cl.clearBuffer(cl.getForceBuffers());
+    return timeMicroseconds(cl, repeats, [&] () {cl.clearBuffer(cl.getForceBuffers());});
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        int repeats = 100;
+        MetalBenchmarkOptions options("BenchmarkMetalUtilities.json");
+        options.addOption("--repeats", repeats);
+        options.parse(argc, argv);
+        MetalBenchmarkOptions::checkAtLeast("--repeats", repeats, 1);
+        vector<int> sizes = {10000, 100000, 1000000};
+        vector<string> distributions = {"uniform", "clustered", "presorted"};
+        vector<int> gridSizes = {32, 64, 96};
+        BenchmarkContext small(32, options);
+        MetalContext& cl = small.getContext();
+        MetalBenchmarkWriter out(options.outputFile);
+        out.add("precision", options.precision);
+        out.add("device", cl.getDevice().getInfo<CL_DEVICE_NAME>());
+        out.add("units", "microseconds");
+
+        // Sorting.
+
+        out.beginArray("sort");
+        for (const string& distribution : distributions)
+            for (int size : sizes) {
+                vector<float> values = createSortKeys(size, distribution);
+                bool uniform = (distribution != "clustered");
+                double bucket = timeSort(cl, values, uniform, MetalSort::BucketSort, repeats);
+                double radix = timeSort(cl, values, uniform, MetalSort::RadixSort, repeats);
+                MetalSort automatic(cl, new SortTrait(), size, uniform);
+                const char* chosen = (automatic.getEngine() == MetalSort::RadixSort ? "radix" : "bucket");
+                out.beginObject();
+                out.add("keys", distribution);
+                out.add("length", size);
+                out.add("bucketSort", bucket);
+                out.add("radixSort", radix);
+                out.add("automatic", chosen);
+                out.endObject();
+                cout << "sort " << distribution << " " << size << ": bucket " << bucket << " us, radix " << radix << " us, automatic " << chosen << endl;
+            }
+        out.endArray();
+
+        // Force reduction and buffer clearing scale with the number of atoms, so each size
+        // needs a context of its own.
+
+        out.beginArray("reduction");
+        for (int size : sizes) {
+            BenchmarkContext context(size, options);
+            double reduce = timeReduceForces(context.getContext(), repeats);
+            double clear = timeClearBuffer(context.getContext(), repeats);
+            out.beginObject();
+            out.add("atoms", size);
+            out.add("reduceForces", reduce);
+            out.add("clearForceBuffers", clear);
+            out.endObject();
+            cout << "reduction " << size << " atoms: reduce " << reduce << " us, clear " << clear << " us" << endl;
+        }
+        out.endArray();
+
+        // FFTs with the default plan for each grid.
+
+        out.beginArray("fft");
+        for (int n : gridSizes) {
+            double fft = 1e6*MetalFFT3D::timePlan(cl, n, n, n, true, MetalFFT3D::getDefaultPlan(cl, n, n, n, true));
+            out.beginObject();
+            out.add("grid", n);
+            out.add("time", fft);
+            out.endObject();
+            cout << "fft " << n << "^3: " << fft << " us" << endl;
+        }
+        out.endArray();
+        out.close();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
@@ -241,7 +241,7 @@ public:
 private:
     MetalContext* context;
     cl::Buffer* buffer;
-    size_t size;
+    size_t size, capacity;
     int elementSize;
     cl_int flags;
     bool ownsBuffer;
@@ -0,0 +1,139 @@
+#ifndef OPENMM_METALBUFFERPOOL_H_
+#define OPENMM_METALBUFFERPOOL_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#include "openmm/common/windowsExportCommon.h"
+#include "../src/opencl.hpp"
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace OpenMM {
+
+/**
+ * This class recycles device memory for MetalArrays.  Rather than releasing a buffer when
+ * an array is deleted or resized, the buffer is returned to the pool and handed out again
+ * the next time an array of a compatible size is created.  This avoids repeatedly going
+ * through the driver's allocator when arrays grow (such as the neighbor list) or when
+ * temporary arrays are created and destroyed, and it limits fragmentation on long runs.
+ * <p>
+ * Requests are rounded up to a size class.  Sizes up to 4 kB are rounded to a multiple of
+ * 256 bytes.  Larger sizes are divided into eight classes per power of two, so no more than
+ * 12.5% of an allocation is wasted.  Buffers are only shared between requests that specify
+ * the same memory flags.
+ * <p>
+ * The pool also records statistics on the number of bytes in use, which can be used to
+ * measure the peak memory footprint of a simulation.
+ */
+
+class OPENMM_EXPORT_COMMON MetalBufferPool {
+public:
+    /**
+     * Create a MetalBufferPool.
+     *
+     * @param context    the Metal context from which to allocate memory
+     */
+    MetalBufferPool(cl::Context& context);
+    ~MetalBufferPool();
+    /**
+     * Set whether buffers are recycled.  If this is false, every request is sent directly
+     * to the driver and buffers are released as soon as they are returned.  Statistics are
+     * still recorded.
+     */
+    void setEnabled(bool enabled);
+    /**
+     * Get a buffer that is at least as large as the requested size.
+     *
+     * @param bytes      the minimum size of the buffer in bytes
+     * @param flags      the flags to specify when creating the buffer
+     * @param capacity   on exit, the actual size of the buffer.  This value must be passed
+     *                   to release() when the buffer is no longer needed.
+     */
+    cl::Buffer* allocate(size_t bytes, cl_int flags, size_t& capacity);
+    /**
+     * Return a buffer to the pool.
+     *
+     * @param buffer     a buffer that was returned by allocate()
+     * @param flags      the flags that were passed to allocate()
+     * @param capacity   the capacity that was returned by allocate()
+     */
+    void release(cl::Buffer* buffer, cl_int flags, size_t capacity);
+    /**
+     * Release all buffers that are not currently in use back to the driver.
+     */
+    void trim();
+    /**
+     * Get the size class a request for a given number of bytes is rounded up to.
+     */
+    static size_t getSizeClass(size_t bytes);
+    /**
+     * Get the number of bytes in buffers that are currently in use.
+     */
+    size_t getLiveBytes() const {
+        return liveBytes;
+    }
+    /**
+     * Get the largest value getLiveBytes() has had at any time.
+     */
+    size_t getPeakLiveBytes() const {
+        return peakLiveBytes;
+    }
+    /**
+     * Get the number of bytes in buffers held by the pool but not currently in use.
+     */
+    size_t getCachedBytes() const {
+        return cachedBytes;
+    }
+    /**
+     * Get the number of buffers that were allocated from the driver.
+     */
+    long long getNumDriverAllocations() const {
+        return numDriverAllocations;
+    }
+    /**
+     * Get the number of requests that were satisfied by recycling a buffer.
+     */
+    long long getNumRecycledAllocations() const {
+        return numRecycledAllocations;
+    }
+private:
+    cl::Context& context;
+    bool enabled;
+    std::map<std::pair<cl_int, size_t>, std::vector<cl::Buffer*> > freeBuffers;
+    std::mutex lock;
+    size_t liveBytes, peakLiveBytes, cachedBytes;
+    long long numDriverAllocations, numRecycledAllocations;
+};
+
+} // namespace OpenMM
+
+#endif /*OPENMM_METALBUFFERPOOL_H_*/
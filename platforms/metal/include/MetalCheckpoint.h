@@ -0,0 +1,190 @@
+#ifndef OPENMM_METALCHECKPOINT_H_
+#define OPENMM_METALCHECKPOINT_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#include "openmm/common/windowsExportCommon.h"
+#include "../src/opencl.hpp"
+#include <iosfwd>
+#include <map>
+#include <vector>
+
+namespace OpenMM {
+
+class MetalContext;
+
+/**
+ * This class reads and writes the sections of a version 4 checkpoint, and holds the state
+ * that persists between checkpoints.
+ * <p>
+ * A version 4 checkpoint consists of a header followed by a list of sections, each holding one
+ * array.  Each section records how it is encoded, so the reader never needs to know what the
+ * writer chose.  Arrays of floating point values are compressed losslessly by XORing every word
+ * with a reference word and dropping the high order bytes that are zero.  In a full checkpoint
+ * the reference is the same component of the previous element, which is usually close since
+ * atoms are stored in spatially sorted order.  In an incremental checkpoint it is the same word
+ * in the full checkpoint the incremental one is based on, and sections that have not changed
+ * at all are stored as a marker with no data.
+ * <p>
+ * Arrays are downloaded into a pinned staging buffer without blocking, so each section can be
+ * encoded and written while later ones are still being transferred.
+ */
+
+class OPENMM_EXPORT_COMMON MetalCheckpoint {
+public:
+    /**
+     * Identifies the array stored in a section.
+     */
+    enum Section {
+        EndOfSections = 0,
+        Positions = 1,
+        PositionCorrections = 2,
+        Velocities = 3,
+        AtomIndex = 4,
+        CellOffsets = 5,
+        BoxVectors = 6,
+        VelocityCorrections = 7
+    };
+    /**
+     * The ways a section can be encoded.
+     */
+    enum Encoding {
+        /**
+         * The data is stored unmodified.
+         */
+        Raw = 0,
+        /**
+         * The data is identical to the same section of the base checkpoint, and is not stored.
+         */
+        Unchanged = 1,
+        /**
+         * Each word is XORed with the corresponding word of the previous element.
+         */
+        XorPrevious = 2,
+        /**
+         * Each word is XORed with the corresponding word of the base checkpoint.
+         */
+        XorBase = 3
+    };
+    MetalCheckpoint();
+    ~MetalCheckpoint();
+    /**
+     * Get a block of pinned host memory that arrays can be downloaded into without blocking.
+     * The memory remains valid until the next call with a larger size.
+     */
+    char* getStagingMemory(MetalContext& context, size_t size);
+    /**
+     * Get the ID of the full checkpoint that incremental checkpoints are written against and
+     * can be loaded on top of, or 0 if there is none.
+     */
+    long long getBaseId() const {
+        return baseId;
+    }
+    /**
+     * Get whether the next checkpoint written should be incremental.
+     *
+     * @param incrementalCheckpoints   the number of incremental checkpoints to write after each full one
+     */
+    bool isNextIncremental(int incrementalCheckpoints) const;
+    /**
+     * Start writing the sections of a checkpoint.  This should be called after writing the header.
+     *
+     * @param incremental   whether this is an incremental checkpoint
+     */
+    void beginWrite(bool incremental);
+    /**
+     * Write a section.
+     *
+     * @param stream        the stream to write to
+     * @param section       identifies the array being written
+     * @param data          the contents of the array
+     * @param size          the size of the array in bytes
+     * @param wordSize      the size of each floating point value (4 or 8), or 0 if the array should
+     *                      not be compressed
+     * @param elementSize   the size in bytes of each element of the array
+     */
+    void writeSection(std::ostream& stream, Section section, const char* data, size_t size, int wordSize, int elementSize);
+    /**
+     * Finish writing a checkpoint.  If it was a full checkpoint, it becomes the new base.
+     *
+     * @param stream   the stream to write to
+     * @param id       the ID that was written in the header
+     */
+    void endWrite(std::ostream& stream, long long id);
+    /**
+     * Read all sections of a checkpoint.
+     *
+     * @param stream     the stream to read from
+     * @param id         the ID of the checkpoint being read
+     * @param baseId     the ID of the full checkpoint this one is based on, or 0 if it is a full checkpoint
+     * @param sections   on exit, the decoded contents of each section
+     */
+    void readSections(std::istream& stream, long long id, long long baseId, std::map<int, std::vector<char> >& sections);
+    /**
+     * Create a new, unique ID for a checkpoint.
+     */
+    static long long createId();
+    /**
+     * Encode an array by XORing each word with a reference and dropping the zero high order bytes.
+     *
+     * @param data         the array to encode
+     * @param reference    the reference to XOR with.  If this is NULL, each element is XORed with
+     *                     the one before it.
+     * @param size         the size of the array in bytes
+     * @param wordSize     the size of each word (4 or 8)
+     * @param elementSize  the size of each element in bytes.  This is only used if reference is NULL.
+     * @param encoded      the encoded data is appended to this
+     */
+    static void encodeXor(const char* data, const char* reference, size_t size, int wordSize, int elementSize, std::vector<char>& encoded);
+    /**
+     * Decode an array that was encoded with encodeXor().
+     *
+     * @param encoded      the encoded data
+     * @param encodedSize  the size of the encoded data in bytes
+     * @param reference    the reference that was passed to encodeXor()
+     * @param size         the size of the decoded array in bytes
+     * @param wordSize     the size of each word (4 or 8)
+     * @param elementSize  the size of each element in bytes
+     * @param data         the decoded array is stored into this
+     */
+    static void decodeXor(const char* encoded, size_t encodedSize, const char* reference, size_t size, int wordSize, int elementSize, char* data);
+private:
+    cl::Buffer* stagingBuffer;
+    char* stagingMemory;
+    size_t stagingSize;
+    long long baseId;
+    int incrementalCount;
+    bool writingIncremental;
+    std::map<int, std::vector<char> > baseSections, pendingSections;
+};
+
+} // namespace OpenMM
+
+#endif /*OPENMM_METALCHECKPOINT_H_*/
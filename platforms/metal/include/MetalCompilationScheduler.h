@@ -0,0 +1,78 @@
+#ifndef OPENMM_METALCOMPILATIONSCHEDULER_H_
+#define OPENMM_METALCOMPILATIONSCHEDULER_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#include "MetalContext.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace OpenMM {
+
+/**
+ * This class builds programs on a set of background threads, so that compilation can
+ * overlap with the rest of Context creation.  Each call to submit() returns a future
+ * that becomes ready once the program has been built.  If the build fails, the exception
+ * is rethrown by the future when its value is requested.
+ * <p>
+ * The destructor waits for all submitted builds to finish, so it must be deleted before
+ * the MetalContext whose programs it builds.
+ */
+
+class MetalCompilationScheduler {
+public:
+    /**
+     * Create a MetalCompilationScheduler.
+     *
+     * @param numThreads   the number of programs to build in parallel
+     */
+    MetalCompilationScheduler(int numThreads);
+    ~MetalCompilationScheduler();
+    /**
+     * Add a program to the queue of builds to perform.
+     *
+     * @param build     a function that builds the program and returns it
+     * @return a future whose value is the built program
+     */
+    std::shared_future<cl::Program> submit(std::function<cl::Program()> build);
+private:
+    void runWorker();
+    std::vector<std::thread> workers;
+    std::deque<std::packaged_task<cl::Program()> > tasks;
+    std::mutex queueLock;
+    std::condition_variable queueCondition;
+    bool isDeleted;
+};
+
+} // namespace OpenMM
+
+#endif /*OPENMM_METALCOMPILATIONSCHEDULER_H_*/
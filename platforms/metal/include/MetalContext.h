@@ -53,8 +53,12 @@
 #include "openmm/common/windowsExportCommon.h"
 #include "MetalArray.h"
 #include "MetalBondedUtilities.h"
+#include "MetalBufferPool.h"
 #include "MetalExpressionUtilities.h"
+#include "MetalForceGroupSchedule.h"
 #include "MetalIntegrationUtilities.h"
+#include "MetalKernelProfiler.h"
+#include "MetalKernelTuner.h"
 #include "MetalLogging.h"
 #include "MetalNonbondedUtilities.h"
 #include "MetalPlatform.h"
@@ -62,6 +66,9 @@
 
 namespace OpenMM {
 
+class MetalCompilationScheduler;
+class MetalStateDownloader;
+class MetalTrajectoryBuffer;
 class MetalForceInfo;
 
 /**
@@ -131,6 +138,12 @@ public:
     class ForcePostComputation;
     static const int ThreadBlockSize;
     static const int TileSize;
+    /**
+     * The ways molecules can be arranged when atoms are reordered.  MoleculeOrder keeps the order
+     * chosen by ComputeContext.  HilbertOrder and MortonOrder sort the instances of each kind of
+     * molecule along a Hilbert or Morton (Z-order) curve through the system.
+     */
+    enum AtomOrder {MoleculeOrder, HilbertOrder, MortonOrder};
     MetalContext(const System& system, int platformIndex, int deviceIndex, const std::string& precision, MetalPlatform::PlatformData& platformData,
         MetalContext* originalContext);
     ~MetalContext();
@@ -220,6 +233,15 @@ public:
      * @param defines            a set of preprocessor definitions (name, value) to define when compiling the program
      */
     ComputeProgram compileProgram(const std::string source, const std::map<std::string, std::string>& defines=std::map<std::string, std::string>());
+    /**
+     * Compile source code to create a ComputeProgram.
+     *
+     * @param source             the source code of the program
+     * @param defines            a set of preprocessor definitions (name, value) to define when compiling the program
+     * @param optimizationFlags  the optimization flags to pass to the Metal compiler.  If this is
+     *                           NULL, a default set of options will be used
+     */
+    ComputeProgram compileProgram(const std::string source, const std::map<std::string, std::string>& defines, const char* optimizationFlags);
     /**
      * Convert an array to an MetalArray.  If the argument is already an MetalArray, this simply casts it.
      * If the argument is a ComputeArray that wraps an MetalArray, this returns the wrapped array.  For any
@@ -233,7 +255,8 @@ public:
         return posq;
     }
     /**
-     * Get the array which contains a correction to the position of each atom.  This only exists if getUseMixedPrecision() returns true.
+     * Get the array which contains a correction to the position of each atom.  This only exists if getUseMixedPrecision()
+     * or getUseFloatFloatPrecision() returns true.
      */
     MetalArray& getPosqCorrection() {
         return posqCorrection;
@@ -244,6 +267,32 @@ public:
     MetalArray& getVelm() {
         return velm;
     }
+    /**
+     * Get the array which contains a correction to the velocity of each atom.  This only exists if
+     * getUseFloatFloatPrecision() returns true.
+     */
+    MetalArray& getVelmCorrection() {
+        return velmCorrection;
+    }
+    /**
+     * Record that posqCorrection and velmCorrection are already in the current atom order.  Call this
+     * after uploading them together with a new atom order, so the next reordering does not permute them.
+     */
+    void resetCorrectionOrder();
+    /**
+     * Get the program containing the float-float integration kernels.  It is compiled without any
+     * optimizations that could reorder floating point operations, and is only available if
+     * getUseFloatFloatPrecision() returns true.
+     */
+    cl::Program& getFloatFloatProgram() {
+        return floatFloatProgram;
+    }
+    /**
+     * Add posqCorrection and velmCorrection into posq and velm, then clear the corrections.  Call this
+     * before running a kernel that modifies posq or velm without knowing about the corrections.  It
+     * does nothing unless getUseFloatFloatPrecision() returns true.
+     */
+    void foldFloatFloatCorrections();
     /**
      * Get the array which contains the force on each atom.
      */
@@ -304,6 +353,33 @@ public:
     MetalArray& getAtomIndexArray() {
         return atomIndexDevice;
     }
+    /**
+     * Get the pool from which MetalArrays allocate device memory.
+     */
+    MetalBufferPool& getBufferPool() {
+        return bufferPool;
+    }
+    /**
+     * Get the profiler that records the execution time of every kernel launched by this context.
+     */
+    MetalKernelProfiler& getKernelProfiler() {
+        return *kernelProfiler;
+    }
+    /**
+     * Get the object used to take snapshots of the state without blocking the simulation.
+     * It is created the first time this is called.
+     */
+    MetalStateDownloader& getStateDownloader();
+    /**
+     * Create a buffer that records the positions of selected atoms on the device at regular
+     * intervals.  The context owns the buffer and deletes it when the context is deleted.
+     *
+     * @param atoms       the original indices of the atoms to record
+     * @param interval    the number of steps between frames
+     * @param capacity    the maximum number of frames held on the device
+     * @param quantize    if true, store coordinates as 16 bit fractions of the box vectors
+     */
+    MetalTrajectoryBuffer& createTrajectoryBuffer(const std::vector<int>& atoms, int interval, int capacity, bool quantize);
     /**
      * Create an Metal Program from source code.
      *
@@ -428,6 +504,121 @@ public:
     void setStepsSinceReorder(int steps) {
         stepsSinceReorder = steps;
     }
+    /**
+     * Get the way molecules are arranged when atoms are reordered.
+     */
+    AtomOrder getAtomOrder() const {
+        return atomOrder;
+    }
+    /**
+     * Set the way molecules are arranged when atoms are reordered.  This takes effect the next
+     * time atoms are reordered.
+     */
+    void setAtomOrder(AtomOrder order) {
+        atomOrder = order;
+    }
+    /**
+     * Get the number of time steps between reorderings of atoms.  Atoms may also be reordered
+     * sooner if the neighbor list grows.
+     */
+    int getReorderInterval() const {
+        return reorderInterval;
+    }
+    /**
+     * Set the number of time steps between reorderings of atoms.  This cannot be more than 250,
+     * since ComputeContext always reorders at least that often.
+     */
+    void setReorderInterval(int steps);
+    /**
+     * Get the number of replicas of a system that are batched in this context.  The System
+     * holds the replicas one after another, each with getNumAtoms()/getNumReplicas() atoms,
+     * and atoms in different replicas never interact.
+     */
+    int getNumReplicas() const {
+        return platformData.numReplicas;
+    }
+    /**
+     * Get whether FFT plans and PME grid sizes should be chosen by timing candidates on the device.
+     */
+    bool getAutotuneFFT() const {
+        return autotuneFFT;
+    }
+    /**
+     * Get whether the launch parameters of the most expensive kernels should be chosen by timing
+     * candidates on the device.  See MetalKernelTuner.
+     */
+    bool getAutotuneKernels() const {
+        return autotuneKernels;
+    }
+    /**
+     * Get the version of the checkpoint format to write.  This is either 3 (a single uncompressed
+     * blob) or 4 (compressed sections, optionally incremental).  Both can always be loaded.
+     */
+    int getCheckpointFormat() const {
+        return checkpointFormat;
+    }
+    /**
+     * Get the number of incremental checkpoints to write after each full one.  An incremental
+     * checkpoint can only be loaded after the full checkpoint it is based on.
+     */
+    int getIncrementalCheckpoints() const {
+        return incrementalCheckpoints;
+    }
+    /**
+     * Get the number of steps in each block of fused steps.  Within a block, decisions that
+     * need data from the device are deferred to the block boundaries, so the host never waits
+     * for the device in the middle of a block.  A value of 1 means steps are not fused.
+     */
+    int getFusedSteps() const {
+        return fusedSteps;
+    }
+    /**
+     * Get whether this context shares its cl::Context with the other devices of a multi-device
+     * simulation.  When it does, positions and forces are copied directly between the devices'
+     * buffers instead of being staged through host memory.
+     */
+    bool getUsePeerTransfers() const {
+        return usePeerTransfers;
+    }
+    /**
+     * Get whether per-atom nonbonded parameters with a limited dynamic range should be stored
+     * in half precision.  They are expanded to single precision when the interaction kernel
+     * loads them, so this only reduces the memory traffic of the kernel, not the precision of
+     * the arithmetic.
+     */
+    bool getUseCompressedParameters() const {
+        return useCompressedParameters;
+    }
+    /**
+     * Get whether the current step is the first one in a block of fused steps.  Atoms are
+     * only reordered at the start of a block.
+     */
+    bool isStepBlockStart() {
+        return (getStepCount()%fusedSteps == 0);
+    }
+    /**
+     * Get whether the current step is the last one in a block of fused steps.  The host
+     * synchronizes with the device at the end of a block.
+     */
+    bool isStepBlockEnd() {
+        return ((getStepCount()+1)%fusedSteps == 0);
+    }
+    /**
+     * Look up the result of an earlier autotuning run on this device.  Results are kept for the
+     * lifetime of the process, and also in the program cache directory if one is enabled.
+     *
+     * @param key     identifies what was tuned, including every parameter the result depends on
+     * @param value   on exit, the stored result if one was found
+     * @return true if a result was found, false otherwise
+     */
+    bool loadTuningResult(const std::string& key, std::string& value);
+    /**
+     * Store the result of an autotuning run on this device, so loadTuningResult() can find it later.
+     *
+     * @param key     identifies what was tuned, including every parameter the result depends on
+     * @param value   the result to store.  It must fit on a single line.
+     */
+    void saveTuningResult(const std::string& key, const std::string& value);
     /**
      * Get the flag that marks whether the current force evaluation is valid.
      */
@@ -523,6 +714,15 @@ public:
       }
         return useMixedPrecision;
     }
+    /**
+     * Get whether mixed precision is being emulated with pairs of floats.  This is what the "mixed"
+     * precision mode uses, since the devices do not support double precision.  Kernels and host code
+     * outside the integrators see single precision, but the integrators keep positions and velocities
+     * as float-float pairs in posq/posqCorrection and velm/velmCorrection.
+     */
+    bool getUseFloatFloatPrecision() const {
+        return useFloatFloatPrecision;
+    }
     /**
      * Get whether the periodic box is triclinic.
      */
@@ -636,6 +836,12 @@ public:
     MetalNonbondedUtilities& getNonbondedUtilities() {
         return *nonbonded;
     }
+    /**
+     * Get the MetalForceGroupSchedule for this context.
+     */
+    MetalForceGroupSchedule& getForceGroupSchedule() {
+        return *forceGroupSchedule;
+    }
     /**
      * Create a new NonbondedUtilities for use with this context.  This should be called
      * only in unusual situations, when a Force needs its own NonbondedUtilities object
@@ -688,8 +894,38 @@ public:
      */
     void flushQueue();
 private:
+    class MoleculeReorderListener;
+    class CorrectionReorderListener;
     MetalPlatform::PlatformData& platformData;
-    void printProfilingEvents();
+    /**
+     * Compute the name under which a compiled program is stored in the program cache.  This is
+     * a SHA1 hash of the fully expanded source, the compiler options, and the device and driver.
+     */
+    std::string getProgramCacheKey(const std::string& source, const std::string& options);
+    /**
+     * Time the reduceForces kernel with a range of launch parameters and select the fastest.
+     */
+    void tuneReduceForces();
+    /**
+     * Combine the compilation defines, type definitions, common code, and program-specific
+     * defines with the source code of a program.
+     */
+    std::string expandProgramSource(const std::string& source, const std::map<std::string, std::string>& defines, const std::string& options);
+    /**
+     * Get the options to build a program with, given the optimization flags requested by the
+     * caller (or NULL for the defaults).
+     */
+    std::string getCompilationOptions(const char* optimizationFlags) const;
+    /**
+     * Build a program from fully expanded source code, using the program cache if it is enabled.
+     * This may be called from any thread.
+     */
+    cl::Program buildProgram(const std::string& source, const std::string& options);
+    /**
+     * Rebuild the table of autoclear buffers that clearAutoclearBuffers() reads on the device, and
+     * set the arguments of the kernels that clear them.
+     */
+    void buildAutoclearTable();
     int deviceIndex;
     int platformIndex;
     int contextIndex;
@@ -698,29 +934,36 @@ private:
     int numForceBuffers;
     int simdWidth;
   int reduceEnergyThreadgroups;
-  bool supports64BitGlobalAtomics, supportsDoublePrecision, useDoublePrecision, useMixedPrecision, boxIsTriclinic, hasAssignedPosqCharges, enableKernelProfiling;
+    int reorderInterval;
+    AtomOrder atomOrder;
+  bool supports64BitGlobalAtomics, supportsDoublePrecision, useDoublePrecision, useMixedPrecision, useFloatFloatPrecision, boxIsTriclinic, hasAssignedPosqCharges, enableKernelProfiling, usePeerTransfers, useCompressedParameters;
+    bool autotuneFFT, autotuneKernels, reduceForcesNeedsTuning;
+    int checkpointFormat, incrementalCheckpoints, fusedSteps;
     mm_float4 periodicBoxSize, invPeriodicBoxSize, periodicBoxVecX, periodicBoxVecY, periodicBoxVecZ;
     mm_double4 periodicBoxSizeDouble, invPeriodicBoxSizeDouble, periodicBoxVecXDouble, periodicBoxVecYDouble, periodicBoxVecZDouble;
     std::string defaultOptimizationOptions;
+    std::string programCacheDirectory;
     std::map<std::string, std::string> compilationDefines;
     cl::Context context;
     cl::Device device;
     cl::CommandQueue defaultQueue, currentQueue;
+    // The pool keeps a reference to context, so it must be declared after it.  It allocates
+    // nothing until the constructor has created the context.
+    MetalBufferPool bufferPool;
     cl::Kernel clearBufferKernel;
-    cl::Kernel clearTwoBuffersKernel;
-    cl::Kernel clearThreeBuffersKernel;
-    cl::Kernel clearFourBuffersKernel;
-    cl::Kernel clearFiveBuffersKernel;
-    cl::Kernel clearSixBuffersKernel;
     cl::Kernel reduceReal4Kernel;
     cl::Kernel reduceForcesKernel;
+    MetalKernelTuner::LaunchConfig reduceForcesLaunch;
     cl::Kernel reduceEnergyKernel;
     cl::Kernel setChargesKernel;
+    cl::Program floatFloatProgram;
+    cl::Kernel foldCorrectionsKernel;
     cl::Buffer* pinnedBuffer;
     void* pinnedMemory;
     MetalArray posq;
     MetalArray posqCorrection;
     MetalArray velm;
+    MetalArray velmCorrection;
     MetalArray force;
     MetalArray forceBuffers;
     MetalArray longForceBuffer;
@@ -733,13 +976,20 @@ private:
     std::map<std::string, double> energyParamDerivWorkspace;
     std::vector<cl::Memory*> autoclearBuffers;
     std::vector<int> autoclearBufferSizes;
-    std::vector<cl::Event> profilingEvents;
-    std::vector<std::string> profilingKernelNames;
-    cl_ulong profileStartTime;
+    std::vector<cl_mem> autoclearHandles;
+    std::vector<cl::Kernel> autoclearKernels;
+    std::vector<int> autoclearWorkUnits;
+    MetalArray autoclearChunkStart, autoclearSizes;
+    MetalKernelProfiler* kernelProfiler;
+    MetalStateDownloader* stateDownloader;
+    CorrectionReorderListener* correctionReorderListener;
+    std::vector<MetalTrajectoryBuffer*> trajectoryBuffers;
     MetalIntegrationUtilities* integration;
     MetalExpressionUtilities* expression;
     MetalBondedUtilities* bonded;
     MetalNonbondedUtilities* nonbonded;
+    MetalForceGroupSchedule* forceGroupSchedule;
+    MetalCompilationScheduler* compilationScheduler;
 };
 
 /**
@@ -29,6 +29,8 @@
 
 #define USE_VKFFT
 #include "MetalArray.h"
+#include <string>
+#include <vector>
 #ifdef USE_VKFFT
 #define VKFFT_BACKEND 3
     #pragma clang diagnostic push
@@ -40,47 +42,79 @@
 
 namespace OpenMM {
 
-#ifdef USE_VKFFT
-/**
- * This class performs three dimensional Fast Fourier Transforms.  It uses the
- * VkFFT library (https://github.com/DTolm/VkFFT).
- * <p>
- * This class is most efficient when the size of each dimension is a product of
- * small prime factors: 2, 3, 5, 7, 11, and 13.  You can call findLegalDimension()
- * to determine the smallest size that satisfies this requirement and is greater
- * than or equal to a specified minimum size.
- * <p>
- * Note that this class performs an unnormalized transform.  That means that if you perform
- * a forward transform followed immediately by an inverse transform, the effect is to
- * multiply every value of the original data set by the total number of data points.
- */
-#else
 /**
- * This class performs three dimensional Fast Fourier Transforms.  It is based on the
- * mixed radix algorithm described in
+ * This class performs three dimensional Fast Fourier Transforms.  It can use either of two
+ * implementations.  The first is the VkFFT library (https://github.com/DTolm/VkFFT), which is
+ * only available when USE_VKFFT is defined.  The second is built in, and is based on the mixed
+ * radix algorithm described in
  * <p>
  * Takahashi, D. and Kanada, Y., "High-Performance Radix-2, 3 and 5 Parallel 1-D Complex
  * FFT Algorithms for Distributed-Memory Parallel Computers."  Journal of Supercomputing,
  * 15, 207–228 (2000).
  * <p>
- * This class places certain restrictions on the allowed dimensions of the grid.  First,
- * the size of each dimension may have no prime factors other than 2, 3, 5, and 7.  You
- * can call findLegalDimension() to determine the smallest size that satisfies this
- * requirement and is greater than or equal to a specified minimum size.  Second, the size
- * of each dimension must be small enough to compute each 1D transform entirely in local
- * memory with one work unit per data point.  This will vary between platforms, but is
+ * This class is most efficient when the size of each dimension is a product of small prime
+ * factors.  VkFFT allows 2, 3, 5, 7, 11, and 13, while the built in implementation only allows
+ * 2, 3, 5, and 7.  You can call findLegalDimension() to determine the smallest size that satisfies
+ * this requirement and is greater than or equal to a specified minimum size.  In addition, the
+ * built in implementation computes each 1D transform entirely in local memory, so the size of
+ * each dimension must be small enough to fit.  This will vary between platforms, but is
  * typically at least 512.
  * <p>
+ * The way a transform is computed is described by a Plan.  By default, VkFFT is used if it is
+ * available.  findFastestPlan() instead times a set of candidate plans on the device and returns
+ * the fastest one, and findFastestDimensions() uses the same timings to choose between grids of
+ * similar sizes.
+ * <p>
  * Note that this class performs an unnormalized transform.  That means that if you perform
  * a forward transform followed immediately by an inverse transform, the effect is to
  * multiply every value of the original data set by the total number of data points.
  */
-#endif
-
 class OPENMM_EXPORT_COMMON MetalFFT3D {
 public:
     /**
-     * Create an MetalFFT3D object for performing transforms of a particular size.
+     * This describes how a transform is computed.  All plans produce the same results, up to
+     * rounding error, but they differ in speed.
+     */
+    struct Plan {
+        Plan() : useVkFFT(false), packedAxis(-1), maxThreads(256), radixOrder(0) {
+        }
+        /**
+         * Whether to use VkFFT instead of the built in kernels.  This may only be true when
+         * USE_VKFFT is defined.
+         */
+        bool useVkFFT;
+        /**
+         * For real-to-complex transforms with the built in kernels, the axis (0, 1, or 2) along
+         * which pairs of real values are packed into a complex grid that is half as large.  That
+         * axis must have an even size.  If this is -1, the real values are transformed directly.
+         */
+        int packedAxis;
+        /**
+         * The maximum number of threads in each block.  VkFFT treats this as a target rather
+         * than a hard limit.
+         */
+        int maxThreads;
+        /**
+         * Which of the orders returned by getRadixOrder() the built in kernels use to factor
+         * each dimension.
+         */
+        int radixOrder;
+        /**
+         * Get a description of this plan that can be parsed by fromString().
+         */
+        std::string toString() const;
+        /**
+         * Parse a description created by toString().
+         */
+        static Plan fromString(const std::string& description);
+        bool operator==(const Plan& other) const {
+            return (useVkFFT == other.useVkFFT && packedAxis == other.packedAxis && maxThreads == other.maxThreads && radixOrder == other.radixOrder);
+        }
+    };
+    /**
+     * Create an MetalFFT3D object for performing transforms of a particular size.  If autotuning
+     * is enabled for the context, the plan is chosen by findFastestPlan().  Otherwise the one
+     * returned by getDefaultPlan() is used.
      *
      * @param context the context in which to perform calculations
      * @param xsize   the first dimension of the data sets on which FFTs will be performed
@@ -89,9 +123,18 @@ public:
      * @param realToComplex  if true, a real-to-complex transform will be done.  Otherwise, it is complex-to-complex.
      */
     MetalFFT3D(MetalContext& context, int xsize, int ysize, int zsize, bool realToComplex=false);
-#ifdef USE_VKFFT
+    /**
+     * Create an MetalFFT3D object for performing transforms of a particular size with a specified plan.
+     *
+     * @param context the context in which to perform calculations
+     * @param xsize   the first dimension of the data sets on which FFTs will be performed
+     * @param ysize   the second dimension of the data sets on which FFTs will be performed
+     * @param zsize   the third dimension of the data sets on which FFTs will be performed
+     * @param realToComplex  if true, a real-to-complex transform will be done.  Otherwise, it is complex-to-complex.
+     * @param plan    the way to compute the transform
+     */
+    MetalFFT3D(MetalContext& context, int xsize, int ysize, int zsize, bool realToComplex, const Plan& plan);
     ~MetalFFT3D();
-#endif
     /**
      * Perform a Fourier transform.  The transform cannot be done in-place: the input and output
      * arrays must be different.  Also, the input array is used as workspace, so its contents
@@ -106,25 +149,73 @@ public:
      * @param forward  true to perform a forward transform, false to perform an inverse transform
      */
     void execFFT(MetalArray& in, MetalArray& out, bool forward = true);
+    /**
+     * Get the plan used to compute transforms.
+     */
+    const Plan& getPlan() const {
+        return plan;
+    }
     /**
      * Get the smallest legal size for a dimension of the grid (that is, a size with no prime
-     * factors other than 2, 3, 5, and 7).
+     * factors other than the ones supported by the available implementations).
      *
      * @param minimum   the minimum size the return value must be greater than or equal to
      */
     static int findLegalDimension(int minimum);
+    /**
+     * Get the order in which the built in kernels try to divide a dimension by each radix.
+     * Radices are tried in this order at every pass, so earlier ones are used first.
+     *
+     * @param index    the index of the order, between 0 and getNumRadixOrders()-1
+     */
+    static const std::vector<int>& getRadixOrder(int index);
+    /**
+     * Get the number of orders that can be passed to getRadixOrder().
+     */
+    static int getNumRadixOrders();
+    /**
+     * Get the plan that is used when autotuning is disabled.
+     */
+    static Plan getDefaultPlan(MetalContext& context, int xsize, int ysize, int zsize, bool realToComplex);
+    /**
+     * Get every plan that can be used for a transform.  Plans that would create identical
+     * kernels are only included once.
+     */
+    static std::vector<Plan> getCandidatePlans(MetalContext& context, int xsize, int ysize, int zsize, bool realToComplex);
+    /**
+     * Measure how long a plan takes to perform a forward and an inverse transform.
+     *
+     * @return the average time in seconds, or -1 if the plan could not be created on this device
+     */
+    static double timePlan(MetalContext& context, int xsize, int ysize, int zsize, bool realToComplex, const Plan& plan);
+    /**
+     * Find the fastest plan for a transform by timing candidates on the device.  The result is
+     * remembered with MetalContext::saveTuningResult(), so later calls with the same arguments
+     * return immediately.
+     */
+    static Plan findFastestPlan(MetalContext& context, int xsize, int ysize, int zsize, bool realToComplex);
+    /**
+     * Choose the size of a grid by timing transforms.  On entry the arguments contain the
+     * minimum size of each dimension, and on exit they contain legal sizes that are at least
+     * as large.  Each dimension may be slightly larger than findLegalDimension() would choose
+     * if that makes the transform faster.  The result is remembered the same way as for
+     * findFastestPlan().
+     */
+    static void findFastestDimensions(MetalContext& context, int& xsize, int& ysize, int& zsize, bool realToComplex);
 private:
+    void initialize(bool realToComplex);
+    cl::Kernel createKernel(int xsize, int ysize, int zsize, int& threads, int axis, bool forward, bool inputIsReal);
+    static std::vector<int> factorDimension(int size, int radixOrder);
     int xsize, ysize, zsize;
     int xthreads, ythreads, zthreads;
     bool packRealAsComplex;
     MetalContext& context;
-#ifdef USE_VKFFT
-    VkFFTApplication app;
-#else
-    cl::Kernel createKernel(int xsize, int ysize, int zsize, int& threads, int axis, bool forward, bool inputIsReal);
+    Plan plan;
     cl::Kernel xkernel, ykernel, zkernel;
     cl::Kernel invxkernel, invykernel, invzkernel;
     cl::Kernel packForwardKernel, unpackForwardKernel, packBackwardKernel, unpackBackwardKernel;
+#ifdef USE_VKFFT
+    VkFFTApplication app;
 #endif
 };
 
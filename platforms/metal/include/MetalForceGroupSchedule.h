@@ -0,0 +1,172 @@
+#ifndef OPENMM_METALFORCEGROUPSCHEDULE_H_
+#define OPENMM_METALFORCEGROUPSCHEDULE_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#include "MetalArray.h"
+#include "openmm/common/windowsExportCommon.h"
+
+namespace OpenMM {
+
+class MetalContext;
+class System;
+
+/**
+ * This class implements a declared multiple time step schedule.  Integrators such as RESPA
+ * evaluate a set of slow force groups (for example PME reciprocal space) once per outer step,
+ * at the same positions as the last evaluation of the fast groups in that step.  When a
+ * schedule is declared, the evaluation of the fast groups on every innerSteps'th call also
+ * computes the slow groups, in a pass that clears the buffers and builds the neighbor list
+ * for both.  The slow forces are kept on the device, and the next evaluation, if it asks for
+ * exactly the slow groups, copies them instead of computing anything.
+ * <p>
+ * If the slow groups are requested after a different number of fast evaluations than declared,
+ * the schedule adopts the number it observes, so a slow pass that would be discarded is not
+ * repeated on every outer step.
+ * <p>
+ * Declaring a schedule is a promise that positions and parameters do not change between the
+ * last fast evaluation of a step and the slow one that follows it.  The cache is only used by
+ * the evaluation immediately after the one that filled it, within the same step, and it is
+ * discarded when positions or the box are set or atoms are reordered.  Evaluations that
+ * include energy, contexts with energy parameter derivatives, and simulations split across
+ * several devices never use the schedule.
+ * <p>
+ * ContextImpl still calls every force when the slow forces come from the cache.  Only forces
+ * that do all their work in the bonded and nonbonded utilities, or in NonbondedForce, skip it.
+ * Forces that launch kernels of their own, such as CustomGBForce or CustomCVForce, would still
+ * run and have their results overwritten by the cache, so a schedule whose slow groups contain
+ * them is refused.
+ * <p>
+ * The schedule is read from OPENMM_METAL_SLOW_FORCE_GROUPS and OPENMM_METAL_MTS_INNER_STEPS
+ * when the context is created, and may be changed later with setSchedule().
+ */
+
+class OPENMM_EXPORT_COMMON MetalForceGroupSchedule {
+public:
+    class InvalidateListener;
+    MetalForceGroupSchedule(MetalContext& context, const System& system);
+    /**
+     * Declare the schedule.  This throws an exception if the slow groups contain a force that
+     * cannot skip its work when the slow forces come from the cache.
+     *
+     * @param slowGroups    a set of bit flags for the force groups evaluated once per outer step.
+     *                      0 disables the schedule.
+     * @param innerSteps    the number of fast evaluations in each outer step
+     */
+    void setSchedule(int slowGroups, int innerSteps);
+    /**
+     * Get the set of bit flags for the force groups evaluated once per outer step.
+     */
+    int getSlowGroups() const {
+        return slowGroups;
+    }
+    /**
+     * Get the number of fast evaluations in each outer step.
+     */
+    int getInnerSteps() const {
+        return innerSteps;
+    }
+    /**
+     * Get the number of evaluations that have copied their forces from the cache.
+     */
+    int getNumCachedEvaluations() const {
+        return numCachedEvaluations;
+    }
+    /**
+     * Get whether the current evaluation copies its forces from the cache.  Force kernels that
+     * do work outside the bonded and nonbonded utilities should skip it when this is true.
+     */
+    bool isUsingCachedForces() const {
+        return state == CachedPass;
+    }
+    /**
+     * Get whether the current evaluation follows a pass over the slow groups, so the buffers
+     * are already clear and the neighbor list is already built.
+     */
+    bool isFollowingSlowPass() const {
+        return state == SharedPass;
+    }
+    /**
+     * Get the force groups the neighbor list should be built for in the current evaluation.
+     *
+     * @param groups    the force groups being evaluated
+     */
+    int getNeighborListGroups(int groups) const {
+        return (state == SlowPass ? groups|pendingGroups : groups);
+    }
+    /**
+     * Called at the start of every force evaluation to decide how it will be performed.
+     *
+     * @param groups         the force groups being evaluated
+     * @param includeForces  true if forces should be computed
+     * @param includeEnergy  true if potential energy should be computed
+     * @return the slow groups that should be evaluated in a pass of their own before this one,
+     * or 0 if there are none
+     */
+    int beginEvaluation(int groups, bool includeForces, bool includeEnergy);
+    /**
+     * Called after the pass over the slow groups.  If it succeeded, this stores the forces and
+     * clears the force buffers for the evaluation that requested it.
+     *
+     * @param valid    whether the pass produced valid forces
+     */
+    void finishSlowPass(bool valid);
+    /**
+     * Copy the cached forces into the long force buffer.
+     */
+    void loadCachedForces();
+    /**
+     * Called at the end of every force evaluation.
+     *
+     * @param valid    whether the evaluation produced valid forces
+     */
+    void finishEvaluation(bool valid);
+    /**
+     * Discard the cached forces.
+     */
+    void invalidate() {
+        cacheValid = false;
+    }
+private:
+    /**
+     * Find a force in the given groups that cannot skip its work when the slow forces come from
+     * the cache.  This returns its index, or -1 if there is none.
+     */
+    int findUnskippableForce(int groups) const;
+    enum State {Idle, SlowPass, SharedPass, CachedPass};
+    MetalContext& context;
+    const System& system;
+    MetalArray cachedForces;
+    State state;
+    int slowGroups, innerSteps, period, pendingGroups, fastEvaluations, cachedEvaluation, numCachedEvaluations;
+    long long cachedStep;
+    bool cacheValid, countsAsFast, countsAsSlow, slowRequest;
+};
+
+} // namespace OpenMM
+
+#endif /*OPENMM_METALFORCEGROUPSCHEDULE_H_*/
@@ -44,6 +44,7 @@ class MetalContext;
 class OPENMM_EXPORT_COMMON MetalIntegrationUtilities : public IntegrationUtilities {
 public:
     MetalIntegrationUtilities(MetalContext& context, const System& system);
+    ~MetalIntegrationUtilities();
     /**
      * Get the array which contains position deltas.
      */
@@ -61,10 +62,38 @@ public:
      * Distribute forces from virtual sites to the atoms they are based on.
      */
     void distributeForcesFromVirtualSites();
+    /**
+     * Get the number of times the multiple kernel version of CCMA stopped before the constraints
+     * converged.  The first failure also prints a warning.  When the host does not wait for the
+     * device, a failure is only found once the device has finished that call, so this waits for
+     * any calls still pending.
+     */
+    int getNumCcmaConvergenceFailures();
 private:
+    /**
+     * How the number of CCMA iterations is decided.  With HostConvergence, the host checks the
+     * convergence flag every few iterations.  With DeviceConvergence, a batch of iterations is
+     * enqueued at once based on how many recent calls needed, and the host only waits once
+     * to make sure it was enough.  AsyncDeviceConvergence does not wait at all.
+     */
+    enum ConvergenceMode {HostConvergence = 0, DeviceConvergence = 1, AsyncDeviceConvergence = 2};
     void applyConstraintsImpl(bool constrainVelocities, double tol);
+    /**
+     * Check the convergence status of earlier calls that have finished on the device, or of all
+     * of them if wait is true.  This updates the predicted number of iterations and reports any
+     * calls that did not converge.
+     */
+    void updateCcmaIterationEstimate(int mode, bool wait);
+    void reportCcmaConvergenceFailure();
     MetalArray ccmaConvergedHostBuffer;
+    cl::Buffer* ccmaStatusBuffer;
+    int* ccmaStatusMemory;
+    std::vector<cl::Event> ccmaStatusEvent[2];
+    std::vector<int> ccmaNumIterations[2], ccmaNumStatusReadsPending[2];
+    int ccmaPredictedIterations[2], ccmaNextStatusSlot[2];
+    int ccmaNumConvergenceFailures;
     bool ccmaUseDirectBuffer;
+    ConvergenceMode ccmaConvergenceMode;
 };
 
 } // namespace OpenMM
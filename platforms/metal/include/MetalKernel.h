@@ -29,6 +29,8 @@
 
 #include "MetalArray.h"
 #include "MetalContext.h"
+#include <future>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -47,6 +49,23 @@ public:
      * @param kernel       the kernel to be invoked
      */
     MetalKernel(MetalContext& context, cl::Kernel kernel);
+    /**
+     * Create a new MetalKernel from a program that may still be compiling.  The kernel
+     * is looked up the first time it is needed, blocking until compilation finishes.
+     * 
+     * @param context      the context this kernel belongs to
+     * @param program      a future that will hold the compiled program
+     * @param name         the name of the kernel within the program
+     */
+    MetalKernel(MetalContext& context, std::shared_future<cl::Program> program, const std::string& name);
+    /**
+     * Look up a kernel in a program, waiting for the program to compile if necessary.  If the
+     * build failed, this throws an exception that names the kernel and includes the build log.
+     *
+     * @param program      a future that will hold the compiled program
+     * @param name         the name of the kernel within the program
+     */
+    static cl::Kernel lookUpKernel(const std::shared_future<cl::Program>& program, const std::string& name);
     /**
      * Get the name of this kernel.
      */
@@ -95,14 +114,23 @@ protected:
      * Add an argument to pass the kernel when it is invoked, where the value is a primitive type.
      * 
      * @param index     the index of the argument to set
-     * @param value    a pointer to the argument value
+     * @param value    a pointer to the argument value, or NULL to allocate local memory of the given size
      * @param size     the size of the value in bytes
      */
     void setPrimitiveArg(int index, const void* value, int size);
 private:
+    /**
+     * Get the underlying kernel, first waiting for the program to compile if necessary.
+     */
+    cl::Kernel& getKernel() const;
     MetalContext& context;
-    cl::Kernel kernel;
+    std::shared_future<cl::Program> program;
+    std::string name;
+    mutable cl::Kernel kernel;
+    mutable bool isResolved;
     std::vector<MetalArray*> arrayArgs;
+    mutable std::map<int, std::vector<char> > pendingArgs;
+    mutable std::map<int, int> pendingLocalArgs;
 };
 
 } // namespace OpenMM
@@ -0,0 +1,239 @@
+#ifndef OPENMM_METALKERNELPROFILER_H_
+#define OPENMM_METALKERNELPROFILER_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#include "openmm/common/windowsExportCommon.h"
+#include "../src/opencl.hpp"
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace OpenMM {
+
+/**
+ * This class records the execution time of every kernel launched by a MetalContext.  It is
+ * created by the context, and can be retrieved with MetalContext::getKernelProfiler().
+ * <p>
+ * Kernels are timed with OpenCL profiling events, which only work on a queue created with
+ * profiling enabled.  The context creates its queue that way when OPENMM_METAL_PROFILE_KERNELS
+ * or OPENMM_METAL_PROFILE_OUTPUT is set.  Otherwise isAvailable() returns false and nothing
+ * is recorded.  Recording can be paused and resumed with setEnabled() at any time.
+ * <p>
+ * Events are resolved in batches, once every getFlushInterval() launches or when flush()
+ * is called.  Each resolved launch becomes a Record, which is stored in a ring buffer holding
+ * the most recent getCapacity() records, passed to the callback if one is set, and written
+ * to the output file if one is open.  The output file uses the JSON trace format read by
+ * https://ui.perfetto.dev and chrome://tracing.
+ */
+
+class OPENMM_EXPORT_COMMON MetalKernelProfiler {
+public:
+    /**
+     * The execution of a single kernel.
+     */
+    struct Record {
+        /**
+         * The name of the kernel function.
+         */
+        std::string name;
+        /**
+         * The total number of threads launched.
+         */
+        int globalSize;
+        /**
+         * The number of threads in each thread block.
+         */
+        int blockSize;
+        /**
+         * Identifies the queue the kernel ran on.  Queues are numbered from 0 in the order the
+         * profiler first sees them, so the context's default queue is normally 0.
+         */
+        int queue;
+        /**
+         * The time the kernel started executing, in nanoseconds on the device clock
+         */
+        double startTime;
+        /**
+         * The time the kernel finished executing, in nanoseconds on the device clock
+         */
+        double endTime;
+    };
+    /**
+     * Statistics on all executions of one kernel.
+     */
+    struct Statistics {
+        /**
+         * The name of the kernel function.
+         */
+        std::string name;
+        /**
+         * The number of executions that have been recorded.
+         */
+        long long count;
+        /**
+         * The total execution time of all recorded executions, in nanoseconds
+         */
+        double totalTime;
+        /**
+         * The median execution time in nanoseconds.  Percentiles only consider the records
+         * currently in the ring buffer.
+         */
+        double medianTime;
+        /**
+         * The 99th percentile of the execution time in nanoseconds
+         */
+        double p99Time;
+    };
+    /**
+     * Create a MetalKernelProfiler.
+     *
+     * @param available   whether kernels are launched on a queue with profiling enabled
+     * @param capacity    the maximum number of records to keep in the ring buffer
+     */
+    MetalKernelProfiler(bool available, int capacity=65536);
+    ~MetalKernelProfiler();
+    /**
+     * Get whether kernels can be profiled.  If this is false, setEnabled() has no effect.
+     */
+    bool isAvailable() const {
+        return available;
+    }
+    /**
+     * Get whether kernels are currently being recorded.
+     */
+    bool isEnabled() const {
+        return available && enabled;
+    }
+    /**
+     * Set whether kernels should be recorded.  Disabling the profiler does not discard
+     * records or statistics that have already been collected.
+     */
+    void setEnabled(bool enabled);
+    /**
+     * Get the maximum number of records kept in the ring buffer.
+     */
+    int getCapacity() const {
+        return capacity;
+    }
+    /**
+     * Set the maximum number of records kept in the ring buffer.  If there are more records
+     * than this, the oldest ones are discarded.
+     */
+    void setCapacity(int capacity);
+    /**
+     * Get the number of launches between automatic calls to flush().
+     */
+    int getFlushInterval() const {
+        return flushInterval;
+    }
+    /**
+     * Set the number of launches between automatic calls to flush().  Resolving an event
+     * waits for the kernel to finish, so a smaller interval gives more timely results at
+     * the cost of more synchronization with the device.
+     */
+    void setFlushInterval(int interval);
+    /**
+     * Set a function to call with every record as it is resolved.  Pass an empty function to
+     * remove it.  The callback is invoked on whichever thread calls flush(), which is usually
+     * the thread running the simulation.
+     */
+    void setCallback(std::function<void(const Record&)> callback);
+    /**
+     * Write records to a file as they are resolved.  Any file that was already open is
+     * finished and closed first.
+     *
+     * @param path    the file to write to.  If this is empty, records are no longer written
+     *                to a file.  If it is "-", they are written to stdout.
+     */
+    void setOutputFile(const std::string& path);
+    /**
+     * Tell the profiler that a kernel has been enqueued.  This is called by MetalContext.
+     *
+     * @param event       the event that was returned when the kernel was enqueued
+     * @param kernel      the kernel that was enqueued
+     * @param globalSize  the total number of threads
+     * @param blockSize   the number of threads in each thread block
+     * @param queue       the queue the kernel was enqueued on
+     */
+    void addEvent(const cl::Event& event, cl::Kernel& kernel, int globalSize, int blockSize, cl::CommandQueue& queue);
+    /**
+     * Add a record that has already been resolved.  This is called by flush() for every
+     * event, but may also be used to inject timings from other sources.
+     */
+    void addRecord(const Record& record);
+    /**
+     * Wait for every kernel that has been enqueued but not yet resolved, and process its record.
+     */
+    void flush();
+    /**
+     * Get the records in the ring buffer, ordered from oldest to newest.  This does not call
+     * flush(), so kernels enqueued since the last flush are not included.
+     */
+    std::vector<Record> getRecords();
+    /**
+     * Get statistics for every kernel that has been recorded, ordered by name.
+     */
+    std::vector<Statistics> getStatistics();
+    /**
+     * Discard all records and statistics.
+     */
+    void clear();
+private:
+    struct PendingEvent {
+        cl::Event event;
+        std::string name;
+        int globalSize, blockSize, queue;
+    };
+    struct Totals {
+        long long count;
+        double totalTime;
+    };
+    void writeRecord(const Record& record);
+    void closeOutput();
+    bool available, enabled;
+    int capacity, flushInterval, nextRecord;
+    std::vector<Record> records;
+    std::vector<PendingEvent> pending;
+    std::map<std::string, Totals> totals;
+    std::map<cl_command_queue, int> queueIndex;
+    std::function<void(const Record&)> callback;
+    FILE* output;
+    bool outputIsStdout, outputIsEmpty;
+    double traceStartTime;
+    std::mutex lock;
+};
+
+} // namespace OpenMM
+
+#endif /*OPENMM_METALKERNELPROFILER_H_*/
@@ -0,0 +1,118 @@
+#ifndef OPENMM_METALKERNELTUNER_H_
+#define OPENMM_METALKERNELTUNER_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#include "openmm/common/windowsExportCommon.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace OpenMM {
+
+class MetalContext;
+
+/**
+ * This class chooses the launch parameters of a kernel by timing it on the device with each
+ * of a set of candidates.  It is meant to be used on a real force evaluation, so the timings
+ * reflect the actual system rather than a synthetic benchmark.
+ * <p>
+ * The result is stored with MetalContext::saveTuningResult(), under a key made from the name
+ * of the kernel and a size bucket.  Systems whose sizes round up to the same power of two
+ * share a bucket, so a later context for a similar system can use the result immediately
+ * instead of sweeping again.
+ */
+
+class OPENMM_EXPORT_COMMON MetalKernelTuner {
+public:
+    /**
+     * The parameters a kernel is launched with.
+     */
+    struct LaunchConfig {
+        LaunchConfig() : numGroups(0), groupSize(0) {
+        }
+        LaunchConfig(int numGroups, int groupSize) : numGroups(numGroups), groupSize(groupSize) {
+        }
+        int numGroups;
+        int groupSize;
+        bool operator==(const LaunchConfig& other) const {
+            return (numGroups == other.numGroups && groupSize == other.groupSize);
+        }
+    };
+    /**
+     * Create a MetalKernelTuner.
+     *
+     * @param context      the context whose device the kernel runs on
+     * @param name         identifies the kernel.  This should include any setting that changes
+     *                     which launch parameters are fastest, such as whether a cutoff is used.
+     * @param problemSize  the number of atoms (or other work items) the kernel processes
+     */
+    MetalKernelTuner(MetalContext& context, const std::string& name, int problemSize);
+    /**
+     * Look up the result of an earlier sweep for this kernel and size bucket.
+     *
+     * @param config   on exit, the stored launch parameters if any were found
+     * @return true if a result was found, false otherwise
+     */
+    bool loadResult(LaunchConfig& config) const;
+    /**
+     * Time every candidate and return the fastest one.  The result is also stored, so
+     * loadResult() will find it.
+     *
+     * @param candidates   the launch parameters to try
+     * @param run          enqueues the kernel with a set of launch parameters
+     * @param restore      restores any buffers the kernel modifies to the state they were in
+     *                     before the sweep began.  It is called before every launch and once
+     *                     more at the end, so the sweep has no effect on the simulation.
+     * @param times        if not NULL, on exit this contains the median time in seconds for each
+     *                     candidate, or -1 for candidates that could not be launched
+     * @return the fastest candidate
+     */
+    LaunchConfig sweep(const std::vector<LaunchConfig>& candidates, const std::function<void(const LaunchConfig&)>& run,
+            const std::function<void()>& restore, std::vector<double>* times=NULL);
+    /**
+     * Get the bucket that a problem size belongs to.  This is the base 2 logarithm of the size,
+     * rounded up.
+     */
+    static int getSizeBucket(int problemSize);
+    /**
+     * Get a list of candidate launch parameters made from every combination of a set of
+     * group counts and a set of group sizes.
+     *
+     * @param numGroups     the group counts to try.  Each one is combined with every group size.
+     * @param groupSizes    the group sizes to try
+     * @param maxThreads    combinations with more than this many threads in total are omitted
+     */
+    static std::vector<LaunchConfig> getCandidates(const std::vector<int>& numGroups, const std::vector<int>& groupSizes, int maxThreads);
+private:
+    MetalContext& context;
+    std::string key;
+};
+
+} // namespace OpenMM
+
+#endif /*OPENMM_METALKERNELTUNER_H_*/
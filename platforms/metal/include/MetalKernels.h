@@ -29,6 +29,7 @@
 
 #include "MetalPlatform.h"
 #include "MetalArray.h"
+#include "MetalCheckpoint.h"
 #include "MetalContext.h"
 #include "MetalFFT3D.h"
 #include "MetalSort.h"
@@ -194,7 +195,10 @@ public:
      */
     void loadCheckpoint(ContextImpl& context, std::istream& stream);
 private:
+    void createVersion3Checkpoint(std::ostream& stream);
+    void loadVersion3Checkpoint(std::istream& stream);
     MetalContext& cl;
+    MetalCheckpoint checkpoint;
 };
 
 /**
@@ -203,7 +207,7 @@ private:
 class MetalCalcNonbondedForceKernel : public CalcNonbondedForceKernel {
 public:
     MetalCalcNonbondedForceKernel(std::string name, const Platform& platform, MetalContext& cl, const System& system) : CalcNonbondedForceKernel(name, platform),
-            hasInitializedKernel(false), cl(cl), sort(NULL), fft(NULL), dispersionFft(NULL), pmeio(NULL), usePmeQueue(false) {
+            hasInitializedKernel(false), cl(cl), sort(NULL), fft(NULL), dispersionFft(NULL), pmeio(NULL), usePmeQueue(false), pmeSpreadChargeNeedsTuning(false) {
     }
     ~MetalCalcNonbondedForceKernel();
     /**
@@ -271,6 +275,7 @@ private:
     bool hasInitializedKernel;
     MetalArray charges;
     MetalArray sigmaEpsilon;
+    MetalArray sigmaEpsilonHalf;
     MetalArray exceptionParams;
     MetalArray exclusionAtoms;
     MetalArray exclusionParams;
@@ -294,6 +299,7 @@ private:
     MetalArray pmeAtomRange;
     MetalArray pmeAtomGridIndex;
     MetalArray pmeEnergyBuffer;
+    MetalArray changedParamIndices;
     MetalSort* sort;
     cl::CommandQueue pmeQueue;
     cl::Event pmeSyncEvent;
@@ -302,7 +308,7 @@ private:
     Kernel cpuPme;
     PmeIO* pmeio;
     SyncQueuePostComputation* syncQueue;
-    cl::Kernel computeParamsKernel, computeExclusionParamsKernel;
+    cl::Kernel computeParamsKernel, computeExclusionParamsKernel, computeChangedParamsKernel;
     cl::Kernel ewaldSumsKernel;
     cl::Kernel ewaldForcesKernel;
     cl::Kernel pmeAtomRangeKernel;
@@ -321,14 +327,17 @@ private:
     cl::Kernel pmeDispersionEvalEnergyKernel;
     cl::Kernel pmeInterpolateForceKernel;
     cl::Kernel pmeDispersionInterpolateForceKernel;
+    MetalKernelTuner::LaunchConfig pmeSpreadChargeLaunch;
     std::map<std::string, std::string> pmeDefines;
     std::vector<std::pair<int, int> > exceptionAtoms;
+    std::vector<mm_float4> currentParticleParams, currentExceptionParams;
+    std::vector<int> changedParticles, changedExceptions;
     std::vector<std::string> paramNames;
     std::vector<double> paramValues;
     double ewaldSelfEnergy, dispersionCoefficient, alpha, dispersionAlpha;
     int gridSizeX, gridSizeY, gridSizeZ;
     int dispersionGridSizeX, dispersionGridSizeY, dispersionGridSizeZ;
-    bool hasCoulomb, hasLJ, usePmeQueue, doLJPME, usePosqCharges, recomputeParams, hasOffsets;
+    bool hasCoulomb, hasLJ, usePmeQueue, doLJPME, usePosqCharges, recomputeParams, hasOffsets, pmeSpreadChargeNeedsTuning;
     NonbondedMethod nonbondedMethod;
     static const int PmeOrder = 5;
 };
@@ -345,6 +354,165 @@ public:
     }
 };
 
+/**
+ * This kernel is invoked by VerletIntegrator to take one time step when positions and velocities
+ * are stored as float-float pairs.  It is only used if getUseFloatFloatPrecision() returns true.
+ */
+class MetalIntegrateVerletStepKernel : public IntegrateVerletStepKernel {
+public:
+    MetalIntegrateVerletStepKernel(std::string name, const Platform& platform, MetalContext& cl) : IntegrateVerletStepKernel(name, platform), cl(cl),
+            hasInitializedKernels(false) {
+    }
+    /**
+     * Initialize the kernel.
+     *
+     * @param system     the System this kernel will be applied to
+     * @param integrator the VerletIntegrator this kernel will be used for
+     */
+    void initialize(const System& system, const VerletIntegrator& integrator);
+    /**
+     * Execute the kernel.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param integrator the VerletIntegrator this kernel is being used for
+     */
+    void execute(ContextImpl& context, const VerletIntegrator& integrator);
+    /**
+     * Compute the kinetic energy.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param integrator the VerletIntegrator this kernel is being used for
+     */
+    double computeKineticEnergy(ContextImpl& context, const VerletIntegrator& integrator);
+private:
+    MetalContext& cl;
+    bool hasInitializedKernels;
+    cl::Kernel kernel1, kernel2;
+};
+
+/**
+ * This kernel is invoked by LangevinMiddleIntegrator to take one time step when positions and
+ * velocities are stored as float-float pairs.  It is only used if getUseFloatFloatPrecision()
+ * returns true.
+ */
+class MetalIntegrateLangevinMiddleStepKernel : public IntegrateLangevinMiddleStepKernel {
+public:
+    MetalIntegrateLangevinMiddleStepKernel(std::string name, const Platform& platform, MetalContext& cl) : IntegrateLangevinMiddleStepKernel(name, platform), cl(cl),
+            hasInitializedKernels(false) {
+    }
+    /**
+     * Initialize the kernel, setting up the particle masses.
+     *
+     * @param system     the System this kernel will be applied to
+     * @param integrator the LangevinMiddleIntegrator this kernel will be used for
+     */
+    void initialize(const System& system, const LangevinMiddleIntegrator& integrator);
+    /**
+     * Execute the kernel.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param integrator the LangevinMiddleIntegrator this kernel is being used for
+     */
+    void execute(ContextImpl& context, const LangevinMiddleIntegrator& integrator);
+    /**
+     * Compute the kinetic energy.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param integrator the LangevinMiddleIntegrator this kernel is being used for
+     */
+    double computeKineticEnergy(ContextImpl& context, const LangevinMiddleIntegrator& integrator);
+private:
+    MetalContext& cl;
+    double prevTemp, prevFriction, prevStepSize;
+    bool hasInitializedKernels;
+    MetalArray params, oldDelta;
+    cl::Kernel kernel1, kernel2, kernel3;
+};
+
+/**
+ * This kernel is invoked by ContextImpl::applyConstraints() and applyVelocityConstraints() when
+ * positions and velocities are stored as float-float pairs.  The constraint kernels only see posq and
+ * velm, so the corrections are folded into them first.
+ */
+class MetalApplyConstraintsKernel : public CommonApplyConstraintsKernel {
+public:
+    MetalApplyConstraintsKernel(std::string name, const Platform& platform, MetalContext& cl) : CommonApplyConstraintsKernel(name, platform, cl), cl(cl) {
+    }
+    /**
+     * Update particle positions to enforce constraints.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param tol        the distance tolerance within which constraints must be satisfied.
+     */
+    void apply(ContextImpl& context, double tol);
+    /**
+     * Update particle velocities to enforce constraints.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param tol        the velocity tolerance within which constraints must be satisfied.
+     */
+    void applyToVelocities(ContextImpl& context, double tol);
+private:
+    MetalContext& cl;
+};
+
+/**
+ * This kernel is invoked by AndersenThermostat when velocities are stored as float-float pairs.  The
+ * corrections are folded into velm before velocities are randomized.
+ */
+class MetalApplyAndersenThermostatKernel : public CommonApplyAndersenThermostatKernel {
+public:
+    MetalApplyAndersenThermostatKernel(std::string name, const Platform& platform, MetalContext& cl) : CommonApplyAndersenThermostatKernel(name, platform, cl), cl(cl) {
+    }
+    /**
+     * Execute the kernel.
+     *
+     * @param context    the context in which to execute this kernel
+     */
+    void execute(ContextImpl& context);
+private:
+    MetalContext& cl;
+};
+
+/**
+ * This kernel is invoked by MonteCarloBarostat when positions are stored as float-float pairs.  The
+ * corrections are folded into posq before the coordinates are scaled.
+ */
+class MetalApplyMonteCarloBarostatKernel : public CommonApplyMonteCarloBarostatKernel {
+public:
+    MetalApplyMonteCarloBarostatKernel(std::string name, const Platform& platform, MetalContext& cl) : CommonApplyMonteCarloBarostatKernel(name, platform, cl), cl(cl) {
+    }
+    /**
+     * Attempt a Monte Carlo step, scaling particle positions (or cluster centers) by a specified value.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param scaleX     the scale factor by which to multiply particle x-coordinate
+     * @param scaleY     the scale factor by which to multiply particle y-coordinate
+     * @param scaleZ     the scale factor by which to multiply particle z-coordinate
+     */
+    void scaleCoordinates(ContextImpl& context, double scaleX, double scaleY, double scaleZ);
+private:
+    MetalContext& cl;
+};
+
+/**
+ * This kernel is invoked by CMMotionRemover when velocities are stored as float-float pairs.  The
+ * corrections are folded into velm before the center of mass motion is removed.
+ */
+class MetalRemoveCMMotionKernel : public CommonRemoveCMMotionKernel {
+public:
+    MetalRemoveCMMotionKernel(std::string name, const Platform& platform, MetalContext& cl) : CommonRemoveCMMotionKernel(name, platform, cl), cl(cl) {
+    }
+    /**
+     * Execute the kernel.
+     *
+     * @param context    the context in which to execute this kernel
+     */
+    void execute(ContextImpl& context);
+private:
+    MetalContext& cl;
+};
+
 } // namespace OpenMM
 
 #endif /*OPENMM_OPENCLKERNELS_H_*/
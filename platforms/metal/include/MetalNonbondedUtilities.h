@@ -181,6 +181,29 @@ public:
      * the neighbor list.
      */
     double padCutoff(double cutoff);
+    /**
+     * Get the padding currently added to the cutoff when building the neighbor list,
+     * as a fraction of the cutoff.  Unless it was fixed by the user, this is adjusted
+     * during the simulation to minimize the combined cost of building the list and
+     * computing the interactions.
+     */
+    double getNeighborListPadding() const;
+    /**
+     * Get a counter that is incremented every time the padding changes.  Anything that caches
+     * a value derived from the padded cutoff should record this and recompute the value when
+     * it differs.
+     */
+    int getPaddingGeneration() const;
+    /**
+     * Get the fraction of steps on which the neighbor list was rebuilt, measured since
+     * the padding last changed.  Steps where a rebuild was forced (for example, by
+     * reordering atoms) are not counted.
+     */
+    double getNeighborListRebuildRate() const;
+    /**
+     * Get whether the padding is being adjusted automatically.
+     */
+    bool getUseAdaptivePadding() const;
     /**
      * Prepare to compute interactions.  This updates the neighbor list.
      */
@@ -199,6 +222,13 @@ public:
      * @return true if the neighbor list needed to be enlarged.
      */
     bool updateNeighborListSize();
+    /**
+     * When the neighbor list size is only checked every few steps, download the current size
+     * and enlarge the arrays if necessary.  This is called when the host is already synchronizing
+     * with the device, such as when downloading the state.  It does nothing if the size is
+     * checked every step.
+     */
+    void checkNeighborListSize();
     /**
      * Get the array containing the center of each atom block.
      */
@@ -213,8 +243,11 @@ public:
     }
     /**
      * Get the array whose first element contains the number of tiles with interactions.
+     * Kernels that use it do not handle a neighbor list overflow on their own, so after
+     * this is called the size of the neighbor list is checked every step.
      */
     MetalArray& getInteractionCount() {
+        countIsShared = true;
         return interactionCount;
     }
     /**
@@ -229,6 +262,31 @@ public:
     MetalArray& getInteractingAtoms() {
         return interactingAtoms;
     }
+    /**
+     * Get whether the neighbor list records which 8x8 sub-tiles of each tile contain interactions,
+     * so the default interaction kernel can skip the empty ones.
+     */
+    bool getUseSubtileMasks() const {
+        return useSubtileMasks;
+    }
+    /**
+     * Get the array containing the sub-tile mask for each tile with interactions.  This is only
+     * initialized if getUseSubtileMasks() returns true.
+     */
+    MetalArray& getInteractingTileMasks() {
+        return interactingTileMasks;
+    }
+    /**
+     * Count how many of the atom pairs the interaction kernel computes for the neighbor list are
+     * within the cutoff.  This downloads the neighbor list and positions, so it is slow and only
+     * meant for diagnostics.  Tiles with exclusions are not included.
+     *
+     * @param pairsWithinCutoff  on exit, the number of pairs in the neighbor list's tiles that are within the cutoff
+     * @param pairsInTiles       on exit, the number of pairs in the neighbor list's tiles
+     * @param pairsInSubtiles    on exit, the number of pairs in sub-tiles that are not skipped.  This equals
+     *                           pairsInTiles unless sub-tile masks are used.
+     */
+    void getNeighborListPairCounts(long long& pairsWithinCutoff, long long& pairsInTiles, long long& pairsInSubtiles);
     /**
      * Get the array containing exclusion flags.
      */
@@ -312,6 +370,52 @@ public:
 private:
     class KernelSet;
     class BlockSortTrait;
+    /**
+     * Get whether the host only checks the size of the neighbor list every countCheckInterval steps.
+     */
+    bool getUseLazyCountCheck() const;
+    /**
+     * Create the kernels that build the neighbor list for a set of force groups.  They depend
+     * on the padding, so they are recreated whenever it changes.
+     */
+    void createNeighborListKernels(KernelSet& kernels);
+    /**
+     * Record whether the neighbor list was rebuilt on a step, and how many tiles it contained.
+     * Once enough steps have been recorded, this may select a different padding.
+     */
+    void recordNeighborListSample(bool rebuilt, unsigned int tiles);
+    /**
+     * Switch to one of the entries in PaddingLevels.  This only increments the padding generation.
+     * prepareInteractions() recreates the neighbor list kernels of any KernelSet built with an older
+     * generation, and rebuilds the list (including sub-tile masks) before it is used again.
+     */
+    void setPaddingLevel(int level);
+    /**
+     * Time the computeNonbonded kernel with a range of thread block counts and adopt the fastest.
+     * Kernels for other forces may already depend on the thread block size, so only the number of
+     * blocks is tuned.  The result is stored, and contexts created later use it from the start.
+     */
+    void tuneInteractionKernel(KernelSet& kernels, cl::Kernel& kernel, int forceGroups, bool includeForces, bool includeEnergy);
+    /**
+     * Time the findBlocksWithInteractions kernel with a range of launch parameters and adopt the
+     * fastest.  This must be called after the block bounds have been computed for the current step.
+     */
+    void tuneNeighborListKernel(KernelSet& kernels);
+    /**
+     * Get the name under which tuning results for a kernel are stored.  It includes every setting
+     * that changes the work the kernel does: the cutoff, the interaction source (which reflects
+     * the nonbonded method), and whether sub-tile masks and compressed parameters are used.
+     */
+    std::string getTuningName(const std::string& kernelName);
+    /**
+     * Get the number of tiles that may contain interactions.  When several replicas are batched
+     * in one context, this only counts tiles whose blocks are both in the same replica.
+     */
+    long long getTotalNumTiles() const;
+    /**
+     * Add the defines that restrict kernels to tiles within a single replica, if there are several.
+     */
+    void addReplicaDefines(std::map<std::string, std::string>& defines) const;
     MetalContext& context;
     std::map<int, KernelSet> groupKernels;
     MetalArray exclusionTiles;
@@ -320,6 +424,7 @@ private:
     MetalArray exclusionRowIndices;
     MetalArray interactingTiles;
     MetalArray interactingAtoms;
+    MetalArray interactingTileMasks;
     MetalArray interactionCount;
     MetalArray blockCenter;
     MetalArray blockBoundingBox;
@@ -342,8 +447,20 @@ private:
     std::map<int, std::string> groupKernelSource;
     double lastCutoff;
     bool useCutoff, usePeriodic, deviceIsCpu, anyExclusions, usePadding, useNeighborList, forceRebuildNeighborList, useLargeBlocks;
+    bool allowSubtileMasks, useSubtileMasks;
     int startTileIndex, startBlockIndex, numBlocks, maxExclusions, numForceThreadBlocks;
     int forceThreadBlockSize, interactingBlocksThreadBlockSize, groupFlags;
+    int interactingBlocksGroupSize, numInteractingBlocksGroups, initialNumForceThreadBlocks;
+    bool hasTunedForceLaunch, interactionKernelNeedsTuning, neighborListKernelNeedsTuning;
+    int countCheckInterval, stepsSinceCountCheck;
+    bool countDownloadPending, countIsShared;
+    bool adaptivePadding, sampleIsForced;
+    double paddingFraction;
+    int paddingGeneration, listPaddingGeneration;
+    int paddingLevel, windowSamples, windowRebuilds, windowsSinceSearch;
+    double windowTiles;
+    long long samplesAtPadding, rebuildsAtPadding;
+    std::vector<double> paddingLevelCost;
     unsigned int tilesAfterReorder;
     long long numTiles;
     std::string kernelSource;
@@ -357,6 +474,7 @@ class MetalNonbondedUtilities::KernelSet {
 public:
     bool hasForces;
     double cutoffDistance;
+    int paddingGeneration;
     std::string source;
     cl::Kernel forceKernel, energyKernel, forceEnergyKernel;
     cl::Kernel findBlockBoundsKernel;
@@ -382,7 +500,7 @@ public:
      * @param constant       whether the memory should be marked as constant
      */
     ParameterInfo(const std::string& name, const std::string& componentType, int numComponents, int size, cl::Memory& memory, bool constant=true) :
-            name(name), componentType(componentType), numComponents(numComponents), size(size), memory(&memory), constant(constant) {
+            name(name), componentType(componentType), numComponents(numComponents), size(size), memory(&memory), constant(constant), storedAsHalf(false) {
         if (numComponents == 1)
             type = componentType;
         else {
@@ -412,13 +530,28 @@ public:
     bool isConstant() const {
         return constant;
     }
+    /**
+     * Get whether the values are stored in memory as half precision.  When they are, the
+     * component type must be float, and the interaction kernel converts each value to float
+     * as it loads it.
+     */
+    bool isStoredAsHalf() const {
+        return storedAsHalf;
+    }
+    /**
+     * Set whether the values are stored in memory as half precision.  The size passed to the
+     * constructor is still the size of the expanded value.
+     */
+    void setStoredAsHalf(bool half) {
+        storedAsHalf = half;
+    }
 private:
     std::string name;
     std::string componentType;
     std::string type;
     int size, numComponents;
     cl::Memory* memory;
-    bool constant;
+    bool constant, storedAsHalf;
 };
 
 } // namespace OpenMM
@@ -85,7 +85,9 @@ private:
     std::vector<long long> completionTimes;
     std::vector<double> contextNonbondedFractions;
     std::vector<int> tileCounts;
+    std::vector<cl::Event> positionEvents, forceEvents;
     MetalArray contextForces;
+    bool usePeerTransfers;
     cl::Buffer* pinnedPositionBuffer;
     cl::Buffer* pinnedForceBuffer;
     void* pinnedPositionMemory;
@@ -104,20 +104,30 @@ public:
         static const std::string key = "DisablePmeStream";
         return key;
     }
+    /**
+     * This is the name of the parameter for selecting how many replicas of a system are batched
+     * in one context.
+     */
+    static const std::string& MetalReplicas() {
+        static const std::string key = "Replicas";
+        return key;
+    }
 };
 
 class OPENMM_EXPORT_COMMON MetalPlatform::PlatformData {
 public:
     PlatformData(const System& system, const std::string& platformPropValue, const std::string& deviceIndexProperty, const std::string& precisionProperty,
-            const std::string& cpuPmeProperty, const std::string& pmeStreamProperty, int numThreads, ContextImpl* originalContext);
+            const std::string& cpuPmeProperty, const std::string& pmeStreamProperty, int numThreads, ContextImpl* originalContext,
+            const std::string& replicasProperty="1");
     ~PlatformData();
     void initializeContexts(const System& system);
     void syncContexts();
     ContextImpl* context;
     std::vector<MetalContext*> contexts;
     std::vector<double> contextEnergy;
+    std::vector<int> deviceIndices;
     bool hasInitializedContexts, removeCM, useCpuPme, disablePmeStream;
-    int cmMotionFrequency, computeForceCount;
+    int cmMotionFrequency, computeForceCount, numReplicas;
     long long stepCount;
     double time;
     std::map<std::string, std::string> propertyValues;
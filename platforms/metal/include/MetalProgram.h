@@ -29,6 +29,7 @@
 
 #include "openmm/common/ComputeProgram.h"
 #include "MetalContext.h"
+#include <future>
 
 namespace OpenMM {
 
@@ -45,6 +46,13 @@ public:
      * @param program      the compiled program
      */
     MetalProgram(MetalContext& context, cl::Program program);
+    /**
+     * Create a new MetalProgram whose compilation may still be in progress.
+     * 
+     * @param context      the context this kernel belongs to
+     * @param program      a future that will hold the program once it has been compiled
+     */
+    MetalProgram(MetalContext& context, std::shared_future<cl::Program> program);
     /**
      * Create a ComputeKernel for one of the kernels in this program.
      * 
@@ -53,7 +61,7 @@ public:
     ComputeKernel createKernel(const std::string& name);
 private:
     MetalContext& context;
-    cl::Program program;
+    std::shared_future<cl::Program> program;
 };
 
 } // namespace OpenMM
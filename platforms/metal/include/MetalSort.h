@@ -64,11 +64,36 @@ namespace OpenMM {
  * involves much less communication between host and device, which is critical to get
  * good performance with the array sizes we typically work with (10,000 to 100,000
  * elements).
+ *
+ * For large arrays whose keys are 32 or 64 bit integers or floating point values, a
+ * least significant digit radix sort can be used instead.  It makes one pass per byte of
+ * the key, each consisting of a per-work group digit histogram, a prefix sum, and a
+ * stable scatter.  Its cost does not depend on the distribution of the data, so it is
+ * preferred for very large or strongly clustered arrays.  By default the engine is
+ * selected automatically based on the array size and key type.
  */
     
 class OPENMM_EXPORT_COMMON MetalSort {
 public:
     class SortTrait;
+    /**
+     * The sorting engines that can be used.
+     */
+    enum SortEngine {
+        /**
+         * Select an engine based on the array size and key type.
+         */
+        AutomaticSort,
+        /**
+         * A bucket sort followed by a bitonic sort within each bucket.
+         */
+        BucketSort,
+        /**
+         * An LSD radix sort.  This requires a key type of int, uint, long, ulong, float,
+         * double, or real.
+         */
+        RadixSort
+    };
     /**
      * Create an MetalSort object for sorting data of a particular type.
      *
@@ -81,14 +106,26 @@ public:
      *                   distribution.  This argument is used only as a hint.  It allows parts
      *                   of the algorithm to be tuned for faster performance on the expected
      *                   distribution.
+     * @param engine     the sorting engine to use
      */
-    MetalSort(MetalContext& context, SortTrait* trait, unsigned int length, bool uniform=true);
+    MetalSort(MetalContext& context, SortTrait* trait, unsigned int length, bool uniform=true, SortEngine engine=AutomaticSort);
     ~MetalSort();
     /**
      * Sort an array.
      */
     void sort(MetalArray& data);
+    /**
+     * Get the engine used for sorting.  This is never AutomaticSort.
+     */
+    SortEngine getEngine() const {
+        return (useRadixSort ? RadixSort : BucketSort);
+    }
+    /**
+     * Get whether the radix sort engine can be used with a particular trait.
+     */
+    static bool supportsRadixSort(const SortTrait& trait);
 private:
+    void radixSort(MetalArray& data);
     MetalContext& context;
     SortTrait* trait;
     MetalArray dataRange;
@@ -96,9 +133,12 @@ private:
     MetalArray offsetInBucket;
     MetalArray bucketOffset;
     MetalArray buckets;
+    MetalArray digitOffsets;
     cl::Kernel shortListKernel, shortList2Kernel, computeRangeKernel, assignElementsKernel, computeBucketPositionsKernel, copyToBucketsKernel, sortBucketsKernel;
+    cl::Kernel digitHistogramsKernel, digitOffsetsKernel, scatterKernel;
     unsigned int dataLength, rangeKernelSize, positionsKernelSize, sortKernelSize;
-    bool isShortList, useShortList2, uniform;
+    unsigned int radixGroupSize, radixNumGroups, radixElementsPerGroup;
+    bool isShortList, useShortList2, uniform, useRadixSort;
 };
 
 /**
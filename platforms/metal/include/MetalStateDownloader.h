@@ -0,0 +1,120 @@
+#ifndef OPENMM_METALSTATEDOWNLOADER_H_
+#define OPENMM_METALSTATEDOWNLOADER_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#include "openmm/Vec3.h"
+#include "openmm/common/windowsExportCommon.h"
+#include "openmm/common/ComputeVectorTypes.h"
+#include "../src/opencl.hpp"
+#include <vector>
+
+namespace OpenMM {
+
+class MetalContext;
+
+/**
+ * This class takes snapshots of a simulation's state without stalling it.  startSnapshot()
+ * enqueues copies of the device arrays into pinned staging memory and returns immediately, so
+ * the caller can keep integrating while the copy completes.  finishSnapshot() later waits for
+ * the copy and converts the data to the form State uses, dividing the work among the
+ * platform's threads.
+ * <p>
+ * There are two staging buffers, so a second snapshot can be started before the first one has
+ * been finished.  Snapshots are finished in the order they were started.
+ */
+
+class OPENMM_EXPORT_COMMON MetalStateDownloader {
+public:
+    /**
+     * The kinds of data a snapshot can include.  These may be combined with bitwise OR.
+     */
+    enum DataType {
+        Positions = 1,
+        Velocities = 2,
+        Forces = 4
+    };
+    /**
+     * The state of the simulation at the time a snapshot was started.  Vectors are ordered
+     * by the original particle index, and only contain the data that was requested.
+     */
+    struct Snapshot {
+        double time;
+        long long stepCount;
+        Vec3 boxVectors[3];
+        std::vector<Vec3> positions, velocities, forces;
+    };
+    MetalStateDownloader(MetalContext& context);
+    ~MetalStateDownloader();
+    /**
+     * Start taking a snapshot of the current state.  This enqueues the copies and returns
+     * without waiting for them.  Forces are the ones from the most recent force evaluation.
+     *
+     * @param types    the data to include, as a combination of DataType values
+     */
+    void startSnapshot(int types);
+    /**
+     * Get the number of snapshots that have been started but not yet finished.
+     */
+    int getNumPendingSnapshots() const {
+        return numPending;
+    }
+    /**
+     * Get whether the copies for the oldest pending snapshot have completed, so
+     * finishSnapshot() will not need to wait for the device.
+     */
+    bool isSnapshotReady() const;
+    /**
+     * Finish the oldest pending snapshot, blocking until its copies have completed.
+     *
+     * @param snapshot    on exit, the contents of the snapshot
+     */
+    void finishSnapshot(Snapshot& snapshot);
+private:
+    struct Slot {
+        cl::Buffer* buffer;
+        char* memory;
+        size_t size;
+        int types;
+        double time;
+        long long stepCount;
+        Vec3 boxVectors[3];
+        std::vector<int> order;
+        std::vector<mm_int4> cellOffsets;
+        std::vector<cl::Event> events;
+    };
+    MetalContext& context;
+    Slot slots[2];
+    int firstPending, numPending;
+};
+
+} // namespace OpenMM
+
+#endif /*OPENMM_METALSTATEDOWNLOADER_H_*/
@@ -0,0 +1,161 @@
+#ifndef OPENMM_METALTRAJECTORYBUFFER_H_
+#define OPENMM_METALTRAJECTORYBUFFER_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#include "MetalArray.h"
+#include "openmm/Vec3.h"
+#include "openmm/common/ComputeVectorTypes.h"
+#include <vector>
+
+namespace OpenMM {
+
+/**
+ * This class records the positions of selected atoms into a ring buffer in device memory at
+ * regular intervals, so high frequency trajectory output does not need a download every time
+ * a frame is written.  It is created with MetalContext::createTrajectoryBuffer(), and the
+ * context owns it.
+ * <p>
+ * A frame is captured by a kernel launched after the forces are computed on any step that is
+ * a multiple of the interval.  The host only records the step count, time, and box vectors
+ * of each frame.  Call getFrames() to download every frame captured since the last call in
+ * one batch.  If more frames are captured than the buffer can hold, the oldest ones are
+ * overwritten and counted by getNumDroppedFrames().
+ * <p>
+ * Frames are stored either as single precision coordinates, with periodic images unwrapped
+ * the same way getState() does, or quantized to 16 bit fixed point fractions of the periodic
+ * box vectors.  Quantized frames take half the memory and are wrapped into the periodic box,
+ * with a resolution of 1/65536 of each box vector.
+ */
+
+class OPENMM_EXPORT_COMMON MetalTrajectoryBuffer {
+public:
+    class Frame;
+    class CapturePostComputation;
+    class CellOffsetListener;
+    /**
+     * Create a trajectory buffer.  Use MetalContext::createTrajectoryBuffer() instead of
+     * calling this directly.
+     *
+     * @param context     the context whose positions are recorded
+     * @param atoms       the original indices of the atoms to record, in the order they should appear in each frame
+     * @param interval    the number of steps between frames
+     * @param capacity    the maximum number of frames held on the device
+     * @param quantize    if true, store coordinates as 16 bit fractions of the box vectors
+     */
+    MetalTrajectoryBuffer(MetalContext& context, const std::vector<int>& atoms, int interval, int capacity, bool quantize);
+    /**
+     * Get the number of steps between frames.
+     */
+    int getInterval() const {
+        return interval;
+    }
+    /**
+     * Get the maximum number of frames held on the device.
+     */
+    int getCapacity() const {
+        return capacity;
+    }
+    /**
+     * Get whether coordinates are quantized.
+     */
+    bool getQuantize() const {
+        return quantize;
+    }
+    /**
+     * Get the number of frames that have been captured but not yet retrieved.
+     */
+    int getNumFrames() const {
+        return numFrames;
+    }
+    /**
+     * Get the number of frames that were overwritten before they could be retrieved.
+     */
+    long long getNumDroppedFrames() const {
+        return numDroppedFrames;
+    }
+    /**
+     * Set whether frames are captured.  This can be used to pause recording without discarding
+     * the frames already in the buffer.
+     */
+    void setEnabled(bool enabled) {
+        this->enabled = enabled;
+    }
+    /**
+     * Get whether frames are captured.
+     */
+    bool isEnabled() const {
+        return enabled;
+    }
+    /**
+     * Capture a frame now, regardless of the current step.  This is normally called
+     * automatically, but may be used to record a frame at an arbitrary point.
+     */
+    void captureFrame();
+    /**
+     * Download every frame captured since the last call, oldest first, and remove them from
+     * the buffer.
+     *
+     * @param frames    on exit, the frames that were retrieved
+     */
+    void getFrames(std::vector<Frame>& frames);
+private:
+    struct FrameInfo {
+        long long stepCount;
+        double time;
+        Vec3 boxVectors[3];
+    };
+    MetalContext& context;
+    int numAtoms, interval, capacity;
+    bool quantize, enabled;
+    int nextFrame, numFrames;
+    long long numDroppedFrames, lastCapturedStep;
+    std::vector<FrameInfo> frameInfo;
+    std::vector<mm_int4> cellOffsets;
+    MetalArray selection;
+    MetalArray deviceCellOffsets;
+    MetalArray frameData;
+    cl::Kernel recordKernel;
+};
+
+/**
+ * A frame retrieved from a MetalTrajectoryBuffer.
+ */
+class MetalTrajectoryBuffer::Frame {
+public:
+    long long stepCount;
+    double time;
+    Vec3 boxVectors[3];
+    /**
+     * The positions of the recorded atoms, in the order they were specified.
+     */
+    std::vector<Vec3> positions;
+};
+
+} // namespace OpenMM
+
+#endif /*OPENMM_METALTRAJECTORYBUFFER_H_*/
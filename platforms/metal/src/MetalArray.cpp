@@ -45,7 +45,7 @@ MetalArray::MetalArray(MetalContext& context, cl::Buffer* buffer, size_t size, i
 
 MetalArray::~MetalArray() {
     if (buffer != NULL && ownsBuffer)
-        delete buffer;
+        context->getBufferPool().release(buffer, flags, capacity);
 }
 
 void MetalArray::initialize(ComputeContext& context, size_t size, int elementSize, const std::string& name) {
@@ -62,7 +62,7 @@ void MetalArray::initialize(MetalContext& context, size_t size, int elementSize,
     this->flags = flags;
     ownsBuffer = true;
     try {
-        buffer = new cl::Buffer(context.getContext(), flags, size*elementSize);
+        buffer = context.getBufferPool().allocate(size*elementSize, flags, capacity);
     }
     catch (cl::Error err) {
         std::stringstream str;
@@ -87,7 +87,7 @@ void MetalArray::resize(size_t size) {
         throw OpenMMException("MetalArray has not been initialized");
     if (!ownsBuffer)
         throw OpenMMException("Cannot resize an array that does not own its storage");
-    delete buffer;
+    context->getBufferPool().release(buffer, flags, capacity);
     buffer = NULL;
     initialize(*context, size, elementSize, name, flags);
 }
@@ -0,0 +1,115 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#include "MetalBufferPool.h"
+#include <algorithm>
+
+using namespace OpenMM;
+using namespace std;
+
+MetalBufferPool::MetalBufferPool(cl::Context& context) : context(context), enabled(true), liveBytes(0), peakLiveBytes(0),
+        cachedBytes(0), numDriverAllocations(0), numRecycledAllocations(0) {
+}
+
+MetalBufferPool::~MetalBufferPool() {
+    trim();
+}
+
+size_t MetalBufferPool::getSizeClass(size_t bytes) {
+    if (bytes <= 4096)
+        return max((size_t) 256, ((bytes+255)/256)*256);
+    size_t octave = 4096;
+    while (octave*2 < bytes)
+        octave *= 2;
+    size_t step = octave/8;
+    return ((bytes+step-1)/step)*step;
+}
+
+cl::Buffer* MetalBufferPool::allocate(size_t bytes, cl_int flags, size_t& capacity) {
+    unique_lock<mutex> guard(lock);
+    cl::Buffer* buffer = NULL;
+    capacity = (enabled ? getSizeClass(bytes) : bytes);
+    if (enabled) {
+        auto pool = freeBuffers.find(make_pair(flags, capacity));
+        if (pool != freeBuffers.end() && !pool->second.empty()) {
+            buffer = pool->second.back();
+            pool->second.pop_back();
+            cachedBytes -= capacity;
+            numRecycledAllocations++;
+        }
+    }
+    if (buffer == NULL) {
+        try {
+            buffer = new cl::Buffer(context, flags, capacity);
+        }
+        catch (cl::Error err) {
+            // The driver may be out of memory because of buffers held by the pool.  Release
+            // them and try again.
+
+            if (cachedBytes == 0)
+                throw;
+            guard.unlock();
+            trim();
+            guard.lock();
+            buffer = new cl::Buffer(context, flags, capacity);
+        }
+        numDriverAllocations++;
+    }
+    liveBytes += capacity;
+    peakLiveBytes = max(peakLiveBytes, liveBytes);
+    return buffer;
+}
+
+void MetalBufferPool::release(cl::Buffer* buffer, cl_int flags, size_t capacity) {
+    unique_lock<mutex> guard(lock);
+    liveBytes -= capacity;
+
+    // Cached buffers are limited to a quarter of the peak footprint, so memory that is
+    // no longer needed (such as the old storage of an array that grew) is eventually
+    // returned to the system.
+
+    if (!enabled || cachedBytes+capacity > max((size_t) 16*1024*1024, peakLiveBytes/4)) {
+        delete buffer;
+        return;
+    }
+    freeBuffers[make_pair(flags, capacity)].push_back(buffer);
+    cachedBytes += capacity;
+}
+
+void MetalBufferPool::setEnabled(bool enabled) {
+    this->enabled = enabled;
+    if (!enabled)
+        trim();
+}
+
+void MetalBufferPool::trim() {
+    unique_lock<mutex> guard(lock);
+    for (auto& pool : freeBuffers)
+        for (cl::Buffer* buffer : pool.second)
+            delete buffer;
+    freeBuffers.clear();
+    cachedBytes = 0;
+}
@@ -0,0 +1,231 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#include "MetalCheckpoint.h"
+#include "MetalContext.h"
+#include "openmm/OpenMMException.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <istream>
+#include <ostream>
+
+using namespace OpenMM;
+using namespace std;
+
+MetalCheckpoint::MetalCheckpoint() : stagingBuffer(NULL), stagingMemory(NULL), stagingSize(0), baseId(0), incrementalCount(0), writingIncremental(false) {
+}
+
+MetalCheckpoint::~MetalCheckpoint() {
+    if (stagingBuffer != NULL)
+        delete stagingBuffer;
+}
+
+char* MetalCheckpoint::getStagingMemory(MetalContext& context, size_t size) {
+    if (size > stagingSize) {
+        if (stagingBuffer != NULL)
+            delete stagingBuffer;
+        stagingBuffer = new cl::Buffer(context.getContext(), CL_MEM_ALLOC_HOST_PTR, size);
+        stagingMemory = (char*) context.getQueue().enqueueMapBuffer(*stagingBuffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size);
+        stagingSize = size;
+    }
+    return stagingMemory;
+}
+
+bool MetalCheckpoint::isNextIncremental(int incrementalCheckpoints) const {
+    return (baseId != 0 && incrementalCount < incrementalCheckpoints);
+}
+
+void MetalCheckpoint::beginWrite(bool incremental) {
+    writingIncremental = incremental;
+    pendingSections.clear();
+}
+
+void MetalCheckpoint::writeSection(ostream& stream, Section section, const char* data, size_t size, int wordSize, int elementSize) {
+    map<int, vector<char> >::const_iterator base = baseSections.find(section);
+    bool hasBase = (writingIncremental && base != baseSections.end() && base->second.size() == size);
+    bool canCompress = (wordSize > 0 && size%wordSize == 0 && elementSize%wordSize == 0);
+    int encoding;
+    vector<char> encoded;
+    if (hasBase && memcmp(data, &base->second[0], size) == 0)
+        encoding = Unchanged;
+    else if (hasBase && canCompress) {
+        encoding = XorBase;
+        encodeXor(data, &base->second[0], size, wordSize, elementSize, encoded);
+    }
+    else if (canCompress) {
+        encoding = XorPrevious;
+        encodeXor(data, NULL, size, wordSize, elementSize, encoded);
+    }
+    else {
+        encoding = Raw;
+        encoded.assign(data, data+size);
+    }
+    int sectionId = section;
+    long long rawSize = size;
+    long long encodedSize = encoded.size();
+    stream.write((char*) &sectionId, sizeof(int));
+    stream.write((char*) &encoding, sizeof(int));
+    stream.write((char*) &wordSize, sizeof(int));
+    stream.write((char*) &elementSize, sizeof(int));
+    stream.write((char*) &rawSize, sizeof(long long));
+    stream.write((char*) &encodedSize, sizeof(long long));
+    if (encodedSize > 0)
+        stream.write(&encoded[0], encodedSize);
+    if (!writingIncremental)
+        pendingSections[section].assign(data, data+size);
+}
+
+void MetalCheckpoint::endWrite(ostream& stream, long long id) {
+    int end = EndOfSections;
+    stream.write((char*) &end, sizeof(int));
+    if (writingIncremental)
+        incrementalCount++;
+    else {
+        baseSections.swap(pendingSections);
+        baseId = id;
+        incrementalCount = 0;
+    }
+    pendingSections.clear();
+}
+
+void MetalCheckpoint::readSections(istream& stream, long long id, long long baseId, map<int, vector<char> >& sections) {
+    if (baseId != 0 && baseId != this->baseId)
+        throw OpenMMException("This incremental checkpoint can only be loaded after the full checkpoint it is based on");
+    sections.clear();
+    while (true) {
+        int sectionId;
+        stream.read((char*) &sectionId, sizeof(int));
+        if (!stream)
+            throw OpenMMException("Checkpoint is truncated");
+        if (sectionId == EndOfSections)
+            break;
+        int encoding, wordSize, elementSize;
+        long long rawSize, encodedSize;
+        stream.read((char*) &encoding, sizeof(int));
+        stream.read((char*) &wordSize, sizeof(int));
+        stream.read((char*) &elementSize, sizeof(int));
+        stream.read((char*) &rawSize, sizeof(long long));
+        stream.read((char*) &encodedSize, sizeof(long long));
+        vector<char> encoded(encodedSize);
+        if (encodedSize > 0)
+            stream.read(&encoded[0], encodedSize);
+        if (!stream)
+            throw OpenMMException("Checkpoint is truncated");
+        vector<char>& data = sections[sectionId];
+        data.resize(rawSize);
+        const char* reference = NULL;
+        if (encoding == Unchanged || encoding == XorBase) {
+            map<int, vector<char> >::const_iterator base = baseSections.find(sectionId);
+            if (base == baseSections.end() || base->second.size() != rawSize)
+                throw OpenMMException("Incremental checkpoint does not match its base checkpoint");
+            reference = &base->second[0];
+        }
+        if (rawSize == 0)
+            continue;
+        if (encoding == Raw) {
+            if (encodedSize != rawSize)
+                throw OpenMMException("Checkpoint is corrupted");
+            memcpy(&data[0], &encoded[0], rawSize);
+        }
+        else if (encoding == Unchanged)
+            memcpy(&data[0], reference, rawSize);
+        else if (encoding == XorPrevious || encoding == XorBase)
+            decodeXor(encoded.size() == 0 ? NULL : &encoded[0], encodedSize, reference, rawSize, wordSize, elementSize, &data[0]);
+        else
+            throw OpenMMException("Checkpoint contains an unknown section encoding");
+    }
+    if (baseId == 0) {
+        baseSections = sections;
+        this->baseId = id;
+        incrementalCount = 0;
+    }
+}
+
+long long MetalCheckpoint::createId() {
+    static atomic<long long> counter(0);
+    long long id = chrono::high_resolution_clock::now().time_since_epoch().count()*1009+(++counter);
+    return (id == 0 ? 1 : id);
+}
+
+void MetalCheckpoint::encodeXor(const char* data, const char* reference, size_t size, int wordSize, int elementSize, vector<char>& encoded) {
+    // Words are processed in pairs.  Each pair starts with a byte holding the number of
+    // significant bytes in each word (one per nibble), followed by those bytes in little endian
+    // order.  This assumes a little endian host, which is true of every device the Metal
+    // platform runs on.
+
+    size_t numWords = size/wordSize;
+    encoded.reserve(encoded.size()+size/2);
+    for (size_t i = 0; i < numWords; i += 2) {
+        size_t codePosition = encoded.size();
+        encoded.push_back(0);
+        unsigned char code = 0;
+        for (size_t j = i; j < i+2 && j < numWords; j++) {
+            size_t offset = j*wordSize;
+            unsigned char bytes[8];
+            for (int k = 0; k < wordSize; k++) {
+                unsigned char ref = 0;
+                if (reference != NULL)
+                    ref = reference[offset+k];
+                else if (offset >= elementSize)
+                    ref = data[offset+k-elementSize];
+                bytes[k] = (unsigned char) data[offset+k]^ref;
+            }
+            int significant = wordSize;
+            while (significant > 0 && bytes[significant-1] == 0)
+                significant--;
+            code |= significant<<(4*(j-i));
+            encoded.insert(encoded.end(), (char*) bytes, (char*) bytes+significant);
+        }
+        encoded[codePosition] = code;
+    }
+}
+
+void MetalCheckpoint::decodeXor(const char* encoded, size_t encodedSize, const char* reference, size_t size, int wordSize, int elementSize, char* data) {
+    size_t numWords = size/wordSize;
+    size_t position = 0;
+    for (size_t i = 0; i < numWords; i += 2) {
+        if (position >= encodedSize)
+            throw OpenMMException("Checkpoint is corrupted");
+        unsigned char code = encoded[position++];
+        for (size_t j = i; j < i+2 && j < numWords; j++) {
+            size_t offset = j*wordSize;
+            int significant = (code>>(4*(j-i)))&15;
+            if (significant > wordSize || position+significant > encodedSize)
+                throw OpenMMException("Checkpoint is corrupted");
+            for (int k = 0; k < wordSize; k++) {
+                unsigned char value = (k < significant ? (unsigned char) encoded[position+k] : 0);
+                unsigned char ref = 0;
+                if (reference != NULL)
+                    ref = reference[offset+k];
+                else if (offset >= elementSize)
+                    ref = data[offset+k-elementSize];
+                data[offset+k] = (char) (value^ref);
+            }
+            position += significant;
+        }
+    }
+}
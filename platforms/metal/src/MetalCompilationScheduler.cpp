@@ -0,0 +1,75 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#include "MetalCompilationScheduler.h"
+#include <algorithm>
+
+using namespace OpenMM;
+using namespace std;
+
+MetalCompilationScheduler::MetalCompilationScheduler(int numThreads) : isDeleted(false) {
+    for (int i = 0; i < max(1, numThreads); i++)
+        workers.push_back(thread(&MetalCompilationScheduler::runWorker, this));
+}
+
+MetalCompilationScheduler::~MetalCompilationScheduler() {
+    {
+        unique_lock<mutex> lock(queueLock);
+        isDeleted = true;
+    }
+    queueCondition.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+shared_future<cl::Program> MetalCompilationScheduler::submit(function<cl::Program()> build) {
+    packaged_task<cl::Program()> task(build);
+    shared_future<cl::Program> result = task.get_future().share();
+    {
+        unique_lock<mutex> lock(queueLock);
+        tasks.push_back(move(task));
+    }
+    queueCondition.notify_one();
+    return result;
+}
+
+void MetalCompilationScheduler::runWorker() {
+    while (true) {
+        packaged_task<cl::Program()> task;
+        {
+            // Wait for a build to be submitted.  Any builds still in the queue are
+            // completed before the worker exits.
+
+            unique_lock<mutex> lock(queueLock);
+            queueCondition.wait(lock, [this] () { return isDeleted || !tasks.empty(); });
+            if (tasks.empty())
+                return;
+            task = move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
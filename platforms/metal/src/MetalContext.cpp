@@ -31,23 +31,33 @@
 #include "MetalContext.h"
 #include "MetalArray.h"
 #include "MetalBondedUtilities.h"
+#include "MetalCompilationScheduler.h"
 #include "MetalEvent.h"
 #include "MetalForceInfo.h"
 #include "MetalIntegrationUtilities.h"
 #include "MetalKernelSources.h"
 #include "MetalNonbondedUtilities.h"
 #include "MetalProgram.h"
+#include "MetalStateDownloader.h"
+#include "MetalTrajectoryBuffer.h"
 #include "openmm/common/ComputeArray.h"
 #include "openmm/Platform.h"
 #include "openmm/System.h"
 #include "openmm/VirtualSite.h"
 #include "openmm/internal/ContextImpl.h"
+#include "SHA1.h"
+#include "hilbert.h"
 #include <algorithm>
+#include <cstdio>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <set>
 #include <sstream>
 #include <typeinfo>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace OpenMM;
 using namespace std;
@@ -62,6 +72,9 @@ using namespace std;
 const int MetalContext::ThreadBlockSize = 64;
 const int MetalContext::TileSize = 32;
 
+// The number of buffer arguments of the clearAutoclearBuffers kernel.
+static const int MaxAutoclearBuffersPerKernel = 16;
+
 static void CL_CALLBACK errorCallback(const char* errinfo, const void* private_info, size_t cb, void* user_data) {
     string skip = "Metal Build Warning : Compiler build log:";
     if (strncmp(errinfo, skip.c_str(), skip.length()) == 0)
@@ -105,9 +118,277 @@ inline bool is_valid_int(const char *str) {
    return true;
 }
 
+/**
+ * Interleave the bits of three coordinates to get a position along a Morton curve.
+ */
+static bitmask_t getMortonIndex(const bitmask_t coords[3], int bits) {
+    bitmask_t index = 0;
+    for (int i = 0; i < bits; i++)
+        for (int j = 0; j < 3; j++)
+            index |= ((coords[j]>>i)&1)<<(3*i+j);
+    return index;
+}
+
+/**
+ * This is the first reorder listener.  After ComputeContext reorders the atoms, it sorts the
+ * instances of each molecule group along a space-filling curve instead, if one has been requested.
+ * The molecule centers are computed and the arrays are permuted on the device, so only one
+ * position per molecule is downloaded.
+ *
+ * When replicas are batched, ComputeContext may swap identical molecules from different replicas.
+ * Instances are then sorted by the replica they came from first, which moves every molecule back
+ * into its own replica's atoms.
+ */
+class MetalContext::MoleculeReorderListener : public ComputeContext::ReorderListener {
+public:
+    MoleculeReorderListener(MetalContext& context) : context(context), numMolecules(0), hasInitialized(false) {
+    }
+    void execute() {
+        bool batched = (context.getNumReplicas() > 1);
+        if ((context.atomOrder == MoleculeOrder && !batched) || context.getPlatformData().contexts.size() > 1)
+            return;
+        if (!hasInitialized)
+            initialize();
+        updateMolecules();
+        if (numMolecules == 0)
+            return;
+
+        // Find where each molecule lies along the curve.  In molecule order, keep the order
+        // ComputeContext chose.
+
+        vector<bitmask_t> curveIndex(numMolecules);
+        if (context.atomOrder == MoleculeOrder) {
+            int molecule = 0;
+            for (auto& group : context.moleculeGroups)
+                for (int offset : group.offsets)
+                    curveIndex[molecule++] = offset;
+        }
+        else {
+            context.executeKernel(computeCentersKernel, numMolecules);
+            vector<Vec3> centers(numMolecules);
+            if (context.getUseDoublePrecision()) {
+                vector<mm_double4> values;
+                moleculeCenters.download(values);
+                for (int i = 0; i < numMolecules; i++)
+                    centers[i] = Vec3(values[i].x, values[i].y, values[i].z);
+            }
+            else {
+                vector<mm_float4> values;
+                moleculeCenters.download(values);
+                for (int i = 0; i < numMolecules; i++)
+                    centers[i] = Vec3(values[i].x, values[i].y, values[i].z);
+            }
+            computeCurveIndices(centers, curveIndex);
+        }
+
+        // Sort the instances of each molecule group, and find which old index each atom moves from.
+
+        int paddedNumAtoms = context.getPaddedNumAtoms();
+        int replicaSize = context.getNumAtoms()/context.getNumReplicas();
+        vector<cl_int> source(paddedNumAtoms);
+        for (int i = 0; i < paddedNumAtoms; i++)
+            source[i] = i;
+        int firstMolecule = 0;
+        bool changed = false;
+        for (auto& group : context.moleculeGroups) {
+            int numInstances = group.offsets.size();
+            vector<pair<pair<int, bitmask_t>, int> > sorted(numInstances);
+            for (int i = 0; i < numInstances; i++) {
+                int replica = context.atomIndex[group.offsets[i]+group.atoms[0]]/replicaSize;
+                sorted[i] = make_pair(make_pair(replica, curveIndex[firstMolecule+i]), i);
+            }
+            sort(sorted.begin(), sorted.end());
+            vector<int> slots = group.offsets;
+            sort(slots.begin(), slots.end());
+            for (int i = 0; i < numInstances; i++)
+                for (int atom : group.atoms) {
+                    source[slots[i]+atom] = group.offsets[sorted[i].second]+atom;
+                    changed |= (source[slots[i]+atom] != slots[i]+atom);
+                }
+            firstMolecule += numInstances;
+        }
+        if (!changed)
+            return;
+
+        // Permute the arrays.
+
+        sourceIndex.upload(source);
+        context.executeKernel(applyOrderKernel, paddedNumAtoms);
+        newPosq.copyTo(context.getPosq());
+        newVelm.copyTo(context.getVelm());
+        if (context.getUseMixedPrecision())
+            newPosqCorrection.copyTo(context.getPosqCorrection());
+        vector<int> newAtomIndex(paddedNumAtoms);
+        vector<mm_int4> newCellOffsets(paddedNumAtoms);
+        for (int i = 0; i < paddedNumAtoms; i++) {
+            newAtomIndex[i] = context.atomIndex[source[i]];
+            newCellOffsets[i] = context.posCellOffsets[source[i]];
+        }
+        context.atomIndex = newAtomIndex;
+        context.posCellOffsets = newCellOffsets;
+        context.atomIndexDevice.upload(context.atomIndex);
+    }
+private:
+    void initialize() {
+        hasInitialized = true;
+        int paddedNumAtoms = context.getPaddedNumAtoms();
+        MetalArray& posq = context.getPosq();
+        MetalArray& velm = context.getVelm();
+        sourceIndex.initialize<cl_int>(context, paddedNumAtoms, "sourceIndex");
+        newPosq.initialize(context, paddedNumAtoms, posq.getElementSize(), "newPosq");
+        newVelm.initialize(context, paddedNumAtoms, velm.getElementSize(), "newVelm");
+        cl::Program program = context.createProgram(MetalKernelSources::reorderAtoms);
+        computeCentersKernel = cl::Kernel(program, "computeMoleculeCenters");
+        applyOrderKernel = cl::Kernel(program, "applyAtomOrder");
+        applyOrderKernel.setArg<cl_int>(0, paddedNumAtoms);
+        applyOrderKernel.setArg<cl::Buffer>(1, sourceIndex.getDeviceBuffer());
+        applyOrderKernel.setArg<cl::Buffer>(2, posq.getDeviceBuffer());
+        applyOrderKernel.setArg<cl::Buffer>(3, newPosq.getDeviceBuffer());
+        applyOrderKernel.setArg<cl::Buffer>(4, velm.getDeviceBuffer());
+        applyOrderKernel.setArg<cl::Buffer>(5, newVelm.getDeviceBuffer());
+        if (context.getUseMixedPrecision()) {
+            MetalArray& posqCorrection = context.getPosqCorrection();
+            newPosqCorrection.initialize(context, paddedNumAtoms, posqCorrection.getElementSize(), "newPosqCorrection");
+            applyOrderKernel.setArg<cl::Buffer>(6, posqCorrection.getDeviceBuffer());
+            applyOrderKernel.setArg<cl::Buffer>(7, newPosqCorrection.getDeviceBuffer());
+        }
+    }
+    void updateMolecules() {
+        // Record the atoms in each molecule, in the same order as moleculeGroups.  The groups
+        // are rebuilt if a force's parameters change, so check whether they are still the same.
+
+        vector<cl_int> startIndex(1, 0), atoms;
+        for (auto& group : context.moleculeGroups)
+            for (int offset : group.offsets) {
+                for (int atom : group.atoms)
+                    atoms.push_back(offset+atom);
+                startIndex.push_back(atoms.size());
+            }
+        if (startIndex == lastStartIndex && atoms == lastAtoms)
+            return;
+        lastStartIndex = startIndex;
+        lastAtoms = atoms;
+        numMolecules = startIndex.size()-1;
+        if (numMolecules == 0)
+            return;
+        if (moleculeStartIndex.isInitialized()) {
+            moleculeStartIndex.resize(startIndex.size());
+            moleculeAtoms.resize(atoms.size());
+            moleculeCenters.resize(numMolecules);
+        }
+        else {
+            moleculeStartIndex.initialize<cl_int>(context, startIndex.size(), "moleculeStartIndex");
+            moleculeAtoms.initialize<cl_int>(context, atoms.size(), "moleculeAtoms");
+            moleculeCenters.initialize(context, numMolecules, context.getPosq().getElementSize(), "moleculeCenters");
+        }
+        moleculeStartIndex.upload(startIndex);
+        moleculeAtoms.upload(atoms);
+        computeCentersKernel.setArg<cl_int>(0, numMolecules);
+        computeCentersKernel.setArg<cl::Buffer>(1, moleculeStartIndex.getDeviceBuffer());
+        computeCentersKernel.setArg<cl::Buffer>(2, moleculeAtoms.getDeviceBuffer());
+        computeCentersKernel.setArg<cl::Buffer>(3, context.getPosq().getDeviceBuffer());
+        computeCentersKernel.setArg<cl::Buffer>(4, moleculeCenters.getDeviceBuffer());
+    }
+    void computeCurveIndices(const vector<Vec3>& centers, vector<bitmask_t>& curveIndex) {
+        // Map each center to integer coordinates.  With periodic boundary conditions, the curve
+        // fills the periodic box.  Otherwise it fills a cube around all the molecules.
+
+        const int bits = 10;
+        const int maxCoord = (1<<bits)-1;
+        bool periodic = context.getNonbondedUtilities().getUsePeriodic();
+        Vec3 a, b, c;
+        context.getPeriodicBoxVectors(a, b, c);
+        Vec3 minPos = centers[0], maxPos = centers[0];
+        for (const Vec3& center : centers)
+            for (int j = 0; j < 3; j++) {
+                minPos[j] = min(minPos[j], center[j]);
+                maxPos[j] = max(maxPos[j], center[j]);
+            }
+        double width = max(max(maxPos[0]-minPos[0], maxPos[1]-minPos[1]), maxPos[2]-minPos[2]);
+        if (width == 0.0)
+            width = 1.0;
+        for (int i = 0; i < numMolecules; i++) {
+            Vec3 scaled;
+            if (periodic) {
+                Vec3 pos = centers[i];
+                pos -= c*floor(pos[2]/c[2]);
+                pos -= b*floor(pos[1]/b[1]);
+                pos -= a*floor(pos[0]/a[0]);
+                scaled = Vec3(pos[0]/a[0], pos[1]/b[1], pos[2]/c[2]);
+            }
+            else
+                scaled = (centers[i]-minPos)/width;
+            bitmask_t coords[3];
+            for (int j = 0; j < 3; j++)
+                coords[j] = (bitmask_t) min(maxCoord, max(0, (int) (scaled[j]*(maxCoord+1))));
+            if (context.atomOrder == HilbertOrder)
+                curveIndex[i] = hilbert_c2i(3, bits, coords);
+            else
+                curveIndex[i] = getMortonIndex(coords, bits);
+        }
+    }
+    MetalContext& context;
+    int numMolecules;
+    bool hasInitialized;
+    vector<cl_int> lastStartIndex, lastAtoms;
+    MetalArray moleculeStartIndex, moleculeAtoms, moleculeCenters, sourceIndex;
+    MetalArray newPosq, newVelm, newPosqCorrection;
+    cl::Kernel computeCentersKernel, applyOrderKernel;
+};
+
+/**
+ * With float-float precision, ComputeContext does not know about posqCorrection and velmCorrection,
+ * so they are not permuted along with posq and velm.  This listener compares the atom order to
+ * the one the corrections were last permuted to and applies the difference on the device.
+ */
+class MetalContext::CorrectionReorderListener : public ComputeContext::ReorderListener {
+public:
+    CorrectionReorderListener(MetalContext& context) : context(context), lastAtomIndex(context.atomIndex) {
+        int paddedNumAtoms = context.getPaddedNumAtoms();
+        MetalArray& posqCorrection = context.getPosqCorrection();
+        MetalArray& velmCorrection = context.getVelmCorrection();
+        sourceIndex.initialize<cl_int>(context, paddedNumAtoms, "correctionSourceIndex");
+        newPosqCorrection.initialize(context, paddedNumAtoms, posqCorrection.getElementSize(), "newPosqCorrection");
+        newVelmCorrection.initialize(context, paddedNumAtoms, velmCorrection.getElementSize(), "newVelmCorrection");
+        cl::Program program = context.createProgram(MetalKernelSources::reorderAtoms);
+        applyOrderKernel = cl::Kernel(program, "applyAtomOrder");
+        applyOrderKernel.setArg<cl_int>(0, paddedNumAtoms);
+        applyOrderKernel.setArg<cl::Buffer>(1, sourceIndex.getDeviceBuffer());
+        applyOrderKernel.setArg<cl::Buffer>(2, posqCorrection.getDeviceBuffer());
+        applyOrderKernel.setArg<cl::Buffer>(3, newPosqCorrection.getDeviceBuffer());
+        applyOrderKernel.setArg<cl::Buffer>(4, velmCorrection.getDeviceBuffer());
+        applyOrderKernel.setArg<cl::Buffer>(5, newVelmCorrection.getDeviceBuffer());
+    }
+    void execute() {
+        const vector<int>& atomIndex = context.atomIndex;
+        if (atomIndex == lastAtomIndex)
+            return;
+        int paddedNumAtoms = context.getPaddedNumAtoms();
+        vector<cl_int> lastPosition(paddedNumAtoms), source(paddedNumAtoms);
+        for (int i = 0; i < paddedNumAtoms; i++)
+            lastPosition[lastAtomIndex[i]] = i;
+        for (int i = 0; i < paddedNumAtoms; i++)
+            source[i] = lastPosition[atomIndex[i]];
+        sourceIndex.upload(source);
+        context.executeKernel(applyOrderKernel, paddedNumAtoms);
+        newPosqCorrection.copyTo(context.getPosqCorrection());
+        newVelmCorrection.copyTo(context.getVelmCorrection());
+        lastAtomIndex = atomIndex;
+    }
+    void resetOrder() {
+        lastAtomIndex = context.atomIndex;
+    }
+private:
+    MetalContext& context;
+    vector<int> lastAtomIndex;
+    MetalArray sourceIndex, newPosqCorrection, newVelmCorrection;
+    cl::Kernel applyOrderKernel;
+};
+
 MetalContext::MetalContext(const System& system, int platformIndex, int deviceIndex, const string& precision, MetalPlatform::PlatformData& platformData, MetalContext* originalContext) :
-        ComputeContext(system), platformData(platformData), numForceBuffers(0), enableKernelProfiling(false), hasAssignedPosqCharges(false),
-        integration(NULL), expression(NULL), bonded(NULL), nonbonded(NULL), pinnedBuffer(NULL), profileStartTime(0) {
+        ComputeContext(system), platformData(platformData), numForceBuffers(0), hasAssignedPosqCharges(false), enableKernelProfiling(false), bufferPool(context),
+        pinnedBuffer(NULL), kernelProfiler(NULL), stateDownloader(NULL), correctionReorderListener(NULL), integration(NULL), expression(NULL), bonded(NULL), nonbonded(NULL),
+        forceGroupSchedule(NULL), compilationScheduler(NULL) {
     
     char *optionProfileKernels = getenv("OPENMM_METAL_PROFILE_KERNELS");
     if (optionProfileKernels != nullptr) {
@@ -125,6 +406,18 @@ MetalContext::MetalContext(const System& system, int platformIndex, int deviceIn
         exit(7);
       }
     }
+    
+    string profileOutput = (enableKernelProfiling ? "-" : "");
+    char *optionProfileOutput = getenv("OPENMM_METAL_PROFILE_OUTPUT");
+    if (optionProfileOutput != nullptr && strlen(optionProfileOutput) > 0) {
+      this->enableKernelProfiling = true;
+      profileOutput = optionProfileOutput;
+      
+      // Each device writes its own file.
+      
+      if (platformData.contexts.size() > 0)
+        profileOutput += "."+intToString(platformData.contexts.size());
+    }
           
     char *optionReduceEnergyThreadgroups = getenv("OPENMM_METAL_REDUCE_ENERGY_THREADGROUPS");
           if (optionReduceEnergyThreadgroups != nullptr) {
@@ -148,14 +441,236 @@ MetalContext::MetalContext(const System& system, int platformIndex, int deviceIn
           } else {
             this->reduceEnergyThreadgroups = 1024;
           }
+
+    char *optionProgramCache = getenv("OPENMM_METAL_PROGRAM_CACHE");
+    if (optionProgramCache != nullptr && strlen(optionProgramCache) > 0) {
+      string directory(optionProgramCache);
+      struct stat info;
+      if (stat(directory.c_str(), &info) != 0)
+        mkdir(directory.c_str(), 0755);
+      if (stat(directory.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+        std::cout << std::endl;
+        std::cout << METAL_LOG_HEADER << "Error: Invalid option for ";
+        std::cout << "'OPENMM_METAL_PROGRAM_CACHE'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Specified '" << optionProgramCache << "', but ";
+        std::cout << "could not find or create a directory at that path." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Quitting now." << std::endl;
+        exit(11);
+      }
+      this->programCacheDirectory = directory;
+    }
+
+    bool useAsyncCompilation = true;
+    char *optionAsyncCompilation = getenv("OPENMM_METAL_ASYNC_COMPILATION");
+    if (optionAsyncCompilation != nullptr) {
+      if (strcmp(optionAsyncCompilation, "0") == 0) {
+        useAsyncCompilation = false;
+      } else if (strcmp(optionAsyncCompilation, "1") == 0) {
+        useAsyncCompilation = true;
+      } else {
+        std::cout << std::endl;
+        std::cout << METAL_LOG_HEADER << "Error: Invalid option for ";
+        std::cout << "'OPENMM_METAL_ASYNC_COMPILATION'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Specified '" << optionAsyncCompilation << "', but ";
+        std::cout << "expected either '0' or '1'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Quitting now." << std::endl;
+        exit(7);
+      }
+    }
+    if (useAsyncCompilation)
+      compilationScheduler = new MetalCompilationScheduler(platformData.threads.getNumThreads());
+
+    char *optionBufferPool = getenv("OPENMM_METAL_BUFFER_POOL");
+    if (optionBufferPool != nullptr) {
+      if (strcmp(optionBufferPool, "0") == 0) {
+        bufferPool.setEnabled(false);
+      } else if (strcmp(optionBufferPool, "1") == 0) {
+        bufferPool.setEnabled(true);
+      } else {
+        std::cout << std::endl;
+        std::cout << METAL_LOG_HEADER << "Error: Invalid option for ";
+        std::cout << "'OPENMM_METAL_BUFFER_POOL'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Specified '" << optionBufferPool << "', but ";
+        std::cout << "expected either '0' or '1'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Quitting now." << std::endl;
+        exit(7);
+      }
+    }
     
+    this->atomOrder = MoleculeOrder;
+    char *optionAtomOrder = getenv("OPENMM_METAL_ATOM_ORDER");
+    if (optionAtomOrder != nullptr) {
+      if (strcmp(optionAtomOrder, "molecule") == 0) {
+        this->atomOrder = MoleculeOrder;
+      } else if (strcmp(optionAtomOrder, "hilbert") == 0) {
+        this->atomOrder = HilbertOrder;
+      } else if (strcmp(optionAtomOrder, "morton") == 0) {
+        this->atomOrder = MortonOrder;
+      } else {
+        std::cout << std::endl;
+        std::cout << METAL_LOG_HEADER << "Error: Invalid option for ";
+        std::cout << "'OPENMM_METAL_ATOM_ORDER'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Specified '" << optionAtomOrder << "', but ";
+        std::cout << "expected 'molecule', 'hilbert', or 'morton'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Quitting now." << std::endl;
+        exit(7);
+      }
+    }
+    
+    this->reorderInterval = 250;
+    char *optionReorderInterval = getenv("OPENMM_METAL_REORDER_INTERVAL");
+    if (optionReorderInterval != nullptr) {
+      if (is_valid_int(optionReorderInterval) && atoi(optionReorderInterval) >= 1 && atoi(optionReorderInterval) <= 250) {
+        this->reorderInterval = atoi(optionReorderInterval);
+      } else {
+        std::cout << std::endl;
+        std::cout << METAL_LOG_HEADER << "Error: Invalid option for ";
+        std::cout << "'OPENMM_METAL_REORDER_INTERVAL'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Specified '" << optionReorderInterval << "', but ";
+        std::cout << "expected a number between '1' and '250'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Quitting now." << std::endl;
+        exit(9);
+      }
+    }
+    
+    this->autotuneFFT = false;
+    char *optionAutotuneFFT = getenv("OPENMM_METAL_AUTOTUNE_FFT");
+    if (optionAutotuneFFT != nullptr) {
+      if (strcmp(optionAutotuneFFT, "0") == 0) {
+        this->autotuneFFT = false;
+      } else if (strcmp(optionAutotuneFFT, "1") == 0) {
+        this->autotuneFFT = true;
+      } else {
+        std::cout << std::endl;
+        std::cout << METAL_LOG_HEADER << "Error: Invalid option for ";
+        std::cout << "'OPENMM_METAL_AUTOTUNE_FFT'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Specified '" << optionAutotuneFFT << "', but ";
+        std::cout << "expected either '0' or '1'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Quitting now." << std::endl;
+        exit(7);
+      }
+    }
+    
+    this->autotuneKernels = false;
+    char *optionAutotuneKernels = getenv("OPENMM_METAL_AUTOTUNE_KERNELS");
+    if (optionAutotuneKernels != nullptr) {
+      if (strcmp(optionAutotuneKernels, "0") == 0) {
+        this->autotuneKernels = false;
+      } else if (strcmp(optionAutotuneKernels, "1") == 0) {
+        this->autotuneKernels = true;
+      } else {
+        std::cout << std::endl;
+        std::cout << METAL_LOG_HEADER << "Error: Invalid option for ";
+        std::cout << "'OPENMM_METAL_AUTOTUNE_KERNELS'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Specified '" << optionAutotuneKernels << "', but ";
+        std::cout << "expected either '0' or '1'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Quitting now." << std::endl;
+        exit(7);
+      }
+    }
+    
+    this->checkpointFormat = 4;
+    char *optionCheckpointFormat = getenv("OPENMM_METAL_CHECKPOINT_FORMAT");
+    if (optionCheckpointFormat != nullptr) {
+      if (strcmp(optionCheckpointFormat, "3") == 0) {
+        this->checkpointFormat = 3;
+      } else if (strcmp(optionCheckpointFormat, "4") == 0) {
+        this->checkpointFormat = 4;
+      } else {
+        std::cout << std::endl;
+        std::cout << METAL_LOG_HEADER << "Error: Invalid option for ";
+        std::cout << "'OPENMM_METAL_CHECKPOINT_FORMAT'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Specified '" << optionCheckpointFormat << "', but ";
+        std::cout << "expected either '3' or '4'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Quitting now." << std::endl;
+        exit(7);
+      }
+    }
+    
+    this->incrementalCheckpoints = 0;
+    char *optionIncrementalCheckpoints = getenv("OPENMM_METAL_INCREMENTAL_CHECKPOINTS");
+    if (optionIncrementalCheckpoints != nullptr) {
+      if (is_valid_int(optionIncrementalCheckpoints) && atoi(optionIncrementalCheckpoints) >= 0 && atoi(optionIncrementalCheckpoints) <= 1000) {
+        this->incrementalCheckpoints = atoi(optionIncrementalCheckpoints);
+      } else {
+        std::cout << std::endl;
+        std::cout << METAL_LOG_HEADER << "Error: Invalid option for ";
+        std::cout << "'OPENMM_METAL_INCREMENTAL_CHECKPOINTS'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Specified '" << optionIncrementalCheckpoints << "', but ";
+        std::cout << "expected a number between '0' and '1000'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Quitting now." << std::endl;
+        exit(9);
+      }
+    }
+    
+    this->fusedSteps = 1;
+    char *optionFusedSteps = getenv("OPENMM_METAL_FUSED_STEPS");
+    if (optionFusedSteps != nullptr) {
+      if (is_valid_int(optionFusedSteps) && atoi(optionFusedSteps) >= 1 && atoi(optionFusedSteps) <= 1000) {
+        this->fusedSteps = atoi(optionFusedSteps);
+      } else {
+        std::cout << std::endl;
+        std::cout << METAL_LOG_HEADER << "Error: Invalid option for ";
+        std::cout << "'OPENMM_METAL_FUSED_STEPS'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Specified '" << optionFusedSteps << "', but ";
+        std::cout << "expected a number between '1' and '1000'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Quitting now." << std::endl;
+        exit(9);
+      }
+    }
+    
+    bool allowPeerTransfers = true;
+    char *optionPeerTransfers = getenv("OPENMM_METAL_PEER_TRANSFERS");
+    if (optionPeerTransfers != nullptr) {
+      if (strcmp(optionPeerTransfers, "0") == 0) {
+        allowPeerTransfers = false;
+      } else if (strcmp(optionPeerTransfers, "1") == 0) {
+        allowPeerTransfers = true;
+      } else {
+        std::cout << std::endl;
+        std::cout << METAL_LOG_HEADER << "Error: Invalid option for ";
+        std::cout << "'OPENMM_METAL_PEER_TRANSFERS'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Specified '" << optionPeerTransfers << "', but ";
+        std::cout << "expected either '0' or '1'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Quitting now." << std::endl;
+        exit(7);
+      }
+    }
+    
+    this->useCompressedParameters = false;
+    char *optionCompressedParameters = getenv("OPENMM_METAL_COMPRESSED_PARAMETERS");
+    if (optionCompressedParameters != nullptr) {
+      if (strcmp(optionCompressedParameters, "0") == 0) {
+        this->useCompressedParameters = false;
+      } else if (strcmp(optionCompressedParameters, "1") == 0) {
+        this->useCompressedParameters = true;
+      } else {
+        std::cout << std::endl;
+        std::cout << METAL_LOG_HEADER << "Error: Invalid option for ";
+        std::cout << "'OPENMM_METAL_COMPRESSED_PARAMETERS'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Specified '" << optionCompressedParameters << "', but ";
+        std::cout << "expected either '0' or '1'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Quitting now." << std::endl;
+        exit(7);
+      }
+    }
+    
+    // This must be the first listener, so the ones added later by forces and integrators
+    // only see the final order.
+    
+    addReorderListener(new MoleculeReorderListener(*this));
+    
+    useFloatFloatPrecision = false;
     if (precision == "single") {
         useDoublePrecision = false;
         useMixedPrecision = false;
     }
     else if (precision == "mixed") {
+        // The devices have no double precision, so emulate it with pairs of floats in the integrators.
+
         useDoublePrecision = false;
-        useMixedPrecision = true;
+        useMixedPrecision = false;
+        useFloatFloatPrecision = true;
     }
     else if (precision == "double") {
         useDoublePrecision = true;
@@ -204,7 +719,7 @@ MetalContext::MetalContext(const System& system, int platformIndex, int deviceIn
                     continue;
                 if (platformVendor == "Apple" && (devices[i].getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU))
                     continue; // The CPU device on OS X won't work correctly.
-                if (useMixedPrecision || useDoublePrecision) {
+                if (useDoublePrecision) {
                     bool supportsDouble = (devices[i].getInfo<CL_DEVICE_EXTENSIONS>().find("cl_khr_fp64") != string::npos);
                     if (!supportsDouble)
                         continue; // This device does not support double precision.
@@ -292,7 +807,7 @@ MetalContext::MetalContext(const System& system, int platformIndex, int deviceIn
         if (platformVendor.size() >= 5 && platformVendor.substr(0, 5) == "Intel")
             defaultOptimizationOptions = "";
 #if __APPLE__ && defined(__aarch64__)
-        else if (useMixedPrecision)
+        else if (useFloatFloatPrecision)
             // '-cl-no-signed-zeros' breaks double-single FP64 emulation.
             defaultOptimizationOptions = "-cl-mad-enable";
 #endif
@@ -300,7 +815,7 @@ MetalContext::MetalContext(const System& system, int platformIndex, int deviceIn
             defaultOptimizationOptions = "-cl-mad-enable -cl-no-signed-zeros";
         supports64BitGlobalAtomics = (device.getInfo<CL_DEVICE_EXTENSIONS>().find("cl_khr_int64_base_atomics") != string::npos);
         supportsDoublePrecision = (device.getInfo<CL_DEVICE_EXTENSIONS>().find("cl_khr_fp64") != string::npos);
-        if ((useDoublePrecision || useMixedPrecision) && !supportsDoublePrecision)
+        if (useDoublePrecision && !supportsDoublePrecision)
             throw OpenMMException("This device does not support double precision");
         string vendor = device.getInfo<CL_DEVICE_VENDOR>();
         int numThreadBlocksPerComputeUnit = 6;
@@ -448,21 +963,57 @@ MetalContext::MetalContext(const System& system, int platformIndex, int deviceIn
         vector<cl::Device> contextDevices;
         contextDevices.push_back(device);
         cl_context_properties cprops[] = {CL_CONTEXT_PLATFORM, (cl_context_properties) platforms[bestPlatform](), 0};
+        usePeerTransfers = false;
+        if (originalContext == NULL && allowPeerTransfers && platformData.deviceIndices.size() > 1) {
+            // When every device of a multi-device simulation is on this platform, put them all in one
+            // cl::Context.  The first context creates it and the others reuse it, so positions and forces
+            // can be copied directly between their buffers.
+
+            if (contextIndex == 0) {
+                set<int> peerIndices;
+                for (int index : platformData.deviceIndices)
+                    if (index >= 0 && index < (int) devices.size())
+                        peerIndices.insert(index);
+                if (peerIndices.size() == platformData.deviceIndices.size() && platformData.deviceIndices[0] == bestDevice) {
+                    for (int i = 1; i < (int) platformData.deviceIndices.size(); i++)
+                        contextDevices.push_back(devices[platformData.deviceIndices[i]]);
+                    usePeerTransfers = true;
+                }
+            }
+            else {
+                MetalContext& first = *platformData.contexts[0];
+                if (first.usePeerTransfers && first.platformIndex == bestPlatform)
+                    for (cl::Device& peer : first.context.getInfo<CL_CONTEXT_DEVICES>())
+                        if (peer() == device())
+                            usePeerTransfers = true;
+            }
+        }
         if (originalContext == NULL) {
-          context = cl::Context(contextDevices, cprops, errorCallback);
+          if (usePeerTransfers && contextIndex > 0)
+            context = platformData.contexts[0]->context;
+          else
+            context = cl::Context(contextDevices, cprops, errorCallback);
           if (enableKernelProfiling) {
             defaultQueue = cl::CommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE);
             printf("[Metal] Kernel profiling enabled.\n");
             printf("[Metal] Will log performance data every 500 GPU commands.\n");
-            printf("[Metal] Logging raw profiling data.\n");
-            printf("[ ");
+            if (profileOutput == "-")
+              printf("[Metal] Logging raw profiling data.\n");
           } else {
             defaultQueue = cl::CommandQueue(context, device);
           }
+          kernelProfiler = new MetalKernelProfiler(enableKernelProfiling);
+          kernelProfiler->setOutputFile(profileOutput);
         }
         else {
             context = originalContext->context;
             defaultQueue = originalContext->defaultQueue;
+            usePeerTransfers = originalContext->usePeerTransfers;
+            
+            // The queue is shared, so profiling is available if the original context has it.
+            // Only the original context writes to the output file.
+            
+            kernelProfiler = new MetalKernelProfiler(originalContext->kernelProfiler->isAvailable());
         }
       
       
@@ -509,6 +1060,10 @@ MetalContext::MetalContext(const System& system, int platformIndex, int deviceIn
         else {
             posq.initialize<mm_float4>(*this, paddedNumAtoms, "posq");
             velm.initialize<mm_float4>(*this, paddedNumAtoms, "velm");
+            if (useFloatFloatPrecision) {
+                posqCorrection.initialize<mm_float4>(*this, paddedNumAtoms, "posqCorrection");
+                velmCorrection.initialize<mm_float4>(*this, paddedNumAtoms, "velmCorrection");
+            }
             compilationDefines["convert_real4"] = "convert_float4";
             compilationDefines["make_real2"] = "make_float2";
             compilationDefines["make_real3"] = "make_float3";
@@ -536,15 +1091,30 @@ MetalContext::MetalContext(const System& system, int platformIndex, int deviceIn
 
     cl::Program utilities = createProgram(MetalKernelSources::utilities);
     clearBufferKernel = cl::Kernel(utilities, "clearBuffer");
-    clearTwoBuffersKernel = cl::Kernel(utilities, "clearTwoBuffers");
-    clearThreeBuffersKernel = cl::Kernel(utilities, "clearThreeBuffers");
-    clearFourBuffersKernel = cl::Kernel(utilities, "clearFourBuffers");
-    clearFiveBuffersKernel = cl::Kernel(utilities, "clearFiveBuffers");
-    clearSixBuffersKernel = cl::Kernel(utilities, "clearSixBuffers");
     reduceReal4Kernel = cl::Kernel(utilities, "reduceReal4Buffer");
     reduceForcesKernel = cl::Kernel(utilities, "reduceForces");
     reduceEnergyKernel = cl::Kernel(utilities, "reduceEnergy");
     setChargesKernel = cl::Kernel(utilities, "setCharges");
+    if (useFloatFloatPrecision) {
+        correctionReorderListener = new CorrectionReorderListener(*this);
+        addReorderListener(correctionReorderListener);
+
+        // The float-float kernels are compiled without fast math or contraction.  Make sure the compiler
+        // really kept the error-free transformations, since otherwise the corrections silently stay zero.
+
+        floatFloatProgram = createProgram(MetalKernelSources::floatFloatIntegrators, "");
+        foldCorrectionsKernel = cl::Kernel(floatFloatProgram, "foldFloatFloatCorrections");
+        cl::Kernel checkKernel(floatFloatProgram, "checkFloatFloatArithmetic");
+        MetalArray checkArray(*this, 2, sizeof(cl_float), "floatFloatCheck");
+        vector<cl_float> checkResult(2);
+        checkKernel.setArg<cl_float>(0, 1.0f);
+        checkKernel.setArg<cl_float>(1, 1e-9f);
+        checkKernel.setArg<cl::Buffer>(2, checkArray.getDeviceBuffer());
+        executeKernel(checkKernel, 1, 1);
+        checkArray.download(checkResult);
+        if (checkResult[0] != 1.0f || checkResult[1] != 1e-9f)
+            throw OpenMMException("The Metal compiler does not preserve float-float arithmetic, so mixed precision cannot be used");
+    }
 
     // Decide whether native_sqrt(), native_rsqrt(), and native_recip() are sufficiently accurate to use.
 
@@ -647,11 +1217,14 @@ MetalContext::MetalContext(const System& system, int platformIndex, int deviceIn
 
     bonded = new MetalBondedUtilities(*this);
     nonbonded = new MetalNonbondedUtilities(*this);
+    forceGroupSchedule = new MetalForceGroupSchedule(*this, system);
     integration = new MetalIntegrationUtilities(*this, system);
     expression = new MetalExpressionUtilities(*this);
 }
 
 MetalContext::~MetalContext() {
+    if (compilationScheduler != NULL)
+        delete compilationScheduler;
     for (auto force : forces)
         delete force;
     for (auto listener : reorderListeners)
@@ -670,26 +1243,25 @@ MetalContext::~MetalContext() {
         delete bonded;
     if (nonbonded != NULL)
         delete nonbonded;
-  if (enableKernelProfiling) {
-//    printf("[Metal] Logging raw profiling data.\n");
-//    printf("[ ");
-    printProfilingEvents();
-    printf(" ]\n");
-  }
+    if (forceGroupSchedule != NULL)
+        delete forceGroupSchedule;
+    if (stateDownloader != NULL)
+        delete stateDownloader;
+    for (auto buffer : trajectoryBuffers)
+        delete buffer;
+    if (kernelProfiler != NULL) {
+        kernelProfiler->flush();
+        delete kernelProfiler;
+    }
 }
 
 void MetalContext::initialize() {
     bonded->initialize(system);
     numForceBuffers = std::max(numForceBuffers, (int) platformData.contexts.size());
     int energyBufferSize = max(numThreadBlocks*ThreadBlockSize, nonbonded->getNumEnergyBuffers());
-  if (useDoublePrecision || useMixedPrecision) {
+  if (useDoublePrecision) {
     std::cout << METAL_LOG_HEADER << "Detected unsupported precision: ";
-    if (useDoublePrecision) {
-      std::cout << "double";
-    } else {
-      std::cout << "mixed";
-    }
-    std::cout << " precision." << std::endl;
+    std::cout << "double precision." << std::endl;
     std::cout << METAL_LOG_HEADER << "Quitting now." << std::endl;
     exit(10);
   }
@@ -727,10 +1299,30 @@ void MetalContext::initialize() {
             ((mm_float4*) pinnedMemory)[i] = mm_float4(0.0f, 0.0f, 0.0f, mass == 0.0 ? 0.0f : (cl_float) (1.0/mass));
     }
     velm.upload(pinnedMemory);
+    if (useFloatFloatPrecision) {
+        clearBuffer(posqCorrection);
+        clearBuffer(velmCorrection);
+    }
     findMoleculeGroups();
+    reduceForcesLaunch = MetalKernelTuner::LaunchConfig(min((paddedNumAtoms+127)/128, numThreadBlocks), 128);
+    reduceForcesNeedsTuning = false;
+    if (autotuneKernels)
+        reduceForcesNeedsTuning = !MetalKernelTuner(*this, "reduceForces", paddedNumAtoms).loadResult(reduceForcesLaunch);
     nonbonded->initialize(system);
 }
 
+MetalStateDownloader& MetalContext::getStateDownloader() {
+    if (stateDownloader == NULL)
+        stateDownloader = new MetalStateDownloader(*this);
+    return *stateDownloader;
+}
+
+MetalTrajectoryBuffer& MetalContext::createTrajectoryBuffer(const vector<int>& atoms, int interval, int capacity, bool quantize) {
+    MetalTrajectoryBuffer* buffer = new MetalTrajectoryBuffer(*this, atoms, interval, capacity, quantize);
+    trajectoryBuffers.push_back(buffer);
+    return *buffer;
+}
+
 void MetalContext::initializeContexts() {
     getPlatformData().initializeContexts(system);
 }
@@ -751,11 +1343,18 @@ cl::Program MetalContext::createProgram(const string source, const char* optimiz
 }
 
 cl::Program MetalContext::createProgram(const string source, const map<string, string>& defines, const char* optimizationFlags) {
+    string options = getCompilationOptions(optimizationFlags);
+    return buildProgram(expandProgramSource(source, defines, options), options);
+}
+
+string MetalContext::getCompilationOptions(const char* optimizationFlags) const {
     string options = (optimizationFlags == NULL ? defaultOptimizationOptions : string(optimizationFlags));
     
     // Suppress the compiler warnings that flood the console.
-    options = options + std::string(" -w");
-    
+    return options + std::string(" -w");
+}
+
+string MetalContext::expandProgramSource(const string& source, const map<string, string>& defines, const string& options) {
     stringstream src;
     if (!options.empty())
         src << "// Compilation Options: " << options << endl << endl;
@@ -806,16 +1405,142 @@ cl::Program MetalContext::createProgram(const string source, const map<string, s
     if (!defines.empty())
         src << endl;
     src << source << endl;
-    cl::Program::Sources sources({src.str()});
+    return src.str();
+}
+
+cl::Program MetalContext::buildProgram(const string& source, const string& options) {
+    // If a program cache is enabled, try to load a previously compiled binary.
+
+    string cacheFile;
+    if (!programCacheDirectory.empty()) {
+        cacheFile = programCacheDirectory+"/"+getProgramCacheKey(source, options)+".bin";
+        ifstream cached(cacheFile.c_str(), ios::in | ios::binary);
+        if (cached.is_open()) {
+            vector<unsigned char> binary((istreambuf_iterator<char>(cached)), istreambuf_iterator<char>());
+            cached.close();
+            try {
+                cl::Program program(context, vector<cl::Device>(1, device), cl::Program::Binaries(1, binary));
+                program.build(vector<cl::Device>(1, device), options.c_str());
+                return program;
+            }
+            catch (cl::Error err) {
+                // The driver rejected the binary, so discard it and compile from source.
+
+                remove(cacheFile.c_str());
+            }
+        }
+    }
+    cl::Program::Sources sources({source});
     cl::Program program(context, sources);
     try {
         program.build(vector<cl::Device>(1, device), options.c_str());
     } catch (cl::Error err) {
         throw OpenMMException("Error compiling kernel: "+program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device));
     }
+    if (!cacheFile.empty()) {
+        // Save the binary.  It is written to a temporary file and then renamed, so other
+        // processes and threads sharing the cache never see a partially written file.
+
+        try {
+            // A context shared with peer devices has one binary per device, and only this device's was built.
+
+            vector<vector<unsigned char> > binaries = program.getInfo<CL_PROGRAM_BINARIES>();
+            vector<cl::Device> programDevices = program.getInfo<CL_PROGRAM_DEVICES>();
+            int binaryIndex = 0;
+            for (int i = 0; i < (int) programDevices.size(); i++)
+                if (programDevices[i]() == device())
+                    binaryIndex = i;
+            if (binaryIndex < (int) binaries.size() && !binaries[binaryIndex].empty()) {
+                stringstream tempName;
+                tempName << cacheFile << "." << getpid() << "." << this_thread::get_id();
+                string tempFile = tempName.str();
+                ofstream out(tempFile.c_str(), ios::out | ios::binary);
+                out.write((const char*) binaries[binaryIndex].data(), binaries[binaryIndex].size());
+                out.close();
+                if (out.fail() || rename(tempFile.c_str(), cacheFile.c_str()) != 0)
+                    remove(tempFile.c_str());
+            }
+        }
+        catch (cl::Error err) {
+            // Failing to cache a program is not an error.  It will simply be compiled again next time.
+        }
+    }
     return program;
 }
 
+string MetalContext::getProgramCacheKey(const string& source, const string& options) {
+    // The binary depends on the device, the driver, and the complete source and options.
+
+    stringstream identity;
+    identity << device.getInfo<CL_DEVICE_NAME>() << endl;
+    identity << device.getInfo<CL_DEVICE_VENDOR>() << endl;
+    identity << device.getInfo<CL_DEVICE_VERSION>() << endl;
+    identity << device.getInfo<CL_DRIVER_VERSION>() << endl;
+    identity << cl::Platform(device.getInfo<CL_DEVICE_PLATFORM>()).getInfo<CL_PLATFORM_VERSION>() << endl;
+    identity << options << endl;
+    string key = identity.str()+source;
+    CSHA1 sha1;
+    sha1.Update((const UINT_8*) key.c_str(), key.size());
+    sha1.Final();
+    UINT_8 hash[20];
+    sha1.GetHash(hash);
+    stringstream hashString;
+    hashString.fill('0');
+    hashString << hex;
+    for (int i = 0; i < 20; i++)
+        hashString << setw(2) << (int) hash[i];
+    return hashString.str();
+}
+
+/**
+ * Tuning results found so far by any context in this process, indexed by the hash of the
+ * device and key.
+ */
+static map<string, string> tuningResults;
+static mutex tuningResultsLock;
+
+bool MetalContext::loadTuningResult(const string& key, string& value) {
+    string hash = getProgramCacheKey(key, "tuning");
+    {
+        lock_guard<mutex> lock(tuningResultsLock);
+        auto result = tuningResults.find(hash);
+        if (result != tuningResults.end()) {
+            value = result->second;
+            return true;
+        }
+    }
+    if (programCacheDirectory.empty())
+        return false;
+    ifstream in((programCacheDirectory+"/"+hash+".tuning").c_str());
+    if (!in.is_open() || !getline(in, value))
+        return false;
+    lock_guard<mutex> lock(tuningResultsLock);
+    tuningResults[hash] = value;
+    return true;
+}
+
+void MetalContext::saveTuningResult(const string& key, const string& value) {
+    string hash = getProgramCacheKey(key, "tuning");
+    {
+        lock_guard<mutex> lock(tuningResultsLock);
+        tuningResults[hash] = value;
+    }
+    if (programCacheDirectory.empty())
+        return;
+
+    // Write to a temporary file and rename it, the same as for program binaries.
+
+    string file = programCacheDirectory+"/"+hash+".tuning";
+    stringstream tempName;
+    tempName << file << "." << getpid() << "." << this_thread::get_id();
+    string tempFile = tempName.str();
+    ofstream out(tempFile.c_str());
+    out << value << endl;
+    out.close();
+    if (out.fail() || rename(tempFile.c_str(), file.c_str()) != 0)
+        remove(tempFile.c_str());
+}
+
 cl::CommandQueue& MetalContext::getQueue() {
     return currentQueue;
 }
@@ -837,7 +1562,23 @@ ComputeEvent MetalContext::createEvent() {
 }
 
 ComputeProgram MetalContext::compileProgram(const std::string source, const std::map<std::string, std::string>& defines) {
-    cl::Program program = createProgram(source, defines);
+    return compileProgram(source, defines, NULL);
+}
+
+ComputeProgram MetalContext::compileProgram(const std::string source, const std::map<std::string, std::string>& defines, const char* optimizationFlags) {
+    if (compilationScheduler == NULL) {
+        cl::Program program = createProgram(source, defines, optimizationFlags);
+        return shared_ptr<ComputeProgramImpl>(new MetalProgram(*this, program));
+    }
+    
+    // Expand the source on this thread, then build it in the background.  Kernels are
+    // looked up from the program the first time they are needed.
+
+    string options = getCompilationOptions(optimizationFlags);
+    string fullSource = expandProgramSource(source, defines, options);
+    shared_future<cl::Program> program = compilationScheduler->submit([this, fullSource, options] () {
+        return buildProgram(fullSource, options);
+    });
     return shared_ptr<ComputeProgramImpl>(new MetalProgram(*this, program));
 }
 
@@ -858,14 +1599,10 @@ void MetalContext::executeKernel(cl::Kernel& kernel, int workUnits, int blockSiz
         blockSize = ThreadBlockSize;
     int size = std::min((workUnits+blockSize-1)/blockSize, numThreadBlocks)*blockSize;
     try {
-      if (enableKernelProfiling) {
+      if (kernelProfiler->isEnabled()) {
         cl::Event event;
         currentQueue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(size), cl::NDRange(blockSize), NULL, &event);
-        profilingEvents.push_back(event);
-        profilingKernelNames.push_back(kernel.getInfo<CL_KERNEL_FUNCTION_NAME>());
-        if (profilingEvents.size() >= 500) {
-          printProfilingEvents();
-        }
+        kernelProfiler->addEvent(event, kernel, size, blockSize, currentQueue);
       } else {
         currentQueue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(size), cl::NDRange(blockSize));
       }
@@ -877,29 +1614,6 @@ void MetalContext::executeKernel(cl::Kernel& kernel, int workUnits, int blockSiz
     }
 }
 
-void MetalContext::printProfilingEvents() {
-    for (int i = 0; i < profilingEvents.size(); i++) {
-        cl::Event event = profilingEvents[i];
-        event.wait();
-        cl_ulong start, end;
-        event.getProfilingInfo(CL_PROFILING_COMMAND_START, &start);
-        event.getProfilingInfo(CL_PROFILING_COMMAND_END, &end);
-        if (profileStartTime == 0)
-            profileStartTime = start;
-        else
-            printf(",\n");
-        printf("{ \"pid\":1, \"tid\":1, \"ts\":%.6g, \"dur\":%g, \"ph\":\"X\", \"name\":\"%s\" }",
-#if __APPLE__ && defined(__aarch64__)
-               // Workaround for Apple's OpenCL driver bug.
-               0.001*(start-profileStartTime)*125.0/3.0, 0.001*(end-start)*125.0/3.0, profilingKernelNames[i].c_str());
-#else
-                0.001*(start-profileStartTime), 0.001*(end-start), profilingKernelNames[i].c_str());
-#endif
-    }
-    profilingEvents.clear();
-    profilingKernelNames.clear();
-}
-
 int MetalContext::computeThreadBlockSize(double memory) const {
     int maxShared = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
     // On some implementations, more local memory gets used than we calculate by
@@ -924,6 +1638,17 @@ void MetalContext::clearBuffer(cl::Memory& memory, int size) {
     executeKernel(clearBufferKernel, words, 128);
 }
 
+void MetalContext::foldFloatFloatCorrections() {
+    if (!useFloatFloatPrecision)
+        return;
+    foldCorrectionsKernel.setArg<cl_int>(0, numAtoms);
+    foldCorrectionsKernel.setArg<cl::Buffer>(1, posq.getDeviceBuffer());
+    foldCorrectionsKernel.setArg<cl::Buffer>(2, posqCorrection.getDeviceBuffer());
+    foldCorrectionsKernel.setArg<cl::Buffer>(3, velm.getDeviceBuffer());
+    foldCorrectionsKernel.setArg<cl::Buffer>(4, velmCorrection.getDeviceBuffer());
+    executeKernel(foldCorrectionsKernel, numAtoms);
+}
+
 void MetalContext::addAutoclearBuffer(ArrayInterface& array) {
     addAutoclearBuffer(unwrap(array).getDeviceBuffer(), array.getSize()*array.getElementSize());
 }
@@ -934,71 +1659,99 @@ void MetalContext::addAutoclearBuffer(cl::Memory& memory, int size) {
 }
 
 void MetalContext::clearAutoclearBuffers() {
-    int base = 0;
-    int total = autoclearBufferSizes.size();
-    while (total-base >= 6) {
-        clearSixBuffersKernel.setArg<cl::Memory>(0, *autoclearBuffers[base]);
-        clearSixBuffersKernel.setArg<cl_int>(1, autoclearBufferSizes[base]);
-        clearSixBuffersKernel.setArg<cl::Memory>(2, *autoclearBuffers[base+1]);
-        clearSixBuffersKernel.setArg<cl_int>(3, autoclearBufferSizes[base+1]);
-        clearSixBuffersKernel.setArg<cl::Memory>(4, *autoclearBuffers[base+2]);
-        clearSixBuffersKernel.setArg<cl_int>(5, autoclearBufferSizes[base+2]);
-        clearSixBuffersKernel.setArg<cl::Memory>(6, *autoclearBuffers[base+3]);
-        clearSixBuffersKernel.setArg<cl_int>(7, autoclearBufferSizes[base+3]);
-        clearSixBuffersKernel.setArg<cl::Memory>(8, *autoclearBuffers[base+4]);
-        clearSixBuffersKernel.setArg<cl_int>(9, autoclearBufferSizes[base+4]);
-        clearSixBuffersKernel.setArg<cl::Memory>(10, *autoclearBuffers[base+5]);
-        clearSixBuffersKernel.setArg<cl_int>(11, autoclearBufferSizes[base+5]);
-        executeKernel(clearSixBuffersKernel, max(max(max(max(max(autoclearBufferSizes[base], autoclearBufferSizes[base+1]), autoclearBufferSizes[base+2]), autoclearBufferSizes[base+3]), autoclearBufferSizes[base+4]), autoclearBufferSizes[base+5]), 128);
-        base += 6;
-    }
-    if (total-base == 5) {
-        clearFiveBuffersKernel.setArg<cl::Memory>(0, *autoclearBuffers[base]);
-        clearFiveBuffersKernel.setArg<cl_int>(1, autoclearBufferSizes[base]);
-        clearFiveBuffersKernel.setArg<cl::Memory>(2, *autoclearBuffers[base+1]);
-        clearFiveBuffersKernel.setArg<cl_int>(3, autoclearBufferSizes[base+1]);
-        clearFiveBuffersKernel.setArg<cl::Memory>(4, *autoclearBuffers[base+2]);
-        clearFiveBuffersKernel.setArg<cl_int>(5, autoclearBufferSizes[base+2]);
-        clearFiveBuffersKernel.setArg<cl::Memory>(6, *autoclearBuffers[base+3]);
-        clearFiveBuffersKernel.setArg<cl_int>(7, autoclearBufferSizes[base+3]);
-        clearFiveBuffersKernel.setArg<cl::Memory>(8, *autoclearBuffers[base+4]);
-        clearFiveBuffersKernel.setArg<cl_int>(9, autoclearBufferSizes[base+4]);
-        executeKernel(clearFiveBuffersKernel, max(max(max(max(autoclearBufferSizes[base], autoclearBufferSizes[base+1]), autoclearBufferSizes[base+2]), autoclearBufferSizes[base+3]), autoclearBufferSizes[base+4]), 128);
-    }
-    else if (total-base == 4) {
-        clearFourBuffersKernel.setArg<cl::Memory>(0, *autoclearBuffers[base]);
-        clearFourBuffersKernel.setArg<cl_int>(1, autoclearBufferSizes[base]);
-        clearFourBuffersKernel.setArg<cl::Memory>(2, *autoclearBuffers[base+1]);
-        clearFourBuffersKernel.setArg<cl_int>(3, autoclearBufferSizes[base+1]);
-        clearFourBuffersKernel.setArg<cl::Memory>(4, *autoclearBuffers[base+2]);
-        clearFourBuffersKernel.setArg<cl_int>(5, autoclearBufferSizes[base+2]);
-        clearFourBuffersKernel.setArg<cl::Memory>(6, *autoclearBuffers[base+3]);
-        clearFourBuffersKernel.setArg<cl_int>(7, autoclearBufferSizes[base+3]);
-        executeKernel(clearFourBuffersKernel, max(max(max(autoclearBufferSizes[base], autoclearBufferSizes[base+1]), autoclearBufferSizes[base+2]), autoclearBufferSizes[base+3]), 128);
+    // The table only needs to be rebuilt if a buffer was added or reallocated since the last call.
+
+    bool changed = (autoclearHandles.size() != autoclearBuffers.size());
+    for (int i = 0; i < autoclearHandles.size() && !changed; i++)
+        changed = (autoclearHandles[i] != (*autoclearBuffers[i])());
+    if (changed)
+        buildAutoclearTable();
+    for (int i = 0; i < autoclearKernels.size(); i++)
+        executeKernel(autoclearKernels[i], autoclearWorkUnits[i], 128);
+}
+
+void MetalContext::buildAutoclearTable() {
+    int numBuffers = autoclearBuffers.size();
+    int numGroups = (numBuffers+MaxAutoclearBuffersPerKernel-1)/MaxAutoclearBuffersPerKernel;
+    autoclearHandles.resize(numBuffers);
+    for (int i = 0; i < numBuffers; i++)
+        autoclearHandles[i] = (*autoclearBuffers[i])();
+    autoclearKernels.clear();
+    autoclearWorkUnits.clear();
+    if (numBuffers == 0)
+        return;
+
+    // Each buffer is divided into int4 chunks.  Record where each buffer's chunks start within its group.
+
+    vector<cl_int> chunkStart(numGroups*(MaxAutoclearBuffersPerKernel+1), 0);
+    vector<cl_int> sizes(numGroups*MaxAutoclearBuffersPerKernel, 0);
+    for (int group = 0; group < numGroups; group++) {
+        int first = group*MaxAutoclearBuffersPerKernel;
+        int count = min(MaxAutoclearBuffersPerKernel, numBuffers-first);
+        cl_int* start = &chunkStart[group*(MaxAutoclearBuffersPerKernel+1)];
+        for (int i = 0; i < count; i++) {
+            sizes[first+i] = autoclearBufferSizes[first+i];
+            start[i+1] = start[i]+autoclearBufferSizes[first+i]/4;
+        }
+        autoclearWorkUnits.push_back(max(start[count], 1));
     }
-    else if (total-base == 3) {
-        clearThreeBuffersKernel.setArg<cl::Memory>(0, *autoclearBuffers[base]);
-        clearThreeBuffersKernel.setArg<cl_int>(1, autoclearBufferSizes[base]);
-        clearThreeBuffersKernel.setArg<cl::Memory>(2, *autoclearBuffers[base+1]);
-        clearThreeBuffersKernel.setArg<cl_int>(3, autoclearBufferSizes[base+1]);
-        clearThreeBuffersKernel.setArg<cl::Memory>(4, *autoclearBuffers[base+2]);
-        clearThreeBuffersKernel.setArg<cl_int>(5, autoclearBufferSizes[base+2]);
-        executeKernel(clearThreeBuffersKernel, max(max(autoclearBufferSizes[base], autoclearBufferSizes[base+1]), autoclearBufferSizes[base+2]), 128);
+    if (autoclearChunkStart.isInitialized()) {
+        autoclearChunkStart.resize(chunkStart.size());
+        autoclearSizes.resize(sizes.size());
     }
-    else if (total-base == 2) {
-        clearTwoBuffersKernel.setArg<cl::Memory>(0, *autoclearBuffers[base]);
-        clearTwoBuffersKernel.setArg<cl_int>(1, autoclearBufferSizes[base]);
-        clearTwoBuffersKernel.setArg<cl::Memory>(2, *autoclearBuffers[base+1]);
-        clearTwoBuffersKernel.setArg<cl_int>(3, autoclearBufferSizes[base+1]);
-        executeKernel(clearTwoBuffersKernel, max(autoclearBufferSizes[base], autoclearBufferSizes[base+1]), 128);
+    else {
+        autoclearChunkStart.initialize<cl_int>(*this, chunkStart.size(), "autoclearChunkStart");
+        autoclearSizes.initialize<cl_int>(*this, sizes.size(), "autoclearSizes");
     }
-    else if (total-base == 1) {
-        clearBuffer(*autoclearBuffers[base], autoclearBufferSizes[base]*4);
+    autoclearChunkStart.upload(chunkStart);
+    autoclearSizes.upload(sizes);
+
+    // Create one kernel for each group, with its arguments set once here rather than on every call.
+
+    cl::Program program = clearBufferKernel.getInfo<CL_KERNEL_PROGRAM>();
+    for (int group = 0; group < numGroups; group++) {
+        int first = group*MaxAutoclearBuffersPerKernel;
+        int count = min(MaxAutoclearBuffersPerKernel, numBuffers-first);
+        cl::Kernel kernel(program, "clearAutoclearBuffers");
+        kernel.setArg<cl::Buffer>(0, autoclearChunkStart.getDeviceBuffer());
+        kernel.setArg<cl::Buffer>(1, autoclearSizes.getDeviceBuffer());
+        kernel.setArg<cl_int>(2, group);
+        kernel.setArg<cl_int>(3, count);
+        for (int i = 0; i < MaxAutoclearBuffersPerKernel; i++)
+            kernel.setArg<cl::Memory>(4+i, *autoclearBuffers[first+(i < count ? i : 0)]);
+        autoclearKernels.push_back(kernel);
     }
 }
 
 void MetalContext::reduceForces() {
-    executeKernel(reduceForcesKernel, paddedNumAtoms, 128);
+    if (reduceForcesNeedsTuning) {
+        reduceForcesNeedsTuning = false;
+        tuneReduceForces();
+    }
+    executeKernel(reduceForcesKernel, reduceForcesLaunch.numGroups*reduceForcesLaunch.groupSize, reduceForcesLaunch.groupSize);
+}
+
+void MetalContext::tuneReduceForces() {
+    // The kernel adds the force buffers together in place, so save them and restore them
+    // before every launch.
+
+    MetalArray savedLongForces(*this, longForceBuffer.getSize(), longForceBuffer.getElementSize(), "savedLongForces");
+    MetalArray savedForces(*this, forceBuffers.getSize(), forceBuffers.getElementSize(), "savedForces");
+    longForceBuffer.copyTo(savedLongForces);
+    forceBuffers.copyTo(savedForces);
+    vector<MetalKernelTuner::LaunchConfig> candidates = {reduceForcesLaunch};
+    vector<int> numGroups = {numThreadBlocks/8, numThreadBlocks/4, numThreadBlocks/2, numThreadBlocks};
+    vector<int> groupSizes = {32, 64, 128, 256};
+    for (const MetalKernelTuner::LaunchConfig& config : MetalKernelTuner::getCandidates(numGroups, groupSizes, max(paddedNumAtoms, 256)))
+        if (!(config == reduceForcesLaunch))
+            candidates.push_back(config);
+    MetalKernelTuner tuner(*this, "reduceForces", paddedNumAtoms);
+    reduceForcesLaunch = tuner.sweep(candidates, [&] (const MetalKernelTuner::LaunchConfig& config) {
+        executeKernel(reduceForcesKernel, config.numGroups*config.groupSize, config.groupSize);
+    }, [&] () {
+        savedLongForces.copyTo(longForceBuffer);
+        savedForces.copyTo(forceBuffers);
+    });
 }
 
 void MetalContext::reduceBuffer(MetalArray& array, MetalArray& longBuffer, int numBuffers) {
@@ -1062,3 +1815,14 @@ void MetalContext::addEnergyParameterDerivative(const string& param) {
 void MetalContext::flushQueue() {
     getQueue().flush();
 }
+
+void MetalContext::resetCorrectionOrder() {
+    if (correctionReorderListener != NULL)
+        correctionReorderListener->resetOrder();
+}
+
+void MetalContext::setReorderInterval(int steps) {
+    if (steps < 1 || steps > 250)
+        throw OpenMMException("The reorder interval must be between 1 and 250");
+    reorderInterval = steps;
+}
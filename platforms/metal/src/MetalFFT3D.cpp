@@ -30,108 +30,152 @@
 #include "MetalKernelSources.h"
 #include "SimTKOpenMMRealType.h"
 #include <algorithm>
+#include <chrono>
 #include <map>
+#include <set>
 #include <sstream>
 #include <string>
+#include <tuple>
 
 using namespace OpenMM;
 using namespace std;
 
-#ifdef USE_VKFFT
+/**
+ * The orders in which the built in kernels try radices.  The first one uses the largest radix
+ * that divides the remaining size, which gives the fewest passes.  The second does the radix 4,
+ * 3, and 2 passes first and leaves 5 and 7 for the end.  The third never uses radix 4, which
+ * takes more passes but fewer registers.
+ */
+static const vector<vector<int> > radixOrders = {{7, 5, 4, 3, 2}, {4, 3, 2, 5, 7}, {2, 3, 5, 7}};
 
-MetalFFT3D::MetalFFT3D(MetalContext& context, int xsize, int ysize, int zsize, bool realToComplex) :
-        context(context), xsize(xsize), ysize(ysize), zsize(zsize) {
-    app = {};
-    VkFFTConfiguration config = {};
-    config.FFTdim = 3;
-    config.size[0] = zsize;
-    config.size[1] = ysize;
-    config.size[2] = xsize;
-    config.performR2C = realToComplex;
-    config.doublePrecision = context.getUseDoublePrecision();
-    config.device = &context.getDevice()();
-    config.context = &context.getContext()();
-    config.inverseReturnToInputBuffer = true;
-    config.isInputFormatted = 1;
-    config.inputBufferStride[0] = zsize;
-    config.inputBufferStride[1] = ysize*zsize;
-    config.inputBufferStride[2] = xsize*ysize*zsize;
-    VkFFTResult result = initializeVkFFT(&app, config);
-    if (result != VKFFT_SUCCESS)
-        throw OpenMMException("Error initializing VkFFT: "+context.intToString(result));
+static bool hasOnlySmallFactors(int size, int maxFactor) {
+    for (int factor = 2; factor <= maxFactor; factor++) {
+        while (size > 1 && size%factor == 0)
+            size /= factor;
+    }
+    return (size == 1);
 }
 
-MetalFFT3D::~MetalFFT3D() {
-    deleteVkFFT(&app);
+static string getTuningKey(MetalContext& context, const string& kind, int xsize, int ysize, int zsize, bool realToComplex) {
+    stringstream key;
+    key << "MetalFFT3D " << kind << " " << xsize << " " << ysize << " " << zsize << " " << realToComplex;
+    key << " " << (context.getUseDoublePrecision() ? "double" : "single");
+#ifdef USE_VKFFT
+    key << " vkfft";
+#endif
+    return key.str();
 }
 
-void MetalFFT3D::execFFT(MetalArray& in, MetalArray& out, bool forward) {
-    VkFFTLaunchParams params = {};
-    if (forward) {
-        params.inputBuffer = &in.getDeviceBuffer()();
-        params.buffer = &out.getDeviceBuffer()();
-    }
-    else {
-        params.inputBuffer = &out.getDeviceBuffer()();
-        params.buffer = &in.getDeviceBuffer()();
-    }
-    params.commandQueue = &context.getQueue()();
-    VkFFTResult result = VkFFTAppend(&app, forward ? -1 : 1, &params);
-    if (result != VKFFT_SUCCESS)
-        throw OpenMMException("Error executing VkFFT: "+context.intToString(result));
+string MetalFFT3D::Plan::toString() const {
+    stringstream description;
+    description << (useVkFFT ? 1 : 0) << " " << packedAxis << " " << maxThreads << " " << radixOrder;
+    return description.str();
 }
 
-#else
+MetalFFT3D::Plan MetalFFT3D::Plan::fromString(const string& description) {
+    stringstream in(description);
+    int useVkFFT;
+    Plan plan;
+    if (!(in >> useVkFFT >> plan.packedAxis >> plan.maxThreads >> plan.radixOrder))
+        throw OpenMMException("Invalid FFT plan: "+description);
+    plan.useVkFFT = (useVkFFT != 0);
+    return plan;
+}
 
 MetalFFT3D::MetalFFT3D(MetalContext& context, int xsize, int ysize, int zsize, bool realToComplex) :
         context(context), xsize(xsize), ysize(ysize), zsize(zsize) {
+    if (context.getAutotuneFFT())
+        plan = findFastestPlan(context, xsize, ysize, zsize, realToComplex);
+    else
+        plan = getDefaultPlan(context, xsize, ysize, zsize, realToComplex);
+    initialize(realToComplex);
+}
+
+MetalFFT3D::MetalFFT3D(MetalContext& context, int xsize, int ysize, int zsize, bool realToComplex, const Plan& plan) :
+        context(context), xsize(xsize), ysize(ysize), zsize(zsize), plan(plan) {
+    initialize(realToComplex);
+}
+
+MetalFFT3D::~MetalFFT3D() {
+#ifdef USE_VKFFT
+    if (plan.useVkFFT)
+        deleteVkFFT(&app);
+#endif
+}
+
+void MetalFFT3D::initialize(bool realToComplex) {
+    if (plan.radixOrder < 0 || plan.radixOrder >= getNumRadixOrders() || plan.maxThreads < 1 || plan.packedAxis < -1 || plan.packedAxis > 2)
+        throw OpenMMException("Invalid FFT plan: "+plan.toString());
     packRealAsComplex = false;
+    if (plan.useVkFFT) {
+#ifdef USE_VKFFT
+        app = {};
+        VkFFTConfiguration config = {};
+        config.FFTdim = 3;
+        config.size[0] = zsize;
+        config.size[1] = ysize;
+        config.size[2] = xsize;
+        config.performR2C = realToComplex;
+        config.doublePrecision = context.getUseDoublePrecision();
+        config.device = &context.getDevice()();
+        config.context = &context.getContext()();
+        config.inverseReturnToInputBuffer = true;
+        config.isInputFormatted = 1;
+        config.inputBufferStride[0] = zsize;
+        config.inputBufferStride[1] = ysize*zsize;
+        config.inputBufferStride[2] = xsize*ysize*zsize;
+        config.aimThreads = plan.maxThreads;
+        VkFFTResult result = initializeVkFFT(&app, config);
+        if (result != VKFFT_SUCCESS)
+            throw OpenMMException("Error initializing VkFFT: "+context.intToString(result));
+        return;
+#else
+        throw OpenMMException("Cannot create an FFT plan that uses VkFFT, because it is not available");
+#endif
+    }
     int packedXSize = xsize;
     int packedYSize = ysize;
     int packedZSize = zsize;
-    if (realToComplex) {
-        // If any axis size is even, we can pack the real values into a complex grid that is only half as large.
-        // Look for an appropriate axis.
+    if (realToComplex && plan.packedAxis != -1) {
+        // Pack the real values into a complex grid that is only half as large.  This requires the
+        // packed axis to have an even size.
         
-        packRealAsComplex = true;
-        int packedAxis, bufferSize;
-        if (xsize%2 == 0) {
-            packedAxis = 0;
+        int packedAxis = plan.packedAxis;
+        int bufferSize;
+        if (packedAxis == 0 && xsize%2 == 0) {
             packedXSize /= 2;
             bufferSize = packedXSize;
         }
-        else if (ysize%2 == 0) {
-            packedAxis = 1;
+        else if (packedAxis == 1 && ysize%2 == 0) {
             packedYSize /= 2;
             bufferSize = packedYSize;
         }
-        else if (zsize%2 == 0) {
-            packedAxis = 2;
+        else if (packedAxis == 2 && zsize%2 == 0) {
             packedZSize /= 2;
             bufferSize = packedZSize;
         }
         else
-            packRealAsComplex = false;
-        if (packRealAsComplex) {
-            // Build the kernels for packing and unpacking the data.
-            
-            map<string, string> defines;
-            defines["XSIZE"] = context.intToString(xsize);
-            defines["YSIZE"] = context.intToString(ysize);
-            defines["ZSIZE"] = context.intToString(zsize);
-            defines["PACKED_AXIS"] = context.intToString(packedAxis);
-            defines["PACKED_XSIZE"] = context.intToString(packedXSize);
-            defines["PACKED_YSIZE"] = context.intToString(packedYSize);
-            defines["PACKED_ZSIZE"] = context.intToString(packedZSize);
-            defines["M_PI"] = context.doubleToString(M_PI);
-            cl::Program program = context.createProgram(MetalKernelSources::fftR2C, defines);
-            packForwardKernel = cl::Kernel(program, "packForwardData");
-            unpackForwardKernel = cl::Kernel(program, "unpackForwardData");
-            unpackForwardKernel.setArg(2, bufferSize*(context.getUseDoublePrecision() ? sizeof(mm_double2) : sizeof(mm_float2)), NULL);
-            packBackwardKernel = cl::Kernel(program, "packBackwardData");
-            packBackwardKernel.setArg(2, bufferSize*(context.getUseDoublePrecision() ? sizeof(mm_double2) : sizeof(mm_float2)), NULL);
-            unpackBackwardKernel = cl::Kernel(program, "unpackBackwardData");
-        }
+            throw OpenMMException("Invalid FFT plan: the packed axis must have an even size");
+        packRealAsComplex = true;
+
+        // Build the kernels for packing and unpacking the data.
+
+        map<string, string> defines;
+        defines["XSIZE"] = context.intToString(xsize);
+        defines["YSIZE"] = context.intToString(ysize);
+        defines["ZSIZE"] = context.intToString(zsize);
+        defines["PACKED_AXIS"] = context.intToString(packedAxis);
+        defines["PACKED_XSIZE"] = context.intToString(packedXSize);
+        defines["PACKED_YSIZE"] = context.intToString(packedYSize);
+        defines["PACKED_ZSIZE"] = context.intToString(packedZSize);
+        defines["M_PI"] = context.doubleToString(M_PI);
+        cl::Program program = context.createProgram(MetalKernelSources::fftR2C, defines);
+        packForwardKernel = cl::Kernel(program, "packForwardData");
+        unpackForwardKernel = cl::Kernel(program, "unpackForwardData");
+        unpackForwardKernel.setArg(2, bufferSize*(context.getUseDoublePrecision() ? sizeof(mm_double2) : sizeof(mm_float2)), NULL);
+        packBackwardKernel = cl::Kernel(program, "packBackwardData");
+        packBackwardKernel.setArg(2, bufferSize*(context.getUseDoublePrecision() ? sizeof(mm_double2) : sizeof(mm_float2)), NULL);
+        unpackBackwardKernel = cl::Kernel(program, "unpackBackwardData");
     }
     bool inputIsReal = (realToComplex && !packRealAsComplex);
     zkernel = createKernel(packedXSize, packedYSize, packedZSize, zthreads, 0, true, inputIsReal);
@@ -143,6 +187,24 @@ MetalFFT3D::MetalFFT3D(MetalContext& context, int xsize, int ysize, int zsize, b
 }
 
 void MetalFFT3D::execFFT(MetalArray& in, MetalArray& out, bool forward) {
+#ifdef USE_VKFFT
+    if (plan.useVkFFT) {
+        VkFFTLaunchParams params = {};
+        if (forward) {
+            params.inputBuffer = &in.getDeviceBuffer()();
+            params.buffer = &out.getDeviceBuffer()();
+        }
+        else {
+            params.inputBuffer = &out.getDeviceBuffer()();
+            params.buffer = &in.getDeviceBuffer()();
+        }
+        params.commandQueue = &context.getQueue()();
+        VkFFTResult result = VkFFTAppend(&app, forward ? -1 : 1, &params);
+        if (result != VKFFT_SUCCESS)
+            throw OpenMMException("Error executing VkFFT: "+context.intToString(result));
+        return;
+    }
+#endif
     cl::Kernel kernel1 = (forward ? zkernel : invzkernel);
     cl::Kernel kernel2 = (forward ? xkernel : invxkernel);
     cl::Kernel kernel3 = (forward ? ykernel : invykernel);
@@ -189,7 +251,7 @@ void MetalFFT3D::execFFT(MetalArray& in, MetalArray& out, bool forward) {
 }
 
 cl::Kernel MetalFFT3D::createKernel(int xsize, int ysize, int zsize, int& threads, int axis, bool forward, bool inputIsReal) {
-    int maxThreads = min(256, (int) context.getDevice().getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>());
+    int maxThreads = min(plan.maxThreads, (int) context.getDevice().getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>());
     while (maxThreads > 128 && maxThreads-64 >= zsize)
         maxThreads -= 64;
     bool isCPU = context.getDevice().getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU;
@@ -203,22 +265,11 @@ cl::Kernel MetalFFT3D::createKernel(int xsize, int ysize, int zsize, int& thread
 
         // Factor zsize, generating an appropriate block of code for each factor.
 
+        vector<int> radices = factorDimension(zsize, plan.radixOrder);
         while (L > 1) {
             int input = stage%2;
             int output = 1-input;
-            int radix;
-            if (L%7 == 0)
-                radix = 7;
-            else if (L%5 == 0)
-                radix = 5;
-            else if (L%4 == 0)
-                radix = 4;
-            else if (L%3 == 0)
-                radix = 3;
-            else if (L%2 == 0)
-                radix = 2;
-            else
-                throw OpenMMException("Illegal size for FFT: "+context.intToString(zsize));
+            int radix = radices[stage];
             source<<"{\n";
             L = L/radix;
             source<<"// Pass "<<(stage+1)<<" (radix "<<radix<<")\n";
@@ -397,8 +448,6 @@ cl::Kernel MetalFFT3D::createKernel(int xsize, int ysize, int zsize, int& thread
     }
 }
 
-#endif
-
 int MetalFFT3D::findLegalDimension(int minimum) {
     if (minimum < 1)
         return 1;
@@ -407,16 +456,252 @@ int MetalFFT3D::findLegalDimension(int minimum) {
 #else
     const int maxFactor = 7;
 #endif
-    while (true) {
-        // Attempt to factor the current value.
+    while (!hasOnlySmallFactors(minimum, maxFactor))
+        minimum++;
+    return minimum;
+}
 
-        int unfactored = minimum;
-        for (int factor = 2; factor <= maxFactor; factor++) {
-            while (unfactored > 1 && unfactored%factor == 0)
-                unfactored /= factor;
+const vector<int>& MetalFFT3D::getRadixOrder(int index) {
+    return radixOrders[index];
+}
+
+int MetalFFT3D::getNumRadixOrders() {
+    return radixOrders.size();
+}
+
+vector<int> MetalFFT3D::factorDimension(int size, int radixOrder) {
+    const vector<int>& order = getRadixOrder(radixOrder);
+    vector<int> radices;
+    while (size > 1) {
+        int radix = 0;
+        for (int candidate : order)
+            if (size%candidate == 0) {
+                radix = candidate;
+                break;
+            }
+        if (radix == 0)
+            throw OpenMMException("Illegal size for FFT: "+to_string(size));
+        radices.push_back(radix);
+        size /= radix;
+    }
+    return radices;
+}
+
+/**
+ * Get the plan for the built in kernels that is used when VkFFT is not available.
+ */
+static MetalFFT3D::Plan getDefaultBuiltInPlan(int xsize, int ysize, int zsize, bool realToComplex) {
+    MetalFFT3D::Plan plan;
+    if (realToComplex) {
+        if (xsize%2 == 0)
+            plan.packedAxis = 0;
+        else if (ysize%2 == 0)
+            plan.packedAxis = 1;
+        else if (zsize%2 == 0)
+            plan.packedAxis = 2;
+    }
+    return plan;
+}
+
+MetalFFT3D::Plan MetalFFT3D::getDefaultPlan(MetalContext& context, int xsize, int ysize, int zsize, bool realToComplex) {
+#ifdef USE_VKFFT
+    Plan plan;
+    plan.useVkFFT = true;
+    plan.maxThreads = 128;
+    return plan;
+#else
+    return getDefaultBuiltInPlan(xsize, ysize, zsize, realToComplex);
+#endif
+}
+
+vector<MetalFFT3D::Plan> MetalFFT3D::getCandidatePlans(MetalContext& context, int xsize, int ysize, int zsize, bool realToComplex) {
+    vector<Plan> plans;
+    int deviceMaxThreads = context.getDevice().getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+    vector<int> threadCounts;
+    for (int threads = 64; threads <= min(256, deviceMaxThreads); threads *= 2)
+        threadCounts.push_back(threads);
+    if (threadCounts.empty())
+        threadCounts.push_back(deviceMaxThreads);
+#ifdef USE_VKFFT
+    for (int threads : threadCounts) {
+        Plan plan;
+        plan.useVkFFT = true;
+        plan.maxThreads = threads;
+        plans.push_back(plan);
+    }
+#endif
+    if (!hasOnlySmallFactors(xsize, 7) || !hasOnlySmallFactors(ysize, 7) || !hasOnlySmallFactors(zsize, 7))
+        return plans;
+    vector<int> packedAxes = {-1};
+    if (realToComplex) {
+        int sizes[] = {xsize, ysize, zsize};
+        for (int axis = 0; axis < 3; axis++)
+            if (sizes[axis]%2 == 0)
+                packedAxes.push_back(axis);
+    }
+    for (int packedAxis : packedAxes) {
+        int sizes[] = {xsize, ysize, zsize};
+        if (packedAxis != -1)
+            sizes[packedAxis] /= 2;
+
+        // Different radix orders often factor every dimension the same way.  Only keep the first
+        // order that produces each set of factorizations.
+
+        set<vector<vector<int> > > factorizations;
+        for (int order = 0; order < getNumRadixOrders(); order++) {
+            vector<vector<int> > factors;
+            for (int axis = 0; axis < 3; axis++)
+                factors.push_back(factorDimension(sizes[axis], order));
+            if (!factorizations.insert(factors).second)
+                continue;
+            for (int threads : threadCounts) {
+                Plan plan;
+                plan.packedAxis = packedAxis;
+                plan.radixOrder = order;
+                plan.maxThreads = threads;
+                plans.push_back(plan);
+            }
+        }
+    }
+    return plans;
+}
+
+double MetalFFT3D::timePlan(MetalContext& context, int xsize, int ysize, int zsize, bool realToComplex, const Plan& plan) {
+    int elementSize = (context.getUseDoublePrecision() ? sizeof(mm_double2) : sizeof(mm_float2));
+    MetalArray grid1(context, xsize*ysize*zsize, elementSize, "fftTimingGrid1");
+    MetalArray grid2(context, xsize*ysize*zsize, elementSize, "fftTimingGrid2");
+    context.clearBuffer(grid1);
+    context.clearBuffer(grid2);
+    try {
+        MetalFFT3D fft(context, xsize, ysize, zsize, realToComplex, plan);
+
+        // The first transforms may include one time setup costs, so they are not timed.
+
+        fft.execFFT(grid1, grid2, true);
+        fft.execFFT(grid2, grid1, false);
+        context.getQueue().finish();
+        const int iterations = 10;
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++) {
+            fft.execFFT(grid1, grid2, true);
+            fft.execFFT(grid2, grid1, false);
+        }
+        context.getQueue().finish();
+        return chrono::duration<double>(chrono::steady_clock::now()-start).count()/iterations;
+    }
+    catch (OpenMMException& ex) {
+        // The device can't run this plan, for example because it needs too much local memory.
+
+        return -1;
+    }
+    catch (cl::Error& err) {
+        return -1;
+    }
+}
+
+MetalFFT3D::Plan MetalFFT3D::findFastestPlan(MetalContext& context, int xsize, int ysize, int zsize, bool realToComplex) {
+    vector<Plan> candidates = getCandidatePlans(context, xsize, ysize, zsize, realToComplex);
+    string key = getTuningKey(context, "plan", xsize, ysize, zsize, realToComplex);
+    string stored;
+    if (context.loadTuningResult(key, stored)) {
+        try {
+            Plan plan = Plan::fromString(stored);
+            if (find(candidates.begin(), candidates.end(), plan) != candidates.end())
+                return plan;
+        }
+        catch (OpenMMException& ex) {
+            // The stored result is corrupt, so tune again.
+        }
+    }
+
+    // Timing every candidate would compile hundreds of kernels for some grids.  Instead, start
+    // from the default plan and repeatedly try every plan that differs from the best one in a
+    // single parameter.  Switching between VkFFT and the built in kernels counts as one change.
+
+    Plan builtInPlan = getDefaultBuiltInPlan(xsize, ysize, zsize, realToComplex);
+    Plan best = getDefaultPlan(context, xsize, ysize, zsize, realToComplex);
+    double bestTime = timePlan(context, xsize, ysize, zsize, realToComplex, best);
+    set<string> timed;
+    timed.insert(best.toString());
+    bool improved = true;
+    while (improved) {
+        improved = false;
+        for (const Plan& candidate : candidates) {
+            bool isNeighbor;
+            if (candidate.useVkFFT != best.useVkFFT)
+                isNeighbor = (candidate.maxThreads == best.maxThreads && (candidate.useVkFFT ||
+                        (candidate.packedAxis == builtInPlan.packedAxis && candidate.radixOrder == builtInPlan.radixOrder)));
+            else
+                isNeighbor = ((candidate.packedAxis != best.packedAxis) + (candidate.maxThreads != best.maxThreads) + (candidate.radixOrder != best.radixOrder) == 1);
+            if (!isNeighbor || !timed.insert(candidate.toString()).second)
+                continue;
+            double time = timePlan(context, xsize, ysize, zsize, realToComplex, candidate);
+            if (time >= 0 && (bestTime < 0 || time < bestTime)) {
+                best = candidate;
+                bestTime = time;
+                improved = true;
+            }
+        }
+    }
+    if (bestTime >= 0)
+        context.saveTuningResult(key, best.toString());
+    return best;
+}
+
+void MetalFFT3D::findFastestDimensions(MetalContext& context, int& xsize, int& ysize, int& zsize, bool realToComplex) {
+    string key = getTuningKey(context, "grid", xsize, ysize, zsize, realToComplex);
+    string stored;
+    if (context.loadTuningResult(key, stored)) {
+        stringstream in(stored);
+        int x, y, z;
+        if (in >> x >> y >> z && x >= xsize && y >= ysize && z >= zsize && x == findLegalDimension(x) && y == findLegalDimension(y) && z == findLegalDimension(z)) {
+            xsize = x;
+            ysize = y;
+            zsize = z;
+            return;
+        }
+    }
+
+    // For each axis, consider up to three legal sizes that are at most 10% larger than the
+    // smallest one.
+
+    int minimum[] = {xsize, ysize, zsize};
+    vector<int> sizes[3];
+    for (int axis = 0; axis < 3; axis++) {
+        int size = findLegalDimension(minimum[axis]);
+        int limit = size+size/10;
+        while (size <= limit && sizes[axis].size() < 3) {
+            sizes[axis].push_back(size);
+            size = findLegalDimension(size+1);
+        }
+    }
+
+    // Time the grids with the fewest points, using the plan each one would get without autotuning.
+    // Grids are compared with their default plans, since searching for the fastest plan of every
+    // one would take too long.  The plan for the grid that is chosen is tuned separately.
+
+    vector<tuple<long long, int, int, int> > grids;
+    for (int x : sizes[0])
+        for (int y : sizes[1])
+            for (int z : sizes[2])
+                grids.push_back(make_tuple((long long) x*y*z, x, y, z));
+    sort(grids.begin(), grids.end());
+    const int maxGrids = 8;
+    int bestGrid = 0;
+    double bestTime = -1;
+    for (int i = 0; i < min(maxGrids, (int) grids.size()); i++) {
+        int x = get<1>(grids[i]);
+        int y = get<2>(grids[i]);
+        int z = get<3>(grids[i]);
+        double time = timePlan(context, x, y, z, realToComplex, getDefaultPlan(context, x, y, z, realToComplex));
+        if (time >= 0 && (bestTime < 0 || time < bestTime)) {
+            bestGrid = i;
+            bestTime = time;
         }
-        if (unfactored == 1)
-            return minimum;
-        minimum++;
     }
+    xsize = get<1>(grids[bestGrid]);
+    ysize = get<2>(grids[bestGrid]);
+    zsize = get<3>(grids[bestGrid]);
+    if (bestTime >= 0)
+        context.saveTuningResult(key, context.intToString(xsize)+" "+context.intToString(ysize)+" "+context.intToString(zsize));
 }
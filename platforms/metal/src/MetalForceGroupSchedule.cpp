@@ -0,0 +1,238 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#include "MetalForceGroupSchedule.h"
+#include "MetalContext.h"
+#include "MetalLogging.h"
+#include "openmm/AndersenThermostat.h"
+#include "openmm/CMAPTorsionForce.h"
+#include "openmm/CMMotionRemover.h"
+#include "openmm/CustomAngleForce.h"
+#include "openmm/CustomBondForce.h"
+#include "openmm/CustomCompoundBondForce.h"
+#include "openmm/CustomExternalForce.h"
+#include "openmm/CustomNonbondedForce.h"
+#include "openmm/CustomTorsionForce.h"
+#include "openmm/HarmonicAngleForce.h"
+#include "openmm/HarmonicBondForce.h"
+#include "openmm/MonteCarloAnisotropicBarostat.h"
+#include "openmm/MonteCarloBarostat.h"
+#include "openmm/MonteCarloMembraneBarostat.h"
+#include "openmm/NonbondedForce.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/PeriodicTorsionForce.h"
+#include "openmm/RBTorsionForce.h"
+#include "openmm/System.h"
+#include <cstdlib>
+#include <iostream>
+
+using namespace OpenMM;
+using namespace std;
+
+class MetalForceGroupSchedule::InvalidateListener : public ComputeContext::ReorderListener {
+public:
+    InvalidateListener(MetalForceGroupSchedule& schedule) : schedule(schedule) {
+    }
+    void execute() {
+        // The cached forces are stored in the old atom order.
+
+        schedule.invalidate();
+    }
+private:
+    MetalForceGroupSchedule& schedule;
+};
+
+MetalForceGroupSchedule::MetalForceGroupSchedule(MetalContext& context, const System& system) : context(context), system(system), state(Idle), slowGroups(0), innerSteps(1),
+        period(1), pendingGroups(0), fastEvaluations(0), cachedEvaluation(-1), numCachedEvaluations(0), cachedStep(-1), cacheValid(false), countsAsFast(false),
+        countsAsSlow(false), slowRequest(false) {
+    char *optionSlowGroups = getenv("OPENMM_METAL_SLOW_FORCE_GROUPS");
+    if (optionSlowGroups != nullptr) {
+      char *end;
+      long groups = strtol(optionSlowGroups, &end, 10);
+      if (end == optionSlowGroups || *end != '\0' || groups < 0 || groups > 0x7FFFFFFF) {
+        std::cout << std::endl;
+        std::cout << METAL_LOG_HEADER << "Error: Invalid option for ";
+        std::cout << "'OPENMM_METAL_SLOW_FORCE_GROUPS'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Specified '" << optionSlowGroups << "', but ";
+        std::cout << "expected a bit mask of force groups between '0' and '2147483647'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Quitting now." << std::endl;
+        exit(9);
+      }
+      int force = findUnskippableForce((int) groups);
+      if (force != -1) {
+        std::cout << std::endl;
+        std::cout << METAL_LOG_HEADER << "Error: Invalid option for ";
+        std::cout << "'OPENMM_METAL_SLOW_FORCE_GROUPS'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Force " << force << " is in a slow group, but ";
+        std::cout << "launches its own kernels, so it can't use the cached forces." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Quitting now." << std::endl;
+        exit(9);
+      }
+      slowGroups = (int) groups;
+    }
+    
+    char *optionInnerSteps = getenv("OPENMM_METAL_MTS_INNER_STEPS");
+    if (optionInnerSteps != nullptr) {
+      char *end;
+      long steps = strtol(optionInnerSteps, &end, 10);
+      if (end == optionInnerSteps || *end != '\0' || steps < 1 || steps > 1000) {
+        std::cout << std::endl;
+        std::cout << METAL_LOG_HEADER << "Error: Invalid option for ";
+        std::cout << "'OPENMM_METAL_MTS_INNER_STEPS'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Specified '" << optionInnerSteps << "', but ";
+        std::cout << "expected a number between '1' and '1000'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Quitting now." << std::endl;
+        exit(9);
+      }
+      innerSteps = (int) steps;
+    }
+    period = innerSteps;
+    context.addReorderListener(new InvalidateListener(*this));
+}
+
+void MetalForceGroupSchedule::setSchedule(int slowGroups, int innerSteps) {
+    if (innerSteps < 1)
+        throw OpenMMException("MetalForceGroupSchedule: innerSteps must be at least 1");
+    int force = findUnskippableForce(slowGroups);
+    if (force != -1)
+        throw OpenMMException("MetalForceGroupSchedule: force "+context.intToString(force)+" is in a slow group, but launches its own kernels, so it can't use the cached forces");
+    this->slowGroups = slowGroups;
+    this->innerSteps = innerSteps;
+    period = innerSteps;
+    fastEvaluations = 0;
+    cacheValid = false;
+}
+
+int MetalForceGroupSchedule::findUnskippableForce(int groups) const {
+    for (int i = 0; i < system.getNumForces(); i++) {
+        const Force& force = system.getForce(i);
+        const NonbondedForce* nonbonded = dynamic_cast<const NonbondedForce*>(&force);
+        int forceGroups = 1<<force.getForceGroup();
+        if (nonbonded != NULL && nonbonded->getReciprocalSpaceForceGroup() >= 0)
+            forceGroups |= 1<<nonbonded->getReciprocalSpaceForceGroup();
+        if ((forceGroups&groups) == 0)
+            continue;
+
+        // These do all their work in the bonded or nonbonded utilities, check for the cache
+        // themselves, or compute no forces at all.
+
+        const CustomNonbondedForce* customNonbonded = dynamic_cast<const CustomNonbondedForce*>(&force);
+        if (customNonbonded != NULL) {
+            if (customNonbonded->getNumInteractionGroups() == 0)
+                continue;
+        }
+        else if (nonbonded != NULL || dynamic_cast<const HarmonicBondForce*>(&force) != NULL || dynamic_cast<const HarmonicAngleForce*>(&force) != NULL ||
+                dynamic_cast<const PeriodicTorsionForce*>(&force) != NULL || dynamic_cast<const RBTorsionForce*>(&force) != NULL ||
+                dynamic_cast<const CMAPTorsionForce*>(&force) != NULL || dynamic_cast<const CustomBondForce*>(&force) != NULL ||
+                dynamic_cast<const CustomAngleForce*>(&force) != NULL || dynamic_cast<const CustomTorsionForce*>(&force) != NULL ||
+                dynamic_cast<const CustomExternalForce*>(&force) != NULL || dynamic_cast<const CustomCompoundBondForce*>(&force) != NULL ||
+                dynamic_cast<const CMMotionRemover*>(&force) != NULL || dynamic_cast<const AndersenThermostat*>(&force) != NULL ||
+                dynamic_cast<const MonteCarloBarostat*>(&force) != NULL || dynamic_cast<const MonteCarloAnisotropicBarostat*>(&force) != NULL ||
+                dynamic_cast<const MonteCarloMembraneBarostat*>(&force) != NULL)
+            continue;
+        return i;
+    }
+    return -1;
+}
+
+int MetalForceGroupSchedule::beginEvaluation(int groups, bool includeForces, bool includeEnergy) {
+    // An evaluation started from inside the slow pass is that pass itself.
+
+    if (state == SlowPass)
+        return 0;
+    state = Idle;
+    countsAsFast = false;
+    countsAsSlow = false;
+    slowRequest = false;
+    if (slowGroups == 0 || context.getPlatformData().contexts.size() > 1 || context.getEnergyParamDerivNames().size() > 0) {
+        cacheValid = false;
+        return 0;
+    }
+    bool forcesOnly = (includeForces && !includeEnergy);
+    countsAsSlow = ((groups&slowGroups) != 0);
+    countsAsFast = (forcesOnly && !countsAsSlow);
+    slowRequest = (forcesOnly && groups == slowGroups);
+    if (cacheValid && slowRequest && context.getComputeForceCount() == cachedEvaluation && context.getStepCount() == cachedStep) {
+        state = CachedPass;
+        numCachedEvaluations++;
+        return 0;
+    }
+    cacheValid = false;
+    if (countsAsFast && (fastEvaluations+1)%period == 0) {
+        // This is the last fast evaluation of the outer step, so the slow groups come next.
+
+        state = SlowPass;
+        pendingGroups = groups;
+        return slowGroups;
+    }
+    return 0;
+}
+
+void MetalForceGroupSchedule::finishSlowPass(bool valid) {
+    if (!valid) {
+        // Let the requested evaluation run on its own.  The slow groups will be computed
+        // separately when they are requested.
+
+        state = Idle;
+        return;
+    }
+    MetalArray& forces = context.getLongForceBuffer();
+    if (!cachedForces.isInitialized())
+        cachedForces.initialize(context, forces.getSize(), forces.getElementSize(), "cachedForces");
+    forces.copyTo(cachedForces);
+    context.clearBuffer(forces);
+    context.clearBuffer(context.getForceBuffers());
+    state = SharedPass;
+}
+
+void MetalForceGroupSchedule::loadCachedForces() {
+    cachedForces.copyTo(context.getLongForceBuffer());
+}
+
+void MetalForceGroupSchedule::finishEvaluation(bool valid) {
+    if (state == SlowPass)
+        return;
+    cacheValid = false;
+    if (valid) {
+        if (state == SharedPass) {
+            cacheValid = true;
+            cachedEvaluation = context.getComputeForceCount();
+            cachedStep = context.getStepCount();
+        }
+        if (countsAsSlow) {
+            // If the integrator asked for the slow groups after a different number of fast
+            // evaluations than expected (for example, because it recomputes the fast forces at
+            // the start of each outer step), follow the pattern it actually uses.
+
+            if (slowRequest && state != CachedPass && fastEvaluations > 0)
+                period = fastEvaluations;
+            fastEvaluations = 0;
+        }
+        else if (countsAsFast)
+            fastEvaluations++;
+    }
+    state = Idle;
+}
@@ -26,17 +26,65 @@
 
 #include "MetalIntegrationUtilities.h"
 #include "MetalContext.h"
+#include "MetalLogging.h"
+#include <cstring>
+#include <iostream>
 
 using namespace OpenMM;
 using namespace std;
 
-MetalIntegrationUtilities::MetalIntegrationUtilities(MetalContext& context, const System& system) : IntegrationUtilities(context, system) {
+static const int MaxCcmaIterations = 150;
+static const int CcmaCheckInterval = 4;
+static const int NumCcmaStatusReads = (MaxCcmaIterations+CcmaCheckInterval-1)/CcmaCheckInterval;
+static const int CcmaStatusSlots = 4;
+
+MetalIntegrationUtilities::MetalIntegrationUtilities(MetalContext& context, const System& system) : IntegrationUtilities(context, system),
+        ccmaStatusBuffer(NULL), ccmaConvergenceMode(DeviceConvergence), ccmaNumConvergenceFailures(0) {
         ccmaConvergedHostBuffer.initialize<cl_int>(context, 1, "CcmaConvergedHostBuffer", CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR);
         // Different communication mechanisms give optimal performance on AMD and on NVIDIA.
         string vendor = context.getDevice().getInfo<CL_DEVICE_VENDOR>();
         
         ccmaUseDirectBuffer = (vendor.size() >= 3 && vendor.substr(0, 3) == "AMD") ||
                               (vendor.size() >= 28 && vendor.substr(0, 28) == "Advanced Micro Devices, Inc.");
+        
+        char *optionDeviceConvergence = getenv("OPENMM_METAL_CCMA_DEVICE_CONVERGENCE");
+        if (optionDeviceConvergence != nullptr) {
+          if (strcmp(optionDeviceConvergence, "0") == 0) {
+            ccmaConvergenceMode = HostConvergence;
+          } else if (strcmp(optionDeviceConvergence, "1") == 0) {
+            ccmaConvergenceMode = DeviceConvergence;
+          } else if (strcmp(optionDeviceConvergence, "2") == 0) {
+            ccmaConvergenceMode = AsyncDeviceConvergence;
+          } else {
+            std::cout << std::endl;
+            std::cout << METAL_LOG_HEADER << "Error: Invalid option for ";
+            std::cout << "'OPENMM_METAL_CCMA_DEVICE_CONVERGENCE'." << std::endl;
+            std::cout << METAL_LOG_HEADER << "Specified '" << optionDeviceConvergence << "', but ";
+            std::cout << "expected either '0', '1', or '2'." << std::endl;
+            std::cout << METAL_LOG_HEADER << "Quitting now." << std::endl;
+            exit(7);
+          }
+        }
+        if (ccmaConvergenceMode != HostConvergence) {
+            // Positions and velocities each have their own ring of status words, so the results
+            // of a few calls can be pending at once without overwriting each other.
+            
+            int size = 2*CcmaStatusSlots*NumCcmaStatusReads*sizeof(cl_int);
+            ccmaStatusBuffer = new cl::Buffer(context.getContext(), CL_MEM_ALLOC_HOST_PTR, size);
+            ccmaStatusMemory = (int*) context.getQueue().enqueueMapBuffer(*ccmaStatusBuffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size);
+            for (int i = 0; i < 2; i++) {
+                ccmaPredictedIterations[i] = MaxCcmaIterations/2;
+                ccmaNextStatusSlot[i] = 0;
+                ccmaStatusEvent[i].resize(CcmaStatusSlots);
+                ccmaNumIterations[i].resize(CcmaStatusSlots, 0);
+                ccmaNumStatusReadsPending[i].resize(CcmaStatusSlots, 0);
+            }
+        }
+}
+
+MetalIntegrationUtilities::~MetalIntegrationUtilities() {
+    if (ccmaStatusBuffer != NULL)
+        delete ccmaStatusBuffer;
 }
 
 MetalArray& MetalIntegrationUtilities::getPosDelta() {
@@ -95,25 +143,76 @@ void MetalIntegrationUtilities::applyConstraintsImpl(bool constrainVelocities, d
             else
                 ccmaForceKernel->setArg(7, (float) tol);
             ccmaDirectionsKernel->execute(ccmaConstraintAtoms.getSize());
-            const int checkInterval = 4;
             MetalContext& cl = dynamic_cast<MetalContext&>(context);
             cl::CommandQueue queue = cl.getQueue();
+            ccmaUpdateKernel->setArg(4, constrainVelocities ? context.getVelm() : posDelta);
+            int firstIteration = 0;
+            if (ccmaConvergenceMode != HostConvergence) {
+                // Enqueue a batch of iterations at once.  Once the device finds that the
+                // constraints have converged, the remaining kernels return immediately.  The
+                // convergence flag is copied to pinned memory every few iterations without
+                // waiting for it, and later calls use those values to decide how many
+                // iterations to enqueue.
+
+                int mode = (constrainVelocities ? 1 : 0);
+                updateCcmaIterationEstimate(mode, false);
+                int slot = ccmaNextStatusSlot[mode];
+                if (ccmaNumStatusReadsPending[mode][slot] > 0) {
+                    // The device is several calls behind, and this slot still holds results
+                    // that have not been checked.
+
+                    ccmaStatusEvent[mode][slot].wait();
+                    updateCcmaIterationEstimate(mode, false);
+                }
+                ccmaNextStatusSlot[mode] = (slot+1)%CcmaStatusSlots;
+                int predicted = ccmaPredictedIterations[mode];
+                int numIterations = min(MaxCcmaIterations, max(2*predicted, predicted+8));
+                int* status = ccmaStatusMemory+(mode*CcmaStatusSlots+slot)*NumCcmaStatusReads;
+                int numReads = 0;
+                for (int i = 0; i < numIterations; i++) {
+                    ccmaForceKernel->setArg(8, i);
+                    ccmaForceKernel->execute(ccmaConstraintAtoms.getSize());
+                    if ((i+1)%CcmaCheckInterval == 0 || i == numIterations-1) {
+                        cl::Event* event = (i == numIterations-1 ? &ccmaStatusEvent[mode][slot] : NULL);
+                        queue.enqueueReadBuffer(cl.unwrap(ccmaConverged).getDeviceBuffer(), CL_FALSE, (i%2)*sizeof(int), sizeof(int), status+numReads, NULL, event);
+                        numReads++;
+                    }
+                    ccmaMultiplyKernel->setArg(5, i);
+                    ccmaMultiplyKernel->execute(ccmaConstraintAtoms.getSize());
+                    ccmaUpdateKernel->setArg(9, i);
+                    ccmaUpdateKernel->execute(context.getNumAtoms());
+                }
+                ccmaNumIterations[mode][slot] = numIterations;
+                ccmaNumStatusReadsPending[mode][slot] = numReads;
+                if (ccmaConvergenceMode == AsyncDeviceConvergence || numIterations == MaxCcmaIterations)
+                    return;
+
+                // Wait once to make sure the batch was enough.  If it was not, continue with the
+                // host checking for convergence, which reports a failure itself.
+
+                ccmaStatusEvent[mode][slot].wait();
+                if (status[numReads-1])
+                    return;
+                ccmaPredictedIterations[mode] = MaxCcmaIterations;
+                ccmaNumStatusReadsPending[mode][slot] = 0;
+                firstIteration = numIterations;
+            }
             int* converged = (int*) context.getPinnedBuffer();
             int* ccmaConvergedHostMemory = (int*) queue.enqueueMapBuffer(ccmaConvergedHostBuffer.getDeviceBuffer(), CL_TRUE, CL_MAP_WRITE, 0, sizeof(cl_int));
             ccmaConvergedHostMemory[0] = 0;
             queue.enqueueUnmapMemObject(ccmaConvergedHostBuffer.getDeviceBuffer(), ccmaConvergedHostMemory);
-            ccmaUpdateKernel->setArg(4, constrainVelocities ? context.getVelm() : posDelta);
-            for (int i = 0; i < 150; i++) {
+            bool hasConverged = false;
+            for (int i = firstIteration; i < MaxCcmaIterations; i++) {
                 ccmaForceKernel->setArg(8, i);
                 ccmaForceKernel->execute(ccmaConstraintAtoms.getSize());
                 cl::Event event;
-                if ((i+1)%checkInterval == 0 && !ccmaUseDirectBuffer)
+                if ((i+1)%CcmaCheckInterval == 0 && !ccmaUseDirectBuffer)
                     queue.enqueueReadBuffer(cl.unwrap(ccmaConverged).getDeviceBuffer(), CL_FALSE, 0, 2*sizeof(int), converged, NULL, &event);
                 ccmaMultiplyKernel->setArg(5, i);
                 ccmaMultiplyKernel->execute(ccmaConstraintAtoms.getSize());
                 ccmaUpdateKernel->setArg(9, i);
                 ccmaUpdateKernel->execute(context.getNumAtoms());
-                if ((i+1)%checkInterval == 0) {
+                if ((i+1)%CcmaCheckInterval == 0) {
                     if (ccmaUseDirectBuffer) {
                         ccmaConvergedHostMemory = (int*) queue.enqueueMapBuffer(ccmaConvergedHostBuffer.getDeviceBuffer(), CL_FALSE, CL_MAP_READ, 0, sizeof(cl_int), NULL, &event);
                         queue.flush();
@@ -124,14 +223,65 @@ void MetalIntegrationUtilities::applyConstraintsImpl(bool constrainVelocities, d
                     }
                     else
                         event.wait();
-                    if (converged[i%2])
+                    if (converged[i%2]) {
+                        hasConverged = true;
                         break;
+                    }
                 }
             }
+            if (!hasConverged)
+                reportCcmaConvergenceFailure();
         }
     }
 }
 
+void MetalIntegrationUtilities::updateCcmaIterationEstimate(int mode, bool wait) {
+    // Check the pending calls from oldest to newest.  The queue executes in order, so once one
+    // is still running, the later ones are too.
+
+    for (int k = 0; k < CcmaStatusSlots; k++) {
+        int slot = (ccmaNextStatusSlot[mode]+k)%CcmaStatusSlots;
+        if (ccmaNumStatusReadsPending[mode][slot] == 0)
+            continue;
+        if (wait)
+            ccmaStatusEvent[mode][slot].wait();
+        else if (ccmaStatusEvent[mode][slot].getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() != CL_COMPLETE)
+            return;
+
+        // Find the first check at which the constraints had converged.  If they never did, the
+        // call was left less converged than the tolerance, and the maximum number of iterations
+        // is enqueued next time.
+
+        int* status = ccmaStatusMemory+(mode*CcmaStatusSlots+slot)*NumCcmaStatusReads;
+        int needed = MaxCcmaIterations;
+        bool hasConverged = false;
+        for (int i = 0; i < ccmaNumStatusReadsPending[mode][slot]; i++)
+            if (status[i]) {
+                needed = min(CcmaCheckInterval*(i+1), ccmaNumIterations[mode][slot]);
+                hasConverged = true;
+                break;
+            }
+        if (!hasConverged)
+            reportCcmaConvergenceFailure();
+        ccmaPredictedIterations[mode] = needed;
+        ccmaNumStatusReadsPending[mode][slot] = 0;
+    }
+}
+
+void MetalIntegrationUtilities::reportCcmaConvergenceFailure() {
+    if (ccmaNumConvergenceFailures++ == 0) {
+        std::cout << METAL_LOG_HEADER << "Warning: CCMA stopped before the constraints converged to the requested tolerance." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Later failures will not be reported." << std::endl;
+    }
+}
+
+int MetalIntegrationUtilities::getNumCcmaConvergenceFailures() {
+    if (ccmaConvergenceMode != HostConvergence)
+        for (int mode = 0; mode < 2; mode++)
+            updateCcmaIterationEstimate(mode, true);
+    return ccmaNumConvergenceFailures;
+}
+
 void MetalIntegrationUtilities::distributeForcesFromVirtualSites() {
     if (numVsites > 0) {
         vsiteForceKernel->setArg(2, context.getLongForceBuffer());
@@ -27,19 +27,59 @@
 #include "MetalKernel.h"
 #include "openmm/common/ComputeArray.h"
 #include "openmm/internal/AssertionUtilities.h"
+#include "openmm/OpenMMException.h"
+#include <sstream>
 
 using namespace OpenMM;
 using namespace std;
 
-MetalKernel::MetalKernel(MetalContext& context, cl::Kernel kernel) : context(context), kernel(kernel) {
+MetalKernel::MetalKernel(MetalContext& context, cl::Kernel kernel) : context(context), kernel(kernel), isResolved(true) {
+    name = kernel.getInfo<CL_KERNEL_FUNCTION_NAME>();
+}
+
+MetalKernel::MetalKernel(MetalContext& context, shared_future<cl::Program> program, const string& name) :
+        context(context), program(program), name(name), isResolved(false) {
+}
+
+cl::Kernel& MetalKernel::getKernel() const {
+    if (!isResolved) {
+        // Any arguments that were set before the program was compiled get applied now.
+
+        kernel = lookUpKernel(program, name);
+        isResolved = true;
+        for (auto& arg : pendingArgs)
+            kernel.setArg(arg.first, arg.second.size(), arg.second.data());
+        for (auto& arg : pendingLocalArgs)
+            kernel.setArg(arg.first, arg.second, NULL);
+        pendingArgs.clear();
+        pendingLocalArgs.clear();
+    }
+    return kernel;
+}
+
+cl::Kernel MetalKernel::lookUpKernel(const shared_future<cl::Program>& program, const string& name) {
+    // A build that failed in the background is only reported here, which may be long after
+    // the program was submitted, so say which kernel needed it.
+
+    try {
+        return cl::Kernel(program.get(), name.c_str());
+    }
+    catch (OpenMMException& ex) {
+        throw OpenMMException("Error compiling the program for kernel "+name+": "+ex.what());
+    }
+    catch (cl::Error& err) {
+        stringstream str;
+        str<<"Error creating kernel "<<name<<": "<<err.what()<<" ("<<err.err()<<")";
+        throw OpenMMException(str.str());
+    }
 }
 
 string MetalKernel::getName() const {
-    return kernel.getInfo<CL_KERNEL_FUNCTION_NAME>();
+    return name;
 }
 
 int MetalKernel::getMaxBlockSize() const {
-    return kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(context.getDevice());
+    return getKernel().getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(context.getDevice());
 }
 
 void MetalKernel::execute(int threads, int blockSize) {
@@ -47,6 +87,7 @@ void MetalKernel::execute(int threads, int blockSize) {
     // possible resize() will get called on an array, causing its internal storage to be
     // recreated.
     
+    cl::Kernel& kernel = getKernel();
     for (int i = 0; i < arrayArgs.size(); i++)
         if (arrayArgs[i] != NULL)
             kernel.setArg<cl::Buffer>(i, arrayArgs[i]->getDeviceBuffer());
@@ -78,5 +119,17 @@ void MetalKernel::setPrimitiveArg(int index, const void* value, int size) {
     ASSERT_VALID_INDEX(index, arrayArgs);
     // The const_cast is needed because of a bug in the Metal C++ wrappers.  clSetKernelArg()
     // declares the value to be const, but the C++ wrapper doesn't.
-    kernel.setArg(index, size, const_cast<void*>(value));
+    if (isResolved)
+        kernel.setArg(index, size, const_cast<void*>(value));
+    else if (value == NULL) {
+        // A NULL value allocates local memory of the given size, so there are no bytes to copy.
+
+        pendingArgs.erase(index);
+        pendingLocalArgs[index] = size;
+    }
+    else {
+        const char* bytes = (const char*) value;
+        pendingLocalArgs.erase(index);
+        pendingArgs[index] = vector<char>(bytes, bytes+size);
+    }
 }
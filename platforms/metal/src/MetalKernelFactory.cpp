@@ -28,12 +28,49 @@
 #include "MetalParallelKernels.h"
 #include "openmm/common/CommonKernels.h"
 #include "openmm/internal/ContextImpl.h"
+#include "openmm/CustomIntegrator.h"
+#include "openmm/CustomNonbondedForce.h"
 #include "openmm/OpenMMException.h"
 
 using namespace OpenMM;
 
 KernelImpl* MetalKernelFactory::createKernelImpl(std::string name, const Platform& platform, ContextImpl& context) const {
     MetalPlatform::PlatformData& data = *static_cast<MetalPlatform::PlatformData*>(context.getPlatformData());
+    if (data.numReplicas > 1) {
+        // These kernels either loop over all pairs of atoms without using the neighbor list, or
+        // compute a quantity for the whole System, so they would couple separate replicas.
+
+        if (name == CalcGBSAOBCForceKernel::Name() || name == CalcCustomGBForceKernel::Name() || name == CalcCustomHbondForceKernel::Name() ||
+                name == CalcCustomManyParticleForceKernel::Name() || name == CalcGayBerneForceKernel::Name() || name == CalcCustomCVForceKernel::Name() ||
+                name == ApplyMonteCarloBarostatKernel::Name() || name == RemoveCMMotionKernel::Name() || name == CalcRMSDForceKernel::Name() ||
+                name == IntegrateNoseHooverStepKernel::Name() || name == IntegrateVariableVerletStepKernel::Name() ||
+                name == IntegrateVariableLangevinStepKernel::Name())
+            throw OpenMMException("The kernel '"+name+"' cannot be used with batched replicas");
+
+        // The long range correction averages over every pair of particle types in the System, and
+        // global sums in a CustomIntegrator add up every replica.
+
+        if (name == CalcCustomNonbondedForceKernel::Name()) {
+            const System& system = context.getSystem();
+            for (int i = 0; i < system.getNumForces(); i++) {
+                const CustomNonbondedForce* force = dynamic_cast<const CustomNonbondedForce*>(&system.getForce(i));
+                if (force != NULL && force->getUseLongRangeCorrection())
+                    throw OpenMMException("CustomNonbondedForce: the long range correction cannot be used with batched replicas");
+            }
+        }
+        if (name == IntegrateCustomStepKernel::Name()) {
+            const CustomIntegrator* integrator = dynamic_cast<const CustomIntegrator*>(&context.getIntegrator());
+            if (integrator != NULL) {
+                for (int i = 0; i < integrator->getNumComputations(); i++) {
+                    CustomIntegrator::ComputationType type;
+                    std::string variable, expression;
+                    integrator->getComputationStep(i, type, variable, expression);
+                    if (type == CustomIntegrator::ComputeSum)
+                        throw OpenMMException("CustomIntegrator: global sums cannot be used with batched replicas");
+                }
+            }
+        }
+    }
     if (data.contexts.size() > 1) {
         // We are running in parallel on multiple devices, so we may want to create a parallel kernel.
         
@@ -71,8 +108,11 @@ KernelImpl* MetalKernelFactory::createKernelImpl(std::string name, const Platfor
         return new MetalCalcForcesAndEnergyKernel(name, platform, cl);
     if (name == UpdateStateDataKernel::Name())
         return new MetalUpdateStateDataKernel(name, platform, cl);
-    if (name == ApplyConstraintsKernel::Name())
+    if (name == ApplyConstraintsKernel::Name()) {
+        if (cl.getUseFloatFloatPrecision())
+            return new MetalApplyConstraintsKernel(name, platform, cl);
         return new CommonApplyConstraintsKernel(name, platform, cl);
+    }
     if (name == VirtualSitesKernel::Name())
         return new CommonVirtualSitesKernel(name, platform, cl);
     if (name == CalcHarmonicBondForceKernel::Name())
@@ -115,12 +155,22 @@ KernelImpl* MetalKernelFactory::createKernelImpl(std::string name, const Platfor
         return new CommonCalcCustomManyParticleForceKernel(name, platform, cl, context.getSystem());
     if (name == CalcGayBerneForceKernel::Name())
         return new CommonCalcGayBerneForceKernel(name, platform, cl);
-    if (name == IntegrateVerletStepKernel::Name())
+    if (cl.getUseFloatFloatPrecision() && (name == IntegrateLangevinStepKernel::Name() || name == IntegrateBrownianStepKernel::Name() ||
+            name == IntegrateVariableVerletStepKernel::Name() || name == IntegrateVariableLangevinStepKernel::Name() ||
+            name == IntegrateCustomStepKernel::Name() || name == IntegrateNoseHooverStepKernel::Name()))
+        throw OpenMMException("The kernel '"+name+"' cannot be used with mixed precision.  Use VerletIntegrator or LangevinMiddleIntegrator, or single precision");
+    if (name == IntegrateVerletStepKernel::Name()) {
+        if (cl.getUseFloatFloatPrecision())
+            return new MetalIntegrateVerletStepKernel(name, platform, cl);
         return new CommonIntegrateVerletStepKernel(name, platform, cl);
+    }
     if (name == IntegrateLangevinStepKernel::Name())
         return new CommonIntegrateLangevinStepKernel(name, platform, cl);
-    if (name == IntegrateLangevinMiddleStepKernel::Name())
+    if (name == IntegrateLangevinMiddleStepKernel::Name()) {
+        if (cl.getUseFloatFloatPrecision())
+            return new MetalIntegrateLangevinMiddleStepKernel(name, platform, cl);
         return new CommonIntegrateLangevinMiddleStepKernel(name, platform, cl);
+    }
     if (name == IntegrateBrownianStepKernel::Name())
         return new CommonIntegrateBrownianStepKernel(name, platform, cl);
     if (name == IntegrateVariableVerletStepKernel::Name())
@@ -129,13 +179,22 @@ KernelImpl* MetalKernelFactory::createKernelImpl(std::string name, const Platfor
         return new CommonIntegrateVariableLangevinStepKernel(name, platform, cl);
     if (name == IntegrateCustomStepKernel::Name())
         return new CommonIntegrateCustomStepKernel(name, platform, cl);
-    if (name == ApplyAndersenThermostatKernel::Name())
+    if (name == ApplyAndersenThermostatKernel::Name()) {
+        if (cl.getUseFloatFloatPrecision())
+            return new MetalApplyAndersenThermostatKernel(name, platform, cl);
         return new CommonApplyAndersenThermostatKernel(name, platform, cl);
+    }
     if (name == IntegrateNoseHooverStepKernel::Name())
         return new CommonIntegrateNoseHooverStepKernel(name, platform, cl);
-    if (name == ApplyMonteCarloBarostatKernel::Name())
+    if (name == ApplyMonteCarloBarostatKernel::Name()) {
+        if (cl.getUseFloatFloatPrecision())
+            return new MetalApplyMonteCarloBarostatKernel(name, platform, cl);
         return new CommonApplyMonteCarloBarostatKernel(name, platform, cl);
-    if (name == RemoveCMMotionKernel::Name())
+    }
+    if (name == RemoveCMMotionKernel::Name()) {
+        if (cl.getUseFloatFloatPrecision())
+            return new MetalRemoveCMMotionKernel(name, platform, cl);
         return new CommonRemoveCMMotionKernel(name, platform, cl);
+    }
     throw OpenMMException((std::string("Tried to create kernel with illegal kernel name '")+name+"'").c_str());
 }
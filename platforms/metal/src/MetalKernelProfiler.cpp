@@ -0,0 +1,220 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#include "MetalKernelProfiler.h"
+#include "openmm/OpenMMException.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace OpenMM;
+using namespace std;
+
+MetalKernelProfiler::MetalKernelProfiler(bool available, int capacity) : available(available), enabled(available), capacity(capacity),
+        flushInterval(500), nextRecord(0), output(NULL), outputIsStdout(false), outputIsEmpty(true), traceStartTime(0) {
+    if (capacity < 1)
+        throw OpenMMException("MetalKernelProfiler: capacity must be positive");
+}
+
+MetalKernelProfiler::~MetalKernelProfiler() {
+    closeOutput();
+}
+
+void MetalKernelProfiler::setEnabled(bool enabled) {
+    this->enabled = enabled;
+}
+
+void MetalKernelProfiler::setCapacity(int capacity) {
+    if (capacity < 1)
+        throw OpenMMException("MetalKernelProfiler: capacity must be positive");
+    vector<Record> ordered = getRecords();
+    lock_guard<mutex> guard(lock);
+    if (ordered.size() > capacity)
+        ordered.erase(ordered.begin(), ordered.end()-capacity);
+    records = ordered;
+    nextRecord = 0;
+    this->capacity = capacity;
+}
+
+void MetalKernelProfiler::setFlushInterval(int interval) {
+    if (interval < 1)
+        throw OpenMMException("MetalKernelProfiler: flush interval must be positive");
+    flushInterval = interval;
+}
+
+void MetalKernelProfiler::setCallback(function<void(const Record&)> callback) {
+    lock_guard<mutex> guard(lock);
+    this->callback = callback;
+}
+
+void MetalKernelProfiler::setOutputFile(const string& path) {
+    lock_guard<mutex> guard(lock);
+    closeOutput();
+    if (path.size() == 0)
+        return;
+    if (path == "-") {
+        output = stdout;
+        outputIsStdout = true;
+    }
+    else {
+        output = fopen(path.c_str(), "w");
+        if (output == NULL)
+            throw OpenMMException("MetalKernelProfiler: could not open "+path+" for writing");
+        outputIsStdout = false;
+    }
+    outputIsEmpty = true;
+    fprintf(output, "[ ");
+}
+
+void MetalKernelProfiler::closeOutput() {
+    if (output == NULL)
+        return;
+    fprintf(output, " ]\n");
+    if (outputIsStdout)
+        fflush(output);
+    else
+        fclose(output);
+    output = NULL;
+}
+
+void MetalKernelProfiler::addEvent(const cl::Event& event, cl::Kernel& kernel, int globalSize, int blockSize, cl::CommandQueue& queue) {
+    PendingEvent pendingEvent;
+    pendingEvent.event = event;
+    pendingEvent.name = kernel.getInfo<CL_KERNEL_FUNCTION_NAME>();
+    pendingEvent.globalSize = globalSize;
+    pendingEvent.blockSize = blockSize;
+    bool needsFlush;
+    {
+        lock_guard<mutex> guard(lock);
+        map<cl_command_queue, int>::iterator index = queueIndex.find(queue());
+        if (index == queueIndex.end())
+            index = queueIndex.insert(make_pair(queue(), (int) queueIndex.size())).first;
+        pendingEvent.queue = index->second;
+        pending.push_back(pendingEvent);
+        needsFlush = (pending.size() >= flushInterval);
+    }
+    if (needsFlush)
+        flush();
+}
+
+void MetalKernelProfiler::flush() {
+    vector<PendingEvent> events;
+    {
+        lock_guard<mutex> guard(lock);
+        events.swap(pending);
+    }
+    for (PendingEvent& pendingEvent : events) {
+        pendingEvent.event.wait();
+        cl_ulong start, end;
+        pendingEvent.event.getProfilingInfo(CL_PROFILING_COMMAND_START, &start);
+        pendingEvent.event.getProfilingInfo(CL_PROFILING_COMMAND_END, &end);
+#if __APPLE__ && defined(__aarch64__)
+        // Workaround for Apple's OpenCL driver bug.
+        double scale = 125.0/3.0;
+#else
+        double scale = 1.0;
+#endif
+        Record record;
+        record.name = pendingEvent.name;
+        record.globalSize = pendingEvent.globalSize;
+        record.blockSize = pendingEvent.blockSize;
+        record.queue = pendingEvent.queue;
+        record.startTime = start*scale;
+        record.endTime = end*scale;
+        addRecord(record);
+    }
+}
+
+void MetalKernelProfiler::addRecord(const Record& record) {
+    function<void(const Record&)> recordCallback;
+    {
+        lock_guard<mutex> guard(lock);
+        if (records.size() < capacity)
+            records.push_back(record);
+        else {
+            records[nextRecord] = record;
+            nextRecord = (nextRecord+1)%capacity;
+        }
+        Totals& kernelTotals = totals[record.name];
+        kernelTotals.count++;
+        kernelTotals.totalTime += record.endTime-record.startTime;
+        if (output != NULL)
+            writeRecord(record);
+        recordCallback = callback;
+    }
+    if (recordCallback)
+        recordCallback(record);
+}
+
+void MetalKernelProfiler::writeRecord(const Record& record) {
+    if (traceStartTime == 0)
+        traceStartTime = record.startTime;
+    if (!outputIsEmpty)
+        fprintf(output, ",\n");
+    outputIsEmpty = false;
+    fprintf(output, "{ \"pid\":1, \"tid\":%d, \"ts\":%.6g, \"dur\":%g, \"ph\":\"X\", \"name\":\"%s\", \"args\":{ \"globalSize\":%d, \"blockSize\":%d } }",
+            record.queue+1, 0.001*(record.startTime-traceStartTime), 0.001*(record.endTime-record.startTime), record.name.c_str(), record.globalSize, record.blockSize);
+}
+
+vector<MetalKernelProfiler::Record> MetalKernelProfiler::getRecords() {
+    lock_guard<mutex> guard(lock);
+    vector<Record> ordered(records.begin()+nextRecord, records.end());
+    ordered.insert(ordered.end(), records.begin(), records.begin()+nextRecord);
+    return ordered;
+}
+
+vector<MetalKernelProfiler::Statistics> MetalKernelProfiler::getStatistics() {
+    lock_guard<mutex> guard(lock);
+    map<string, vector<double> > times;
+    for (const Record& record : records)
+        times[record.name].push_back(record.endTime-record.startTime);
+    vector<Statistics> result;
+    for (map<string, Totals>::const_iterator iter = totals.begin(); iter != totals.end(); ++iter) {
+        Statistics stats;
+        stats.name = iter->first;
+        stats.count = iter->second.count;
+        stats.totalTime = iter->second.totalTime;
+        stats.medianTime = 0;
+        stats.p99Time = 0;
+        vector<double>& kernelTimes = times[iter->first];
+        if (kernelTimes.size() > 0) {
+            // Use the nearest rank definition, so every percentile is a time that was measured.
+
+            sort(kernelTimes.begin(), kernelTimes.end());
+            int n = kernelTimes.size();
+            stats.medianTime = kernelTimes[max(0, (int) ceil(0.5*n)-1)];
+            stats.p99Time = kernelTimes[max(0, (int) ceil(0.99*n)-1)];
+        }
+        result.push_back(stats);
+    }
+    return result;
+}
+
+void MetalKernelProfiler::clear() {
+    lock_guard<mutex> guard(lock);
+    records.clear();
+    nextRecord = 0;
+    totals.clear();
+}
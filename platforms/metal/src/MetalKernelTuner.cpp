@@ -0,0 +1,127 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#include "MetalKernelTuner.h"
+#include "MetalContext.h"
+#include "openmm/OpenMMException.h"
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+
+using namespace OpenMM;
+using namespace std;
+
+MetalKernelTuner::MetalKernelTuner(MetalContext& context, const string& name, int problemSize) : context(context) {
+    stringstream description;
+    description << "MetalKernelTuner " << name << " " << getSizeBucket(problemSize) << " ";
+    if (context.getUseDoublePrecision())
+        description << "double";
+    else if (context.getUseMixedPrecision())
+        description << "mixed";
+    else
+        description << "single";
+    key = description.str();
+}
+
+bool MetalKernelTuner::loadResult(LaunchConfig& config) const {
+    string stored;
+    if (!context.loadTuningResult(key, stored))
+        return false;
+    stringstream in(stored);
+    LaunchConfig result;
+    if (!(in >> result.numGroups >> result.groupSize) || result.numGroups < 1 || result.groupSize < 1)
+        return false;
+    config = result;
+    return true;
+}
+
+MetalKernelTuner::LaunchConfig MetalKernelTuner::sweep(const vector<LaunchConfig>& candidates, const function<void(const LaunchConfig&)>& run,
+            const function<void()>& restore, vector<double>* times) {
+    const int iterations = 5;
+    LaunchConfig best = candidates[0];
+    double bestTime = -1;
+    if (times != NULL)
+        times->assign(candidates.size(), -1.0);
+    for (int candidate = 0; candidate < (int) candidates.size(); candidate++) {
+        const LaunchConfig& config = candidates[candidate];
+        vector<double> samples;
+        try {
+            // The first launch may compile the kernel or page in memory, so it is not timed.
+
+            restore();
+            run(config);
+            for (int i = 0; i < iterations; i++) {
+                restore();
+                context.getQueue().finish();
+                auto start = chrono::steady_clock::now();
+                run(config);
+                context.getQueue().finish();
+                samples.push_back(chrono::duration<double>(chrono::steady_clock::now()-start).count());
+            }
+        }
+        catch (OpenMMException& ex) {
+            // The device can't launch the kernel with these parameters.
+
+            continue;
+        }
+        catch (cl::Error& err) {
+            continue;
+        }
+
+        // Use the median, so a single interruption by the OS doesn't decide the result.
+
+        sort(samples.begin(), samples.end());
+        double time = samples[iterations/2];
+        if (times != NULL)
+            (*times)[candidate] = time;
+        if (bestTime < 0 || time < bestTime) {
+            best = config;
+            bestTime = time;
+        }
+    }
+    restore();
+    if (bestTime >= 0)
+        context.saveTuningResult(key, context.intToString(best.numGroups)+" "+context.intToString(best.groupSize));
+    return best;
+}
+
+int MetalKernelTuner::getSizeBucket(int problemSize) {
+    int bucket = 0;
+    while ((1LL<<bucket) < problemSize)
+        bucket++;
+    return bucket;
+}
+
+vector<MetalKernelTuner::LaunchConfig> MetalKernelTuner::getCandidates(const vector<int>& numGroups, const vector<int>& groupSizes, int maxThreads) {
+    vector<LaunchConfig> candidates;
+    for (int size : groupSizes)
+        for (int groups : numGroups) {
+            LaunchConfig config(groups, size);
+            if (groups >= 1 && size >= 1 && (long long) groups*size <= maxThreads && find(candidates.begin(), candidates.end(), config) == candidates.end())
+                candidates.push_back(config);
+        }
+    return candidates;
+}
@@ -32,6 +32,7 @@
 #include "CommonKernelSources.h"
 #include "MetalBondedUtilities.h"
 #include "MetalExpressionUtilities.h"
+#include "MetalForceGroupSchedule.h"
 #include "MetalIntegrationUtilities.h"
 #include "MetalNonbondedUtilities.h"
 #include "MetalKernelSources.h"
@@ -40,6 +41,7 @@
 #include <algorithm>
 #include <assert.h>
 #include <cmath>
+#include <cstring>
 #include <iterator>
 #include <set>
 
@@ -74,19 +76,49 @@ void MetalCalcForcesAndEnergyKernel::initialize(const System& system) {
 }
 
 void MetalCalcForcesAndEnergyKernel::beginComputation(ContextImpl& context, bool includeForces, bool includeEnergy, int groups) {
+    MetalForceGroupSchedule& schedule = cl.getForceGroupSchedule();
+    int slowGroups = schedule.beginEvaluation(groups, includeForces, includeEnergy);
+    if (slowGroups != 0) {
+        // This is the last fast evaluation of an outer step.  Evaluate the slow groups first, in a
+        // pass that also builds the neighbor list for the requested groups, and keep their forces
+        // on the device for the evaluation that will ask for them next.
+
+        bool slowValid = true;
+        beginComputation(context, true, false, slowGroups);
+        for (auto force : context.getForceImpls())
+            force->calcForcesAndEnergy(context, true, false, slowGroups);
+        finishComputation(context, true, false, slowGroups, slowValid);
+        schedule.finishSlowPass(slowValid);
+    }
     cl.setForcesValid(true);
-    cl.clearAutoclearBuffers();
+    if (cl.getStepsSinceReorder() >= cl.getReorderInterval() && cl.isStepBlockStart())
+        cl.forceReorder();
+    if (schedule.isUsingCachedForces()) {
+        cl.setComputeForceCount(cl.getComputeForceCount()+1);
+        return;
+    }
+    if (!schedule.isFollowingSlowPass())
+        cl.clearAutoclearBuffers();
     for (auto computation : cl.getPreComputations())
         computation->computeForceAndEnergy(includeForces, includeEnergy, groups);
     MetalNonbondedUtilities& nb = cl.getNonbondedUtilities();
     cl.setComputeForceCount(cl.getComputeForceCount()+1);
-    nb.prepareInteractions(groups);
+    if (!schedule.isFollowingSlowPass())
+        nb.prepareInteractions(schedule.getNeighborListGroups(groups));
     map<string, double>& derivs = cl.getEnergyParamDerivWorkspace();
     for (auto& param : context.getParameters())
         derivs[param.first] = 0;
 }
 
 double MetalCalcForcesAndEnergyKernel::finishComputation(ContextImpl& context, bool includeForces, bool includeEnergy, int groups, bool& valid) {
+    MetalForceGroupSchedule& schedule = cl.getForceGroupSchedule();
+    if (schedule.isUsingCachedForces()) {
+        // Virtual sites were already handled when the cached forces were computed.
+
+        schedule.loadCachedForces();
+        schedule.finishEvaluation(true);
+        return 0.0;
+    }
     cl.getBondedUtilities().computeInteractions(groups);
     cl.getNonbondedUtilities().computeInteractions(groups, includeForces, includeEnergy);
     double sum = 0.0;
@@ -98,6 +130,7 @@ double MetalCalcForcesAndEnergyKernel::finishComputation(ContextImpl& context, b
         sum += cl.reduceEnergy();
     if (!cl.getForcesValid())
         valid = false;
+    schedule.finishEvaluation(valid);
     return sum;
 }
 
@@ -132,7 +165,7 @@ void MetalUpdateStateDataKernel::getPositions(ContextImpl& context, vector<Vec3>
         mm_double4* posq = (mm_double4*) cl.getPinnedBuffer();
         cl.getPosq().download(posq);
     }
-    else if (cl.getUseMixedPrecision()) {
+    else if (cl.getUseMixedPrecision() || cl.getUseFloatFloatPrecision()) {
         mm_float4* posq = (mm_float4*) cl.getPinnedBuffer();
         cl.getPosq().download(posq, false);
         posCorrection.resize(numParticles);
@@ -143,6 +176,10 @@ void MetalUpdateStateDataKernel::getPositions(ContextImpl& context, vector<Vec3>
         cl.getPosq().download(posq);
     }
     
+    // The device is idle, so this is a good time to check whether the neighbor list has overflowed.
+    
+    cl.getNonbondedUtilities().checkNeighborListSize();
+    
     // Filling in the output array is done in parallel for speed.
     
     cl.getPlatformData().threads.execute([&] (ThreadPool& threads, int threadIndex) {
@@ -163,7 +200,7 @@ void MetalUpdateStateDataKernel::getPositions(ContextImpl& context, vector<Vec3>
                 positions[order[i]] = Vec3(pos.x, pos.y, pos.z)-boxVectors[0]*offset.x-boxVectors[1]*offset.y-boxVectors[2]*offset.z;
             }
         }
-        else if (cl.getUseMixedPrecision()) {
+        else if (cl.getUseMixedPrecision() || cl.getUseFloatFloatPrecision()) {
             mm_float4* posq = (mm_float4*) cl.getPinnedBuffer();
             for (int i = start; i < end; ++i) {
                 mm_float4 pos1 = posq[i];
@@ -185,6 +222,7 @@ void MetalUpdateStateDataKernel::getPositions(ContextImpl& context, vector<Vec3>
 }
 
 void MetalUpdateStateDataKernel::setPositions(ContextImpl& context, const vector<Vec3>& positions) {
+    cl.getForceGroupSchedule().invalidate();
     const vector<cl_int>& order = cl.getAtomIndex();
     int numParticles = context.getSystem().getNumParticles();
     if (cl.getUseDoublePrecision()) {
@@ -215,7 +253,7 @@ void MetalUpdateStateDataKernel::setPositions(ContextImpl& context, const vector
             posq[i] = mm_float4(0.0f, 0.0f, 0.0f, 0.0f);
         cl.getPosq().upload(posq);
     }
-    if (cl.getUseMixedPrecision()) {
+    if (cl.getUseMixedPrecision() || cl.getUseFloatFloatPrecision()) {
         mm_float4* posCorrection = (mm_float4*) cl.getPinnedBuffer();
         for (int i = 0; i < numParticles; ++i) {
             mm_float4& c = posCorrection[i];
@@ -235,25 +273,49 @@ void MetalUpdateStateDataKernel::setPositions(ContextImpl& context, const vector
 }
 
 void MetalUpdateStateDataKernel::getVelocities(ContextImpl& context, vector<Vec3>& velocities) {
-    const vector<cl_int>& order = cl.getAtomIndex();
     int numParticles = context.getSystem().getNumParticles();
     velocities.resize(numParticles);
-    if (cl.getUseDoublePrecision() || cl.getUseMixedPrecision()) {
-        mm_double4* velm = (mm_double4*) cl.getPinnedBuffer();
-        cl.getVelm().download(velm);
-        for (int i = 0; i < numParticles; ++i) {
-            mm_double4 vel = velm[i];
-            velocities[order[i]] = Vec3(vel.x, vel.y, vel.z);
-        }
+    bool useDouble = (cl.getUseDoublePrecision() || cl.getUseMixedPrecision());
+    bool useFloatFloat = cl.getUseFloatFloatPrecision();
+    vector<mm_float4> velCorrection;
+    if (useFloatFloat) {
+        cl.getVelm().download(cl.getPinnedBuffer(), false);
+        cl.getVelmCorrection().download(velCorrection);
     }
-    else {
-        mm_float4* velm = (mm_float4*) cl.getPinnedBuffer();
-        cl.getVelm().download(velm);
-        for (int i = 0; i < numParticles; ++i) {
-            mm_float4 vel = velm[i];
-            velocities[order[i]] = Vec3(vel.x, vel.y, vel.z);
+    else
+        cl.getVelm().download(cl.getPinnedBuffer());
+    
+    // Filling in the output array is done in parallel for speed.
+    
+    cl.getPlatformData().threads.execute([&] (ThreadPool& threads, int threadIndex) {
+        const vector<int>& order = cl.getAtomIndex();
+        int numThreads = threads.getNumThreads();
+        int start = threadIndex*numParticles/numThreads;
+        int end = (threadIndex+1)*numParticles/numThreads;
+        if (useDouble) {
+            mm_double4* velm = (mm_double4*) cl.getPinnedBuffer();
+            for (int i = start; i < end; ++i) {
+                mm_double4 vel = velm[i];
+                velocities[order[i]] = Vec3(vel.x, vel.y, vel.z);
+            }
         }
-    }
+        else if (useFloatFloat) {
+            mm_float4* velm = (mm_float4*) cl.getPinnedBuffer();
+            for (int i = start; i < end; ++i) {
+                mm_float4 vel1 = velm[i];
+                mm_float4 vel2 = velCorrection[i];
+                velocities[order[i]] = Vec3((double) vel1.x+(double) vel2.x, (double) vel1.y+(double) vel2.y, (double) vel1.z+(double) vel2.z);
+            }
+        }
+        else {
+            mm_float4* velm = (mm_float4*) cl.getPinnedBuffer();
+            for (int i = start; i < end; ++i) {
+                mm_float4 vel = velm[i];
+                velocities[order[i]] = Vec3(vel.x, vel.y, vel.z);
+            }
+        }
+    });
+    cl.getPlatformData().threads.waitForThreads();
 }
 
 void MetalUpdateStateDataKernel::setVelocities(ContextImpl& context, const vector<Vec3>& velocities) {
@@ -287,6 +349,20 @@ void MetalUpdateStateDataKernel::setVelocities(ContextImpl& context, const vecto
             velm[i] = mm_float4(0.0f, 0.0f, 0.0f, 0.0f);
         cl.getVelm().upload(velm);
     }
+    if (cl.getUseFloatFloatPrecision()) {
+        mm_float4* velCorrection = (mm_float4*) cl.getPinnedBuffer();
+        for (int i = 0; i < numParticles; ++i) {
+            mm_float4& c = velCorrection[i];
+            const Vec3& v = velocities[order[i]];
+            c.x = (cl_float) (v[0]-(cl_float) v[0]);
+            c.y = (cl_float) (v[1]-(cl_float) v[1]);
+            c.z = (cl_float) (v[2]-(cl_float) v[2]);
+            c.w = 0;
+        }
+        for (int i = numParticles; i < cl.getPaddedNumAtoms(); i++)
+            velCorrection[i] = mm_float4(0.0f, 0.0f, 0.0f, 0.0f);
+        cl.getVelmCorrection().upload(velCorrection);
+    }
 }
 
 void MetalUpdateStateDataKernel::computeShiftedVelocities(ContextImpl& context, double timeShift, vector<Vec3>& velocities) {
@@ -294,25 +370,33 @@ void MetalUpdateStateDataKernel::computeShiftedVelocities(ContextImpl& context,
 }
 
 void MetalUpdateStateDataKernel::getForces(ContextImpl& context, vector<Vec3>& forces) {
-    const vector<cl_int>& order = cl.getAtomIndex();
     int numParticles = context.getSystem().getNumParticles();
     forces.resize(numParticles);
-    if (cl.getUseDoublePrecision()) {
-        mm_double4* force = (mm_double4*) cl.getPinnedBuffer();
-        cl.getForce().download(force);
-        for (int i = 0; i < numParticles; ++i) {
-            mm_double4 f = force[i];
-            forces[order[i]] = Vec3(f.x, f.y, f.z);
+    cl.getForce().download(cl.getPinnedBuffer());
+    
+    // Filling in the output array is done in parallel for speed.
+    
+    cl.getPlatformData().threads.execute([&] (ThreadPool& threads, int threadIndex) {
+        const vector<int>& order = cl.getAtomIndex();
+        int numThreads = threads.getNumThreads();
+        int start = threadIndex*numParticles/numThreads;
+        int end = (threadIndex+1)*numParticles/numThreads;
+        if (cl.getUseDoublePrecision()) {
+            mm_double4* force = (mm_double4*) cl.getPinnedBuffer();
+            for (int i = start; i < end; ++i) {
+                mm_double4 f = force[i];
+                forces[order[i]] = Vec3(f.x, f.y, f.z);
+            }
         }
-    }
-    else {
-        mm_float4* force = (mm_float4*) cl.getPinnedBuffer();
-        cl.getForce().download(force);
-        for (int i = 0; i < numParticles; ++i) {
-            mm_float4 f = force[i];
-            forces[order[i]] = Vec3(f.x, f.y, f.z);
+        else {
+            mm_float4* force = (mm_float4*) cl.getPinnedBuffer();
+            for (int i = start; i < end; ++i) {
+                mm_float4 f = force[i];
+                forces[order[i]] = Vec3(f.x, f.y, f.z);
+            }
         }
-    }
+    });
+    cl.getPlatformData().threads.waitForThreads();
 }
 
 void MetalUpdateStateDataKernel::getEnergyParameterDerivatives(ContextImpl& context, map<string, double>& derivs) {
@@ -347,6 +431,7 @@ void MetalUpdateStateDataKernel::getPeriodicBoxVectors(ContextImpl& context, Vec
 }
 
 void MetalUpdateStateDataKernel::setPeriodicBoxVectors(ContextImpl& context, const Vec3& a, const Vec3& b, const Vec3& c) {
+    cl.getForceGroupSchedule().invalidate();
     vector<MetalContext*>& contexts = cl.getPlatformData().contexts;
 
     // If any particles have been wrapped to the first periodic box, we need to unwrap them
@@ -369,9 +454,140 @@ void MetalUpdateStateDataKernel::setPeriodicBoxVectors(ContextImpl& context, con
 }
 
 void MetalUpdateStateDataKernel::createCheckpoint(ContextImpl& context, ostream& stream) {
+    if (cl.getCheckpointFormat() == 3) {
+        createVersion3Checkpoint(stream);
+        return;
+    }
+
+    // Start downloading the device arrays into pinned memory without blocking, so they are
+    // transferred while the header and the host arrays are written.
+
+    vector<MetalArray*> arrays;
+    vector<MetalCheckpoint::Section> arraySections;
+    arrays.push_back(&cl.getPosq());
+    arraySections.push_back(MetalCheckpoint::Positions);
+    if (cl.getUseMixedPrecision() || cl.getUseFloatFloatPrecision()) {
+        arrays.push_back(&cl.getPosqCorrection());
+        arraySections.push_back(MetalCheckpoint::PositionCorrections);
+    }
+    arrays.push_back(&cl.getVelm());
+    arraySections.push_back(MetalCheckpoint::Velocities);
+    if (cl.getUseFloatFloatPrecision()) {
+        arrays.push_back(&cl.getVelmCorrection());
+        arraySections.push_back(MetalCheckpoint::VelocityCorrections);
+    }
+    vector<size_t> offsets;
+    size_t totalSize = 0;
+    for (MetalArray* array : arrays) {
+        offsets.push_back(totalSize);
+        totalSize += array->getSize()*array->getElementSize();
+    }
+    char* staging = checkpoint.getStagingMemory(cl, totalSize);
+    vector<cl::Event> events(arrays.size());
+    for (int i = 0; i < arrays.size(); i++)
+        cl.getQueue().enqueueReadBuffer(arrays[i]->getDeviceBuffer(), CL_FALSE, 0, arrays[i]->getSize()*arrays[i]->getElementSize(), staging+offsets[i], NULL, &events[i]);
+    cl.getQueue().flush();
+
+    // Write the header.
+
+    bool incremental = checkpoint.isNextIncremental(cl.getIncrementalCheckpoints());
+    long long id = MetalCheckpoint::createId();
+    long long baseId = (incremental ? checkpoint.getBaseId() : 0);
+    int version = 4;
+    stream.write((char*) &version, sizeof(int));
+    int precision = (cl.getUseDoublePrecision() ? 2 : cl.getUseMixedPrecision() || cl.getUseFloatFloatPrecision() ? 1 : 0);
+    stream.write((char*) &precision, sizeof(int));
+    double time = cl.getTime();
+    stream.write((char*) &time, sizeof(double));
+    long long stepCount = cl.getStepCount();
+    stream.write((char*) &stepCount, sizeof(long long));
+    int stepsSinceReorder = cl.getStepsSinceReorder();
+    stream.write((char*) &stepsSinceReorder, sizeof(int));
+    stream.write((char*) &id, sizeof(long long));
+    stream.write((char*) &baseId, sizeof(long long));
+
+    // Write the sections, waiting for each array only when it is needed.
+
+    checkpoint.beginWrite(incremental);
+    checkpoint.writeSection(stream, MetalCheckpoint::AtomIndex, (char*) &cl.getAtomIndex()[0], sizeof(cl_int)*cl.getAtomIndex().size(), sizeof(cl_int), sizeof(cl_int));
+    checkpoint.writeSection(stream, MetalCheckpoint::CellOffsets, (char*) &cl.getPosCellOffsets()[0], sizeof(mm_int4)*cl.getPosCellOffsets().size(), sizeof(cl_int), sizeof(mm_int4));
+    Vec3 boxVectors[3];
+    cl.getPeriodicBoxVectors(boxVectors[0], boxVectors[1], boxVectors[2]);
+    checkpoint.writeSection(stream, MetalCheckpoint::BoxVectors, (char*) boxVectors, 3*sizeof(Vec3), 0, sizeof(Vec3));
+    for (int i = 0; i < arrays.size(); i++) {
+        events[i].wait();
+        checkpoint.writeSection(stream, arraySections[i], staging+offsets[i], arrays[i]->getSize()*arrays[i]->getElementSize(), arrays[i]->getElementSize()/4, arrays[i]->getElementSize());
+    }
+    checkpoint.endWrite(stream, id);
+    cl.getIntegrationUtilities().createCheckpoint(stream);
+    SimTKOpenMMUtilities::createCheckpoint(stream);
+}
+
+void MetalUpdateStateDataKernel::loadCheckpoint(ContextImpl& context, istream& stream) {
+    cl.getForceGroupSchedule().invalidate();
+    int version;
+    stream.read((char*) &version, sizeof(int));
+    if (version == 3) {
+        loadVersion3Checkpoint(stream);
+        return;
+    }
+    if (version != 4)
+        throw OpenMMException("Checkpoint was created with a different version of OpenMM");
+    int precision;
+    stream.read((char*) &precision, sizeof(int));
+    int expectedPrecision = (cl.getUseDoublePrecision() ? 2 : cl.getUseMixedPrecision() || cl.getUseFloatFloatPrecision() ? 1 : 0);
+    if (precision != expectedPrecision)
+        throw OpenMMException("Checkpoint was created with a different numeric precision");
+    double time;
+    stream.read((char*) &time, sizeof(double));
+    long long stepCount;
+    stream.read((char*) &stepCount, sizeof(long long));
+    int stepsSinceReorder;
+    stream.read((char*) &stepsSinceReorder, sizeof(int));
+    long long id, baseId;
+    stream.read((char*) &id, sizeof(long long));
+    stream.read((char*) &baseId, sizeof(long long));
+    map<int, vector<char> > sections;
+    checkpoint.readSections(stream, id, baseId, sections);
+    auto getSection = [&] (MetalCheckpoint::Section section, size_t size) {
+        vector<char>& data = sections[section];
+        if (data.size() != size)
+            throw OpenMMException("Checkpoint was created for a different System");
+        return &data[0];
+    };
+    vector<MetalContext*>& contexts = cl.getPlatformData().contexts;
+    for (auto ctx : contexts) {
+        ctx->setTime(time);
+        ctx->setStepCount(stepCount);
+        ctx->setStepsSinceReorder(stepsSinceReorder);
+    }
+    cl.getPosq().upload(getSection(MetalCheckpoint::Positions, cl.getPosq().getSize()*cl.getPosq().getElementSize()));
+    if (cl.getUseMixedPrecision() || cl.getUseFloatFloatPrecision())
+        cl.getPosqCorrection().upload(getSection(MetalCheckpoint::PositionCorrections, cl.getPosqCorrection().getSize()*cl.getPosqCorrection().getElementSize()));
+    cl.getVelm().upload(getSection(MetalCheckpoint::Velocities, cl.getVelm().getSize()*cl.getVelm().getElementSize()));
+    if (cl.getUseFloatFloatPrecision())
+        cl.getVelmCorrection().upload(getSection(MetalCheckpoint::VelocityCorrections, cl.getVelmCorrection().getSize()*cl.getVelmCorrection().getElementSize()));
+    size_t atomIndexSize = sizeof(cl_int)*cl.getAtomIndex().size();
+    memcpy(&cl.getAtomIndex()[0], getSection(MetalCheckpoint::AtomIndex, atomIndexSize), atomIndexSize);
+    cl.getAtomIndexArray().upload(cl.getAtomIndex());
+    cl.resetCorrectionOrder();
+    size_t cellOffsetsSize = sizeof(mm_int4)*cl.getPosCellOffsets().size();
+    memcpy(&cl.getPosCellOffsets()[0], getSection(MetalCheckpoint::CellOffsets, cellOffsetsSize), cellOffsetsSize);
+    Vec3 boxVectors[3];
+    memcpy(boxVectors, getSection(MetalCheckpoint::BoxVectors, 3*sizeof(Vec3)), 3*sizeof(Vec3));
+    for (auto ctx : contexts)
+        ctx->setPeriodicBoxVectors(boxVectors[0], boxVectors[1], boxVectors[2]);
+    cl.getIntegrationUtilities().loadCheckpoint(stream);
+    SimTKOpenMMUtilities::loadCheckpoint(stream);
+    for (auto listener : cl.getReorderListeners())
+        listener->execute();
+    cl.validateAtomOrder();
+}
+
+void MetalUpdateStateDataKernel::createVersion3Checkpoint(ostream& stream) {
     int version = 3;
     stream.write((char*) &version, sizeof(int));
-    int precision = (cl.getUseDoublePrecision() ? 2 : cl.getUseMixedPrecision() ? 1 : 0);
+    int precision = (cl.getUseDoublePrecision() ? 2 : cl.getUseMixedPrecision() || cl.getUseFloatFloatPrecision() ? 1 : 0);
     stream.write((char*) &precision, sizeof(int));
     double time = cl.getTime();
     stream.write((char*) &time, sizeof(double));
@@ -382,12 +598,16 @@ void MetalUpdateStateDataKernel::createCheckpoint(ContextImpl& context, ostream&
     char* buffer = (char*) cl.getPinnedBuffer();
     cl.getPosq().download(buffer);
     stream.write(buffer, cl.getPosq().getSize()*cl.getPosq().getElementSize());
-    if (cl.getUseMixedPrecision()) {
+    if (cl.getUseMixedPrecision() || cl.getUseFloatFloatPrecision()) {
         cl.getPosqCorrection().download(buffer);
         stream.write(buffer, cl.getPosqCorrection().getSize()*cl.getPosqCorrection().getElementSize());
     }
     cl.getVelm().download(buffer);
     stream.write(buffer, cl.getVelm().getSize()*cl.getVelm().getElementSize());
+    if (cl.getUseFloatFloatPrecision()) {
+        cl.getVelmCorrection().download(buffer);
+        stream.write(buffer, cl.getVelmCorrection().getSize()*cl.getVelmCorrection().getElementSize());
+    }
     stream.write((char*) &cl.getAtomIndex()[0], sizeof(cl_int)*cl.getAtomIndex().size());
     stream.write((char*) &cl.getPosCellOffsets()[0], sizeof(mm_int4)*cl.getPosCellOffsets().size());
     Vec3 boxVectors[3];
@@ -397,14 +617,10 @@ void MetalUpdateStateDataKernel::createCheckpoint(ContextImpl& context, ostream&
     SimTKOpenMMUtilities::createCheckpoint(stream);
 }
 
-void MetalUpdateStateDataKernel::loadCheckpoint(ContextImpl& context, istream& stream) {
-    int version;
-    stream.read((char*) &version, sizeof(int));
-    if (version != 3)
-        throw OpenMMException("Checkpoint was created with a different version of OpenMM");
+void MetalUpdateStateDataKernel::loadVersion3Checkpoint(istream& stream) {
     int precision;
     stream.read((char*) &precision, sizeof(int));
-    int expectedPrecision = (cl.getUseDoublePrecision() ? 2 : cl.getUseMixedPrecision() ? 1 : 0);
+    int expectedPrecision = (cl.getUseDoublePrecision() ? 2 : cl.getUseMixedPrecision() || cl.getUseFloatFloatPrecision() ? 1 : 0);
     if (precision != expectedPrecision)
         throw OpenMMException("Checkpoint was created with a different numeric precision");
     double time;
@@ -422,14 +638,19 @@ void MetalUpdateStateDataKernel::loadCheckpoint(ContextImpl& context, istream& s
     char* buffer = (char*) cl.getPinnedBuffer();
     stream.read(buffer, cl.getPosq().getSize()*cl.getPosq().getElementSize());
     cl.getPosq().upload(buffer);
-    if (cl.getUseMixedPrecision()) {
+    if (cl.getUseMixedPrecision() || cl.getUseFloatFloatPrecision()) {
         stream.read(buffer, cl.getPosqCorrection().getSize()*cl.getPosqCorrection().getElementSize());
         cl.getPosqCorrection().upload(buffer);
     }
     stream.read(buffer, cl.getVelm().getSize()*cl.getVelm().getElementSize());
     cl.getVelm().upload(buffer);
+    if (cl.getUseFloatFloatPrecision()) {
+        stream.read(buffer, cl.getVelmCorrection().getSize()*cl.getVelmCorrection().getElementSize());
+        cl.getVelmCorrection().upload(buffer);
+    }
     stream.read((char*) &cl.getAtomIndex()[0], sizeof(cl_int)*cl.getAtomIndex().size());
     cl.getAtomIndexArray().upload(cl.getAtomIndex());
+    cl.resetCorrectionOrder();
     stream.read((char*) &cl.getPosCellOffsets()[0], sizeof(mm_int4)*cl.getPosCellOffsets().size());
     Vec3 boxVectors[3];
     stream.read((char*) &boxVectors, 3*sizeof(Vec3));
@@ -642,6 +863,8 @@ void MetalCalcNonbondedForceKernel::initialize(const System& system, const Nonbo
         exclusionList[exclusion.second].push_back(exclusion.first);
     }
     nonbondedMethod = CalcNonbondedForceKernel::NonbondedMethod(force.getNonbondedMethod());
+    if (cl.getNumReplicas() > 1 && (nonbondedMethod == Ewald || nonbondedMethod == PME || nonbondedMethod == LJPME))
+        throw OpenMMException("NonbondedForce: Ewald and PME cannot be used with batched replicas");
     bool useCutoff = (nonbondedMethod != NoCutoff);
     bool usePeriodic = (nonbondedMethod != NoCutoff && nonbondedMethod != CutoffNonPeriodic);
     doLJPME = (nonbondedMethod == LJPME && hasLJ);
@@ -667,8 +890,12 @@ void MetalCalcNonbondedForceKernel::initialize(const System& system, const Nonbo
             defines["LJ_SWITCH_C5"] = cl.doubleToString(6/pow(force.getSwitchingDistance()-force.getCutoffDistance(), 5.0));
         }
     }
-    if (force.getUseDispersionCorrection() && cl.getContextIndex() == 0 && !doLJPME)
-        dispersionCoefficient = NonbondedForceImpl::calcDispersionCorrection(system, force);
+    if (force.getUseDispersionCorrection() && cl.getContextIndex() == 0 && !doLJPME) {
+        // With batched replicas, the correction counts pairs of atoms in different replicas.
+        // For identical replicas, dividing by the number of replicas removes them.
+
+        dispersionCoefficient = NonbondedForceImpl::calcDispersionCorrection(system, force)/cl.getNumReplicas();
+    }
     else
         dispersionCoefficient = 0.0;
     alpha = 0;
@@ -722,15 +949,34 @@ void MetalCalcNonbondedForceKernel::initialize(const System& system, const Nonbo
         // Compute the PME parameters.
 
         NonbondedForceImpl::calcPMEParameters(system, force, alpha, gridSizeX, gridSizeY, gridSizeZ, false);
-        gridSizeX = MetalFFT3D::findLegalDimension(gridSizeX);
-        gridSizeY = MetalFFT3D::findLegalDimension(gridSizeY);
-        gridSizeZ = MetalFFT3D::findLegalDimension(gridSizeZ);
-        if (doLJPME) {
+        if (doLJPME)
             NonbondedForceImpl::calcPMEParameters(system, force, dispersionAlpha, dispersionGridSizeX,
                                                   dispersionGridSizeY, dispersionGridSizeZ, true);
-            dispersionGridSizeX = MetalFFT3D::findLegalDimension(dispersionGridSizeX);
-            dispersionGridSizeY = MetalFFT3D::findLegalDimension(dispersionGridSizeY);
-            dispersionGridSizeZ = MetalFFT3D::findLegalDimension(dispersionGridSizeZ);
+
+        // When autotuning is enabled, a grid that is slightly larger than the minimum may be chosen
+        // if the device transforms it faster.  That is at least as accurate.  Sizes the user set
+        // explicitly are only rounded up to the next legal size.
+
+        bool tuneGridSize = (cl.getAutotuneFFT() && cl.getContextIndex() == 0 && !cl.getPlatformData().useCpuPme);
+        double specifiedAlpha;
+        int specifiedX, specifiedY, specifiedZ;
+        force.getPMEParameters(specifiedAlpha, specifiedX, specifiedY, specifiedZ);
+        if (tuneGridSize && specifiedX == 0)
+            MetalFFT3D::findFastestDimensions(cl, gridSizeX, gridSizeY, gridSizeZ, true);
+        else {
+            gridSizeX = MetalFFT3D::findLegalDimension(gridSizeX);
+            gridSizeY = MetalFFT3D::findLegalDimension(gridSizeY);
+            gridSizeZ = MetalFFT3D::findLegalDimension(gridSizeZ);
+        }
+        if (doLJPME) {
+            force.getLJPMEParameters(specifiedAlpha, specifiedX, specifiedY, specifiedZ);
+            if (tuneGridSize && specifiedX == 0)
+                MetalFFT3D::findFastestDimensions(cl, dispersionGridSizeX, dispersionGridSizeY, dispersionGridSizeZ, true);
+            else {
+                dispersionGridSizeX = MetalFFT3D::findLegalDimension(dispersionGridSizeX);
+                dispersionGridSizeY = MetalFFT3D::findLegalDimension(dispersionGridSizeY);
+                dispersionGridSizeZ = MetalFFT3D::findLegalDimension(dispersionGridSizeZ);
+            }
         }
         defines["EWALD_ALPHA"] = cl.doubleToString(alpha);
         defines["TWO_OVER_SQRT_PI"] = cl.doubleToString(2.0/sqrt(M_PI));
@@ -954,6 +1200,7 @@ void MetalCalcNonbondedForceKernel::initialize(const System& system, const Nonbo
     charges.initialize(cl, cl.getPaddedNumAtoms(), cl.getUseDoublePrecision() ? sizeof(double) : sizeof(float), "charges");
     baseParticleParams.initialize<mm_float4>(cl, cl.getPaddedNumAtoms(), "baseParticleParams");
     baseParticleParams.upload(baseParticleParamVec);
+    currentParticleParams = baseParticleParamVec;
     map<string, string> replacements;
     replacements["ONE_4PI_EPS0"] = cl.doubleToString(ONE_4PI_EPS0);
     if (usePosqCharges) {
@@ -967,10 +1214,26 @@ void MetalCalcNonbondedForceKernel::initialize(const System& system, const Nonbo
     if (hasCoulomb && !usePosqCharges)
         cl.getNonbondedUtilities().addParameter(MetalNonbondedUtilities::ParameterInfo(prefix+"charge", "real", 1, charges.getElementSize(), charges.getDeviceBuffer()));
     sigmaEpsilon.initialize<mm_float2>(cl, cl.getPaddedNumAtoms(), "sigmaEpsilon");
+    bool useHalfSigmaEpsilon = (hasLJ && cl.getUseCompressedParameters());
+    sigmaEpsilonHalf.initialize<mm_ushort2>(cl, useHalfSigmaEpsilon ? cl.getPaddedNumAtoms() : 1, "sigmaEpsilonHalf");
+    if (useHalfSigmaEpsilon) {
+        // The interaction kernel reads a half precision copy of sigma and epsilon, which
+        // the parameter kernels write alongside the full precision values.  The padding
+        // atoms are never written, so clear them now.
+
+        sigmaEpsilonHalf.upload(vector<mm_ushort2>(cl.getPaddedNumAtoms(), mm_ushort2(0, 0)));
+        paramsDefines["USE_HALF_SIGMA_EPSILON"] = "1";
+    }
     if (hasLJ) {
         replacements["SIGMA_EPSILON1"] = prefix+"sigmaEpsilon1";
         replacements["SIGMA_EPSILON2"] = prefix+"sigmaEpsilon2";
-        cl.getNonbondedUtilities().addParameter(MetalNonbondedUtilities::ParameterInfo(prefix+"sigmaEpsilon", "float", 2, sizeof(cl_float2), sigmaEpsilon.getDeviceBuffer()));
+        if (useHalfSigmaEpsilon) {
+            MetalNonbondedUtilities::ParameterInfo param(prefix+"sigmaEpsilon", "float", 2, sizeof(cl_float2), sigmaEpsilonHalf.getDeviceBuffer());
+            param.setStoredAsHalf(true);
+            cl.getNonbondedUtilities().addParameter(param);
+        }
+        else
+            cl.getNonbondedUtilities().addParameter(MetalNonbondedUtilities::ParameterInfo(prefix+"sigmaEpsilon", "float", 2, sizeof(cl_float2), sigmaEpsilon.getDeviceBuffer()));
     }
     source = cl.replaceStrings(source, replacements);
     if (force.getIncludeDirectSpace())
@@ -996,6 +1259,7 @@ void MetalCalcNonbondedForceKernel::initialize(const System& system, const Nonbo
             exceptionAtoms[i] = make_pair(atoms[i][0], atoms[i][1]);
         }
         baseExceptionParams.upload(baseExceptionParamsVec);
+        currentExceptionParams = baseExceptionParamsVec;
         map<string, string> replacements;
         replacements["APPLY_PERIODIC"] = (usePeriodic && force.getExceptionsUsePeriodicBoundaryConditions() ? "1" : "0");
         replacements["PARAMS"] = cl.getBondedUtilities().addArgument(exceptionParams.getDeviceBuffer(), "float4");
@@ -1078,11 +1342,14 @@ void MetalCalcNonbondedForceKernel::initialize(const System& system, const Nonbo
     cl::Program program = cl.createProgram(MetalKernelSources::nonbondedParameters, paramsDefines);
     computeParamsKernel = cl::Kernel(program, "computeParameters");
     computeExclusionParamsKernel = cl::Kernel(program, "computeExclusionParameters");
+    computeChangedParamsKernel = cl::Kernel(program, "computeChangedParameters");
     info = new ForceInfo(0, force);
     cl.addForce(info);
 }
 
 double MetalCalcNonbondedForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy, bool includeDirect, bool includeReciprocal) {
+    if (cl.getForceGroupSchedule().isUsingCachedForces())
+        return 0.0;
     bool deviceIsCpu = (cl.getDevice().getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU);
     if (!hasInitializedKernel) {
         hasInitializedKernel = true;
@@ -1095,6 +1362,7 @@ double MetalCalcNonbondedForceKernel::execute(ContextImpl& context, bool include
         computeParamsKernel.setArg<cl::Buffer>(index++, cl.getPosq().getDeviceBuffer());
         computeParamsKernel.setArg<cl::Buffer>(index++, charges.getDeviceBuffer());
         computeParamsKernel.setArg<cl::Buffer>(index++, sigmaEpsilon.getDeviceBuffer());
+        computeParamsKernel.setArg<cl::Buffer>(index++, sigmaEpsilonHalf.getDeviceBuffer());
         computeParamsKernel.setArg<cl::Buffer>(index++, particleParamOffsets.getDeviceBuffer());
         computeParamsKernel.setArg<cl::Buffer>(index++, particleOffsetIndices.getDeviceBuffer());
         if (exceptionParams.isInitialized()) {
@@ -1104,6 +1372,21 @@ double MetalCalcNonbondedForceKernel::execute(ContextImpl& context, bool include
             computeParamsKernel.setArg<cl::Buffer>(index++, exceptionParamOffsets.getDeviceBuffer());
             computeParamsKernel.setArg<cl::Buffer>(index++, exceptionOffsetIndices.getDeviceBuffer());
         }
+        index = 3;
+        computeChangedParamsKernel.setArg<cl::Buffer>(index++, globalParams.getDeviceBuffer());
+        computeChangedParamsKernel.setArg<cl::Buffer>(index++, baseParticleParams.getDeviceBuffer());
+        computeChangedParamsKernel.setArg<cl::Buffer>(index++, cl.getPosq().getDeviceBuffer());
+        computeChangedParamsKernel.setArg<cl::Buffer>(index++, charges.getDeviceBuffer());
+        computeChangedParamsKernel.setArg<cl::Buffer>(index++, sigmaEpsilon.getDeviceBuffer());
+        computeChangedParamsKernel.setArg<cl::Buffer>(index++, sigmaEpsilonHalf.getDeviceBuffer());
+        computeChangedParamsKernel.setArg<cl::Buffer>(index++, particleParamOffsets.getDeviceBuffer());
+        computeChangedParamsKernel.setArg<cl::Buffer>(index++, particleOffsetIndices.getDeviceBuffer());
+        if (exceptionParams.isInitialized()) {
+            computeChangedParamsKernel.setArg<cl::Buffer>(index++, baseExceptionParams.getDeviceBuffer());
+            computeChangedParamsKernel.setArg<cl::Buffer>(index++, exceptionParams.getDeviceBuffer());
+            computeChangedParamsKernel.setArg<cl::Buffer>(index++, exceptionParamOffsets.getDeviceBuffer());
+            computeChangedParamsKernel.setArg<cl::Buffer>(index++, exceptionOffsetIndices.getDeviceBuffer());
+        }
         if (exclusionParams.isInitialized()) {
             computeExclusionParamsKernel.setArg<cl::Buffer>(0, cl.getPosq().getDeviceBuffer());
             computeExclusionParamsKernel.setArg<cl::Buffer>(1, charges.getDeviceBuffer());
@@ -1138,6 +1421,11 @@ double MetalCalcNonbondedForceKernel::execute(ContextImpl& context, bool include
             pmeSpreadChargeKernel.setArg<cl::Buffer>(1, pmeGrid2.getDeviceBuffer());
             pmeSpreadChargeKernel.setArg<cl::Buffer>(10, pmeAtomGridIndex.getDeviceBuffer());
             pmeSpreadChargeKernel.setArg<cl::Buffer>(11, charges.getDeviceBuffer());
+            int spreadBlockSize = MetalContext::ThreadBlockSize;
+            pmeSpreadChargeLaunch = MetalKernelTuner::LaunchConfig(min((cl.getNumAtoms()+spreadBlockSize-1)/spreadBlockSize, cl.getNumThreadBlocks()), spreadBlockSize);
+            MetalKernelTuner spreadTuner(cl, "gridSpreadCharge", cl.getNumAtoms());
+            if (!spreadTuner.loadResult(pmeSpreadChargeLaunch))
+                pmeSpreadChargeNeedsTuning = cl.getAutotuneKernels();
             pmeConvolutionKernel.setArg<cl::Buffer>(0, pmeGrid2.getDeviceBuffer());
             pmeConvolutionKernel.setArg<cl::Buffer>(1, pmeBsplineModuliX.getDeviceBuffer());
             pmeConvolutionKernel.setArg<cl::Buffer>(2, pmeBsplineModuliY.getDeviceBuffer());
@@ -1217,9 +1505,38 @@ double MetalCalcNonbondedForceKernel::execute(ContextImpl& context, bool include
         globalParams.upload(paramValues, true);
     }
     double energy = (includeReciprocal ? ewaldSelfEnergy : 0.0);
+    bool paramsUpdated = false;
     if (recomputeParams || hasOffsets) {
         computeParamsKernel.setArg<cl_int>(1, includeEnergy && includeReciprocal);
         cl.executeKernel(computeParamsKernel, cl.getPaddedNumAtoms());
+        if (hasOffsets)
+            energy = 0.0; // The Ewald self energy was computed in the kernel.
+        recomputeParams = false;
+        paramsUpdated = true;
+    }
+    else if (changedParticles.size() > 0 || changedExceptions.size() > 0) {
+        // Only a few parameters were changed by updateParametersInContext(), so only recompute those.
+
+        std::sort(changedParticles.begin(), changedParticles.end());
+        changedParticles.erase(unique(changedParticles.begin(), changedParticles.end()), changedParticles.end());
+        std::sort(changedExceptions.begin(), changedExceptions.end());
+        changedExceptions.erase(unique(changedExceptions.begin(), changedExceptions.end()), changedExceptions.end());
+        vector<cl_int> indices(changedParticles.begin(), changedParticles.end());
+        indices.insert(indices.end(), changedExceptions.begin(), changedExceptions.end());
+        if (!changedParamIndices.isInitialized())
+            changedParamIndices.initialize<cl_int>(cl, indices.size(), "changedParamIndices");
+        else if (changedParamIndices.getSize() < indices.size())
+            changedParamIndices.resize(indices.size());
+        changedParamIndices.uploadSubArray(indices.data(), 0, indices.size());
+        computeChangedParamsKernel.setArg<cl_int>(0, changedParticles.size());
+        computeChangedParamsKernel.setArg<cl_int>(1, changedExceptions.size());
+        computeChangedParamsKernel.setArg<cl::Buffer>(2, changedParamIndices.getDeviceBuffer());
+        cl.executeKernel(computeChangedParamsKernel, (int) max(changedParticles.size(), changedExceptions.size()));
+        paramsUpdated = true;
+    }
+    changedParticles.clear();
+    changedExceptions.clear();
+    if (paramsUpdated) {
         if (exclusionParams.isInitialized())
             cl.executeKernel(computeExclusionParamsKernel, exclusionParams.getSize());
         if (usePmeQueue) {
@@ -1227,9 +1544,6 @@ double MetalCalcNonbondedForceKernel::execute(ContextImpl& context, bool include
             cl.getQueue().enqueueMarkerWithWaitList(NULL, &events[0]);
             pmeQueue.enqueueBarrierWithWaitList(&events);
         }
-        if (hasOffsets)
-            energy = 0.0; // The Ewald self energy was computed in the kernel.
-        recomputeParams = false;
     }
     
     // Do reciprocal space calculations.
@@ -1292,7 +1606,28 @@ double MetalCalcNonbondedForceKernel::execute(ContextImpl& context, bool include
                 pmeSpreadChargeKernel.setArg<mm_float4>(8, recipBoxVectorsFloat[1]);
                 pmeSpreadChargeKernel.setArg<mm_float4>(9, recipBoxVectorsFloat[2]);
             }
-            cl.executeKernel(pmeSpreadChargeKernel, cl.getNumAtoms());
+            if (pmeSpreadChargeNeedsTuning) {
+                // The kernel accumulates into pmeGrid2, which was cleared at the start of this step,
+                // so clearing it again restores it.
+
+                pmeSpreadChargeNeedsTuning = false;
+                int computeUnits = cl.getDevice().getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+                vector<int> numGroups;
+                for (int blocksPerUnit : {1, 2, 4, 6, 8, 12, 16})
+                    if (blocksPerUnit*computeUnits <= cl.getNumThreadBlocks())
+                        numGroups.push_back(blocksPerUnit*computeUnits);
+                vector<MetalKernelTuner::LaunchConfig> candidates = {pmeSpreadChargeLaunch};
+                for (const MetalKernelTuner::LaunchConfig& config : MetalKernelTuner::getCandidates(numGroups, {64, 128, 256}, max(cl.getPaddedNumAtoms(), 256)))
+                    if (!(config == pmeSpreadChargeLaunch))
+                        candidates.push_back(config);
+                MetalKernelTuner tuner(cl, "gridSpreadCharge", cl.getNumAtoms());
+                pmeSpreadChargeLaunch = tuner.sweep(candidates, [&] (const MetalKernelTuner::LaunchConfig& config) {
+                    cl.executeKernel(pmeSpreadChargeKernel, config.numGroups*config.groupSize, config.groupSize);
+                }, [&] () {
+                    cl.clearBuffer(pmeGrid2);
+                });
+            }
+            cl.executeKernel(pmeSpreadChargeKernel, pmeSpreadChargeLaunch.numGroups*pmeSpreadChargeLaunch.groupSize, pmeSpreadChargeLaunch.groupSize);
             cl.executeKernel(pmeFinishSpreadChargeKernel, gridSizeX*gridSizeY*gridSizeZ);
             fft->execFFT(pmeGrid1, pmeGrid2, true);
             mm_double4 boxSize = cl.getPeriodicBoxSizeDouble();
@@ -1412,6 +1747,47 @@ double MetalCalcNonbondedForceKernel::execute(ContextImpl& context, bool include
     return energy;
 }
 
+/**
+ * When updateParametersInContext() changes more than 1/MinFractionForFullUpdate of the nonbonded
+ * particles and exceptions, all parameters are uploaded and recomputed instead of only the changed ones.
+ */
+static const int MinFractionForFullUpdate = 8;
+
+/**
+ * Changed elements closer together than this are uploaded with a single copy.
+ */
+static const int MaxUploadGap = 256;
+
+/**
+ * If the changed elements form more runs than this, they are uploaded as a single span.
+ */
+static const int MaxUploadRuns = 16;
+
+/**
+ * Upload the elements of an array whose indices are listed in changed, which must be sorted.  Nearby
+ * elements are merged into runs, and if there would be many runs, the whole span from the first
+ * changed element to the last one is uploaded at once.
+ */
+static void uploadChangedElements(MetalArray& array, const vector<mm_float4>& values, const vector<int>& changed) {
+    if (changed.size() == 0)
+        return;
+    if (changed.size() > array.getSize()/MinFractionForFullUpdate) {
+        array.upload(values);
+        return;
+    }
+    vector<pair<int, int> > runs;
+    for (int index : changed) {
+        if (runs.size() > 0 && index-runs.back().second <= MaxUploadGap)
+            runs.back().second = index+1;
+        else
+            runs.push_back(make_pair(index, index+1));
+    }
+    if (runs.size() > MaxUploadRuns)
+        runs = vector<pair<int, int> >(1, make_pair(runs.front().first, runs.back().second));
+    for (auto& run : runs)
+        array.uploadSubArray(&values[run.first], run.first, run.second-run.first);
+}
+
 void MetalCalcNonbondedForceKernel::copyParametersToContext(ContextImpl& context, const NonbondedForce& force) {
     // Make sure the new parameters are acceptable.
 
@@ -1450,7 +1826,8 @@ void MetalCalcNonbondedForceKernel::copyParametersToContext(ContextImpl& context
     if (numExceptions != exceptionAtoms.size())
         throw OpenMMException("updateParametersInContext: The set of non-excluded exceptions has changed");
 
-    // Record the per-particle parameters.
+    // Record the per-particle parameters.  Only the ones that differ from what was last uploaded
+    // are copied to the device.
 
     vector<mm_float4> baseParticleParamVec(cl.getPaddedNumAtoms(), mm_float4(0, 0, 0, 0));
     for (int i = 0; i < force.getNumParticles(); i++) {
@@ -1458,7 +1835,17 @@ void MetalCalcNonbondedForceKernel::copyParametersToContext(ContextImpl& context
         force.getParticleParameters(i, charge, sigma, epsilon);
         baseParticleParamVec[i] = mm_float4(charge, sigma, epsilon, 0);
     }
-    baseParticleParams.upload(baseParticleParamVec);
+    vector<int> particlesToUpdate, exceptionsToUpdate;
+    bool ljChanged = false;
+    for (int i = 0; i < force.getNumParticles(); i++) {
+        mm_float4 oldParams = currentParticleParams[i], newParams = baseParticleParamVec[i];
+        if (oldParams.x != newParams.x || oldParams.y != newParams.y || oldParams.z != newParams.z) {
+            particlesToUpdate.push_back(i);
+            ljChanged |= (oldParams.y != newParams.y || oldParams.z != newParams.z);
+        }
+    }
+    uploadChangedElements(baseParticleParams, baseParticleParamVec, particlesToUpdate);
+    currentParticleParams = baseParticleParamVec;
     
     // Record the exceptions.
     
@@ -1471,8 +1858,12 @@ void MetalCalcNonbondedForceKernel::copyParametersToContext(ContextImpl& context
             if (make_pair(particle1, particle2) != exceptionAtoms[i])
                 throw OpenMMException("updateParametersInContext: The set of non-excluded exceptions has changed");
             baseExceptionParamsVec[i] = mm_float4(chargeProd, sigma, epsilon, 0);
+            mm_float4 oldParams = currentExceptionParams[i], newParams = baseExceptionParamsVec[i];
+            if (oldParams.x != newParams.x || oldParams.y != newParams.y || oldParams.z != newParams.z)
+                exceptionsToUpdate.push_back(i);
         }
-        baseExceptionParams.upload(baseExceptionParamsVec);
+        uploadChangedElements(baseExceptionParams, baseExceptionParamsVec, exceptionsToUpdate);
+        currentExceptionParams = baseExceptionParamsVec;
     }
     
     // Compute other values.
@@ -1487,10 +1878,19 @@ void MetalCalcNonbondedForceKernel::copyParametersToContext(ContextImpl& context
             }
         }
     }
-    if (force.getUseDispersionCorrection() && cl.getContextIndex() == 0 && (nonbondedMethod == CutoffPeriodic || nonbondedMethod == Ewald || nonbondedMethod == PME))
-        dispersionCoefficient = NonbondedForceImpl::calcDispersionCorrection(context.getSystem(), force);
+    if (ljChanged && force.getUseDispersionCorrection() && cl.getContextIndex() == 0 && (nonbondedMethod == CutoffPeriodic || nonbondedMethod == Ewald || nonbondedMethod == PME))
+        dispersionCoefficient = NonbondedForceImpl::calcDispersionCorrection(context.getSystem(), force)/cl.getNumReplicas();
+    if (particlesToUpdate.size() == 0 && exceptionsToUpdate.size() == 0)
+        return;
     cl.invalidateMolecules(info);
-    recomputeParams = true;
+
+    // If only a small fraction of the parameters changed, the next call to execute() recomputes
+    // just those.  Otherwise it recomputes all of them.
+
+    changedParticles.insert(changedParticles.end(), particlesToUpdate.begin(), particlesToUpdate.end());
+    changedExceptions.insert(changedExceptions.end(), exceptionsToUpdate.begin(), exceptionsToUpdate.end());
+    if (changedParticles.size()+changedExceptions.size() > (cl.getPaddedNumAtoms()+currentExceptionParams.size())/MinFractionForFullUpdate)
+        recomputeParams = true;
 }
 
 void MetalCalcNonbondedForceKernel::getPMEParameters(double& alpha, int& nx, int& ny, int& nz) const {
@@ -1519,3 +1919,161 @@ void MetalCalcNonbondedForceKernel::getLJPMEParameters(double& alpha, int& nx, i
         nz = dispersionGridSizeZ;
     }
 }
+
+void MetalIntegrateVerletStepKernel::initialize(const System& system, const VerletIntegrator& integrator) {
+    cl.initializeContexts();
+    cl::Program& program = cl.getFloatFloatProgram();
+    kernel1 = cl::Kernel(program, "integrateVerletPart1");
+    kernel2 = cl::Kernel(program, "integrateVerletPart2");
+}
+
+void MetalIntegrateVerletStepKernel::execute(ContextImpl& context, const VerletIntegrator& integrator) {
+    MetalIntegrationUtilities& integration = cl.getIntegrationUtilities();
+    int numAtoms = cl.getNumAtoms();
+    int paddedNumAtoms = cl.getPaddedNumAtoms();
+    double dt = integrator.getStepSize();
+    integration.setNextStepSize(dt);
+    if (!hasInitializedKernels) {
+        hasInitializedKernels = true;
+        kernel1.setArg<cl_int>(0, numAtoms);
+        kernel1.setArg<cl_int>(1, paddedNumAtoms);
+        kernel1.setArg<cl::Buffer>(2, integration.getStepSize().getDeviceBuffer());
+        kernel1.setArg<cl::Buffer>(3, cl.getPosq().getDeviceBuffer());
+        kernel1.setArg<cl::Buffer>(4, cl.getVelm().getDeviceBuffer());
+        kernel1.setArg<cl::Buffer>(5, cl.getLongForceBuffer().getDeviceBuffer());
+        kernel1.setArg<cl::Buffer>(6, integration.getPosDelta().getDeviceBuffer());
+        kernel1.setArg<cl::Buffer>(7, cl.getVelmCorrection().getDeviceBuffer());
+        kernel2.setArg<cl_int>(0, numAtoms);
+        kernel2.setArg<cl::Buffer>(1, integration.getStepSize().getDeviceBuffer());
+        kernel2.setArg<cl::Buffer>(2, cl.getPosq().getDeviceBuffer());
+        kernel2.setArg<cl::Buffer>(3, cl.getVelm().getDeviceBuffer());
+        kernel2.setArg<cl::Buffer>(4, integration.getPosDelta().getDeviceBuffer());
+        kernel2.setArg<cl::Buffer>(5, cl.getPosqCorrection().getDeviceBuffer());
+        kernel2.setArg<cl::Buffer>(6, cl.getVelmCorrection().getDeviceBuffer());
+    }
+
+    // Update the velocities, constrain the displacements, then update the positions.
+
+    cl.executeKernel(kernel1, numAtoms);
+    integration.applyConstraints(integrator.getConstraintTolerance());
+    cl.executeKernel(kernel2, numAtoms);
+    integration.computeVirtualSites();
+
+    // Update the time and step count.
+
+    cl.setTime(cl.getTime()+dt);
+    cl.setStepCount(cl.getStepCount()+1);
+    cl.reorderAtoms();
+}
+
+double MetalIntegrateVerletStepKernel::computeKineticEnergy(ContextImpl& context, const VerletIntegrator& integrator) {
+    return cl.getIntegrationUtilities().computeKineticEnergy(0.5*integrator.getStepSize());
+}
+
+void MetalIntegrateLangevinMiddleStepKernel::initialize(const System& system, const LangevinMiddleIntegrator& integrator) {
+    cl.initializeContexts();
+    cl.getIntegrationUtilities().initRandomNumberGenerator(integrator.getRandomNumberSeed());
+    cl::Program& program = cl.getFloatFloatProgram();
+    kernel1 = cl::Kernel(program, "integrateLangevinMiddlePart1");
+    kernel2 = cl::Kernel(program, "integrateLangevinMiddlePart2");
+    kernel3 = cl::Kernel(program, "integrateLangevinMiddlePart3");
+    params.initialize<cl_float>(cl, 2, "langevinMiddleParams");
+    oldDelta.initialize<mm_float4>(cl, cl.getPaddedNumAtoms(), "oldDelta");
+    prevTemp = -1.0;
+    prevFriction = -1.0;
+    prevStepSize = -1.0;
+}
+
+void MetalIntegrateLangevinMiddleStepKernel::execute(ContextImpl& context, const LangevinMiddleIntegrator& integrator) {
+    MetalIntegrationUtilities& integration = cl.getIntegrationUtilities();
+    int numAtoms = cl.getNumAtoms();
+    int paddedNumAtoms = cl.getPaddedNumAtoms();
+    if (!hasInitializedKernels) {
+        hasInitializedKernels = true;
+        kernel1.setArg<cl_int>(0, numAtoms);
+        kernel1.setArg<cl_int>(1, paddedNumAtoms);
+        kernel1.setArg<cl::Buffer>(2, cl.getVelm().getDeviceBuffer());
+        kernel1.setArg<cl::Buffer>(3, cl.getLongForceBuffer().getDeviceBuffer());
+        kernel1.setArg<cl::Buffer>(4, integration.getStepSize().getDeviceBuffer());
+        kernel1.setArg<cl::Buffer>(5, cl.getVelmCorrection().getDeviceBuffer());
+        kernel2.setArg<cl_int>(0, numAtoms);
+        kernel2.setArg<cl::Buffer>(1, cl.getVelm().getDeviceBuffer());
+        kernel2.setArg<cl::Buffer>(2, integration.getPosDelta().getDeviceBuffer());
+        kernel2.setArg<cl::Buffer>(3, oldDelta.getDeviceBuffer());
+        kernel2.setArg<cl::Buffer>(4, params.getDeviceBuffer());
+        kernel2.setArg<cl::Buffer>(5, integration.getStepSize().getDeviceBuffer());
+        kernel2.setArg<cl::Buffer>(6, integration.getRandom().getDeviceBuffer());
+        kernel2.setArg<cl::Buffer>(8, cl.getVelmCorrection().getDeviceBuffer());
+        kernel3.setArg<cl_int>(0, numAtoms);
+        kernel3.setArg<cl::Buffer>(1, cl.getPosq().getDeviceBuffer());
+        kernel3.setArg<cl::Buffer>(2, cl.getVelm().getDeviceBuffer());
+        kernel3.setArg<cl::Buffer>(3, integration.getPosDelta().getDeviceBuffer());
+        kernel3.setArg<cl::Buffer>(4, oldDelta.getDeviceBuffer());
+        kernel3.setArg<cl::Buffer>(5, integration.getStepSize().getDeviceBuffer());
+        kernel3.setArg<cl::Buffer>(6, cl.getPosqCorrection().getDeviceBuffer());
+        kernel3.setArg<cl::Buffer>(7, cl.getVelmCorrection().getDeviceBuffer());
+    }
+    double temperature = context.getParameter(LangevinMiddleIntegrator::Temperature());
+    double friction = context.getParameter(LangevinMiddleIntegrator::Friction());
+    double stepSize = integrator.getStepSize();
+    integration.setNextStepSize(stepSize);
+    if (temperature != prevTemp || friction != prevFriction || stepSize != prevStepSize) {
+        // Calculate the integration parameters.
+
+        double kT = BOLTZ*temperature;
+        double vscale = exp(-stepSize*friction);
+        double noisescale = sqrt(kT*(1-vscale*vscale));
+        vector<cl_float> p(params.getSize());
+        p[0] = (cl_float) vscale;
+        p[1] = (cl_float) noisescale;
+        params.upload(p);
+        prevTemp = temperature;
+        prevFriction = friction;
+        prevStepSize = stepSize;
+    }
+
+    // Perform the integration.
+
+    kernel2.setArg<cl_uint>(7, integration.prepareRandomNumbers(paddedNumAtoms));
+    cl.executeKernel(kernel1, numAtoms);
+    integration.applyVelocityConstraints(integrator.getConstraintTolerance());
+    cl.executeKernel(kernel2, numAtoms);
+    integration.applyConstraints(integrator.getConstraintTolerance());
+    cl.executeKernel(kernel3, numAtoms);
+    integration.computeVirtualSites();
+
+    // Update the time and step count.
+
+    cl.setTime(cl.getTime()+stepSize);
+    cl.setStepCount(cl.getStepCount()+1);
+    cl.reorderAtoms();
+}
+
+double MetalIntegrateLangevinMiddleStepKernel::computeKineticEnergy(ContextImpl& context, const LangevinMiddleIntegrator& integrator) {
+    return cl.getIntegrationUtilities().computeKineticEnergy(0.0);
+}
+
+void MetalApplyConstraintsKernel::apply(ContextImpl& context, double tol) {
+    cl.foldFloatFloatCorrections();
+    CommonApplyConstraintsKernel::apply(context, tol);
+}
+
+void MetalApplyConstraintsKernel::applyToVelocities(ContextImpl& context, double tol) {
+    cl.foldFloatFloatCorrections();
+    CommonApplyConstraintsKernel::applyToVelocities(context, tol);
+}
+
+void MetalApplyAndersenThermostatKernel::execute(ContextImpl& context) {
+    cl.foldFloatFloatCorrections();
+    CommonApplyAndersenThermostatKernel::execute(context);
+}
+
+void MetalApplyMonteCarloBarostatKernel::scaleCoordinates(ContextImpl& context, double scaleX, double scaleY, double scaleZ) {
+    cl.foldFloatFloatCorrections();
+    CommonApplyMonteCarloBarostatKernel::scaleCoordinates(context, scaleX, scaleY, scaleZ);
+}
+
+void MetalRemoveCMMotionKernel::execute(ContextImpl& context) {
+    cl.foldFloatFloatCorrections();
+    CommonRemoveCMMotionKernel::execute(context);
+}
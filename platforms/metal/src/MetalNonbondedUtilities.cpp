@@ -25,6 +25,7 @@
  * -------------------------------------------------------------------------- */
 
 #include "openmm/OpenMMException.h"
+#include "openmm/Vec3.h"
 #include "MetalNonbondedUtilities.h"
 #include "MetalArray.h"
 #include "MetalContext.h"
@@ -33,14 +34,38 @@
 #include "MetalExpressionUtilities.h"
 #include "MetalSort.h"
 #include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <map>
 #include <set>
+#include <sstream>
 #include <utility>
 
 using namespace OpenMM;
 using namespace std;
 
+/**
+ * The values the padding can take when it is adjusted automatically, as fractions of the
+ * cutoff.  Each one needs its own neighbor list kernels, so only a few are allowed.
+ */
+static const double PaddingLevels[] = {0.025, 0.05, 0.075, 0.1, 0.125, 0.15, 0.2, 0.25, 0.3};
+static const int NumPaddingLevels = sizeof(PaddingLevels)/sizeof(PaddingLevels[0]);
+static const int DefaultPaddingLevel = 3;
+
+/**
+ * A padding is measured for at least MinWindowSamples steps and until the list has been
+ * rebuilt MinWindowRebuilds times, but never for more than MaxWindowSamples steps.
+ */
+static const int MinWindowSamples = 100;
+static const int MinWindowRebuilds = 5;
+static const int MaxWindowSamples = 2000;
+
+/**
+ * After the best padding has been found, it is searched for again every this many windows
+ * so it can follow changes in the system, such as heating or compression.
+ */
+static const int WindowsBetweenSearches = 100;
+
 class MetalNonbondedUtilities::BlockSortTrait : public MetalSort::SortTrait {
 public:
     BlockSortTrait(bool useDouble) : useDouble(useDouble) {
@@ -58,7 +83,11 @@ private:
 };
 
 MetalNonbondedUtilities::MetalNonbondedUtilities(MetalContext& context) : context(context), useCutoff(false), usePeriodic(false), useNeighborList(false), anyExclusions(false), usePadding(true),
-        blockSorter(NULL), pinnedCountBuffer(NULL), pinnedCountMemory(NULL), forceRebuildNeighborList(true), lastCutoff(0.0), groupFlags(0) {
+        blockSorter(NULL), pinnedCountBuffer(NULL), pinnedCountMemory(NULL), forceRebuildNeighborList(true), lastCutoff(0.0), groupFlags(0),
+        countCheckInterval(1), stepsSinceCountCheck(0), countDownloadPending(false), countIsShared(false), adaptivePadding(true),
+        sampleIsForced(false), paddingFraction(PaddingLevels[DefaultPaddingLevel]), paddingLevel(DefaultPaddingLevel), paddingGeneration(0), listPaddingGeneration(-1), windowSamples(0),
+        windowRebuilds(0), windowsSinceSearch(0), windowTiles(0.0), samplesAtPadding(0), rebuildsAtPadding(0),
+        paddingLevelCost(NumPaddingLevels, -1.0), allowSubtileMasks(false), useSubtileMasks(false) {
     // Decide how many thread blocks and force buffers to use.
 
     deviceIsCpu = (context.getDevice().getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU);
@@ -84,8 +113,13 @@ MetalNonbondedUtilities::MetalNonbondedUtilities(MetalContext& context) : contex
         numForceThreadBlocks = context.getNumThreadBlocks();
         forceThreadBlockSize = (context.getSIMDWidth() >= 32 ? MetalContext::ThreadBlockSize : 32);
     }
-    pinnedCountBuffer = new cl::Buffer(context.getContext(), CL_MEM_ALLOC_HOST_PTR, sizeof(unsigned int));
-    pinnedCountMemory = (unsigned int*) context.getQueue().enqueueMapBuffer(*pinnedCountBuffer, CL_TRUE, CL_MAP_READ, 0, sizeof(int));
+    interactingBlocksGroupSize = (deviceIsCpu || context.getSIMDWidth() < 32 ? 32 : 256);
+    numInteractingBlocksGroups = 0;
+    hasTunedForceLaunch = false;
+    interactionKernelNeedsTuning = false;
+    neighborListKernelNeedsTuning = false;
+    pinnedCountBuffer = new cl::Buffer(context.getContext(), CL_MEM_ALLOC_HOST_PTR, 2*sizeof(unsigned int));
+    pinnedCountMemory = (unsigned int*) context.getQueue().enqueueMapBuffer(*pinnedCountBuffer, CL_TRUE, CL_MAP_READ, 0, 2*sizeof(int));
     
     {
       std::string vendor = context.getDevice().getInfo<CL_DEVICE_VENDOR>();
@@ -113,6 +147,61 @@ MetalNonbondedUtilities::MetalNonbondedUtilities(MetalContext& context) : contex
       }
     }
     
+    char *optionSubtileMasks = getenv("OPENMM_METAL_SUBTILE_MASKS");
+    if (optionSubtileMasks != nullptr) {
+      if (strcmp(optionSubtileMasks, "0") == 0) {
+        this->allowSubtileMasks = false;
+      } else if (strcmp(optionSubtileMasks, "1") == 0) {
+        this->allowSubtileMasks = true;
+      } else {
+        std::cout << std::endl;
+        std::cout << METAL_LOG_HEADER << "Error: Invalid option for ";
+        std::cout << "'OPENMM_METAL_SUBTILE_MASKS'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Specified '" << optionSubtileMasks << "', but ";
+        std::cout << "expected either '0' or '1'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Quitting now." << std::endl;
+        exit(7);
+      }
+    }
+    
+    char *optionCheckInterval = getenv("OPENMM_METAL_NEIGHBOR_LIST_CHECK_INTERVAL");
+    if (optionCheckInterval != nullptr) {
+      char *end;
+      long interval = strtol(optionCheckInterval, &end, 10);
+      if (end == optionCheckInterval || *end != '\0' || interval < 1 || interval > 1000) {
+        std::cout << std::endl;
+        std::cout << METAL_LOG_HEADER << "Error: Invalid option for ";
+        std::cout << "'OPENMM_METAL_NEIGHBOR_LIST_CHECK_INTERVAL'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Specified '" << optionCheckInterval << "', but ";
+        std::cout << "expected a number between '1' and '1000'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Quitting now." << std::endl;
+        exit(9);
+      }
+      countCheckInterval = (int) interval;
+    }
+    
+    // When steps are fused, the count is only checked at the end of each block.
+    
+    if (context.getFusedSteps() > 1)
+      countCheckInterval = context.getFusedSteps();
+    
+    char *optionPadding = getenv("OPENMM_METAL_NEIGHBOR_LIST_PADDING");
+    if (optionPadding != nullptr) {
+      char *end;
+      double padding = strtod(optionPadding, &end);
+      if (end == optionPadding || *end != '\0' || !(padding >= 0.0 && padding <= 1.0)) {
+        std::cout << std::endl;
+        std::cout << METAL_LOG_HEADER << "Error: Invalid option for ";
+        std::cout << "'OPENMM_METAL_NEIGHBOR_LIST_PADDING'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Specified '" << optionPadding << "', but ";
+        std::cout << "expected a number between '0' and '1'." << std::endl;
+        std::cout << METAL_LOG_HEADER << "Quitting now." << std::endl;
+        exit(9);
+      }
+      paddingFraction = padding;
+      adaptivePadding = false;
+    }
+    
     setKernelSource(deviceIsCpu ? MetalKernelSources::nonbonded_cpu : MetalKernelSources::nonbonded);
 }
 
@@ -234,6 +323,22 @@ static bool compareInt2(mm_int2 a, mm_int2 b) {
     return ((a.y < b.y) || (a.y == b.y && a.x < b.x));
 }
 
+/**
+ * Encode a tile as a 64 bit key.  Sorting keys gives the same order as sorting (x, y) pairs.
+ */
+static cl_ulong getTileKey(int x, int y) {
+    return (((cl_ulong) x)<<32) | (cl_uint) y;
+}
+
+/**
+ * Get the first atom processed by a thread when building exclusions.  The ranges are aligned
+ * to atom blocks, so each thread owns whole rows of the exclusion tiles.
+ */
+static int getExclusionAtomRangeStart(int threadIndex, int numThreads, int numAtoms) {
+    int numBlocks = (numAtoms+MetalContext::TileSize-1)/MetalContext::TileSize;
+    return min(numAtoms, (int) (((long long) threadIndex*numBlocks/numThreads)*MetalContext::TileSize));
+}
+
 static bool compareInt2LargeSIMD(mm_int2 a, mm_int2 b) {
     // This version is used on devices with SIMD width greater than 32.  It puts diagonal tiles before off-diagonal
     // ones to reduce thread divergence.
@@ -249,9 +354,37 @@ static bool compareInt2LargeSIMD(mm_int2 a, mm_int2 b) {
 }
 
 void MetalNonbondedUtilities::initialize(const System& system) {
+    // Sub-tile masks are only understood by the default interaction kernel, and only the
+    // search kernel for 32 wide SIMD groups records them.
+
+    useSubtileMasks = (allowSubtileMasks && useCutoff && useNeighborList && !deviceIsCpu &&
+                       context.getSIMDWidth() == 32 && kernelSource == MetalKernelSources::nonbonded);
+
+    // Parameters found by an earlier autotuning sweep of the same interactions replace the
+    // guesses made in the constructor.  Other forces have already sized their buffers for that
+    // number of thread blocks, so a stored result may only reduce it.
+
+    if (context.getAutotuneKernels()) {
+        MetalKernelTuner::LaunchConfig config;
+        if (MetalKernelTuner(context, getTuningName("computeNonbonded"), context.getNumAtoms()).loadResult(config) &&
+                config.groupSize == forceThreadBlockSize && config.numGroups <= numForceThreadBlocks) {
+            numForceThreadBlocks = config.numGroups;
+            hasTunedForceLaunch = true;
+        }
+        else
+            interactionKernelNeedsTuning = true;
+        if (MetalKernelTuner(context, getTuningName("findBlocksWithInteractions"), context.getNumAtoms()).loadResult(config)) {
+            numInteractingBlocksGroups = config.numGroups;
+            if (!deviceIsCpu)
+                interactingBlocksGroupSize = config.groupSize;
+        }
+        else
+            neighborListKernelNeedsTuning = true;
+    }
+
     // For smaller simulations, we don't want to oversubscribe on RDNA.
     std::string vendor = context.getDevice().getInfo<CL_DEVICE_VENDOR>();
-    if (context.getSIMDWidth() == 32 &&
+    if (!hasTunedForceLaunch && context.getSIMDWidth() == 32 &&
         (vendor.size() >= 3 && vendor.substr(0, 3) == "AMD") ||
         (vendor.size() >= 28 && vendor.substr(0, 28) == "Advanced Micro Devices, Inc."))
     {
@@ -261,12 +394,15 @@ void MetalNonbondedUtilities::initialize(const System& system) {
             numForceThreadBlocks /= 2;
     }
     
-    if (context.getSIMDWidth() == 32 &&
+    if (!hasTunedForceLaunch && context.getSIMDWidth() == 32 &&
         (vendor.size() >= 5 && vendor.substr(0, 5) == "Apple"))
     {
         if (context.getNumAtoms() < 10000)
             numForceThreadBlocks /= 2;
     }
+    initialNumForceThreadBlocks = numForceThreadBlocks;
+    if (!useNeighborList)
+        neighborListKernelNeedsTuning = false;
 
     if (atomExclusions.size() == 0) {
         // No exclusions were specifically requested, so just mark every atom as not interacting with itself.
@@ -282,33 +418,59 @@ void MetalNonbondedUtilities::initialize(const System& system) {
     int numContexts = context.getPlatformData().contexts.size();
     setAtomBlockRange(context.getContextIndex()/(double) numContexts, (context.getContextIndex()+1)/(double) numContexts);
 
-    // Build a list of tiles that contain exclusions.
+    // Build a list of tiles that contain exclusions.  Each thread collects the tiles for a range of
+    // atom blocks, encoding each one as a 64 bit key with the larger block index in the upper half,
+    // and removes duplicates.  Merging and sorting the keys then gives every tile exactly once, in
+    // the same order as sorting (x, y) pairs.
 
-    set<pair<int, int> > tilesWithExclusions;
-    for (int atom1 = 0; atom1 < (int) atomExclusions.size(); ++atom1) {
-        int x = atom1/MetalContext::TileSize;
-        for (int j = 0; j < (int) atomExclusions[atom1].size(); ++j) {
-            int atom2 = atomExclusions[atom1][j];
-            int y = atom2/MetalContext::TileSize;
-            tilesWithExclusions.insert(make_pair(max(x, y), min(x, y)));
+    ThreadPool& threads = context.getPlatformData().threads;
+    int numThreads = threads.getNumThreads();
+    int numExclusionAtoms = atomExclusions.size();
+    vector<vector<cl_ulong> > threadTileKeys(numThreads);
+    threads.execute([&] (ThreadPool& threads, int threadIndex) {
+        int start = getExclusionAtomRangeStart(threadIndex, numThreads, numExclusionAtoms);
+        int end = getExclusionAtomRangeStart(threadIndex+1, numThreads, numExclusionAtoms);
+        vector<cl_ulong>& keys = threadTileKeys[threadIndex];
+        for (int atom1 = start; atom1 < end; ++atom1) {
+            int x = atom1/MetalContext::TileSize;
+            for (int atom2 : atomExclusions[atom1]) {
+                int y = atom2/MetalContext::TileSize;
+                keys.push_back(getTileKey(max(x, y), min(x, y)));
+            }
         }
+        sort(keys.begin(), keys.end());
+        keys.erase(unique(keys.begin(), keys.end()), keys.end());
+    });
+    threads.waitForThreads();
+    vector<cl_ulong> tileKeys;
+    for (int i = 0; i < numThreads; i++) {
+        tileKeys.insert(tileKeys.end(), threadTileKeys[i].begin(), threadTileKeys[i].end());
+        vector<cl_ulong>().swap(threadTileKeys[i]);
     }
-    vector<mm_int2> exclusionTilesVec;
-    for (set<pair<int, int> >::const_iterator iter = tilesWithExclusions.begin(); iter != tilesWithExclusions.end(); ++iter)
-        exclusionTilesVec.push_back(mm_int2(iter->first, iter->second));
+    sort(tileKeys.begin(), tileKeys.end());
+    tileKeys.erase(unique(tileKeys.begin(), tileKeys.end()), tileKeys.end());
+    int numExclusionTiles = tileKeys.size();
+    vector<mm_int2> exclusionTilesVec(numExclusionTiles);
+    for (int i = 0; i < numExclusionTiles; i++)
+        exclusionTilesVec[i] = mm_int2((int) (tileKeys[i]>>32), (int) (tileKeys[i]&0xFFFFFFFF));
     sort(exclusionTilesVec.begin(), exclusionTilesVec.end(), context.getSIMDWidth() <= 32 || !useCutoff ? compareInt2 : compareInt2LargeSIMD);
     exclusionTiles.initialize<mm_int2>(context, exclusionTilesVec.size(), "exclusionTiles");
     exclusionTiles.upload(exclusionTilesVec);
-    map<pair<int, int>, int> exclusionTileMap;
-    for (int i = 0; i < (int) exclusionTilesVec.size(); i++) {
+
+    // tileOrder[i] is the position in exclusionTiles of the tile whose key is tileKeys[i], so a tile's
+    // index can be found with a binary search of tileKeys.
+
+    vector<int> tileOrder(numExclusionTiles);
+    for (int i = 0; i < numExclusionTiles; i++) {
         mm_int2 tile = exclusionTilesVec[i];
-        exclusionTileMap[make_pair(tile.x, tile.y)] = i;
+        tileOrder[lower_bound(tileKeys.begin(), tileKeys.end(), getTileKey(tile.x, tile.y))-tileKeys.begin()] = i;
     }
     vector<vector<int> > exclusionBlocksForBlock(numAtomBlocks);
-    for (set<pair<int, int> >::const_iterator iter = tilesWithExclusions.begin(); iter != tilesWithExclusions.end(); ++iter) {
-        exclusionBlocksForBlock[iter->first].push_back(iter->second);
-        if (iter->first != iter->second)
-            exclusionBlocksForBlock[iter->second].push_back(iter->first);
+    for (cl_ulong key : tileKeys) {
+        int x = (int) (key>>32), y = (int) (key&0xFFFFFFFF);
+        exclusionBlocksForBlock[x].push_back(y);
+        if (x != y)
+            exclusionBlocksForBlock[y].push_back(x);
     }
     vector<cl_uint> exclusionRowIndicesVec(numAtomBlocks+1, 0);
     vector<cl_uint> exclusionIndicesVec;
@@ -324,30 +486,40 @@ void MetalNonbondedUtilities::initialize(const System& system) {
     exclusionIndices.upload(exclusionIndicesVec);
     exclusionRowIndices.upload(exclusionRowIndicesVec);
 
-    // Record the exclusion data.
+    // Record the exclusion data.  The flags for a pair of atoms are stored in the row of the atom
+    // in the larger block (or the second atom for diagonal tiles).  Each thread writes the rows of
+    // its own atoms directly, and saves the few flags that belong to other threads' rows to be
+    // applied afterward, so no word is ever written by two threads at once.
 
-    exclusions.initialize<cl_uint>(context, tilesWithExclusions.size()*MetalContext::TileSize, "exclusions");
+    exclusions.initialize<cl_uint>(context, numExclusionTiles*MetalContext::TileSize, "exclusions");
     cl_uint allFlags = (cl_uint) -1;
     vector<cl_uint> exclusionVec(exclusions.getSize(), allFlags);
-    for (int i = 0; i < exclusions.getSize(); ++i)
-        exclusionVec[i] = 0xFFFFFFFF;
-    for (int atom1 = 0; atom1 < (int) atomExclusions.size(); ++atom1) {
-        int x = atom1/MetalContext::TileSize;
-        int offset1 = atom1-x*MetalContext::TileSize;
-        for (int j = 0; j < (int) atomExclusions[atom1].size(); ++j) {
-            int atom2 = atomExclusions[atom1][j];
-            int y = atom2/MetalContext::TileSize;
-            int offset2 = atom2-y*MetalContext::TileSize;
-            if (x > y) {
-                int index = exclusionTileMap[make_pair(x, y)]*MetalContext::TileSize;
-                exclusionVec[index+offset1] &= allFlags-(1<<offset2);
-            }
-            else {
-                int index = exclusionTileMap[make_pair(y, x)]*MetalContext::TileSize;
-                exclusionVec[index+offset2] &= allFlags-(1<<offset1);
+    vector<vector<pair<int, cl_uint> > > deferredFlags(numThreads);
+    threads.execute([&] (ThreadPool& threads, int threadIndex) {
+        int start = getExclusionAtomRangeStart(threadIndex, numThreads, numExclusionAtoms);
+        int end = getExclusionAtomRangeStart(threadIndex+1, numThreads, numExclusionAtoms);
+        for (int atom1 = start; atom1 < end; ++atom1) {
+            int x = atom1/MetalContext::TileSize;
+            int offset1 = atom1-x*MetalContext::TileSize;
+            for (int atom2 : atomExclusions[atom1]) {
+                int y = atom2/MetalContext::TileSize;
+                int offset2 = atom2-y*MetalContext::TileSize;
+                int rowAtom = (x > y ? atom1 : atom2);
+                cl_ulong key = (x > y ? getTileKey(x, y) : getTileKey(y, x));
+                int index = tileOrder[lower_bound(tileKeys.begin(), tileKeys.end(), key)-tileKeys.begin()]*MetalContext::TileSize;
+                index += (x > y ? offset1 : offset2);
+                cl_uint flags = allFlags-(1<<(x > y ? offset2 : offset1));
+                if (rowAtom >= start && rowAtom < end)
+                    exclusionVec[index] &= flags;
+                else
+                    deferredFlags[threadIndex].push_back(make_pair(index, flags));
             }
         }
-    }
+    });
+    threads.waitForThreads();
+    for (int i = 0; i < numThreads; i++)
+        for (pair<int, cl_uint>& flags : deferredFlags[i])
+            exclusionVec[flags.first] &= flags.second;
     atomExclusions.clear(); // We won't use this again, so free the memory it used
     exclusions.upload(exclusionVec);
 
@@ -364,6 +536,8 @@ void MetalNonbondedUtilities::initialize(const System& system) {
             maxTiles = 1;
         interactingTiles.initialize<cl_int>(context, maxTiles, "interactingTiles");
         interactingAtoms.initialize<cl_int>(context, MetalContext::TileSize*maxTiles, "interactingAtoms");
+        if (useSubtileMasks)
+            interactingTileMasks.initialize<cl_uint>(context, maxTiles, "interactingTileMasks");
         interactionCount.initialize<cl_uint>(context, 1, "interactionCount");
         int elementSize = (context.getUseDoublePrecision() ? sizeof(cl_double) : sizeof(cl_float));
         blockCenter.initialize(context, numAtomBlocks, 4*elementSize, "blockCenter");
@@ -407,11 +581,100 @@ double MetalNonbondedUtilities::getMaxCutoffDistance() {
     return cutoff;
 }
 
+void MetalNonbondedUtilities::getNeighborListPairCounts(long long& pairsWithinCutoff, long long& pairsInTiles, long long& pairsInSubtiles) {
+    pairsWithinCutoff = 0;
+    pairsInTiles = 0;
+    pairsInSubtiles = 0;
+    if (!useCutoff || !useNeighborList || !interactingTiles.isInitialized())
+        return;
+    vector<cl_uint> count;
+    vector<cl_int> tiles, atoms;
+    vector<cl_uint> masks;
+    interactionCount.download(count);
+    interactingTiles.download(tiles);
+    interactingAtoms.download(atoms);
+    if (useSubtileMasks)
+        interactingTileMasks.download(masks);
+    int numAtoms = context.getNumAtoms();
+    vector<Vec3> positions(numAtoms);
+    if (context.getUseDoublePrecision()) {
+        vector<mm_double4> posq;
+        context.getPosq().download(posq);
+        for (int i = 0; i < numAtoms; i++)
+            positions[i] = Vec3(posq[i].x, posq[i].y, posq[i].z);
+    }
+    else {
+        vector<mm_float4> posq;
+        context.getPosq().download(posq);
+        for (int i = 0; i < numAtoms; i++)
+            positions[i] = Vec3(posq[i].x, posq[i].y, posq[i].z);
+    }
+    mm_double4 vecX = context.getPeriodicBoxVecXDouble();
+    mm_double4 vecY = context.getPeriodicBoxVecYDouble();
+    mm_double4 vecZ = context.getPeriodicBoxVecZDouble();
+    Vec3 boxVectors[3] = {Vec3(vecX.x, vecX.y, vecX.z), Vec3(vecY.x, vecY.y, vecY.z), Vec3(vecZ.x, vecZ.y, vecZ.z)};
+    double cutoff = getMaxCutoffDistance();
+    const int tileSize = MetalContext::TileSize;
+    const int subtileSize = 8;
+    const int numDiagonals = tileSize/subtileSize;
+    int numListedTiles = min((int) count[0], (int) interactingTiles.getSize());
+    for (int tile = 0; tile < numListedTiles; tile++) {
+        // The interaction kernel processes the sub-tiles in diagonals of four, and skips a
+        // diagonal only if all of its sub-tiles are empty.
+
+        pairsInTiles += tileSize*tileSize;
+        if (useSubtileMasks) {
+            for (int d = 0; d < numDiagonals; d++)
+                if ((masks[tile] & ((0x84218421u>>(4*d))&0xFFFF)) != 0)
+                    pairsInSubtiles += tileSize*subtileSize;
+        }
+        else
+            pairsInSubtiles += tileSize*tileSize;
+        int x = tiles[tile];
+        for (int i = 0; i < tileSize; i++) {
+            int atom1 = x*tileSize+i;
+            if (atom1 >= numAtoms)
+                continue;
+            for (int k = 0; k < tileSize; k++) {
+                int atom2 = atoms[tile*tileSize+k];
+                if (atom2 >= numAtoms)
+                    continue;
+                Vec3 delta = positions[atom2]-positions[atom1];
+                if (usePeriodic) {
+                    delta -= boxVectors[2]*floor(delta[2]/boxVectors[2][2]+0.5);
+                    delta -= boxVectors[1]*floor(delta[1]/boxVectors[1][1]+0.5);
+                    delta -= boxVectors[0]*floor(delta[0]/boxVectors[0][0]+0.5);
+                }
+                if (delta.dot(delta) < cutoff*cutoff)
+                    pairsWithinCutoff++;
+            }
+        }
+    }
+}
+
 double MetalNonbondedUtilities::padCutoff(double cutoff) {
-    double padding = (usePadding ? 0.1*cutoff : 0.0);
+    double padding = (usePadding ? paddingFraction*cutoff : 0.0);
     return cutoff+padding;
 }
 
+double MetalNonbondedUtilities::getNeighborListPadding() const {
+    return (usePadding ? paddingFraction : 0.0);
+}
+
+int MetalNonbondedUtilities::getPaddingGeneration() const {
+    return paddingGeneration;
+}
+
+double MetalNonbondedUtilities::getNeighborListRebuildRate() const {
+    if (samplesAtPadding == 0)
+        return 0.0;
+    return rebuildsAtPadding/(double) samplesAtPadding;
+}
+
+bool MetalNonbondedUtilities::getUseAdaptivePadding() const {
+    return (adaptivePadding && usePadding && useNeighborList);
+}
+
 void MetalNonbondedUtilities::prepareInteractions(int forceGroups) {
     if ((forceGroups&groupFlags) == 0)
         return;
@@ -433,6 +696,14 @@ void MetalNonbondedUtilities::prepareInteractions(int forceGroups) {
 
     if (lastCutoff != kernels.cutoffDistance)
         forceRebuildNeighborList = true;
+    if (kernels.paddingGeneration != paddingGeneration) {
+        // The padding changed since these kernels were compiled.  Their tuned group size is kept.
+
+        createNeighborListKernels(kernels);
+    }
+    if (listPaddingGeneration != paddingGeneration)
+        forceRebuildNeighborList = true;
+    bool forcedRebuild = forceRebuildNeighborList;
     setPeriodicBoxArgs(context, kernels.findBlockBoundsKernel, 1);
     context.executeKernel(kernels.findBlockBoundsKernel, context.getNumAtoms());
   if (useLargeBlocks) {
@@ -440,16 +711,37 @@ void MetalNonbondedUtilities::prepareInteractions(int forceGroups) {
   } else {
     blockSorter->sort(sortedBlocks);
   }
+    if (neighborListKernelNeedsTuning && forcedRebuild) {
+        // Only tune on a step that rebuilds the list, so the timings reflect the real work.
+
+        neighborListKernelNeedsTuning = false;
+        tuneNeighborListKernel(kernels);
+    }
     kernels.sortBoxDataKernel.setArg<cl_int>(9, forceRebuildNeighborList);
     context.executeKernel(kernels.sortBoxDataKernel, context.getNumAtoms());
     setPeriodicBoxArgs(context, kernels.findInteractingBlocksKernel, 0);
-    context.executeKernel(kernels.findInteractingBlocksKernel, context.getNumAtoms(), interactingBlocksThreadBlockSize);
+    int interactingBlocksWorkUnits = (numInteractingBlocksGroups > 0 ? numInteractingBlocksGroups*interactingBlocksThreadBlockSize : context.getNumAtoms());
+    context.executeKernel(kernels.findInteractingBlocksKernel, interactingBlocksWorkUnits, interactingBlocksThreadBlockSize);
     forceRebuildNeighborList = false;
     lastCutoff = kernels.cutoffDistance;
-    context.getQueue().enqueueReadBuffer(interactionCount.getDeviceBuffer(), CL_FALSE, 0, sizeof(int), pinnedCountMemory, NULL, &downloadCountEvent);
+    listPaddingGeneration = paddingGeneration;
+    bool checkCount;
+    if (!getUseLazyCountCheck())
+        checkCount = true;
+    else if (context.getFusedSteps() > 1)
+        checkCount = context.isStepBlockEnd();
+    else
+        checkCount = (stepsSinceCountCheck+1 >= countCheckInterval);
+    if (checkCount) {
+        context.getQueue().enqueueReadBuffer(interactionCount.getDeviceBuffer(), CL_FALSE, 0, sizeof(int), pinnedCountMemory);
+        context.getQueue().enqueueReadBuffer(rebuildNeighborList.getDeviceBuffer(), CL_FALSE, 0, sizeof(int), pinnedCountMemory+1, NULL, &downloadCountEvent);
+        countDownloadPending = true;
+        sampleIsForced = forcedRebuild;
+    }
     
-    // Segment the command stream to avoid stalls later.
-    if (useNeighborList && numTiles > 0) {
+    // Segment the command stream to avoid stalls later.  Fused steps only submit once per
+    // step, after the interaction kernel.
+    if (useNeighborList && numTiles > 0 && context.getFusedSteps() == 1) {
       if (groupKernels[forceGroups].hasForces)
         context.getQueue().flush();
     }
@@ -458,11 +750,20 @@ void MetalNonbondedUtilities::prepareInteractions(int forceGroups) {
 void MetalNonbondedUtilities::computeInteractions(int forceGroups, bool includeForces, bool includeEnergy) {
     if ((forceGroups&groupFlags) == 0)
         return;
+    if (groupKernels.find(forceGroups) == groupKernels.end()) {
+        // The neighbor list was built by prepareInteractions() for a superset of these groups.
+
+        createKernelsForGroups(forceGroups);
+    }
     KernelSet& kernels = groupKernels[forceGroups];
     if (kernels.hasForces) {
         cl::Kernel& kernel = (includeForces ? (includeEnergy ? kernels.forceEnergyKernel : kernels.forceKernel) : kernels.energyKernel);
         if (*reinterpret_cast<cl_kernel*>(&kernel) == NULL)
             kernel = createInteractionKernel(kernels.source, parameters, arguments, true, true, forceGroups, includeForces, includeEnergy);
+        if (interactionKernelNeedsTuning) {
+            interactionKernelNeedsTuning = false;
+            tuneInteractionKernel(kernels, kernel, forceGroups, includeForces, includeEnergy);
+        }
         if (useCutoff)
             setPeriodicBoxArgs(context, kernel, 9);
         context.executeKernel(kernel, numForceThreadBlocks*forceThreadBlockSize, forceThreadBlockSize);
@@ -473,11 +774,36 @@ void MetalNonbondedUtilities::computeInteractions(int forceGroups, bool includeF
         if (kernels.hasForces)
             context.getQueue().flush();
         #endif
-        downloadCountEvent.wait();
-        updateNeighborListSize();
+        if (countDownloadPending) {
+            downloadCountEvent.wait();
+            countDownloadPending = false;
+            stepsSinceCountCheck = 0;
+            updateNeighborListSize();
+            if (!sampleIsForced)
+                recordNeighborListSample(pinnedCountMemory[1] != 0, pinnedCountMemory[0]);
+        }
+        else
+            stepsSinceCountCheck++;
     }
 }
 
+void MetalNonbondedUtilities::checkNeighborListSize() {
+    if (groupKernels.empty() || !useNeighborList || numTiles == 0 || !getUseLazyCountCheck())
+        return;
+    context.getQueue().enqueueReadBuffer(interactionCount.getDeviceBuffer(), CL_TRUE, 0, sizeof(int), pinnedCountMemory);
+    countDownloadPending = false;
+    stepsSinceCountCheck = 0;
+    updateNeighborListSize();
+}
+
+bool MetalNonbondedUtilities::getUseLazyCountCheck() const {
+    // Only the default interaction kernel can fall back to enumerating all tiles when the
+    // neighbor list overflows.  Other kernels stop early and rely on the host invalidating
+    // the forces, so the count must be checked every step whenever they use the list.
+
+    return (countCheckInterval > 1 && !countIsShared && !deviceIsCpu && kernelSource == MetalKernelSources::nonbonded);
+}
+
 bool MetalNonbondedUtilities::updateNeighborListSize() {
     if (!useCutoff)
         return false;
@@ -492,47 +818,257 @@ bool MetalNonbondedUtilities::updateNeighborListSize() {
     // this from happening in the future.
 
     unsigned int maxTiles = (unsigned int) (1.2*pinnedCountMemory[0]);
-    unsigned int numBlocks = context.getNumAtomBlocks();
-    int totalTiles = numBlocks*(numBlocks+1)/2;
+    long long totalTiles = getTotalNumTiles();
     if (maxTiles > totalTiles)
         maxTiles = totalTiles;
     interactingTiles.resize(maxTiles);
     interactingAtoms.resize(MetalContext::TileSize*(size_t) maxTiles);
+    if (useSubtileMasks)
+        interactingTileMasks.resize(maxTiles);
     for (map<int, KernelSet>::iterator iter = groupKernels.begin(); iter != groupKernels.end(); ++iter) {
         KernelSet& kernels = iter->second;
         if (*reinterpret_cast<cl_kernel*>(&kernels.forceKernel) != NULL) {
             kernels.forceKernel.setArg<cl::Buffer>(7, interactingTiles.getDeviceBuffer());
             kernels.forceKernel.setArg<cl_uint>(14, maxTiles);
             kernels.forceKernel.setArg<cl::Buffer>(17, interactingAtoms.getDeviceBuffer());
+            if (useSubtileMasks)
+                kernels.forceKernel.setArg<cl::Buffer>(18, interactingTileMasks.getDeviceBuffer());
         }
         if (*reinterpret_cast<cl_kernel*>(&kernels.energyKernel) != NULL) {
             kernels.energyKernel.setArg<cl::Buffer>(7, interactingTiles.getDeviceBuffer());
             kernels.energyKernel.setArg<cl_uint>(14, maxTiles);
             kernels.energyKernel.setArg<cl::Buffer>(17, interactingAtoms.getDeviceBuffer());
+            if (useSubtileMasks)
+                kernels.energyKernel.setArg<cl::Buffer>(18, interactingTileMasks.getDeviceBuffer());
         }
         if (*reinterpret_cast<cl_kernel*>(&kernels.forceEnergyKernel) != NULL) {
             kernels.forceEnergyKernel.setArg<cl::Buffer>(7, interactingTiles.getDeviceBuffer());
             kernels.forceEnergyKernel.setArg<cl_uint>(14, maxTiles);
             kernels.forceEnergyKernel.setArg<cl::Buffer>(17, interactingAtoms.getDeviceBuffer());
+            if (useSubtileMasks)
+                kernels.forceEnergyKernel.setArg<cl::Buffer>(18, interactingTileMasks.getDeviceBuffer());
         }
         kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(6, interactingTiles.getDeviceBuffer());
         kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(7, interactingAtoms.getDeviceBuffer());
         kernels.findInteractingBlocksKernel.setArg<cl_uint>(9, maxTiles);
+        if (useSubtileMasks)
+            kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(useLargeBlocks ? 21 : 19, interactingTileMasks.getDeviceBuffer());
     }
     forceRebuildNeighborList = true;
-    context.setForcesValid(false);
+    if (!getUseLazyCountCheck())
+        context.setForcesValid(false);
     return true;
 }
 
+void MetalNonbondedUtilities::recordNeighborListSample(bool rebuilt, unsigned int tiles) {
+    samplesAtPadding++;
+    if (rebuilt)
+        rebuildsAtPadding++;
+    if (!getUseAdaptivePadding())
+        return;
+    windowSamples++;
+    if (rebuilt)
+        windowRebuilds++;
+    windowTiles += tiles;
+    if (windowSamples < MaxWindowSamples && (windowSamples < MinWindowSamples || windowRebuilds < MinWindowRebuilds))
+        return;
+
+    // Estimate the cost per step in units of one tile of the interaction kernel.  Every step
+    // processes the tiles in the list.  A rebuild compares every pair of blocks and then checks
+    // the atoms of each candidate tile, which is modeled as costing about as much as processing
+    // the list once more.
+
+    double tilesPerStep = windowTiles/windowSamples;
+    double rebuildRate = windowRebuilds/(double) windowSamples;
+    double rebuildCost = tilesPerStep + getTotalNumTiles()/(double) MetalContext::TileSize;
+    paddingLevelCost[paddingLevel] = tilesPerStep + rebuildRate*rebuildCost;
+    windowSamples = 0;
+    windowRebuilds = 0;
+    windowTiles = 0.0;
+
+    // Move toward the cheapest padding measured so far.  If a neighbor of it has not been
+    // measured yet, try that next.  Otherwise the search is finished.
+
+    int best = paddingLevel;
+    for (int i = 0; i < NumPaddingLevels; i++)
+        if (paddingLevelCost[i] >= 0.0 && paddingLevelCost[i] < paddingLevelCost[best])
+            best = i;
+    int next = best;
+    if (best > 0 && paddingLevelCost[best-1] < 0.0)
+        next = best-1;
+    else if (best < NumPaddingLevels-1 && paddingLevelCost[best+1] < 0.0)
+        next = best+1;
+    else if (++windowsSinceSearch >= WindowsBetweenSearches) {
+        windowsSinceSearch = 0;
+        for (int i = 0; i < NumPaddingLevels; i++)
+            paddingLevelCost[i] = -1.0;
+    }
+    if (next != paddingLevel)
+        setPaddingLevel(next);
+}
+
+void MetalNonbondedUtilities::setPaddingLevel(int level) {
+    paddingLevel = level;
+    paddingFraction = PaddingLevels[level];
+    samplesAtPadding = 0;
+    rebuildsAtPadding = 0;
+    paddingGeneration++;
+    forceRebuildNeighborList = true;
+    tilesAfterReorder = 0;
+}
+
+/**
+ * Get the numbers of thread blocks to try when tuning a kernel: a range of multiples of the
+ * number of compute units, up to the most that MetalContext::executeKernel() will launch.
+ */
+static vector<int> getTuningGroupCounts(MetalContext& context) {
+    int computeUnits = context.getDevice().getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+    vector<int> counts;
+    for (int blocksPerUnit : {1, 2, 4, 6, 8, 12, 16})
+        if (blocksPerUnit*computeUnits <= context.getNumThreadBlocks())
+            counts.push_back(blocksPerUnit*computeUnits);
+    return counts;
+}
+
+/**
+ * Get the thread block sizes to try when tuning a kernel.
+ */
+static vector<int> getTuningGroupSizes(MetalContext& context, bool deviceIsCpu) {
+    if (deviceIsCpu)
+        return vector<int>(1, 1);
+    int maxSize = context.getDevice().getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+    vector<int> sizes;
+    for (int size = 32; size <= min(256, maxSize); size *= 2)
+        sizes.push_back(size);
+    return sizes;
+}
+
+void MetalNonbondedUtilities::tuneInteractionKernel(KernelSet& kernels, cl::Kernel& kernel, int forceGroups, bool includeForces, bool includeEnergy) {
+    // The kernel adds to the force and energy buffers, so save them and restore them before
+    // every launch.
+
+    MetalArray& longForces = context.getLongForceBuffer();
+    MetalArray& energy = context.getEnergyBuffer();
+    MetalArray savedForces(context, longForces.getSize(), longForces.getElementSize(), "savedForces");
+    MetalArray savedEnergy(context, energy.getSize(), energy.getElementSize(), "savedEnergy");
+    MetalArray savedDerivs;
+    bool hasDerivs = (energyParameterDerivatives.size() > 0);
+    longForces.copyTo(savedForces);
+    energy.copyTo(savedEnergy);
+    if (hasDerivs) {
+        MetalArray& derivs = context.getEnergyParamDerivBuffer();
+        savedDerivs.initialize(context, derivs.getSize(), derivs.getElementSize(), "savedDerivs");
+        derivs.copyTo(savedDerivs);
+    }
+
+    // Every thread writes its own element of the energy buffer, so that limits the total number
+    // of threads.  Buffers owned by other forces were sized for the original thread blocks, so
+    // only fewer blocks of the same size are tried.
+
+    MetalKernelTuner::LaunchConfig current(numForceThreadBlocks, forceThreadBlockSize);
+    vector<MetalKernelTuner::LaunchConfig> candidates = {current};
+    for (const MetalKernelTuner::LaunchConfig& config : MetalKernelTuner::getCandidates(getTuningGroupCounts(context), vector<int>(1, forceThreadBlockSize), energy.getSize()))
+        if (!(config == current) && config.numGroups <= initialNumForceThreadBlocks)
+            candidates.push_back(config);
+    MetalKernelTuner tuner(context, getTuningName("computeNonbonded"), context.getNumAtoms());
+    MetalKernelTuner::LaunchConfig best = tuner.sweep(candidates, [&] (const MetalKernelTuner::LaunchConfig& config) {
+        if (useCutoff)
+            setPeriodicBoxArgs(context, kernel, 9);
+        context.executeKernel(kernel, config.numGroups*config.groupSize, config.groupSize);
+    }, [&] () {
+        savedForces.copyTo(longForces);
+        savedEnergy.copyTo(energy);
+        if (hasDerivs)
+            savedDerivs.copyTo(context.getEnergyParamDerivBuffer());
+    });
+    numForceThreadBlocks = best.numGroups;
+}
+
+void MetalNonbondedUtilities::tuneNeighborListKernel(KernelSet& kernels) {
+    int threadBlockSize = interactingBlocksThreadBlockSize;
+    int defaultGroups = min((context.getNumAtoms()+threadBlockSize-1)/threadBlockSize, context.getNumThreadBlocks());
+    MetalKernelTuner::LaunchConfig current(numInteractingBlocksGroups > 0 ? numInteractingBlocksGroups : defaultGroups, deviceIsCpu ? 1 : interactingBlocksGroupSize);
+    vector<MetalKernelTuner::LaunchConfig> candidates = {current};
+    for (const MetalKernelTuner::LaunchConfig& config : MetalKernelTuner::getCandidates(getTuningGroupCounts(context), getTuningGroupSizes(context, deviceIsCpu), context.getNumThreadBlocks()*256))
+        if (!(config == current))
+            candidates.push_back(config);
+
+    // The group size is compiled into the kernel, so changing it recreates the kernels.  Every
+    // launch rebuilds the neighbor list from scratch, so there is nothing to restore.
+
+    int originalGroupSize = interactingBlocksGroupSize;
+    MetalKernelTuner tuner(context, getTuningName("findBlocksWithInteractions"), context.getNumAtoms());
+    MetalKernelTuner::LaunchConfig best = tuner.sweep(candidates, [&] (const MetalKernelTuner::LaunchConfig& config) {
+        if (!deviceIsCpu && config.groupSize != interactingBlocksGroupSize) {
+            interactingBlocksGroupSize = config.groupSize;
+            createNeighborListKernels(kernels);
+            if (useLargeBlocks)
+                setPeriodicBoxArgs(context, kernels.sortBoxDataKernel, 12);
+        }
+        kernels.sortBoxDataKernel.setArg<cl_int>(9, true);
+        context.executeKernel(kernels.sortBoxDataKernel, context.getNumAtoms());
+        setPeriodicBoxArgs(context, kernels.findInteractingBlocksKernel, 0);
+        context.executeKernel(kernels.findInteractingBlocksKernel, config.numGroups*interactingBlocksThreadBlockSize, interactingBlocksThreadBlockSize);
+    }, [] () {
+    });
+    numInteractingBlocksGroups = best.numGroups;
+    if (!deviceIsCpu) {
+        int lastGroupSize = interactingBlocksGroupSize;
+        interactingBlocksGroupSize = best.groupSize;
+        for (map<int, KernelSet>::iterator iter = groupKernels.begin(); iter != groupKernels.end(); ++iter) {
+            int builtWith = (&iter->second == &kernels ? lastGroupSize : originalGroupSize);
+            if (builtWith != best.groupSize)
+                createNeighborListKernels(iter->second);
+        }
+        if (useLargeBlocks)
+            setPeriodicBoxArgs(context, kernels.sortBoxDataKernel, 12);
+    }
+}
+
+string MetalNonbondedUtilities::getTuningName(const string& kernelName) {
+    // The interaction source identifies the nonbonded method and any custom interactions.
+
+    stringstream name;
+    name << kernelName;
+    if (useCutoff)
+        name << (usePeriodic ? " periodic " : " cutoff ") << getMaxCutoffDistance();
+    else
+        name << " nocutoff";
+    if (useSubtileMasks)
+        name << " masks";
+    if (context.getUseCompressedParameters())
+        name << " compressed";
+    if (kernelSource != MetalKernelSources::nonbonded)
+        name << " customkernel";
+    for (map<int, string>::const_iterator iter = groupKernelSource.begin(); iter != groupKernelSource.end(); ++iter)
+        name << "\n" << iter->second;
+    return name.str();
+}
+
 void MetalNonbondedUtilities::setUsePadding(bool padding) {
+    if (padding != usePadding)
+        paddingGeneration++;
     usePadding = padding;
 }
 
+long long MetalNonbondedUtilities::getTotalNumTiles() const {
+    long long blocksPerReplica = context.getNumAtomBlocks()/context.getNumReplicas();
+    return context.getNumReplicas()*blocksPerReplica*(blocksPerReplica+1)/2;
+}
+
+void MetalNonbondedUtilities::addReplicaDefines(map<string, string>& defines) const {
+    if (context.getNumReplicas() > 1) {
+        int blocksPerReplica = context.getNumAtomBlocks()/context.getNumReplicas();
+        defines["BLOCKS_PER_REPLICA"] = context.intToString(blocksPerReplica);
+        defines["TILES_PER_REPLICA"] = context.intToString(blocksPerReplica*(blocksPerReplica+1)/2);
+    }
+}
+
 void MetalNonbondedUtilities::setAtomBlockRange(double startFraction, double endFraction) {
     int numAtomBlocks = context.getNumAtomBlocks();
     startBlockIndex = (int) (startFraction*numAtomBlocks);
     numBlocks = (int) (endFraction*numAtomBlocks)-startBlockIndex;
-    long long totalTiles = context.getNumAtomBlocks()*((long long)context.getNumAtomBlocks()+1)/2;
+    long long totalTiles = getTotalNumTiles();
     startTileIndex = (int) (startFraction*totalTiles);;
     numTiles = (long long) (endFraction*totalTiles)-startTileIndex;
     if (useCutoff) {
@@ -572,87 +1108,98 @@ void MetalNonbondedUtilities::createKernelsForGroups(int groups) {
     kernels.hasForces = (source.size() > 0);
     kernels.cutoffDistance = cutoff;
     kernels.source = source;
-    if (useCutoff) {
-        double paddedCutoff = padCutoff(cutoff);
-        map<string, string> defines;
-        defines["TILE_SIZE"] = context.intToString(MetalContext::TileSize);
-        defines["NUM_ATOMS"] = context.intToString(context.getNumAtoms());
-        defines["PADDING"] = context.doubleToString(paddedCutoff-cutoff);
-        defines["PADDED_CUTOFF"] = context.doubleToString(paddedCutoff);
-        defines["PADDED_CUTOFF_SQUARED"] = context.doubleToString(paddedCutoff*paddedCutoff);
-        defines["NUM_TILES_WITH_EXCLUSIONS"] = context.intToString(exclusionTiles.getSize());
-        defines["NUM_BLOCKS"] = context.intToString(context.getNumAtomBlocks());
-        defines["SIMD_WIDTH"] = context.intToString(context.getSIMDWidth());
-        if (usePeriodic)
-            defines["USE_PERIODIC"] = "1";
-        if (context.getBoxIsTriclinic())
-            defines["TRICLINIC"] = "1";
-        if (useLargeBlocks)
-            defines["USE_LARGE_BLOCKS"] = "1";
-        defines["MAX_EXCLUSIONS"] = context.intToString(maxExclusions);
-        defines["BUFFER_GROUPS"] = (deviceIsCpu ? "4" : "2");
-        string file = (deviceIsCpu ? MetalKernelSources::findInteractingBlocks_cpu : MetalKernelSources::findInteractingBlocks);
-        int groupSize = (deviceIsCpu || context.getSIMDWidth() < 32 ? 32 : 256);
-        while (true) {
-            defines["GROUP_SIZE"] = context.intToString(groupSize);
-            cl::Program interactingBlocksProgram = context.createProgram(file, defines);
-            kernels.findBlockBoundsKernel = cl::Kernel(interactingBlocksProgram, "findBlockBounds");
-            kernels.findBlockBoundsKernel.setArg<cl_int>(0, context.getNumAtoms());
-            kernels.findBlockBoundsKernel.setArg<cl::Buffer>(6, context.getPosq().getDeviceBuffer());
-            kernels.findBlockBoundsKernel.setArg<cl::Buffer>(7, blockCenter.getDeviceBuffer());
-            kernels.findBlockBoundsKernel.setArg<cl::Buffer>(8, blockBoundingBox.getDeviceBuffer());
-            kernels.findBlockBoundsKernel.setArg<cl::Buffer>(9, rebuildNeighborList.getDeviceBuffer());
-            kernels.findBlockBoundsKernel.setArg<cl::Buffer>(10, sortedBlocks.getDeviceBuffer());
-          
-            kernels.sortBoxDataKernel = cl::Kernel(interactingBlocksProgram, "sortBoxData");
-            kernels.sortBoxDataKernel.setArg<cl::Buffer>(0, sortedBlocks.getDeviceBuffer());
-            kernels.sortBoxDataKernel.setArg<cl::Buffer>(1, blockCenter.getDeviceBuffer());
-            kernels.sortBoxDataKernel.setArg<cl::Buffer>(2, blockBoundingBox.getDeviceBuffer());
-            kernels.sortBoxDataKernel.setArg<cl::Buffer>(3, sortedBlockCenter.getDeviceBuffer());
-            kernels.sortBoxDataKernel.setArg<cl::Buffer>(4, sortedBlockBoundingBox.getDeviceBuffer());
-            kernels.sortBoxDataKernel.setArg<cl::Buffer>(5, context.getPosq().getDeviceBuffer());
-            kernels.sortBoxDataKernel.setArg<cl::Buffer>(6, oldPositions.getDeviceBuffer());
-            kernels.sortBoxDataKernel.setArg<cl::Buffer>(7, interactionCount.getDeviceBuffer());
-            kernels.sortBoxDataKernel.setArg<cl::Buffer>(8, rebuildNeighborList.getDeviceBuffer());
-            kernels.sortBoxDataKernel.setArg<cl_int>(9, true);
-            if (useLargeBlocks) {
-              kernels.sortBoxDataKernel.setArg<cl::Buffer>(10, largeBlockCenter.getDeviceBuffer());
-              kernels.sortBoxDataKernel.setArg<cl::Buffer>(11, largeBlockBoundingBox.getDeviceBuffer());
-            }
-          
-            kernels.findInteractingBlocksKernel = cl::Kernel(interactingBlocksProgram, "findBlocksWithInteractions");
-            kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(5, interactionCount.getDeviceBuffer());
-            kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(6, interactingTiles.getDeviceBuffer());
-            kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(7, interactingAtoms.getDeviceBuffer());
-            kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(8, context.getPosq().getDeviceBuffer());
-            kernels.findInteractingBlocksKernel.setArg<cl_uint>(9, interactingTiles.getSize());
-            kernels.findInteractingBlocksKernel.setArg<cl_uint>(10, startBlockIndex);
-            kernels.findInteractingBlocksKernel.setArg<cl_uint>(11, numBlocks);
-            kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(12, sortedBlocks.getDeviceBuffer());
-            kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(13, sortedBlockCenter.getDeviceBuffer());
-            kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(14, sortedBlockBoundingBox.getDeviceBuffer());
-            kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(15, exclusionIndices.getDeviceBuffer());
-            kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(16, exclusionRowIndices.getDeviceBuffer());
-            kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(17, oldPositions.getDeviceBuffer());
-            kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(18, rebuildNeighborList.getDeviceBuffer());
-            if (useLargeBlocks) {
-              kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(19, largeBlockCenter.getDeviceBuffer());
-              kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(20, largeBlockBoundingBox.getDeviceBuffer());
-            }
-          
-            if (kernels.findInteractingBlocksKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(context.getDevice()) < groupSize) {
-                // The device can't handle this block size, so reduce it.
+    kernels.paddingGeneration = -1;
+    if (useCutoff)
+        createNeighborListKernels(kernels);
+    groupKernels[groups] = kernels;
+}
 
-                groupSize -= 32;
-                if (groupSize < 32)
-                    throw OpenMMException("Failed to create findInteractingBlocks kernel");
-                continue;
-            }
-            break;
+void MetalNonbondedUtilities::createNeighborListKernels(KernelSet& kernels) {
+    double cutoff = kernels.cutoffDistance;
+    double paddedCutoff = padCutoff(cutoff);
+    kernels.paddingGeneration = paddingGeneration;
+    map<string, string> defines;
+    defines["TILE_SIZE"] = context.intToString(MetalContext::TileSize);
+    defines["NUM_ATOMS"] = context.intToString(context.getNumAtoms());
+    defines["PADDING"] = context.doubleToString(paddedCutoff-cutoff);
+    defines["PADDED_CUTOFF"] = context.doubleToString(paddedCutoff);
+    defines["PADDED_CUTOFF_SQUARED"] = context.doubleToString(paddedCutoff*paddedCutoff);
+    defines["NUM_TILES_WITH_EXCLUSIONS"] = context.intToString(exclusionTiles.getSize());
+    defines["NUM_BLOCKS"] = context.intToString(context.getNumAtomBlocks());
+    defines["SIMD_WIDTH"] = context.intToString(context.getSIMDWidth());
+    addReplicaDefines(defines);
+    if (usePeriodic)
+        defines["USE_PERIODIC"] = "1";
+    if (context.getBoxIsTriclinic())
+        defines["TRICLINIC"] = "1";
+    if (useLargeBlocks)
+        defines["USE_LARGE_BLOCKS"] = "1";
+    if (useSubtileMasks)
+        defines["USE_SUBTILE_MASKS"] = "1";
+    defines["MAX_EXCLUSIONS"] = context.intToString(maxExclusions);
+    defines["BUFFER_GROUPS"] = (deviceIsCpu ? "4" : "2");
+    string file = (deviceIsCpu ? MetalKernelSources::findInteractingBlocks_cpu : MetalKernelSources::findInteractingBlocks);
+    int groupSize = interactingBlocksGroupSize;
+    while (true) {
+        defines["GROUP_SIZE"] = context.intToString(groupSize);
+        cl::Program interactingBlocksProgram = context.createProgram(file, defines);
+        kernels.findBlockBoundsKernel = cl::Kernel(interactingBlocksProgram, "findBlockBounds");
+        kernels.findBlockBoundsKernel.setArg<cl_int>(0, context.getNumAtoms());
+        kernels.findBlockBoundsKernel.setArg<cl::Buffer>(6, context.getPosq().getDeviceBuffer());
+        kernels.findBlockBoundsKernel.setArg<cl::Buffer>(7, blockCenter.getDeviceBuffer());
+        kernels.findBlockBoundsKernel.setArg<cl::Buffer>(8, blockBoundingBox.getDeviceBuffer());
+        kernels.findBlockBoundsKernel.setArg<cl::Buffer>(9, rebuildNeighborList.getDeviceBuffer());
+        kernels.findBlockBoundsKernel.setArg<cl::Buffer>(10, sortedBlocks.getDeviceBuffer());
+      
+        kernels.sortBoxDataKernel = cl::Kernel(interactingBlocksProgram, "sortBoxData");
+        kernels.sortBoxDataKernel.setArg<cl::Buffer>(0, sortedBlocks.getDeviceBuffer());
+        kernels.sortBoxDataKernel.setArg<cl::Buffer>(1, blockCenter.getDeviceBuffer());
+        kernels.sortBoxDataKernel.setArg<cl::Buffer>(2, blockBoundingBox.getDeviceBuffer());
+        kernels.sortBoxDataKernel.setArg<cl::Buffer>(3, sortedBlockCenter.getDeviceBuffer());
+        kernels.sortBoxDataKernel.setArg<cl::Buffer>(4, sortedBlockBoundingBox.getDeviceBuffer());
+        kernels.sortBoxDataKernel.setArg<cl::Buffer>(5, context.getPosq().getDeviceBuffer());
+        kernels.sortBoxDataKernel.setArg<cl::Buffer>(6, oldPositions.getDeviceBuffer());
+        kernels.sortBoxDataKernel.setArg<cl::Buffer>(7, interactionCount.getDeviceBuffer());
+        kernels.sortBoxDataKernel.setArg<cl::Buffer>(8, rebuildNeighborList.getDeviceBuffer());
+        kernels.sortBoxDataKernel.setArg<cl_int>(9, true);
+        if (useLargeBlocks) {
+          kernels.sortBoxDataKernel.setArg<cl::Buffer>(10, largeBlockCenter.getDeviceBuffer());
+          kernels.sortBoxDataKernel.setArg<cl::Buffer>(11, largeBlockBoundingBox.getDeviceBuffer());
         }
-        interactingBlocksThreadBlockSize = (deviceIsCpu ? 1 : groupSize);
+      
+        kernels.findInteractingBlocksKernel = cl::Kernel(interactingBlocksProgram, "findBlocksWithInteractions");
+        kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(5, interactionCount.getDeviceBuffer());
+        kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(6, interactingTiles.getDeviceBuffer());
+        kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(7, interactingAtoms.getDeviceBuffer());
+        kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(8, context.getPosq().getDeviceBuffer());
+        kernels.findInteractingBlocksKernel.setArg<cl_uint>(9, interactingTiles.getSize());
+        kernels.findInteractingBlocksKernel.setArg<cl_uint>(10, startBlockIndex);
+        kernels.findInteractingBlocksKernel.setArg<cl_uint>(11, numBlocks);
+        kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(12, sortedBlocks.getDeviceBuffer());
+        kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(13, sortedBlockCenter.getDeviceBuffer());
+        kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(14, sortedBlockBoundingBox.getDeviceBuffer());
+        kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(15, exclusionIndices.getDeviceBuffer());
+        kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(16, exclusionRowIndices.getDeviceBuffer());
+        kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(17, oldPositions.getDeviceBuffer());
+        kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(18, rebuildNeighborList.getDeviceBuffer());
+        if (useLargeBlocks) {
+          kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(19, largeBlockCenter.getDeviceBuffer());
+          kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(20, largeBlockBoundingBox.getDeviceBuffer());
+        }
+        if (useSubtileMasks)
+          kernels.findInteractingBlocksKernel.setArg<cl::Buffer>(useLargeBlocks ? 21 : 19, interactingTileMasks.getDeviceBuffer());
+      
+        if (kernels.findInteractingBlocksKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(context.getDevice()) < groupSize) {
+            // The device can't handle this block size, so reduce it.
+
+            groupSize -= 32;
+            if (groupSize < 32)
+                throw OpenMMException("Failed to create findInteractingBlocks kernel");
+            continue;
+        }
+        break;
     }
-    groupKernels[groups] = kernels;
+    interactingBlocksThreadBlockSize = (deviceIsCpu ? 1 : groupSize);
 }
 
 cl::Kernel MetalNonbondedUtilities::createInteractionKernel(const string& source, const vector<ParameterInfo>& params, const vector<ParameterInfo>& arguments, bool useExclusions, bool isSymmetric, int groups, bool includeForces, bool includeEnergy) {
@@ -676,7 +1223,9 @@ cl::Kernel MetalNonbondedUtilities::createInteractionKernel(const string& source
         args << ", __global ";
         if (param.isConstant())
             args << "const ";
-        if (param.getNumComponents() == 3)
+        if (param.isStoredAsHalf())
+            args << "half";
+        else if (param.getNumComponents() == 3)
             args << param.getComponentType();
         else
             args << param.getType();
@@ -719,10 +1268,15 @@ cl::Kernel MetalNonbondedUtilities::createInteractionKernel(const string& source
     stringstream loadLocal2;
     for (const ParameterInfo& param : params) {
         if (param.getNumComponents() == 1) {
-            loadLocal2<<"localData[localAtomIndex]."<<param.getName()<<" = global_"<<param.getName()<<"[j];\n";
+            if (param.isStoredAsHalf())
+                loadLocal2<<"localData[localAtomIndex]."<<param.getName()<<" = vload_half(j, global_"<<param.getName()<<");\n";
+            else
+                loadLocal2<<"localData[localAtomIndex]."<<param.getName()<<" = global_"<<param.getName()<<"[j];\n";
         }
         else {
-            if (param.getNumComponents() == 3)
+            if (param.isStoredAsHalf())
+                loadLocal2<<param.getType()<<" temp_"<<param.getName()<<" = vload_half"<<param.getNumComponents()<<"(j, global_"<<param.getName()<<");\n";
+            else if (param.getNumComponents() == 3)
                 loadLocal2<<param.getType()<<" temp_"<<param.getName()<<" = make_"<<param.getType()<<"(global_"<<param.getName()<<"[3*j], global_"<<param.getName()<<"[3*j+1], global_"<<param.getName()<<"[3*j+2]);\n";
             else
                 loadLocal2<<param.getType()<<" temp_"<<param.getName()<<" = global_"<<param.getName()<<"[j];\n";
@@ -734,7 +1288,13 @@ cl::Kernel MetalNonbondedUtilities::createInteractionKernel(const string& source
     stringstream load1;
     for (const ParameterInfo& param : params) {
         load1<<param.getType()<<" "<<param.getName()<<"1 = ";
-        if (param.getNumComponents() == 3)
+        if (param.isStoredAsHalf()) {
+            if (param.getNumComponents() == 1)
+                load1<<"vload_half(atom1, global_"<<param.getName()<<");\n";
+            else
+                load1<<"vload_half"<<param.getNumComponents()<<"(atom1, global_"<<param.getName()<<");\n";
+        }
+        else if (param.getNumComponents() == 3)
             load1<<"make_"<<param.getType()<<"(global_"<<param.getName()<<"[3*atom1], global_"<<param.getName()<<"[3*atom1+1], global_"<<param.getName()<<"[3*atom1+2]);\n";
         else
             load1<<"global_"<<param.getName()<<"[atom1];\n";
@@ -788,6 +1348,8 @@ cl::Kernel MetalNonbondedUtilities::createInteractionKernel(const string& source
         defines["USE_SYMMETRIC"] = "1";
     if (useNeighborList)
         defines["USE_NEIGHBOR_LIST"] = "1";
+    if (useNeighborList && countCheckInterval > 1)
+        defines["ALL_TILES_ON_OVERFLOW"] = "1";
     if (useCutoff && context.getSIMDWidth() < 32)
         defines["PRUNE_BY_CUTOFF"] = "1";
     if (includeForces)
@@ -810,6 +1372,7 @@ cl::Kernel MetalNonbondedUtilities::createInteractionKernel(const string& source
     defines["PADDED_NUM_ATOMS"] = context.intToString(context.getPaddedNumAtoms());
     defines["NUM_BLOCKS"] = context.intToString(context.getNumAtomBlocks());
     defines["TILE_SIZE"] = context.intToString(MetalContext::TileSize);
+    addReplicaDefines(defines);
     int numExclusionTiles = exclusionTiles.getSize();
     defines["NUM_TILES_WITH_EXCLUSIONS"] = context.intToString(numExclusionTiles);
     int numContexts = context.getPlatformData().contexts.size();
@@ -819,6 +1382,8 @@ cl::Kernel MetalNonbondedUtilities::createInteractionKernel(const string& source
     defines["LAST_EXCLUSION_TILE"] = context.intToString(endExclusionIndex);
     if ((localDataSize/4)%2 == 0)
         defines["PARAMETER_SIZE_IS_EVEN"] = "1";
+    if (useSubtileMasks)
+        defines["USE_SUBTILE_MASKS"] = "1";
     cl::Program program = context.createProgram(context.replaceStrings(kernelSource, replacements), defines);
     cl::Kernel kernel(program, "computeNonbonded");
 
@@ -840,6 +1405,8 @@ cl::Kernel MetalNonbondedUtilities::createInteractionKernel(const string& source
         kernel.setArg<cl::Buffer>(index++, blockCenter.getDeviceBuffer());
         kernel.setArg<cl::Buffer>(index++, blockBoundingBox.getDeviceBuffer());
         kernel.setArg<cl::Buffer>(index++, interactingAtoms.getDeviceBuffer());
+        if (useSubtileMasks)
+            kernel.setArg<cl::Buffer>(index++, interactingTileMasks.getDeviceBuffer());
     }
     for (const ParameterInfo& param : params)
         kernel.setArg<cl::Memory>(index++, param.getMemory());
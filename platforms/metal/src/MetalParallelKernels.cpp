@@ -54,14 +54,21 @@ using namespace std;
 class MetalParallelCalcForcesAndEnergyKernel::BeginComputationTask : public MetalContext::WorkTask {
 public:
     BeginComputationTask(ContextImpl& context, MetalContext& cl, MetalCalcForcesAndEnergyKernel& kernel,
-            bool includeForce, bool includeEnergy, int groups, void* pinnedMemory, int& numTiles) : context(context), cl(cl), kernel(kernel),
-            includeForce(includeForce), includeEnergy(includeEnergy), groups(groups), pinnedMemory(pinnedMemory), numTiles(numTiles) {
+            bool includeForce, bool includeEnergy, int groups, void* pinnedMemory, cl::Event* positionEvent, int& numTiles) : context(context), cl(cl), kernel(kernel),
+            includeForce(includeForce), includeEnergy(includeEnergy), groups(groups), pinnedMemory(pinnedMemory), positionEvent(positionEvent), numTiles(numTiles) {
     }
     void execute() {
-        // Copy coordinates over to this device and execute the kernel.
+        // Copy coordinates over to this device and execute the kernel.  With peer transfers, the first
+        // device has already enqueued the copy, so this device only needs to wait for it.
 
-        if (cl.getContextIndex() > 0)
-            cl.getQueue().enqueueWriteBuffer(cl.getPosq().getDeviceBuffer(), CL_FALSE, 0, cl.getPaddedNumAtoms()*cl.getPosq().getElementSize(), pinnedMemory);
+        if (cl.getContextIndex() > 0) {
+            if (positionEvent != NULL) {
+                vector<cl::Event> waitEvents(1, *positionEvent);
+                cl.getQueue().enqueueBarrierWithWaitList(&waitEvents);
+            }
+            else
+                cl.getQueue().enqueueWriteBuffer(cl.getPosq().getDeviceBuffer(), CL_FALSE, 0, cl.getPaddedNumAtoms()*cl.getPosq().getElementSize(), pinnedMemory);
+        }
         kernel.beginComputation(context, includeForce, includeEnergy, groups);
         if (cl.getNonbondedUtilities().getUsePeriodic())
             cl.getNonbondedUtilities().getInteractionCount().download(&numTiles, false);
@@ -73,22 +80,28 @@ private:
     bool includeForce, includeEnergy;
     int groups;
     void* pinnedMemory;
+    cl::Event* positionEvent;
     int& numTiles;
 };
 
 class MetalParallelCalcForcesAndEnergyKernel::FinishComputationTask : public MetalContext::WorkTask {
 public:
     FinishComputationTask(ContextImpl& context, MetalContext& cl, MetalCalcForcesAndEnergyKernel& kernel,
-            bool includeForce, bool includeEnergy, int groups, double& energy, long long& completionTime, void* pinnedMemory, bool& valid, int& numTiles) :
-            context(context), cl(cl), kernel(kernel), includeForce(includeForce), includeEnergy(includeEnergy), groups(groups), energy(energy),
-            completionTime(completionTime), pinnedMemory(pinnedMemory), valid(valid), numTiles(numTiles) {
+            bool includeForce, bool includeEnergy, int groups, double& energy, long long& completionTime, void* pinnedMemory, cl::Event* forceEvent,
+            bool& valid, int& numTiles) : context(context), cl(cl), kernel(kernel), includeForce(includeForce), includeEnergy(includeEnergy), groups(groups),
+            energy(energy), completionTime(completionTime), pinnedMemory(pinnedMemory), forceEvent(forceEvent), valid(valid), numTiles(numTiles) {
     }
     void execute() {
-        // Execute the kernel, then download forces.
+        // Execute the kernel, then download forces.  With peer transfers, the forces stay on this device
+        // and the first device copies them once this marker has completed.
         
         energy += kernel.finishComputation(context, includeForce, includeEnergy, groups, valid);
         if (includeForce) {
-            if (cl.getContextIndex() > 0) {
+            if (cl.getContextIndex() > 0 && forceEvent != NULL) {
+                cl.getQueue().enqueueMarkerWithWaitList(NULL, forceEvent);
+                forceEvent->wait();
+            }
+            else if (cl.getContextIndex() > 0) {
                 int numAtoms = cl.getPaddedNumAtoms();
                 void* dest = (cl.getUseDoublePrecision() ? (void*) &((mm_double4*) pinnedMemory)[(cl.getContextIndex()-1)*numAtoms] : (void*) &((mm_float4*) pinnedMemory)[(cl.getContextIndex()-1)*numAtoms]);
                 cl.getQueue().enqueueReadBuffer(cl.getForce().getDeviceBuffer(), CL_TRUE, 0,
@@ -112,15 +125,19 @@ private:
     double& energy;
     long long& completionTime;
     void* pinnedMemory;
+    cl::Event* forceEvent;
     bool& valid;
     int& numTiles;
 };
 
 MetalParallelCalcForcesAndEnergyKernel::MetalParallelCalcForcesAndEnergyKernel(string name, const Platform& platform, MetalPlatform::PlatformData& data) :
         CalcForcesAndEnergyKernel(name, platform), data(data), completionTimes(data.contexts.size()), contextNonbondedFractions(data.contexts.size()),
-        tileCounts(data.contexts.size()), pinnedPositionBuffer(NULL), pinnedPositionMemory(NULL), pinnedForceBuffer(NULL), pinnedForceMemory(NULL) {
-    for (int i = 0; i < (int) data.contexts.size(); i++)
+        tileCounts(data.contexts.size()), positionEvents(data.contexts.size()), forceEvents(data.contexts.size()), usePeerTransfers(true),
+        pinnedPositionBuffer(NULL), pinnedPositionMemory(NULL), pinnedForceBuffer(NULL), pinnedForceMemory(NULL) {
+    for (int i = 0; i < (int) data.contexts.size(); i++) {
         kernels.push_back(Kernel(new MetalCalcForcesAndEnergyKernel(name, platform, *data.contexts[i])));
+        usePeerTransfers &= data.contexts[i]->getUsePeerTransfers();
+    }
 }
 
 MetalParallelCalcForcesAndEnergyKernel::~MetalParallelCalcForcesAndEnergyKernel() {
@@ -143,21 +160,32 @@ void MetalParallelCalcForcesAndEnergyKernel::beginComputation(ContextImpl& conte
     if (!contextForces.isInitialized()) {
         contextForces.initialize<mm_float4>(cl0, &cl0.getForceBuffers().getDeviceBuffer(),
                 data.contexts.size()*cl0.getPaddedNumAtoms(), "contextForces");
-        int bufferBytes = (data.contexts.size()-1)*cl0.getPaddedNumAtoms()*elementSize;
-        pinnedPositionBuffer = new cl::Buffer(cl0.getContext(), CL_MEM_ALLOC_HOST_PTR, bufferBytes);
-        pinnedPositionMemory = cl0.getQueue().enqueueMapBuffer(*pinnedPositionBuffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, bufferBytes);
-        pinnedForceBuffer = new cl::Buffer(cl0.getContext(), CL_MEM_ALLOC_HOST_PTR, bufferBytes);
-        pinnedForceMemory = cl0.getQueue().enqueueMapBuffer(*pinnedForceBuffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, bufferBytes);
+        if (!usePeerTransfers) {
+            int bufferBytes = (data.contexts.size()-1)*cl0.getPaddedNumAtoms()*elementSize;
+            pinnedPositionBuffer = new cl::Buffer(cl0.getContext(), CL_MEM_ALLOC_HOST_PTR, bufferBytes);
+            pinnedPositionMemory = cl0.getQueue().enqueueMapBuffer(*pinnedPositionBuffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, bufferBytes);
+            pinnedForceBuffer = new cl::Buffer(cl0.getContext(), CL_MEM_ALLOC_HOST_PTR, bufferBytes);
+            pinnedForceMemory = cl0.getQueue().enqueueMapBuffer(*pinnedForceBuffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, bufferBytes);
+        }
     }
 
-    // Copy coordinates over to each device and execute the kernel.
+    // Copy coordinates over to each device and execute the kernel.  When the devices share a cl::Context,
+    // the first device copies its positions straight into the others' buffers without the host waiting.
     
-    cl0.getQueue().enqueueReadBuffer(cl0.getPosq().getDeviceBuffer(), CL_TRUE, 0, cl0.getPaddedNumAtoms()*elementSize, pinnedPositionMemory);
+    if (usePeerTransfers) {
+        for (int i = 1; i < (int) data.contexts.size(); i++)
+            cl0.getQueue().enqueueCopyBuffer(cl0.getPosq().getDeviceBuffer(), data.contexts[i]->getPosq().getDeviceBuffer(), 0, 0,
+                    cl0.getPaddedNumAtoms()*elementSize, NULL, &positionEvents[i]);
+        cl0.getQueue().flush();
+    }
+    else
+        cl0.getQueue().enqueueReadBuffer(cl0.getPosq().getDeviceBuffer(), CL_TRUE, 0, cl0.getPaddedNumAtoms()*elementSize, pinnedPositionMemory);
     for (int i = 0; i < (int) data.contexts.size(); i++) {
         data.contextEnergy[i] = 0.0;
         MetalContext& cl = *data.contexts[i];
         ComputeContext::WorkThread& thread = cl.getWorkThread();
-        thread.addTask(new BeginComputationTask(context, cl, getKernel(i), includeForce, includeEnergy, groups, pinnedPositionMemory, tileCounts[i]));
+        thread.addTask(new BeginComputationTask(context, cl, getKernel(i), includeForce, includeEnergy, groups, pinnedPositionMemory,
+                (usePeerTransfers ? &positionEvents[i] : NULL), tileCounts[i]));
     }
 }
 
@@ -165,7 +193,8 @@ double MetalParallelCalcForcesAndEnergyKernel::finishComputation(ContextImpl& co
     for (int i = 0; i < (int) data.contexts.size(); i++) {
         MetalContext& cl = *data.contexts[i];
         ComputeContext::WorkThread& thread = cl.getWorkThread();
-        thread.addTask(new FinishComputationTask(context, cl, getKernel(i), includeForce, includeEnergy, groups, data.contextEnergy[i], completionTimes[i], pinnedForceMemory, valid, tileCounts[i]));
+        thread.addTask(new FinishComputationTask(context, cl, getKernel(i), includeForce, includeEnergy, groups, data.contextEnergy[i], completionTimes[i],
+                pinnedForceMemory, (usePeerTransfers ? &forceEvents[i] : NULL), valid, tileCounts[i]));
     }
     data.syncContexts();
     double energy = 0.0;
@@ -177,8 +206,19 @@ double MetalParallelCalcForcesAndEnergyKernel::finishComputation(ContextImpl& co
         MetalContext& cl = *data.contexts[0];
         int numAtoms = cl.getPaddedNumAtoms();
         int elementSize = (cl.getUseDoublePrecision() ? sizeof(mm_double4) : sizeof(mm_float4));
-        cl.getQueue().enqueueWriteBuffer(contextForces.getDeviceBuffer(), CL_FALSE, numAtoms*elementSize,
-                numAtoms*(data.contexts.size()-1)*elementSize, pinnedForceMemory);
+        if (usePeerTransfers) {
+            // Each copy is ordered after the other device's marker, and after the first device's own work
+            // on its queue, so no device overwrites force buffers another one is still using.
+
+            for (int i = 1; i < (int) data.contexts.size(); i++) {
+                vector<cl::Event> waitEvents(1, forceEvents[i]);
+                cl.getQueue().enqueueCopyBuffer(data.contexts[i]->getForce().getDeviceBuffer(), contextForces.getDeviceBuffer(), 0,
+                        i*numAtoms*elementSize, numAtoms*elementSize, &waitEvents);
+            }
+        }
+        else
+            cl.getQueue().enqueueWriteBuffer(contextForces.getDeviceBuffer(), CL_FALSE, numAtoms*elementSize,
+                    numAtoms*(data.contexts.size()-1)*elementSize, pinnedForceMemory);
         cl.reduceBuffer(contextForces, cl.getLongForceBuffer(), data.contexts.size());
         
         // Balance work between the contexts by transferring a little nonbonded work from the context that
@@ -104,6 +104,7 @@ MetalPlatform::MetalPlatform() {
     platformProperties.push_back(MetalPrecision());
     platformProperties.push_back(MetalUseCpuPme());
     platformProperties.push_back(MetalDisablePmeStream());
+    platformProperties.push_back(MetalReplicas());
     setPropertyDefaultValue(MetalDeviceIndex(), "");
     setPropertyDefaultValue(MetalDeviceName(), "");
     setPropertyDefaultValue(MetalPlatformIndex(), "");
@@ -111,6 +112,7 @@ MetalPlatform::MetalPlatform() {
     setPropertyDefaultValue(MetalPrecision(), "single");
     setPropertyDefaultValue(MetalUseCpuPme(), "false");
     setPropertyDefaultValue(MetalDisablePmeStream(), "false");
+    setPropertyDefaultValue(MetalReplicas(), "1");
 }
 
 double MetalPlatform::getSpeed() const {
@@ -183,6 +185,8 @@ void MetalPlatform::contextCreated(ContextImpl& context, const map<string, strin
             getPropertyDefaultValue(MetalUseCpuPme()) : properties.find(MetalUseCpuPme())->second);
     string pmeStreamPropValue = (properties.find(MetalDisablePmeStream()) == properties.end() ?
             getPropertyDefaultValue(MetalDisablePmeStream()) : properties.find(MetalDisablePmeStream())->second);
+    string replicasPropValue = (properties.find(MetalReplicas()) == properties.end() ?
+            getPropertyDefaultValue(MetalReplicas()) : properties.find(MetalReplicas())->second);
     transform(precisionPropValue.begin(), precisionPropValue.end(), precisionPropValue.begin(), ::tolower);
     transform(cpuPmePropValue.begin(), cpuPmePropValue.end(), cpuPmePropValue.begin(), ::tolower);
     transform(pmeStreamPropValue.begin(), pmeStreamPropValue.end(), pmeStreamPropValue.begin(), ::tolower);
@@ -195,7 +199,7 @@ void MetalPlatform::contextCreated(ContextImpl& context, const map<string, strin
     if (threadsEnv != NULL)
         stringstream(threadsEnv) >> threads;
     context.setPlatformData(new PlatformData(context.getSystem(), platformPropValue, devicePropValue, precisionPropValue, cpuPmePropValue,
-            pmeStreamPropValue, threads, NULL));
+            pmeStreamPropValue, threads, NULL, replicasPropValue));
 }
 
 void MetalPlatform::linkedContextCreated(ContextImpl& context, ContextImpl& originalContext) const {
@@ -205,9 +209,10 @@ void MetalPlatform::linkedContextCreated(ContextImpl& context, ContextImpl& orig
     string precisionPropValue = platform.getPropertyValue(originalContext.getOwner(), MetalPrecision());
     string cpuPmePropValue = platform.getPropertyValue(originalContext.getOwner(), MetalUseCpuPme());
     string pmeStreamPropValue = platform.getPropertyValue(originalContext.getOwner(), MetalDisablePmeStream());
+    string replicasPropValue = platform.getPropertyValue(originalContext.getOwner(), MetalReplicas());
     int threads = reinterpret_cast<PlatformData*>(originalContext.getPlatformData())->threads.getNumThreads();
     context.setPlatformData(new PlatformData(context.getSystem(), platformPropValue, devicePropValue, precisionPropValue, cpuPmePropValue,
-            pmeStreamPropValue, threads, &originalContext));
+            pmeStreamPropValue, threads, &originalContext, replicasPropValue));
 }
 
 void MetalPlatform::contextDestroyed(ContextImpl& context) const {
@@ -216,11 +221,24 @@ void MetalPlatform::contextDestroyed(ContextImpl& context) const {
 }
 
 MetalPlatform::PlatformData::PlatformData(const System& system, const string& platformPropValue, const string& deviceIndexProperty,
-        const string& precisionProperty, const string& cpuPmeProperty, const string& pmeStreamProperty, int numThreads, ContextImpl* originalContext) :
-            removeCM(false), stepCount(0), computeForceCount(0), time(0.0), hasInitializedContexts(false), threads(numThreads)  {
+        const string& precisionProperty, const string& cpuPmeProperty, const string& pmeStreamProperty, int numThreads, ContextImpl* originalContext,
+        const string& replicasProperty) : removeCM(false), stepCount(0), computeForceCount(0), numReplicas(1), time(0.0), hasInitializedContexts(false),
+            threads(numThreads)  {
     int platformIndex = -1;
     if (platformPropValue.length() > 0)
         stringstream(platformPropValue) >> platformIndex;
+    if (replicasProperty.length() > 0)
+        stringstream(replicasProperty) >> numReplicas;
+    if (numReplicas < 1)
+        throw OpenMMException("Illegal value for Replicas: "+replicasProperty);
+    if (numReplicas > 1) {
+        // Each replica must fill a whole number of atom blocks, so no block contains atoms from two replicas.
+
+        int numParticles = system.getNumParticles();
+        if (numParticles%numReplicas != 0 || (numParticles/numReplicas)%MetalContext::TileSize != 0)
+            throw OpenMMException("When batching replicas, the System must contain the replicas one after another, and each one must have a multiple of "+
+                    to_string(MetalContext::TileSize)+" particles.  Add particles with no interactions to pad them if necessary.");
+    }
     vector<string> devices;
     size_t searchPos = 0, nextPos;
     while ((nextPos = deviceIndexProperty.find_first_of(", ", searchPos)) != string::npos) {
@@ -231,14 +249,16 @@ MetalPlatform::PlatformData::PlatformData(const System& system, const string& pl
     PlatformData* originalData = NULL;
     if (originalContext != NULL)
         originalData = reinterpret_cast<PlatformData*>(originalContext->getPlatformData());
-    try {
-        for (int i = 0; i < (int) devices.size(); i++) {
-            if (devices[i].length() > 0) {
-                int deviceIndex;
-                stringstream(devices[i]) >> deviceIndex;
-                contexts.push_back(new MetalContext(system, platformIndex, deviceIndex, precisionProperty, *this, (originalData == NULL ? NULL : originalData->contexts[i])));
-            }
+    for (int i = 0; i < (int) devices.size(); i++) {
+        if (devices[i].length() > 0) {
+            int deviceIndex;
+            stringstream(devices[i]) >> deviceIndex;
+            deviceIndices.push_back(deviceIndex);
         }
+    }
+    try {
+        for (int i = 0; i < (int) deviceIndices.size(); i++)
+            contexts.push_back(new MetalContext(system, platformIndex, deviceIndices[i], precisionProperty, *this, (originalData == NULL ? NULL : originalData->contexts[i])));
         if (contexts.size() == 0)
             contexts.push_back(new MetalContext(system, platformIndex, -1, precisionProperty, *this, (originalData == NULL ? NULL : originalData->contexts[0])));
     }
@@ -259,6 +279,11 @@ MetalPlatform::PlatformData::PlatformData(const System& system, const string& pl
         deviceName << contexts[i]->getDevice().getInfo<CL_DEVICE_NAME>();
     }
     platformIndex = contexts[0]->getPlatformIndex();
+    if (numReplicas > 1 && contexts.size() > 1) {
+        for (int i = 0; i < (int) contexts.size(); i++)
+            delete contexts[i];
+        throw OpenMMException("Batched replicas cannot be split across multiple devices");
+    }
 
     useCpuPme = (cpuPmeProperty == "true" && !contexts[0]->getUseDoublePrecision());
     disablePmeStream = (pmeStreamProperty == "true");
@@ -271,6 +296,7 @@ MetalPlatform::PlatformData::PlatformData(const System& system, const string& pl
     propertyValues[MetalPlatform::MetalPrecision()] = precisionProperty;
     propertyValues[MetalPlatform::MetalUseCpuPme()] = useCpuPme ? "true" : "false";
     propertyValues[MetalPlatform::MetalDisablePmeStream()] = disablePmeStream ? "true" : "false";
+    propertyValues[MetalPlatform::MetalReplicas()] = contexts[0]->intToString(numReplicas);
     contextEnergy.resize(contexts.size());
 }
 
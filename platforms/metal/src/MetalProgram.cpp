@@ -30,10 +30,19 @@
 using namespace OpenMM;
 using namespace std;
 
-MetalProgram::MetalProgram(MetalContext& context, cl::Program program) : context(context), program(program) {
+MetalProgram::MetalProgram(MetalContext& context, cl::Program program) : context(context) {
+    promise<cl::Program> compiled;
+    compiled.set_value(program);
+    this->program = compiled.get_future().share();
+}
+
+MetalProgram::MetalProgram(MetalContext& context, shared_future<cl::Program> program) : context(context), program(program) {
 }
 
 ComputeKernel MetalProgram::createKernel(const string& name) {
-    cl::Kernel kernel = cl::Kernel(program, name.c_str());
-    return shared_ptr<ComputeKernelImpl>(new MetalKernel(context, kernel));
+    // If the program has not finished compiling, the kernel is looked up the first time it is used.
+
+    if (program.wait_for(chrono::seconds(0)) != future_status::ready)
+        return shared_ptr<ComputeKernelImpl>(new MetalKernel(context, program, name));
+    return shared_ptr<ComputeKernelImpl>(new MetalKernel(context, MetalKernel::lookUpKernel(program, name)));
 }
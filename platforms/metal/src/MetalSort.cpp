@@ -37,8 +37,71 @@
 using namespace OpenMM;
 using namespace std;
 
-MetalSort::MetalSort(MetalContext& context, SortTrait* trait, unsigned int length, bool uniform) :
-        context(context), trait(trait), dataLength(length), uniform(uniform) {
+/**
+ * When the engine is selected automatically, the radix sort is used for arrays with at
+ * least this many elements and 32 bit keys.  The thresholds are doubled for 64 bit keys,
+ * which need twice as many passes.  The bucket sort degrades on clustered data, so a
+ * smaller threshold is used when the data is not expected to be uniform.
+ */
+static const unsigned int RadixSortMinLengthUniform = 1<<17;
+static const unsigned int RadixSortMinLengthNonuniform = 1<<15;
+
+MetalSort::MetalSort(MetalContext& context, SortTrait* trait, unsigned int length, bool uniform, SortEngine engine) :
+        context(context), trait(trait), dataLength(length), uniform(uniform), isShortList(false), useShortList2(false), useRadixSort(false) {
+    // Decide which engine to use.
+
+    if (engine == RadixSort) {
+        if (!supportsRadixSort(*trait)) {
+            string keyType = trait->getKeyType();
+            delete trait;
+            throw OpenMMException("MetalSort: The radix sort engine does not support keys of type "+keyType);
+        }
+        useRadixSort = true;
+    }
+    else if (engine == AutomaticSort && supportsRadixSort(*trait)) {
+        unsigned int minLength = (uniform ? RadixSortMinLengthUniform : RadixSortMinLengthNonuniform);
+        useRadixSort = (length >= minLength*(trait->getKeySize()/4));
+    }
+    if (useRadixSort) {
+        // Create the radix sort kernels.
+
+        string keyType = trait->getKeyType();
+        bool is64Bit = (trait->getKeySize() == 8);
+        map<string, string> replacements;
+        replacements["DATA_TYPE"] = trait->getDataType();
+        replacements["KEY_TYPE"] =  trait->getKeyType();
+        replacements["SORT_KEY"] = trait->getSortKey();
+        map<string, string> defines;
+        defines["RADIX_TYPE"] = (is64Bit ? "ulong" : "uint");
+        defines["AS_RADIX_TYPE"] = (is64Bit ? "as_ulong" : "as_uint");
+        defines["RADIX_KEY_BITS"] = (is64Bit ? "64" : "32");
+        if (keyType == "float" || keyType == "double" || keyType == "real")
+            defines["KEY_IS_FLOAT"] = "1";
+        else if (keyType == "int" || keyType == "long")
+            defines["KEY_IS_SIGNED"] = "1";
+        cl::Program program = context.createProgram(context.replaceStrings(MetalKernelSources::radixSort, replacements), defines);
+        digitHistogramsKernel = cl::Kernel(program, "computeDigitHistograms");
+        digitOffsetsKernel = cl::Kernel(program, "computeDigitOffsets");
+        scatterKernel = cl::Kernel(program, "scatterByDigit");
+
+        // Each work group processes one contiguous section of the array.  Limiting the number
+        // of work groups keeps the prefix sum over the digit counts short.
+
+        unsigned int maxGroupSize = std::min(256, (int) context.getDevice().getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>());
+        maxGroupSize = std::min(maxGroupSize, (unsigned int) digitHistogramsKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(context.getDevice()));
+        maxGroupSize = std::min(maxGroupSize, (unsigned int) digitOffsetsKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(context.getDevice()));
+        maxGroupSize = std::min(maxGroupSize, (unsigned int) scatterKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(context.getDevice()));
+        for (radixGroupSize = 1; radixGroupSize*2 <= maxGroupSize; radixGroupSize *= 2)
+            ;
+        radixNumGroups = std::min((length+radixGroupSize-1)/radixGroupSize, (unsigned int) context.getNumThreadBlocks());
+        if (radixNumGroups < 1)
+            radixNumGroups = 1;
+        radixElementsPerGroup = (length+radixNumGroups-1)/radixNumGroups;
+        digitOffsets.initialize<cl_uint>(context, 256*radixNumGroups, "digitOffsets");
+        buckets.initialize(context, length, trait->getDataSize(), "buckets");
+        return;
+    }
+
     // Create kernels.
 
     std::map<std::string, std::string> replacements;
@@ -105,11 +168,24 @@ MetalSort::~MetalSort() {
     delete trait;
 }
 
+bool MetalSort::supportsRadixSort(const SortTrait& trait) {
+    string keyType = trait.getKeyType();
+    if (trait.getKeySize() == 4)
+        return (keyType == "int" || keyType == "uint" || keyType == "unsigned int" || keyType == "float" || keyType == "real");
+    if (trait.getKeySize() == 8)
+        return (keyType == "long" || keyType == "ulong" || keyType == "double" || keyType == "real");
+    return false;
+}
+
 void MetalSort::sort(MetalArray& data) {
     if (data.getSize() != dataLength || data.getElementSize() != trait->getDataSize())
         throw OpenMMException("MetalSort called with different data size");
     if (data.getSize() == 0)
         return;
+    if (useRadixSort) {
+        radixSort(data);
+        return;
+    }
     if (isShortList) {
         // We can use a simpler sort kernel that does the entire operation in one kernel.
         
@@ -186,3 +262,38 @@ void MetalSort::sort(MetalArray& data) {
     sortBucketsKernel.setArg(4, sortKernelSize*trait->getDataSize(), NULL);
     context.executeKernel(sortBucketsKernel, ((data.getSize()+sortKernelSize-1)/sortKernelSize)*sortKernelSize, sortKernelSize);
 }
+
+void MetalSort::radixSort(MetalArray& data) {
+    // Make one pass for each byte of the key.  The number of passes is always even, so
+    // the final result ends up back in the original array.
+
+    MetalArray* source = &data;
+    MetalArray* dest = &buckets;
+    int numPasses = trait->getKeySize();
+    for (int pass = 0; pass < numPasses; pass++) {
+        int shift = 8*pass;
+        digitHistogramsKernel.setArg<cl::Buffer>(0, source->getDeviceBuffer());
+        digitHistogramsKernel.setArg<cl_uint>(1, dataLength);
+        digitHistogramsKernel.setArg<cl_uint>(2, radixElementsPerGroup);
+        digitHistogramsKernel.setArg<cl_int>(3, shift);
+        digitHistogramsKernel.setArg<cl::Buffer>(4, digitOffsets.getDeviceBuffer());
+        digitHistogramsKernel.setArg(5, 256*sizeof(cl_uint), NULL);
+        context.executeKernel(digitHistogramsKernel, radixNumGroups*radixGroupSize, radixGroupSize);
+        digitOffsetsKernel.setArg<cl::Buffer>(0, digitOffsets.getDeviceBuffer());
+        digitOffsetsKernel.setArg<cl_uint>(1, digitOffsets.getSize());
+        digitOffsetsKernel.setArg(2, radixGroupSize*sizeof(cl_uint), NULL);
+        context.executeKernel(digitOffsetsKernel, radixGroupSize, radixGroupSize);
+        scatterKernel.setArg<cl::Buffer>(0, source->getDeviceBuffer());
+        scatterKernel.setArg<cl::Buffer>(1, dest->getDeviceBuffer());
+        scatterKernel.setArg<cl_uint>(2, dataLength);
+        scatterKernel.setArg<cl_uint>(3, radixElementsPerGroup);
+        scatterKernel.setArg<cl_int>(4, shift);
+        scatterKernel.setArg<cl::Buffer>(5, digitOffsets.getDeviceBuffer());
+        scatterKernel.setArg(6, 256*sizeof(cl_uint), NULL);
+        scatterKernel.setArg(7, radixGroupSize*sizeof(cl_uint), NULL);
+        scatterKernel.setArg(8, radixGroupSize*sizeof(cl_uint), NULL);
+        scatterKernel.setArg(9, 256*sizeof(cl_uint), NULL);
+        context.executeKernel(scatterKernel, radixNumGroups*radixGroupSize, radixGroupSize);
+        swap(source, dest);
+    }
+}
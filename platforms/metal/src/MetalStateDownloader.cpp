@@ -0,0 +1,226 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#include "MetalStateDownloader.h"
+#include "MetalContext.h"
+#include "openmm/OpenMMException.h"
+
+using namespace OpenMM;
+using namespace std;
+
+MetalStateDownloader::MetalStateDownloader(MetalContext& context) : context(context), firstPending(0), numPending(0) {
+    for (Slot& slot : slots) {
+        slot.buffer = NULL;
+        slot.memory = NULL;
+        slot.size = 0;
+        slot.types = 0;
+    }
+}
+
+MetalStateDownloader::~MetalStateDownloader() {
+    for (Slot& slot : slots) {
+        for (cl::Event& event : slot.events)
+            event.wait();
+        if (slot.buffer != NULL)
+            delete slot.buffer;
+    }
+}
+
+void MetalStateDownloader::startSnapshot(int types) {
+    if (numPending == 2)
+        throw OpenMMException("MetalStateDownloader: two snapshots are already pending");
+    Slot& slot = slots[(firstPending+numPending)%2];
+
+    // Decide which arrays to copy and where in the staging buffer each one goes.
+
+    vector<MetalArray*> arrays;
+    if (types & Positions) {
+        arrays.push_back(&context.getPosq());
+        if (context.getUseMixedPrecision() || context.getUseFloatFloatPrecision())
+            arrays.push_back(&context.getPosqCorrection());
+    }
+    if (types & Velocities) {
+        arrays.push_back(&context.getVelm());
+        if (context.getUseFloatFloatPrecision())
+            arrays.push_back(&context.getVelmCorrection());
+    }
+    if (types & Forces)
+        arrays.push_back(&context.getForce());
+    size_t totalSize = 0;
+    for (MetalArray* array : arrays)
+        totalSize += array->getSize()*array->getElementSize();
+    if (totalSize > slot.size) {
+        if (slot.buffer != NULL)
+            delete slot.buffer;
+        slot.buffer = new cl::Buffer(context.getContext(), CL_MEM_ALLOC_HOST_PTR, totalSize);
+        slot.memory = (char*) context.getQueue().enqueueMapBuffer(*slot.buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, totalSize);
+        slot.size = totalSize;
+    }
+
+    // Enqueue the copies.  The queue is in order, so they see the state as of this call even
+    // if more steps are enqueued before they execute.
+
+    slot.events.resize(arrays.size());
+    size_t offset = 0;
+    for (int i = 0; i < arrays.size(); i++) {
+        size_t size = arrays[i]->getSize()*arrays[i]->getElementSize();
+        context.getQueue().enqueueReadBuffer(arrays[i]->getDeviceBuffer(), CL_FALSE, 0, size, slot.memory+offset, NULL, &slot.events[i]);
+        offset += size;
+    }
+    context.getQueue().flush();
+
+    // Record the host side state needed to interpret the data, since it may change by the
+    // time the snapshot is finished.
+
+    slot.types = types;
+    slot.time = context.getTime();
+    slot.stepCount = context.getStepCount();
+    context.getPeriodicBoxVectors(slot.boxVectors[0], slot.boxVectors[1], slot.boxVectors[2]);
+    slot.order = context.getAtomIndex();
+    if (types & Positions)
+        slot.cellOffsets = context.getPosCellOffsets();
+    numPending++;
+}
+
+bool MetalStateDownloader::isSnapshotReady() const {
+    if (numPending == 0)
+        return false;
+    for (const cl::Event& event : slots[firstPending].events)
+        if (event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() != CL_COMPLETE)
+            return false;
+    return true;
+}
+
+void MetalStateDownloader::finishSnapshot(Snapshot& snapshot) {
+    if (numPending == 0)
+        throw OpenMMException("MetalStateDownloader: there is no pending snapshot to finish");
+    Slot& slot = slots[firstPending];
+    for (cl::Event& event : slot.events)
+        event.wait();
+    snapshot.time = slot.time;
+    snapshot.stepCount = slot.stepCount;
+    for (int i = 0; i < 3; i++)
+        snapshot.boxVectors[i] = slot.boxVectors[i];
+    int numParticles = context.getNumAtoms();
+    bool positions = (slot.types & Positions), velocities = (slot.types & Velocities), forces = (slot.types & Forces);
+    snapshot.positions.resize(positions ? numParticles : 0);
+    snapshot.velocities.resize(velocities ? numParticles : 0);
+    snapshot.forces.resize(forces ? numParticles : 0);
+
+    // Find where each array is in the staging buffer.
+
+    int paddedNumAtoms = context.getPaddedNumAtoms();
+    int realSize = (context.getUseDoublePrecision() ? sizeof(mm_double4) : sizeof(mm_float4));
+    int mixedSize = (context.getUseDoublePrecision() || context.getUseMixedPrecision() ? sizeof(mm_double4) : sizeof(mm_float4));
+    char* data = slot.memory;
+    char* posq = NULL;
+    char* posqCorrection = NULL;
+    char* velm = NULL;
+    char* velmCorrection = NULL;
+    char* force = NULL;
+    if (positions) {
+        posq = data;
+        data += paddedNumAtoms*realSize;
+        if (context.getUseMixedPrecision() || context.getUseFloatFloatPrecision()) {
+            posqCorrection = data;
+            data += paddedNumAtoms*sizeof(mm_float4);
+        }
+    }
+    if (velocities) {
+        velm = data;
+        data += paddedNumAtoms*mixedSize;
+        if (context.getUseFloatFloatPrecision()) {
+            velmCorrection = data;
+            data += paddedNumAtoms*sizeof(mm_float4);
+        }
+    }
+    if (forces)
+        force = data;
+
+    // Convert the data in parallel.
+
+    ThreadPool& threads = context.getPlatformData().threads;
+    threads.execute([&] (ThreadPool& threads, int threadIndex) {
+        int numThreads = threads.getNumThreads();
+        int start = threadIndex*numParticles/numThreads;
+        int end = (threadIndex+1)*numParticles/numThreads;
+        const vector<int>& order = slot.order;
+        if (positions) {
+            const Vec3* box = slot.boxVectors;
+            for (int i = start; i < end; i++) {
+                Vec3 pos;
+                if (context.getUseDoublePrecision()) {
+                    mm_double4 p = ((mm_double4*) posq)[i];
+                    pos = Vec3(p.x, p.y, p.z);
+                }
+                else if (posqCorrection != NULL) {
+                    mm_float4 p1 = ((mm_float4*) posq)[i];
+                    mm_float4 p2 = ((mm_float4*) posqCorrection)[i];
+                    pos = Vec3((double) p1.x+(double) p2.x, (double) p1.y+(double) p2.y, (double) p1.z+(double) p2.z);
+                }
+                else {
+                    mm_float4 p = ((mm_float4*) posq)[i];
+                    pos = Vec3(p.x, p.y, p.z);
+                }
+                mm_int4 offset = slot.cellOffsets[i];
+                snapshot.positions[order[i]] = pos-box[0]*offset.x-box[1]*offset.y-box[2]*offset.z;
+            }
+        }
+        if (velocities) {
+            for (int i = start; i < end; i++) {
+                if (mixedSize == sizeof(mm_double4)) {
+                    mm_double4 v = ((mm_double4*) velm)[i];
+                    snapshot.velocities[order[i]] = Vec3(v.x, v.y, v.z);
+                }
+                else if (velmCorrection != NULL) {
+                    mm_float4 v1 = ((mm_float4*) velm)[i];
+                    mm_float4 v2 = ((mm_float4*) velmCorrection)[i];
+                    snapshot.velocities[order[i]] = Vec3((double) v1.x+(double) v2.x, (double) v1.y+(double) v2.y, (double) v1.z+(double) v2.z);
+                }
+                else {
+                    mm_float4 v = ((mm_float4*) velm)[i];
+                    snapshot.velocities[order[i]] = Vec3(v.x, v.y, v.z);
+                }
+            }
+        }
+        if (forces) {
+            for (int i = start; i < end; i++) {
+                if (realSize == sizeof(mm_double4)) {
+                    mm_double4 f = ((mm_double4*) force)[i];
+                    snapshot.forces[order[i]] = Vec3(f.x, f.y, f.z);
+                }
+                else {
+                    mm_float4 f = ((mm_float4*) force)[i];
+                    snapshot.forces[order[i]] = Vec3(f.x, f.y, f.z);
+                }
+            }
+        }
+    });
+    threads.waitForThreads();
+    slot.events.clear();
+    firstPending = (firstPending+1)%2;
+    numPending--;
+}
@@ -0,0 +1,202 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#include "MetalTrajectoryBuffer.h"
+#include "MetalContext.h"
+#include "MetalKernelSources.h"
+#include "openmm/OpenMMException.h"
+
+using namespace OpenMM;
+using namespace std;
+
+/**
+ * Captures a frame after the forces are computed on steps that are multiples of the interval.
+ * Forces may be computed more than once on the same step, so each step is only captured once.
+ */
+class MetalTrajectoryBuffer::CapturePostComputation : public ComputeContext::ForcePostComputation {
+public:
+    CapturePostComputation(MetalTrajectoryBuffer& buffer) : buffer(buffer) {
+    }
+    double computeForceAndEnergy(bool includeForces, bool includeEnergy, int groups) {
+        long long step = buffer.context.getStepCount();
+        if (buffer.enabled && step%buffer.interval == 0 && step != buffer.lastCapturedStep)
+            buffer.captureFrame();
+        return 0.0;
+    }
+private:
+    MetalTrajectoryBuffer& buffer;
+};
+
+/**
+ * Uploads the periodic cell offsets after atoms are reordered.
+ */
+class MetalTrajectoryBuffer::CellOffsetListener : public ComputeContext::ReorderListener {
+public:
+    CellOffsetListener(MetalTrajectoryBuffer& buffer) : buffer(buffer) {
+    }
+    void execute() {
+        if (!buffer.quantize) {
+            buffer.cellOffsets = buffer.context.getPosCellOffsets();
+            buffer.deviceCellOffsets.upload(buffer.cellOffsets);
+        }
+    }
+private:
+    MetalTrajectoryBuffer& buffer;
+};
+
+MetalTrajectoryBuffer::MetalTrajectoryBuffer(MetalContext& context, const vector<int>& atoms, int interval, int capacity, bool quantize) :
+        context(context), numAtoms(atoms.size()), interval(interval), capacity(capacity), quantize(quantize), enabled(true),
+        nextFrame(0), numFrames(0), numDroppedFrames(0), lastCapturedStep(-1) {
+    if (atoms.size() == 0)
+        throw OpenMMException("MetalTrajectoryBuffer: no atoms were specified");
+    if (interval < 1)
+        throw OpenMMException("MetalTrajectoryBuffer: the interval must be positive");
+    if (capacity < 1)
+        throw OpenMMException("MetalTrajectoryBuffer: the capacity must be positive");
+
+    // Build the map from original atom index to position within a frame.
+
+    int paddedNumAtoms = context.getPaddedNumAtoms();
+    vector<cl_int> selectionVec(paddedNumAtoms, -1);
+    for (int i = 0; i < numAtoms; i++) {
+        int atom = atoms[i];
+        if (atom < 0 || atom >= context.getNumAtoms())
+            throw OpenMMException("MetalTrajectoryBuffer: illegal atom index");
+        if (selectionVec[atom] != -1)
+            throw OpenMMException("MetalTrajectoryBuffer: an atom was specified more than once");
+        selectionVec[atom] = i;
+    }
+    selection.initialize<cl_int>(context, paddedNumAtoms, "trajectorySelection");
+    selection.upload(selectionVec);
+    cellOffsets = context.getPosCellOffsets();
+    deviceCellOffsets.initialize<mm_int4>(context, paddedNumAtoms, "trajectoryCellOffsets");
+    deviceCellOffsets.upload(cellOffsets);
+    size_t frameDataSize = 3*(size_t) numAtoms*capacity;
+    if (quantize)
+        frameData.initialize<cl_ushort>(context, frameDataSize, "trajectoryFrames");
+    else
+        frameData.initialize<cl_float>(context, frameDataSize, "trajectoryFrames");
+    frameInfo.resize(capacity);
+
+    // Create the kernel.
+
+    map<string, string> defines;
+    if (quantize)
+        defines["QUANTIZE"] = "1";
+    cl::Program program = context.createProgram(MetalKernelSources::trajectoryBuffer, defines);
+    recordKernel = cl::Kernel(program, "recordFrame");
+    recordKernel.setArg<cl_int>(0, context.getNumAtoms());
+    recordKernel.setArg<cl_int>(2, numAtoms);
+    recordKernel.setArg<cl::Buffer>(3, context.getPosq().getDeviceBuffer());
+    recordKernel.setArg<cl::Buffer>(4, context.getAtomIndexArray().getDeviceBuffer());
+    recordKernel.setArg<cl::Buffer>(5, selection.getDeviceBuffer());
+    recordKernel.setArg<cl::Buffer>(6, deviceCellOffsets.getDeviceBuffer());
+    recordKernel.setArg<cl::Buffer>(7, frameData.getDeviceBuffer());
+    context.addPostComputation(new CapturePostComputation(*this));
+    context.addReorderListener(new CellOffsetListener(*this));
+}
+
+void MetalTrajectoryBuffer::captureFrame() {
+    // Positions may have been set without reordering atoms, which resets the cell offsets
+    // without notifying the listener.
+
+    if (!quantize && context.getPosCellOffsets() != cellOffsets) {
+        cellOffsets = context.getPosCellOffsets();
+        deviceCellOffsets.upload(cellOffsets);
+    }
+    recordKernel.setArg<cl_int>(1, nextFrame);
+    if (context.getUseDoublePrecision()) {
+        recordKernel.setArg<mm_double4>(8, context.getInvPeriodicBoxSizeDouble());
+        recordKernel.setArg<mm_double4>(9, context.getPeriodicBoxVecXDouble());
+        recordKernel.setArg<mm_double4>(10, context.getPeriodicBoxVecYDouble());
+        recordKernel.setArg<mm_double4>(11, context.getPeriodicBoxVecZDouble());
+    }
+    else {
+        recordKernel.setArg<mm_float4>(8, context.getInvPeriodicBoxSize());
+        recordKernel.setArg<mm_float4>(9, context.getPeriodicBoxVecX());
+        recordKernel.setArg<mm_float4>(10, context.getPeriodicBoxVecY());
+        recordKernel.setArg<mm_float4>(11, context.getPeriodicBoxVecZ());
+    }
+    context.executeKernel(recordKernel, context.getNumAtoms());
+    FrameInfo& info = frameInfo[nextFrame];
+    info.stepCount = context.getStepCount();
+    info.time = context.getTime();
+    context.getPeriodicBoxVectors(info.boxVectors[0], info.boxVectors[1], info.boxVectors[2]);
+    lastCapturedStep = info.stepCount;
+    nextFrame = (nextFrame+1)%capacity;
+    if (numFrames == capacity)
+        numDroppedFrames++;
+    else
+        numFrames++;
+}
+
+void MetalTrajectoryBuffer::getFrames(vector<Frame>& frames) {
+    frames.resize(numFrames);
+    if (numFrames == 0)
+        return;
+
+    // Download the frames in one or two contiguous pieces, depending on whether they wrap
+    // around the end of the buffer.
+
+    int firstFrame = (nextFrame-numFrames+capacity)%capacity;
+    int frameSize = 3*numAtoms*frameData.getElementSize();
+    vector<char> data((size_t) numFrames*frameSize);
+    int numFirstPiece = min(numFrames, capacity-firstFrame);
+    context.getQueue().enqueueReadBuffer(frameData.getDeviceBuffer(), CL_FALSE, (size_t) firstFrame*frameSize, (size_t) numFirstPiece*frameSize, &data[0]);
+    if (numFirstPiece < numFrames)
+        context.getQueue().enqueueReadBuffer(frameData.getDeviceBuffer(), CL_FALSE, 0, (size_t) (numFrames-numFirstPiece)*frameSize, &data[(size_t) numFirstPiece*frameSize]);
+    context.getQueue().finish();
+
+    // Convert the frames in parallel.
+
+    int count = numFrames;
+    ThreadPool& threads = context.getPlatformData().threads;
+    threads.execute([&] (ThreadPool& threads, int threadIndex) {
+        int numThreads = threads.getNumThreads();
+        for (int i = threadIndex; i < count; i += numThreads) {
+            const FrameInfo& info = frameInfo[(firstFrame+i)%capacity];
+            Frame& frame = frames[i];
+            frame.stepCount = info.stepCount;
+            frame.time = info.time;
+            for (int j = 0; j < 3; j++)
+                frame.boxVectors[j] = info.boxVectors[j];
+            frame.positions.resize(numAtoms);
+            if (quantize) {
+                const cl_ushort* coords = (const cl_ushort*) &data[(size_t) i*frameSize];
+                const double scale = 1.0/65536.0;
+                for (int j = 0; j < numAtoms; j++)
+                    frame.positions[j] = info.boxVectors[0]*(coords[3*j]*scale) + info.boxVectors[1]*(coords[3*j+1]*scale) + info.boxVectors[2]*(coords[3*j+2]*scale);
+            }
+            else {
+                const cl_float* coords = (const cl_float*) &data[(size_t) i*frameSize];
+                for (int j = 0; j < numAtoms; j++)
+                    frame.positions[j] = Vec3(coords[3*j], coords[3*j+1], coords[3*j+2]);
+            }
+        }
+    });
+    threads.waitForThreads();
+    numFrames = 0;
+}
@@ -1,6 +1,14 @@
 #pragma OPENCL EXTENSION cl_khr_global_int32_base_atomics : enable
 #pragma OPENCL EXTENSION cl_khr_byte_addressable_store : enable
 
+#ifdef BLOCKS_PER_REPLICA
+// Blocks are sorted by replica first, so the blocks of each replica occupy a contiguous range of
+// sorted positions.  A block only needs to be compared to the others up to the end of its range.
+#define END_OF_SORTED_RANGE(i) (((i)/BLOCKS_PER_REPLICA+1)*BLOCKS_PER_REPLICA)
+#else
+#define END_OF_SORTED_RANGE(i) NUM_BLOCKS
+#endif
+
 /**
  * Find a bounding box for the atoms in each block.
  */
@@ -41,7 +49,14 @@ __kernel void findBlockBounds(int numAtoms, real4 periodicBoxSize, real4 invPeri
         center.w = sqrt(center.w);
         blockBoundingBox[index] = blockSize;
         blockCenter[index] = center;
-        sortedBlocks[index] = (real2) (blockSize.x+blockSize.y+blockSize.z, index);
+        real sortKey = blockSize.x+blockSize.y+blockSize.z;
+#ifdef BLOCKS_PER_REPLICA
+        // Sort by replica, then by size.  The size is mapped into [0, 0.5) so it can never round
+        // up to the next replica.
+
+        sortKey = (index/BLOCKS_PER_REPLICA) + 0.5f*sortKey/(1+sortKey);
+#endif
+        sortedBlocks[index] = (real2) (sortKey, index);
         index += get_global_size(0);
         base = index*TILE_SIZE;
     }
@@ -112,6 +127,31 @@ __kernel void sortBoxData(__global const real2* restrict sortedBlock, __global c
 
 #define BUFFER_SIZE 256
 
+#ifdef USE_SUBTILE_MASKS
+// Each block is divided into sub-clusters of 8 atoms.  Along with each neighbor, we record a flag
+// for every sub-cluster of block X that has an atom within the padded cutoff of it.
+
+#define SUBTILE_SIZE 8
+#define RECORD_INTERACTION(j, r2) subtileFlags |= ((r2) < PADDED_CUTOFF_SQUARED ? 1<<((j)/SUBTILE_SIZE) : 0);
+
+/**
+ * Combine the sub-cluster flags of the neighbors in a tile into a mask for the tile.  The tile is
+ * divided into 4x4 sub-tiles of 8x8 atoms, and bit 4*i+j is set if sub-cluster i of block X has
+ * any interactions with the j'th group of 8 neighbors.
+ */
+unsigned int getTileMask(__local const uchar* flags, int numNeighbors) {
+    unsigned int mask = 0;
+    for (int k = 0; k < numNeighbors; k++) {
+        unsigned int f = flags[k];
+        unsigned int spread = (f&1) | ((f&2)<<3) | ((f&4)<<6) | ((f&8)<<9);
+        mask |= spread<<(k/SUBTILE_SIZE);
+    }
+    return mask;
+}
+#else
+#define RECORD_INTERACTION(j, r2) interacts |= ((r2) < PADDED_CUTOFF_SQUARED);
+#endif
+
 __kernel void findBlocksWithInteractions(real4 periodicBoxSize, real4 invPeriodicBoxSize, real4 periodicBoxVecX, real4 periodicBoxVecY, real4 periodicBoxVecZ,
         __global unsigned int* restrict interactionCount, __global int* restrict interactingTiles, __global unsigned int* restrict interactingAtoms,
         __global const real3* restrict posq, unsigned int maxTiles, unsigned int startBlockIndex, unsigned int numBlocks, __global real2* restrict sortedBlocks,
@@ -120,6 +160,9 @@ __kernel void findBlocksWithInteractions(real4 periodicBoxSize, real4 invPeriodi
         __global const int* restrict rebuildNeighborList
 #ifdef USE_LARGE_BLOCKS
         , __global real4* restrict largeBlockCenter, __global real4* restrict largeBlockBoundingBox
+#endif
+#ifdef USE_SUBTILE_MASKS
+        , __global unsigned int* restrict interactingTileMasks
 #endif
         ) {
 
@@ -140,6 +183,10 @@ __kernel void findBlocksWithInteractions(real4 periodicBoxSize, real4 invPeriodi
     __local volatile short2 atomCountBuffer[GROUP_SIZE];
 #endif
     __local int* buffer = workgroupBuffer+BUFFER_SIZE*(warpStart/32);
+#ifdef USE_SUBTILE_MASKS
+    __local uchar workgroupFlagsBuffer[BUFFER_SIZE*(GROUP_SIZE/32)];
+    __local uchar* flagsBuffer = workgroupFlagsBuffer+BUFFER_SIZE*(warpStart/32);
+#endif
     __local int* exclusionsForX = warpExclusions+MAX_EXCLUSIONS*(warpStart/32);
     __local volatile unsigned int* tileStartIndex = workgroupTileIndex+(warpStart/32);
 
@@ -188,7 +235,8 @@ __kernel void findBlocksWithInteractions(real4 periodicBoxSize, real4 invPeriodi
         uint largeBlockFlags = 0;
         uint loadedLargeBlocks = 0;
 #endif
-        for (int block2Base = block1+1; block2Base < NUM_BLOCKS; block2Base += 32) {
+        const int lastBlock = END_OF_SORTED_RANGE(block1);
+        for (int block2Base = block1+1; block2Base < lastBlock; block2Base += 32) {
 #ifdef USE_LARGE_BLOCKS
             if (loadedLargeBlocks == 0) {
                 // Check the next set of large blocks.
@@ -221,7 +269,7 @@ __kernel void findBlocksWithInteractions(real4 periodicBoxSize, real4 invPeriodi
             largeBlockFlags >>= 1;
 #endif
             int block2 = block2Base+indexInWarp;
-            bool includeBlock2 = (block2 < NUM_BLOCKS);
+            bool includeBlock2 = (block2 < lastBlock);
 #ifdef VENDOR_APPLE
             bool forceInclude = false;
 #endif
@@ -287,6 +335,9 @@ __kernel void findBlocksWithInteractions(real4 periodicBoxSize, real4 invPeriodi
                         APPLY_PERIODIC_TO_POS_WITH_CENTER(pos2, blockCenterX)
 #endif
                     bool interacts = false;
+#ifdef USE_SUBTILE_MASKS
+                    int subtileFlags = 0;
+#endif
 #ifdef VENDOR_APPLE
                     real4 blockCenterY = sortedBlockCenter[block2Base+i];
                     real3 atomDelta = (posBuffer[warpStart+indexInWarp]).xyz-(blockCenterY).xyz;
@@ -309,7 +360,7 @@ __kernel void findBlocksWithInteractions(real4 periodicBoxSize, real4 invPeriodi
 #endif
                           real3 delta = pos2.xyz-posBuffer[warpStart+j].xyz;
                           APPLY_PERIODIC_TO_DELTA(delta)
-                          interacts |= (delta.x*delta.x+delta.y*delta.y+delta.z*delta.z < PADDED_CUTOFF_SQUARED);
+                          RECORD_INTERACTION(j, delta.x*delta.x+delta.y*delta.y+delta.z*delta.z)
                         }
                       }
                       else {
@@ -318,7 +369,7 @@ __kernel void findBlocksWithInteractions(real4 periodicBoxSize, real4 invPeriodi
 #define __findBlocksWithInteractions_loop1(j) \
 { \
 real3 delta = pos2-posBuffer[warpStart+j];\
-interacts |= (delta.x*delta.x+delta.y*delta.y+delta.z*delta.z < PADDED_CUTOFF_SQUARED);\
+RECORD_INTERACTION(j, delta.x*delta.x+delta.y*delta.y+delta.z*delta.z)\
 } \
 
                         FORCE_UNROLL_32(__findBlocksWithInteractions_loop1)
@@ -326,13 +377,16 @@ interacts |= (delta.x*delta.x+delta.y*delta.y+delta.z*delta.z < PADDED_CUTOFF_SQ
 #else
                         for (int j = 0; j < TILE_SIZE; j++) {
                           real3 delta = pos2-posBuffer[warpStart+j];
-                          interacts |= (delta.x*delta.x+delta.y*delta.y+delta.z*delta.z < PADDED_CUTOFF_SQUARED);
+                          RECORD_INTERACTION(j, delta.x*delta.x+delta.y*delta.y+delta.z*delta.z)
                         }
 #endif
 #ifdef USE_PERIODIC
                       }
 #endif
                   }
+#ifdef USE_SUBTILE_MASKS
+                    interacts = (subtileFlags != 0);
+#endif
                     
                     // Do a prefix sum to compact the list of atoms.
 #ifdef VENDOR_APPLE
@@ -340,6 +394,9 @@ interacts |= (delta.x*delta.x+delta.y*delta.y+delta.z*delta.z < PADDED_CUTOFF_SQ
                     if (interacts) {
                       int index = neighborsInBuffer+popcount(includeAtomFlags&warpMask);
                       buffer[index] = atom2;
+#ifdef USE_SUBTILE_MASKS
+                      flagsBuffer[index] = subtileFlags;
+#endif
                     }
                     neighborsInBuffer += popcount(includeAtomFlags);
 #else
@@ -357,8 +414,12 @@ interacts |= (delta.x*delta.x+delta.y*delta.y+delta.z*delta.z < PADDED_CUTOFF_SQ
                     
                     // Add any interacting atoms to the buffer.
 
-                    if (interacts)
+                    if (interacts) {
                         buffer[neighborsInBuffer+atomCountBuffer[get_local_id(0)].y-1] = atom2;
+#ifdef USE_SUBTILE_MASKS
+                        flagsBuffer[neighborsInBuffer+atomCountBuffer[get_local_id(0)].y-1] = subtileFlags;
+#endif
+                    }
                     neighborsInBuffer += atomCountBuffer[warpStart+TILE_SIZE-1].y;
 #endif
                     if (neighborsInBuffer > BUFFER_SIZE-TILE_SIZE) {
@@ -391,8 +452,17 @@ interacts |= (delta.x*delta.x+delta.y*delta.y+delta.z*delta.z < PADDED_CUTOFF_SQ
 #else
                             for (int j = 0; j < tilesToStore; j++)
                                 interactingAtoms[(newTileStartIndex+j)*TILE_SIZE+indexInWarp] = buffer[indexInWarp+j*TILE_SIZE];
+#endif
+#ifdef USE_SUBTILE_MASKS
+                            if (indexInWarp < tilesToStore)
+                                interactingTileMasks[newTileStartIndex+indexInWarp] = getTileMask(flagsBuffer+indexInWarp*TILE_SIZE, TILE_SIZE);
 #endif
                         }
+#ifdef USE_SUBTILE_MASKS
+                        SYNC_WARPS;
+                        if (indexInWarp+TILE_SIZE*tilesToStore < BUFFER_SIZE)
+                            flagsBuffer[indexInWarp] = flagsBuffer[indexInWarp+TILE_SIZE*tilesToStore];
+#endif
                         if (indexInWarp+TILE_SIZE*tilesToStore < BUFFER_SIZE)
                             buffer[indexInWarp] = buffer[indexInWarp+TILE_SIZE*tilesToStore];
                         neighborsInBuffer -= TILE_SIZE*tilesToStore;
@@ -419,6 +489,10 @@ interacts |= (delta.x*delta.x+delta.y*delta.y+delta.z*delta.z < PADDED_CUTOFF_SQ
                     interactingTiles[newTileStartIndex+indexInWarp] = x;
                 for (int j = 0; j < tilesToStore; j++)
                     interactingAtoms[(newTileStartIndex+j)*TILE_SIZE+indexInWarp] = (indexInWarp+j*TILE_SIZE < neighborsInBuffer ? buffer[indexInWarp+j*TILE_SIZE] : NUM_ATOMS);
+#ifdef USE_SUBTILE_MASKS
+                if (indexInWarp < tilesToStore)
+                    interactingTileMasks[newTileStartIndex+indexInWarp] = getTileMask(flagsBuffer+indexInWarp*TILE_SIZE, min(TILE_SIZE, neighborsInBuffer-indexInWarp*TILE_SIZE));
+#endif
             }
         }
     }
@@ -659,11 +733,12 @@ __kernel void findBlocksWithInteractions(real4 periodicBoxSize, real4 invPeriodi
         
         // Compare it to other blocks after this one in sorted order.
 
-        for (int base = i+1; base < NUM_BLOCKS; base += get_local_size(0)) {
+        const int lastBlock = END_OF_SORTED_RANGE(i);
+        for (int base = i+1; base < lastBlock; base += get_local_size(0)) {
             int j = base+get_local_id(0);
-            real2 sortedKey2 = (j < NUM_BLOCKS ? sortedBlocks[j] : (real2) 0);
-            real4 blockCenterY = (j < NUM_BLOCKS ? sortedBlockCenter[j] : (real4) 0);
-            real4 blockSizeY = (j < NUM_BLOCKS ? sortedBlockBoundingBox[j] : (real4) 0);
+            real2 sortedKey2 = (j < lastBlock ? sortedBlocks[j] : (real2) 0);
+            real4 blockCenterY = (j < lastBlock ? sortedBlockCenter[j] : (real4) 0);
+            real4 blockSizeY = (j < lastBlock ? sortedBlockBoundingBox[j] : (real4) 0);
             int y = (int) sortedKey2.y;
             real4 delta = blockCenterX-blockCenterY;
 #ifdef USE_PERIODIC
@@ -675,7 +750,7 @@ __kernel void findBlocksWithInteractions(real4 periodicBoxSize, real4 invPeriodi
             bool hasExclusions = false;
             for (int k = 0; k < numExclusions; k++)
                 hasExclusions |= (exclusionsForX[k] == y);
-            if (j < NUM_BLOCKS && delta.x*delta.x+delta.y*delta.y+delta.z*delta.z < PADDED_CUTOFF_SQUARED && !hasExclusions) {
+            if (j < lastBlock && delta.x*delta.x+delta.y*delta.y+delta.z*delta.z < PADDED_CUTOFF_SQUARED && !hasExclusions) {
                 // Add this tile to the buffer.
 
                 int bufferIndex = valuesInBuffer*GROUP_SIZE+get_local_id(0);
@@ -1,5 +1,13 @@
 #pragma OPENCL EXTENSION cl_khr_global_int32_base_atomics : enable
 #pragma OPENCL EXTENSION cl_khr_byte_addressable_store : enable
+
+#ifdef BLOCKS_PER_REPLICA
+// Blocks are sorted by replica first, so the blocks of each replica occupy a contiguous range of
+// sorted positions.  A block only needs to be compared to the others up to the end of its range.
+#define END_OF_SORTED_RANGE(i) (((i)/BLOCKS_PER_REPLICA+1)*BLOCKS_PER_REPLICA)
+#else
+#define END_OF_SORTED_RANGE(i) NUM_BLOCKS
+#endif
 #define BUFFER_SIZE BUFFER_GROUPS*GROUP_SIZE
 
 /**
@@ -30,7 +38,14 @@ __kernel void findBlockBounds(int numAtoms, real4 periodicBoxSize, real4 invPeri
         real4 blockSize = 0.5f*(maxPos-minPos);
         blockBoundingBox[index] = blockSize;
         blockCenter[index] = 0.5f*(maxPos+minPos);
-        sortedBlocks[index] = (real2) (blockSize.x+blockSize.y+blockSize.z, index);
+        real sortKey = blockSize.x+blockSize.y+blockSize.z;
+#ifdef BLOCKS_PER_REPLICA
+        // Sort by replica, then by size.  The size is mapped into [0, 0.5) so it can never round
+        // up to the next replica.
+
+        sortKey = (index/BLOCKS_PER_REPLICA) + 0.5f*sortKey/(1+sortKey);
+#endif
+        sortedBlocks[index] = (real2) (sortKey, index);
         index += get_global_size(0);
         base = index*TILE_SIZE;
     }
@@ -193,7 +208,7 @@ __kernel void findBlocksWithInteractions(real4 periodicBoxSize, real4 invPeriodi
         
         // Compare it to other blocks after this one in sorted order.
         
-        for (int j = i+1; j < NUM_BLOCKS; j++) {
+        for (int j = i+1; j < END_OF_SORTED_RANGE(i); j++) {
             real2 sortedKey2 = sortedBlocks[j];
             int y = (int) sortedKey2.y;
             bool hasExclusions = false;
@@ -0,0 +1,192 @@
+/**
+ * Integrators for mixed precision on devices without double precision.  Each position and
+ * velocity is stored as the unevaluated sum of two floats: the leading part in posq or velm, and
+ * a correction in posqCorrection or velmCorrection.  Updates use compensated arithmetic, so
+ * displacements far smaller than the spacing between floats near a coordinate still accumulate.
+ *
+ * The error-free transformations below rely on floating point operations being evaluated exactly
+ * as written, so MetalContext compiles this file without fast math or contraction and verifies the
+ * result with checkFloatFloatArithmetic() before any of these kernels are used.
+ */
+
+/**
+ * Add a value to a float-float number (hi, lo) and renormalize the result.
+ */
+inline void addFloatFloat(float3* hi, float3* lo, float3 value) {
+    float3 sum = *hi+value;
+    float3 rounded = sum-*hi;
+    float3 error = (*hi-(sum-rounded))+(value-rounded)+*lo;
+    *hi = sum+error;
+    *lo = error-(*hi-sum);
+}
+
+/**
+ * Multiply a float-float number (hi, lo) by a scale factor and renormalize the result.
+ */
+inline void scaleFloatFloat(float3* hi, float3* lo, float scale) {
+    float3 product = *hi*scale;
+    float3 error = fma(*hi, (float3) scale, -product)+*lo*scale;
+    *hi = product+error;
+    *lo = error-(*hi-product);
+}
+
+/**
+ * Perform the first step of Verlet integration.
+ */
+__kernel void integrateVerletPart1(int numAtoms, int paddedNumAtoms, __global const float2* restrict dt, __global const float4* restrict posq,
+        __global float4* restrict velm, __global const long* restrict force, __global float4* restrict posDelta, __global float4* restrict velmCorrection) {
+    const float2 stepSize = dt[0];
+    const float dtPos = stepSize.y;
+    const float dtVel = 0.5f*(stepSize.x+stepSize.y);
+    const float scale = dtVel/(float) 0x100000000;
+    for (int index = get_global_id(0); index < numAtoms; index += get_global_size(0)) {
+        float4 velocity = velm[index];
+        if (velocity.w != 0.0f) {
+            float3 vel = velocity.xyz;
+            float3 velCorrection = velmCorrection[index].xyz;
+            float3 f = (float3) ((float) force[index], (float) force[index+paddedNumAtoms], (float) force[index+paddedNumAtoms*2]);
+            addFloatFloat(&vel, &velCorrection, scale*velocity.w*f);
+            posDelta[index] = (float4) (vel*dtPos, 0.0f);
+            velm[index] = (float4) (vel, velocity.w);
+            velmCorrection[index] = (float4) (velCorrection, 0.0f);
+        }
+    }
+}
+
+/**
+ * Perform the second step of Verlet integration.  The velocity is only changed by the amount the
+ * constraints changed the displacement, so it keeps the precision it had after the first step.
+ */
+__kernel void integrateVerletPart2(int numAtoms, __global float2* restrict dt, __global float4* restrict posq,
+        __global float4* restrict velm, __global const float4* restrict posDelta, __global float4* restrict posqCorrection,
+        __global float4* restrict velmCorrection) {
+    float2 stepSize = dt[0];
+    float oneOverDt = 1.0f/stepSize.y;
+    if (get_global_id(0) == 0)
+        dt[0].x = stepSize.y;
+    for (int index = get_global_id(0); index < numAtoms; index += get_global_size(0)) {
+        float4 velocity = velm[index];
+        if (velocity.w != 0.0f) {
+            float4 pos1 = posq[index];
+            float3 pos = pos1.xyz;
+            float3 posCorrection = posqCorrection[index].xyz;
+            float3 delta = posDelta[index].xyz;
+            addFloatFloat(&pos, &posCorrection, delta);
+            float3 vel = velocity.xyz;
+            float3 velCorrection = velmCorrection[index].xyz;
+            addFloatFloat(&vel, &velCorrection, (delta-vel*stepSize.y)*oneOverDt);
+            posq[index] = (float4) (pos, pos1.w);
+            posqCorrection[index] = (float4) (posCorrection, 0.0f);
+            velm[index] = (float4) (vel, velocity.w);
+            velmCorrection[index] = (float4) (velCorrection, 0.0f);
+        }
+    }
+}
+
+enum {VelScale, NoiseScale};
+
+/**
+ * Perform the first part of LangevinMiddle integration: velocity step.
+ */
+__kernel void integrateLangevinMiddlePart1(int numAtoms, int paddedNumAtoms, __global float4* restrict velm, __global const long* restrict force,
+        __global const float2* restrict dt, __global float4* restrict velmCorrection) {
+    float fscale = dt[0].y/(float) 0x100000000;
+    for (int index = get_global_id(0); index < numAtoms; index += get_global_size(0)) {
+        float4 velocity = velm[index];
+        if (velocity.w != 0.0f) {
+            float3 vel = velocity.xyz;
+            float3 velCorrection = velmCorrection[index].xyz;
+            float3 f = (float3) ((float) force[index], (float) force[index+paddedNumAtoms], (float) force[index+paddedNumAtoms*2]);
+            addFloatFloat(&vel, &velCorrection, fscale*velocity.w*f);
+            velm[index] = (float4) (vel, velocity.w);
+            velmCorrection[index] = (float4) (velCorrection, 0.0f);
+        }
+    }
+}
+
+/**
+ * Perform the second part of LangevinMiddle integration: position half step, then interact with
+ * the heat bath, then another position half step.
+ */
+__kernel void integrateLangevinMiddlePart2(int numAtoms, __global float4* restrict velm, __global float4* restrict posDelta,
+        __global float4* restrict oldDelta, __global const float* restrict paramBuffer, __global const float2* restrict dt,
+        __global const float4* restrict random, unsigned int randomIndex, __global float4* restrict velmCorrection) {
+    float vscale = paramBuffer[VelScale];
+    float noisescale = paramBuffer[NoiseScale];
+    float halfdt = 0.5f*dt[0].y;
+    int index = get_global_id(0);
+    randomIndex += index;
+    while (index < numAtoms) {
+        float4 velocity = velm[index];
+        if (velocity.w != 0.0f) {
+            float3 vel = velocity.xyz;
+            float3 velCorrection = velmCorrection[index].xyz;
+            float3 delta = halfdt*vel+halfdt*velCorrection;
+            float sqrtInvMass = sqrt(velocity.w);
+            scaleFloatFloat(&vel, &velCorrection, vscale);
+            addFloatFloat(&vel, &velCorrection, noisescale*sqrtInvMass*random[randomIndex].xyz);
+            delta += halfdt*vel+halfdt*velCorrection;
+            velm[index] = (float4) (vel, velocity.w);
+            velmCorrection[index] = (float4) (velCorrection, 0.0f);
+            posDelta[index] = (float4) (delta, 0.0f);
+            oldDelta[index] = (float4) (delta, 0.0f);
+        }
+        randomIndex += get_global_size(0);
+        index += get_global_size(0);
+    }
+}
+
+/**
+ * Perform the third part of LangevinMiddle integration: apply constraint forces to velocities,
+ * then record the constrained positions.
+ */
+__kernel void integrateLangevinMiddlePart3(int numAtoms, __global float4* restrict posq, __global float4* restrict velm,
+        __global const float4* restrict posDelta, __global const float4* restrict oldDelta, __global const float2* restrict dt,
+        __global float4* restrict posqCorrection, __global float4* restrict velmCorrection) {
+    float invDt = 1.0f/dt[0].y;
+    for (int index = get_global_id(0); index < numAtoms; index += get_global_size(0)) {
+        float4 velocity = velm[index];
+        if (velocity.w != 0.0f) {
+            float3 delta = posDelta[index].xyz;
+            float3 vel = velocity.xyz;
+            float3 velCorrection = velmCorrection[index].xyz;
+            addFloatFloat(&vel, &velCorrection, (delta-oldDelta[index].xyz)*invDt);
+            velm[index] = (float4) (vel, velocity.w);
+            velmCorrection[index] = (float4) (velCorrection, 0.0f);
+            float4 pos1 = posq[index];
+            float3 pos = pos1.xyz;
+            float3 posCorrection = posqCorrection[index].xyz;
+            addFloatFloat(&pos, &posCorrection, delta);
+            posq[index] = (float4) (pos, pos1.w);
+            posqCorrection[index] = (float4) (posCorrection, 0.0f);
+        }
+    }
+}
+
+/**
+ * Add the corrections into posq and velm and clear them.  This is used before kernels that modify
+ * posq or velm without knowing about the corrections.
+ */
+__kernel void foldFloatFloatCorrections(int numAtoms, __global float4* restrict posq, __global float4* restrict posqCorrection,
+        __global float4* restrict velm, __global float4* restrict velmCorrection) {
+    for (int index = get_global_id(0); index < numAtoms; index += get_global_size(0)) {
+        float4 pos = posq[index];
+        float4 vel = velm[index];
+        posq[index] = (float4) (pos.xyz+posqCorrection[index].xyz, pos.w);
+        velm[index] = (float4) (vel.xyz+velmCorrection[index].xyz, vel.w);
+        posqCorrection[index] = (float4) 0.0f;
+        velmCorrection[index] = (float4) 0.0f;
+    }
+}
+
+/**
+ * Add a value to a float-float number so the host can verify that the compiler kept the
+ * error-free transformation intact.
+ */
+__kernel void checkFloatFloatArithmetic(float hi, float value, __global float* restrict result) {
+    float3 sumHi = (float3) hi;
+    float3 sumLo = (float3) 0.0f;
+    addFloatFloat(&sumHi, &sumLo, (float3) value);
+    result[0] = sumHi.x;
+    result[1] = sumLo.x;
+}
@@ -1,5 +1,24 @@
 #define WARPS_PER_GROUP (FORCE_WORK_GROUP_SIZE/TILE_SIZE)
 
+#ifdef USE_SUBTILE_MASKS
+// Tiles from the neighbor list are divided into 4x4 sub-tiles of 8x8 atoms, and the mask for each
+// tile flags the sub-tiles that contain interactions.  Step j of the loop over a tile pairs each
+// 8 atom sub-cluster i of block X with the neighbors in sub-cluster (i+j/8)%4, so each run of 8
+// steps covers one diagonal of four sub-tiles, and can be skipped if all of them are empty.
+
+#define SUBTILE_SIZE 8
+#define TILE_NEIGHBOR(j) ((((tgx/SUBTILE_SIZE)+(j)/SUBTILE_SIZE)&3)*SUBTILE_SIZE + ((tgx+(j))&(SUBTILE_SIZE-1)))
+#define DIAGONAL_MASK(d) ((0x84218421u>>(4*(d)))&0xFFFF)
+#define SKIP_EMPTY_SUBTILES(j) \
+    if (((j)&(SUBTILE_SIZE-1)) == 0 && (tileMask&DIAGONAL_MASK((j)/SUBTILE_SIZE)) == 0) { \
+        j += SUBTILE_SIZE-1; \
+        continue; \
+    } \
+    tj = TILE_NEIGHBOR(j);
+#else
+#define SKIP_EMPTY_SUBTILES(j)
+#endif
+
 typedef struct {
     real x, y, z;
     real q;
@@ -10,6 +29,45 @@ typedef struct {
 #endif
 } AtomData;
 
+/**
+ * Find the block indices (x, y) of the tile at a position in the list of all tiles.  When
+ * replicas are batched, only tiles whose blocks are in the same replica are listed.
+ */
+int2 getTileFromPosition(int pos) {
+#ifdef BLOCKS_PER_REPLICA
+    int replica = pos/TILES_PER_REPLICA;
+    pos -= replica*TILES_PER_REPLICA;
+    const int numBlocks = BLOCKS_PER_REPLICA;
+#else
+    const int numBlocks = NUM_BLOCKS;
+#endif
+    int y = (int) floor(numBlocks+0.5f-SQRT((numBlocks+0.5f)*(numBlocks+0.5f)-2*pos));
+    int x = (pos-y*numBlocks+y*(y+1)/2);
+    if (x < y || x >= numBlocks) { // Occasionally happens due to roundoff error.
+        y += (x < y ? -1 : 1);
+        x = (pos-y*numBlocks+y*(y+1)/2);
+    }
+#ifdef BLOCKS_PER_REPLICA
+    x += replica*BLOCKS_PER_REPLICA;
+    y += replica*BLOCKS_PER_REPLICA;
+#endif
+    return (int2) (x, y);
+}
+
+/**
+ * Find the position of a tile in the list of all tiles.  This is the inverse of getTileFromPosition().
+ */
+int getTilePosition(int x, int y) {
+#ifdef BLOCKS_PER_REPLICA
+    int replica = y/BLOCKS_PER_REPLICA;
+    x -= replica*BLOCKS_PER_REPLICA;
+    y -= replica*BLOCKS_PER_REPLICA;
+    return replica*TILES_PER_REPLICA + x + y*BLOCKS_PER_REPLICA - y*(y+1)/2;
+#else
+    return x + y*NUM_BLOCKS - y*(y+1)/2;
+#endif
+}
+
 /**
  * Compute nonbonded interactions.
  */
@@ -21,6 +79,9 @@ __kernel void computeNonbonded(
         , __global const int* restrict tiles, __global const unsigned int* restrict interactionCount, real4 periodicBoxSize, real4 invPeriodicBoxSize,
         real4 periodicBoxVecX, real4 periodicBoxVecY, real4 periodicBoxVecZ, unsigned int maxTiles, __global const real4* restrict blockCenter,
         __global const real4* restrict blockSize, __global const int* restrict interactingAtoms
+#ifdef USE_SUBTILE_MASKS
+        , __global const unsigned int* restrict interactingTileMasks
+#endif
 #endif
         PARAMETER_ARGUMENTS) {
     const unsigned int totalWarps = get_global_size(0)/TILE_SIZE;
@@ -187,14 +248,29 @@ __kernel void computeNonbonded(
 
 #ifdef USE_NEIGHBOR_LIST
     unsigned int numTiles = interactionCount[0];
+#ifdef ALL_TILES_ON_OVERFLOW
+    // The host only checks for overflow every few steps, so if there wasn't enough memory for
+    // the neighbor list, enumerate all tiles instead.  This is slow, but gives correct results.
+    const bool useNeighborList = (numTiles <= maxTiles);
+#else
     if (numTiles > maxTiles)
         return; // There wasn't enough memory for the neighbor list.
-    int pos = (int) (warp*(long)numTiles/totalWarps);
-    int end = (int) ((warp+1)*(long)numTiles/totalWarps);
+    const bool useNeighborList = true;
+#endif
 #else
-    int pos = (int) (startTileIndex+warp*numTileIndices/totalWarps);
-    int end = (int) (startTileIndex+(warp+1)*numTileIndices/totalWarps);
+    const bool useNeighborList = false;
 #endif
+    int pos, end;
+    if (useNeighborList) {
+#ifdef USE_NEIGHBOR_LIST
+        pos = (int) (warp*(long)numTiles/totalWarps);
+        end = (int) ((warp+1)*(long)numTiles/totalWarps);
+#endif
+    }
+    else {
+        pos = (int) (startTileIndex+warp*numTileIndices/totalWarps);
+        end = (int) (startTileIndex+(warp+1)*numTileIndices/totalWarps);
+    }
     int skipBase = 0;
     int currentSkipIndex = tbx;
     __local int atomIndices[FORCE_WORK_GROUP_SIZE];
@@ -210,39 +286,39 @@ __kernel void computeNonbonded(
 
         int x, y;
         bool singlePeriodicCopy = false;
+        if (useNeighborList) {
 #ifdef USE_NEIGHBOR_LIST
-        x = tiles[pos];
-        real4 blockSizeX = blockSize[x];
-        singlePeriodicCopy = (0.5f*periodicBoxSize.x-blockSizeX.x >= MAX_CUTOFF &&
-                              0.5f*periodicBoxSize.y-blockSizeX.y >= MAX_CUTOFF &&
-                              0.5f*periodicBoxSize.z-blockSizeX.z >= MAX_CUTOFF);
-#else
-        y = (int) floor(NUM_BLOCKS+0.5f-SQRT((NUM_BLOCKS+0.5f)*(NUM_BLOCKS+0.5f)-2*pos));
-        x = (pos-y*NUM_BLOCKS+y*(y+1)/2);
-        if (x < y || x >= NUM_BLOCKS) { // Occasionally happens due to roundoff error.
-            y += (x < y ? -1 : 1);
-            x = (pos-y*NUM_BLOCKS+y*(y+1)/2);
+            x = tiles[pos];
+            real4 blockSizeX = blockSize[x];
+            singlePeriodicCopy = (0.5f*periodicBoxSize.x-blockSizeX.x >= MAX_CUTOFF &&
+                                  0.5f*periodicBoxSize.y-blockSizeX.y >= MAX_CUTOFF &&
+                                  0.5f*periodicBoxSize.z-blockSizeX.z >= MAX_CUTOFF);
+#endif
         }
+        else {
+            int2 tileBlocks = getTileFromPosition(pos);
+            x = tileBlocks.x;
+            y = tileBlocks.y;
 
-        // Skip over tiles that have exclusions, since they were already processed.
+            // Skip over tiles that have exclusions, since they were already processed.
 
-        SYNC_WARPS;
-        while (skipTiles[tbx+TILE_SIZE-1] < pos) {
             SYNC_WARPS;
-            if (skipBase+tgx < NUM_TILES_WITH_EXCLUSIONS) {
-                int2 tile = exclusionTiles[skipBase+tgx];
-                skipTiles[get_local_id(0)] = tile.x + tile.y*NUM_BLOCKS - tile.y*(tile.y+1)/2;
+            while (skipTiles[tbx+TILE_SIZE-1] < pos) {
+                SYNC_WARPS;
+                if (skipBase+tgx < NUM_TILES_WITH_EXCLUSIONS) {
+                    int2 tile = exclusionTiles[skipBase+tgx];
+                    skipTiles[get_local_id(0)] = getTilePosition(tile.x, tile.y);
+                }
+                else
+                    skipTiles[get_local_id(0)] = end;
+                skipBase += TILE_SIZE;
+                currentSkipIndex = tbx;
+                SYNC_WARPS;
             }
-            else
-                skipTiles[get_local_id(0)] = end;
-            skipBase += TILE_SIZE;
-            currentSkipIndex = tbx;
-            SYNC_WARPS;
+            while (skipTiles[currentSkipIndex] < pos)
+                currentSkipIndex++;
+            includeTile = (skipTiles[currentSkipIndex] != pos);
         }
-        while (skipTiles[currentSkipIndex] < pos)
-            currentSkipIndex++;
-        includeTile = (skipTiles[currentSkipIndex] != pos);
-#endif
         if (includeTile) {
             unsigned int atom1 = x*TILE_SIZE + tgx;
 
@@ -250,11 +326,20 @@ __kernel void computeNonbonded(
 
             real4 posq1 = posq[atom1];
             LOAD_ATOM1_PARAMETERS
+            unsigned int j;
+#ifdef USE_SUBTILE_MASKS
+            unsigned int tileMask = 0xFFFF;
+#endif
+            if (useNeighborList) {
 #ifdef USE_NEIGHBOR_LIST
-            unsigned int j = interactingAtoms[pos*TILE_SIZE+tgx];
-#else
-            unsigned int j = y*TILE_SIZE + tgx;
+                j = interactingAtoms[pos*TILE_SIZE+tgx];
+#ifdef USE_SUBTILE_MASKS
+                tileMask = interactingTileMasks[pos];
+#endif
 #endif
+            }
+            else
+                j = y*TILE_SIZE + tgx;
             atomIndices[get_local_id(0)] = j;
             if (j < PADDED_NUM_ATOMS) {
                 real4 tempPosq = posq[j];
@@ -286,6 +371,7 @@ __kernel void computeNonbonded(
                 SYNC_WARPS;
                 unsigned int tj = tgx;
                 for (j = 0; j < TILE_SIZE; j++) {
+                    SKIP_EMPTY_SUBTILES(j)
                     int atom2 = tbx+tj;
                     real4 posq2 = (real4) (localData[atom2].x, localData[atom2].y, localData[atom2].z, localData[atom2].q);
                     real4 delta = (real4) (posq2.xyz - posq1.xyz, 0);
@@ -338,6 +424,7 @@ __kernel void computeNonbonded(
 
                 unsigned int tj = tgx;
                 for (j = 0; j < TILE_SIZE; j++) {
+                    SKIP_EMPTY_SUBTILES(j)
                     int atom2 = tbx+tj;
                     real4 posq2 = (real4) (localData[atom2].x, localData[atom2].y, localData[atom2].z, localData[atom2].q);
                     real4 delta = (real4) (posq2.xyz - posq1.xyz, 0);
@@ -390,11 +477,7 @@ __kernel void computeNonbonded(
             // Write results.
 
 #ifdef INCLUDE_FORCES
-#ifdef USE_NEIGHBOR_LIST
             unsigned int atom2 = atomIndices[get_local_id(0)];
-#else
-            unsigned int atom2 = y*TILE_SIZE + tgx;
-#endif
             ATOMIC_ADD(&forceBuffers[atom1], (mm_ulong) realToFixedPoint(force.x));
             ATOMIC_ADD(&forceBuffers[atom1+PADDED_NUM_ATOMS], (mm_ulong) realToFixedPoint(force.y));
             ATOMIC_ADD(&forceBuffers[atom1+2*PADDED_NUM_ATOMS], (mm_ulong) realToFixedPoint(force.z));
@@ -1,70 +1,117 @@
 /**
- * Compute the nonbonded parameters for particles and exceptions.
+ * Compute the parameters for one particle, and return its contribution to the self energy.
  */
-KERNEL void computeParameters(GLOBAL mixed* RESTRICT energyBuffer, int includeSelfEnergy, GLOBAL real* RESTRICT globalParams,
-        int numAtoms, GLOBAL const float4* RESTRICT baseParticleParams, GLOBAL real4* RESTRICT posq, GLOBAL real* RESTRICT charge,
-        GLOBAL float2* RESTRICT sigmaEpsilon, GLOBAL float4* RESTRICT particleParamOffsets, GLOBAL int* RESTRICT particleOffsetIndices
-#ifdef HAS_EXCEPTIONS
-        , int numExceptions, GLOBAL const float4* RESTRICT baseExceptionParams, GLOBAL float4* RESTRICT exceptionParams,
-        GLOBAL float4* RESTRICT exceptionParamOffsets, GLOBAL int* RESTRICT exceptionOffsetIndices
-#endif
-        ) {
+DEVICE mixed computeParticleParameters(int i, GLOBAL real* RESTRICT globalParams, GLOBAL const float4* RESTRICT baseParticleParams,
+        GLOBAL real4* RESTRICT posq, GLOBAL real* RESTRICT charge, GLOBAL float2* RESTRICT sigmaEpsilon, GLOBAL half* RESTRICT sigmaEpsilonHalf,
+        GLOBAL float4* RESTRICT particleParamOffsets, GLOBAL int* RESTRICT particleOffsetIndices) {
     mixed energy = 0;
-
-    // Compute particle parameters.
-    
-    for (int i = GLOBAL_ID; i < numAtoms; i += GLOBAL_SIZE) {
-        float4 params = baseParticleParams[i];
+    float4 params = baseParticleParams[i];
 #ifdef HAS_PARTICLE_OFFSETS
-        int start = particleOffsetIndices[i], end = particleOffsetIndices[i+1];
-        for (int j = start; j < end; j++) {
-            float4 offset = particleParamOffsets[j];
-            real value = globalParams[(int) offset.w];
-            params.x += value*offset.x;
-            params.y += value*offset.y;
-            params.z += value*offset.z;
-        }
+    int start = particleOffsetIndices[i], end = particleOffsetIndices[i+1];
+    for (int j = start; j < end; j++) {
+        float4 offset = particleParamOffsets[j];
+        real value = globalParams[(int) offset.w];
+        params.x += value*offset.x;
+        params.y += value*offset.y;
+        params.z += value*offset.z;
+    }
 #endif
 #ifdef USE_POSQ_CHARGES
-        posq[i].w = params.x;
+    posq[i].w = params.x;
 #else
-        charge[i] = params.x;
+    charge[i] = params.x;
+#endif
+    float2 sigEps = make_float2(0.5f*params.y, 2*SQRT(params.z));
+    sigmaEpsilon[i] = sigEps;
+#ifdef USE_HALF_SIGMA_EPSILON
+    vstore_half2(sigEps, i, sigmaEpsilonHalf);
 #endif
-        sigmaEpsilon[i] = make_float2(0.5f*params.y, 2*SQRT(params.z));
 #ifdef HAS_OFFSETS
     #ifdef INCLUDE_EWALD
-        energy -= EWALD_SELF_ENERGY_SCALE*params.x*params.x;
+    energy -= EWALD_SELF_ENERGY_SCALE*params.x*params.x;
     #endif
     #ifdef INCLUDE_LJPME
-        real sig3 = params.y*params.y*params.y;
-        energy += LJPME_SELF_ENERGY_SCALE*sig3*sig3*params.z;
+    real sig3 = params.y*params.y*params.y;
+    energy += LJPME_SELF_ENERGY_SCALE*sig3*sig3*params.z;
     #endif
 #endif
+    return energy;
+}
+
+#ifdef HAS_EXCEPTIONS
+/**
+ * Compute the parameters for one exception.
+ */
+DEVICE void computeExceptionParameters(int i, GLOBAL real* RESTRICT globalParams, GLOBAL const float4* RESTRICT baseExceptionParams,
+        GLOBAL float4* RESTRICT exceptionParams, GLOBAL float4* RESTRICT exceptionParamOffsets, GLOBAL int* RESTRICT exceptionOffsetIndices) {
+    float4 params = baseExceptionParams[i];
+#ifdef HAS_EXCEPTION_OFFSETS
+    int start = exceptionOffsetIndices[i], end = exceptionOffsetIndices[i+1];
+    for (int j = start; j < end; j++) {
+        float4 offset = exceptionParamOffsets[j];
+        real value = globalParams[(int) offset.w];
+        params.x += value*offset.x;
+        params.y += value*offset.y;
+        params.z += value*offset.z;
     }
+#endif
+    exceptionParams[i] = make_float4((float) (ONE_4PI_EPS0*params.x), (float) params.y, (float) (4*params.z), 0);
+}
+#endif
+
+/**
+ * Compute the nonbonded parameters for particles and exceptions.
+ */
+KERNEL void computeParameters(GLOBAL mixed* RESTRICT energyBuffer, int includeSelfEnergy, GLOBAL real* RESTRICT globalParams,
+        int numAtoms, GLOBAL const float4* RESTRICT baseParticleParams, GLOBAL real4* RESTRICT posq, GLOBAL real* RESTRICT charge,
+        GLOBAL float2* RESTRICT sigmaEpsilon, GLOBAL half* RESTRICT sigmaEpsilonHalf, GLOBAL float4* RESTRICT particleParamOffsets,
+        GLOBAL int* RESTRICT particleOffsetIndices
+#ifdef HAS_EXCEPTIONS
+        , int numExceptions, GLOBAL const float4* RESTRICT baseExceptionParams, GLOBAL float4* RESTRICT exceptionParams,
+        GLOBAL float4* RESTRICT exceptionParamOffsets, GLOBAL int* RESTRICT exceptionOffsetIndices
+#endif
+        ) {
+    mixed energy = 0;
+
+    // Compute particle parameters.
+    
+    for (int i = GLOBAL_ID; i < numAtoms; i += GLOBAL_SIZE)
+        energy += computeParticleParameters(i, globalParams, baseParticleParams, posq, charge, sigmaEpsilon, sigmaEpsilonHalf, particleParamOffsets, particleOffsetIndices);
 
     // Compute exception parameters.
     
 #ifdef HAS_EXCEPTIONS
-    for (int i = GLOBAL_ID; i < numExceptions; i += GLOBAL_SIZE) {
-        float4 params = baseExceptionParams[i];
-#ifdef HAS_EXCEPTION_OFFSETS
-        int start = exceptionOffsetIndices[i], end = exceptionOffsetIndices[i+1];
-        for (int j = start; j < end; j++) {
-            float4 offset = exceptionParamOffsets[j];
-            real value = globalParams[(int) offset.w];
-            params.x += value*offset.x;
-            params.y += value*offset.y;
-            params.z += value*offset.z;
-        }
-#endif
-        exceptionParams[i] = make_float4((float) (ONE_4PI_EPS0*params.x), (float) params.y, (float) (4*params.z), 0);
-    }
+    for (int i = GLOBAL_ID; i < numExceptions; i += GLOBAL_SIZE)
+        computeExceptionParameters(i, globalParams, baseExceptionParams, exceptionParams, exceptionParamOffsets, exceptionOffsetIndices);
 #endif
     if (includeSelfEnergy) {
         energyBuffer[GLOBAL_ID] += energy;
     }
 }
 
+/**
+ * Recompute the parameters of only the particles and exceptions whose base parameters have changed.
+ * changedIndices holds numChangedAtoms particle indices followed by numChangedExceptions exception
+ * indices.  This is only used when there are no parameter offsets, so the self energy is computed
+ * on the host.
+ */
+KERNEL void computeChangedParameters(int numChangedAtoms, int numChangedExceptions, GLOBAL const int* RESTRICT changedIndices,
+        GLOBAL real* RESTRICT globalParams, GLOBAL const float4* RESTRICT baseParticleParams, GLOBAL real4* RESTRICT posq, GLOBAL real* RESTRICT charge,
+        GLOBAL float2* RESTRICT sigmaEpsilon, GLOBAL half* RESTRICT sigmaEpsilonHalf, GLOBAL float4* RESTRICT particleParamOffsets,
+        GLOBAL int* RESTRICT particleOffsetIndices
+#ifdef HAS_EXCEPTIONS
+        , GLOBAL const float4* RESTRICT baseExceptionParams, GLOBAL float4* RESTRICT exceptionParams,
+        GLOBAL float4* RESTRICT exceptionParamOffsets, GLOBAL int* RESTRICT exceptionOffsetIndices
+#endif
+        ) {
+    for (int i = GLOBAL_ID; i < numChangedAtoms; i += GLOBAL_SIZE)
+        computeParticleParameters(changedIndices[i], globalParams, baseParticleParams, posq, charge, sigmaEpsilon, sigmaEpsilonHalf, particleParamOffsets, particleOffsetIndices);
+#ifdef HAS_EXCEPTIONS
+    for (int i = GLOBAL_ID; i < numChangedExceptions; i += GLOBAL_SIZE)
+        computeExceptionParameters(changedIndices[numChangedAtoms+i], globalParams, baseExceptionParams, exceptionParams, exceptionParamOffsets, exceptionOffsetIndices);
+#endif
+}
+
 /**
  * Compute parameters for subtracting the reciprocal part of excluded interactions.
  */
@@ -5,6 +5,45 @@ typedef struct {
     ATOM_PARAMETER_DATA
 } AtomData;
 
+/**
+ * Find the block indices (x, y) of the tile at a position in the list of all tiles.  When
+ * replicas are batched, only tiles whose blocks are in the same replica are listed.
+ */
+int2 getTileFromPosition(int pos) {
+#ifdef BLOCKS_PER_REPLICA
+    int replica = pos/TILES_PER_REPLICA;
+    pos -= replica*TILES_PER_REPLICA;
+    const int numBlocks = BLOCKS_PER_REPLICA;
+#else
+    const int numBlocks = NUM_BLOCKS;
+#endif
+    int y = (int) floor(numBlocks+0.5f-SQRT((numBlocks+0.5f)*(numBlocks+0.5f)-2*pos));
+    int x = (pos-y*numBlocks+y*(y+1)/2);
+    if (x < y || x >= numBlocks) { // Occasionally happens due to roundoff error.
+        y += (x < y ? -1 : 1);
+        x = (pos-y*numBlocks+y*(y+1)/2);
+    }
+#ifdef BLOCKS_PER_REPLICA
+    x += replica*BLOCKS_PER_REPLICA;
+    y += replica*BLOCKS_PER_REPLICA;
+#endif
+    return (int2) (x, y);
+}
+
+/**
+ * Find the position of a tile in the list of all tiles.  This is the inverse of getTileFromPosition().
+ */
+int getTilePosition(int x, int y) {
+#ifdef BLOCKS_PER_REPLICA
+    int replica = y/BLOCKS_PER_REPLICA;
+    x -= replica*BLOCKS_PER_REPLICA;
+    y -= replica*BLOCKS_PER_REPLICA;
+    return replica*TILES_PER_REPLICA + x + y*BLOCKS_PER_REPLICA - y*(y+1)/2;
+#else
+    return x + y*NUM_BLOCKS - y*(y+1)/2;
+#endif
+}
+
 /**
  * Compute nonbonded interactions.
  */
@@ -241,19 +280,16 @@ __kernel void computeNonbonded(
                               0.5f*periodicBoxSize.y-blockSizeX.y >= MAX_CUTOFF &&
                               0.5f*periodicBoxSize.z-blockSizeX.z >= MAX_CUTOFF);
 #else
-        y = (int) floor(NUM_BLOCKS+0.5f-SQRT((NUM_BLOCKS+0.5f)*(NUM_BLOCKS+0.5f)-2*pos));
-        x = (pos-y*NUM_BLOCKS+y*(y+1)/2);
-        if (x < y || x >= NUM_BLOCKS) { // Occasionally happens due to roundoff error.
-            y += (x < y ? -1 : 1);
-            x = (pos-y*NUM_BLOCKS+y*(y+1)/2);
-        }
+        int2 tileBlocks = getTileFromPosition(pos);
+        x = tileBlocks.x;
+        y = tileBlocks.y;
 
         // Skip over tiles that have exclusions, since they were already processed.
 
         while (nextToSkip < pos) {
             if (currentSkipIndex < NUM_TILES_WITH_EXCLUSIONS) {
                 int2 tile = exclusionTiles[currentSkipIndex++];
-                nextToSkip = tile.x + tile.y*NUM_BLOCKS - tile.y*(tile.y+1)/2;
+                nextToSkip = getTilePosition(tile.x, tile.y);
             }
             else
                 nextToSkip = end;
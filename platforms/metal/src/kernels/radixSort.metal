@@ -0,0 +1,136 @@
+#pragma OPENCL EXTENSION cl_khr_local_int32_base_atomics : enable
+
+#define NUM_DIGITS 256
+
+/**
+ * Map the key of a value to an unsigned integer whose ordering matches the ordering of the keys.
+ */
+RADIX_TYPE getRadixKey(DATA_TYPE value) {
+    KEY_TYPE key = SORT_KEY;
+#if defined(KEY_IS_FLOAT)
+    RADIX_TYPE bits = AS_RADIX_TYPE(key);
+    RADIX_TYPE signBit = ((RADIX_TYPE) 1) << (RADIX_KEY_BITS-1);
+    return bits ^ ((bits & signBit) != 0 ? ~((RADIX_TYPE) 0) : signBit);
+#elif defined(KEY_IS_SIGNED)
+    return ((RADIX_TYPE) key) ^ (((RADIX_TYPE) 1) << (RADIX_KEY_BITS-1));
+#else
+    return (RADIX_TYPE) key;
+#endif
+}
+
+uint getDigit(DATA_TYPE value, int shift) {
+    return (uint) ((getRadixKey(value) >> shift) & (NUM_DIGITS-1));
+}
+
+/**
+ * Count how many elements in each work group's section of the array have each value of
+ * the current digit.  The counts are stored digit-major, so a prefix sum over the whole
+ * array gives each work group the position of its first element with every digit.
+ */
+__kernel void computeDigitHistograms(__global const DATA_TYPE* restrict data, uint length, uint elementsPerGroup, int shift,
+        __global uint* restrict digitCounts, __local uint* restrict localCounts) {
+    for (uint i = get_local_id(0); i < NUM_DIGITS; i += get_local_size(0))
+        localCounts[i] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    uint start = get_group_id(0)*elementsPerGroup;
+    uint end = min(start+elementsPerGroup, length);
+    for (uint index = start+get_local_id(0); index < end; index += get_local_size(0))
+        atomic_inc(&localCounts[getDigit(data[index], shift)]);
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (uint i = get_local_id(0); i < NUM_DIGITS; i += get_local_size(0))
+        digitCounts[i*get_num_groups(0)+get_group_id(0)] = localCounts[i];
+}
+
+/**
+ * Convert the digit counts to offsets with an exclusive prefix sum.  This kernel is executed
+ * as a single work group.
+ */
+__kernel void computeDigitOffsets(__global uint* restrict digitCounts, uint numCounts, __local uint* restrict buffer) {
+    uint globalOffset = 0;
+    for (uint start = 0; start < numCounts; start += get_local_size(0)) {
+        uint index = start+get_local_id(0);
+        uint count = (index < numCounts ? digitCounts[index] : 0);
+        buffer[get_local_id(0)] = count;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for (uint step = 1; step < get_local_size(0); step *= 2) {
+            uint add = (get_local_id(0) >= step ? buffer[get_local_id(0)-step] : 0);
+            barrier(CLK_LOCAL_MEM_FENCE);
+            buffer[get_local_id(0)] += add;
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+        if (index < numCounts)
+            digitCounts[index] = globalOffset+buffer[get_local_id(0)]-count;
+        globalOffset += buffer[get_local_size(0)-1];
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+}
+
+/**
+ * Move every element to its position in the order of the current digit.  Each work group
+ * processes its section of the array in blocks, in order.  Within a block, the (digit, position)
+ * pairs are sorted in local memory with one stable split per bit of the digit, each using a
+ * prefix scan.  An element's rank is then its distance from the start of its digit's run, so
+ * the sort is stable and ranking takes O(log(local size)) steps per bit.
+ */
+__kernel void scatterByDigit(__global const DATA_TYPE* restrict dataIn, __global DATA_TYPE* restrict dataOut, uint length, uint elementsPerGroup,
+        int shift, __global const uint* restrict digitOffsets, __local uint* restrict localOffsets, __local uint* restrict localKeys,
+        __local uint* restrict localScan, __local uint* restrict localStarts) {
+    const uint localId = get_local_id(0);
+    const uint localSize = get_local_size(0);
+    for (uint i = localId; i < NUM_DIGITS; i += localSize)
+        localOffsets[i] = digitOffsets[i*get_num_groups(0)+get_group_id(0)];
+    uint start = get_group_id(0)*elementsPerGroup;
+    uint end = min(start+elementsPerGroup, length);
+    for (uint blockStart = start; blockStart < end; blockStart += localSize) {
+        uint index = blockStart+localId;
+        uint numValid = min(localSize, end-blockStart);
+        DATA_TYPE value;
+        uint digit = NUM_DIGITS-1;
+        if (index < end) {
+            value = dataIn[index];
+            digit = getDigit(value, shift);
+        }
+        localKeys[localId] = (digit<<16) | localId;
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        // Sort the keys by digit.  Elements past the end of the array have the largest digit
+        // and the largest positions, so they end up last.
+
+        for (int bit = 0; bit < 8; bit++) {
+            uint key = localKeys[localId];
+            uint flag = (key>>(16+bit)) & 1;
+            localScan[localId] = flag;
+            barrier(CLK_LOCAL_MEM_FENCE);
+            for (uint step = 1; step < localSize; step *= 2) {
+                uint add = (localId >= step ? localScan[localId-step] : 0);
+                barrier(CLK_LOCAL_MEM_FENCE);
+                localScan[localId] += add;
+                barrier(CLK_LOCAL_MEM_FENCE);
+            }
+            uint onesBefore = localScan[localId]-flag;
+            uint numZeros = localSize-localScan[localSize-1];
+            localKeys[flag ? numZeros+onesBefore : localId-onesBefore] = key;
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+
+        // Find where each digit's run starts, and send every element its rank within the run.
+
+        uint key = localKeys[localId];
+        uint sortedDigit = key>>16;
+        uint source = key & 0xFFFF;
+        bool valid = (source < numValid);
+        if (valid && (localId == 0 || (localKeys[localId-1]>>16) != sortedDigit))
+            localStarts[sortedDigit] = localId;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        uint rank = localId-localStarts[sortedDigit];
+        bool isLast = valid && (localId == localSize-1 || (localKeys[localId+1]>>16) != sortedDigit || (localKeys[localId+1] & 0xFFFF) >= numValid);
+        localScan[source] = rank;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if (index < end)
+            dataOut[localOffsets[digit]+localScan[localId]] = value;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if (isLast)
+            localOffsets[sortedDigit] += rank+1;
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+}
@@ -0,0 +1,35 @@
+/**
+ * Compute the center of each molecule.  The atoms of molecule i are moleculeAtoms[moleculeStartIndex[i]]
+ * through moleculeAtoms[moleculeStartIndex[i+1]-1].
+ */
+__kernel void computeMoleculeCenters(int numMolecules, __global const int* restrict moleculeStartIndex, __global const int* restrict moleculeAtoms,
+        __global const real4* restrict posq, __global real4* restrict moleculeCenters) {
+    for (int i = get_global_id(0); i < numMolecules; i += get_global_size(0)) {
+        int start = moleculeStartIndex[i];
+        int end = moleculeStartIndex[i+1];
+        real4 center = (real4) 0;
+        for (int j = start; j < end; j++)
+            center += posq[moleculeAtoms[j]];
+        moleculeCenters[i] = center/(real) (end-start);
+    }
+}
+
+/**
+ * Copy each atom from its old index to its new one.  Element i of the output arrays receives
+ * element sourceIndex[i] of the input arrays.
+ */
+__kernel void applyAtomOrder(int numAtoms, __global const int* restrict sourceIndex, __global const real4* restrict posq, __global real4* restrict newPosq,
+        __global const mixed4* restrict velm, __global mixed4* restrict newVelm
+#ifdef USE_MIXED_PRECISION
+        , __global const real4* restrict posqCorrection, __global real4* restrict newPosqCorrection
+#endif
+        ) {
+    for (int i = get_global_id(0); i < numAtoms; i += get_global_size(0)) {
+        int source = sourceIndex[i];
+        newPosq[i] = posq[source];
+        newVelm[i] = velm[source];
+#ifdef USE_MIXED_PRECISION
+        newPosqCorrection[i] = posqCorrection[source];
+#endif
+    }
+}
@@ -0,0 +1,37 @@
+/**
+ * Record the positions of selected atoms into one frame of a trajectory buffer.  selection[i]
+ * is the position within the frame of the atom whose original index is i, or -1 if it is not
+ * recorded.  Without quantization, coordinates are stored as floats and periodic images are
+ * unwrapped using the cell offsets.  With quantization, each coordinate is stored as a 16 bit
+ * fraction of the corresponding box vector, which wraps it into the periodic box.
+ */
+__kernel void recordFrame(int numAtoms, int frame, int numSelected, __global const real4* restrict posq,
+        __global const int* restrict atomIndex, __global const int* restrict selection, __global const int4* restrict cellOffsets,
+#ifdef QUANTIZE
+        __global ushort* restrict frames,
+#else
+        __global float* restrict frames,
+#endif
+        real4 invPeriodicBoxSize, real4 periodicBoxVecX, real4 periodicBoxVecY, real4 periodicBoxVecZ) {
+    for (int i = get_global_id(0); i < numAtoms; i += get_global_size(0)) {
+        int index = selection[atomIndex[i]];
+        if (index == -1)
+            continue;
+        real4 pos = posq[i];
+        mm_ulong base = 3*((mm_ulong) frame*numSelected+index);
+#ifdef QUANTIZE
+        real fz = pos.z*invPeriodicBoxSize.z;
+        real fy = (pos.y-fz*periodicBoxVecZ.y)*invPeriodicBoxSize.y;
+        real fx = (pos.x-fy*periodicBoxVecY.x-fz*periodicBoxVecZ.x)*invPeriodicBoxSize.x;
+        frames[base] = (ushort) (((int) floor(fx*65536+0.5f)) & 0xFFFF);
+        frames[base+1] = (ushort) (((int) floor(fy*65536+0.5f)) & 0xFFFF);
+        frames[base+2] = (ushort) (((int) floor(fz*65536+0.5f)) & 0xFFFF);
+#else
+        int4 offset = cellOffsets[i];
+        pos.xyz -= offset.x*periodicBoxVecX.xyz + offset.y*periodicBoxVecY.xyz + offset.z*periodicBoxVecZ.xyz;
+        frames[base] = (float) pos.x;
+        frames[base+1] = (float) pos.y;
+        frames[base+2] = (float) pos.z;
+#endif
+    }
+}
@@ -16,53 +16,53 @@ __kernel void clearBuffer(__global int* restrict buffer, int size) {
 }
 
 /**
- * Fill two buffers with 0.
+ * Select one of the buffers passed to clearAutoclearBuffers().
  */
-__kernel void clearTwoBuffers(__global int* restrict buffer1, int size1, __global int* restrict buffer2, int size2) {
-    clearBuffer(buffer1, size1);
-    clearBuffer(buffer2, size2);
-}
-
-/**
- * Fill three buffers with 0.
- */
-__kernel void clearThreeBuffers(__global int* restrict buffer1, int size1, __global int* restrict buffer2, int size2, __global int* restrict buffer3, int size3) {
-    clearBuffer(buffer1, size1);
-    clearBuffer(buffer2, size2);
-    clearBuffer(buffer3, size3);
-}
-
-/**
- * Fill four buffers with 0.
- */
-__kernel void clearFourBuffers(__global int* restrict buffer1, int size1, __global int* restrict buffer2, int size2, __global int* restrict buffer3, int size3, __global int* restrict buffer4, int size4) {
-    clearBuffer(buffer1, size1);
-    clearBuffer(buffer2, size2);
-    clearBuffer(buffer3, size3);
-    clearBuffer(buffer4, size4);
-}
-
-/**
- * Fill five buffers with 0.
- */
-__kernel void clearFiveBuffers(__global int* restrict buffer1, int size1, __global int* restrict buffer2, int size2, __global int* restrict buffer3, int size3, __global int* restrict buffer4, int size4, __global int* restrict buffer5, int size5) {
-    clearBuffer(buffer1, size1);
-    clearBuffer(buffer2, size2);
-    clearBuffer(buffer3, size3);
-    clearBuffer(buffer4, size4);
-    clearBuffer(buffer5, size5);
+inline __global int* selectAutoclearBuffer(int index, __global int* restrict buffer0, __global int* restrict buffer1, __global int* restrict buffer2, __global int* restrict buffer3, __global int* restrict buffer4, __global int* restrict buffer5, __global int* restrict buffer6, __global int* restrict buffer7, __global int* restrict buffer8, __global int* restrict buffer9, __global int* restrict buffer10, __global int* restrict buffer11, __global int* restrict buffer12, __global int* restrict buffer13, __global int* restrict buffer14, __global int* restrict buffer15) {
+    switch (index) {
+        case 0: return buffer0;
+        case 1: return buffer1;
+        case 2: return buffer2;
+        case 3: return buffer3;
+        case 4: return buffer4;
+        case 5: return buffer5;
+        case 6: return buffer6;
+        case 7: return buffer7;
+        case 8: return buffer8;
+        case 9: return buffer9;
+        case 10: return buffer10;
+        case 11: return buffer11;
+        case 12: return buffer12;
+        case 13: return buffer13;
+        case 14: return buffer14;
+        default: return buffer15;
+    }
 }
 
 /**
- * Fill six buffers with 0.
+ * Fill up to 16 buffers with 0 in a single launch.  The buffers are treated as one combined range
+ * of int4 chunks, and each thread steps through it.  Buffer i covers chunks chunkStart[i] through
+ * chunkStart[i+1]-1 and holds bufferSize[i] ints.  The tables hold 17 and 16 entries for each
+ * group of buffers, so several launches can share them.  Arguments past numBuffers are never accessed.
  */
-__kernel void clearSixBuffers(__global int* restrict buffer1, int size1, __global int* restrict buffer2, int size2, __global int* restrict buffer3, int size3, __global int* restrict buffer4, int size4, __global int* restrict buffer5, int size5, __global int* restrict buffer6, int size6) {
-    clearBuffer(buffer1, size1);
-    clearBuffer(buffer2, size2);
-    clearBuffer(buffer3, size3);
-    clearBuffer(buffer4, size4);
-    clearBuffer(buffer5, size5);
-    clearBuffer(buffer6, size6);
+__kernel void clearAutoclearBuffers(__global const int* restrict chunkStart, __global const int* restrict bufferSize, int group, int numBuffers,
+        __global int* restrict buffer0, __global int* restrict buffer1, __global int* restrict buffer2, __global int* restrict buffer3, __global int* restrict buffer4, __global int* restrict buffer5, __global int* restrict buffer6, __global int* restrict buffer7, __global int* restrict buffer8, __global int* restrict buffer9, __global int* restrict buffer10, __global int* restrict buffer11, __global int* restrict buffer12, __global int* restrict buffer13, __global int* restrict buffer14, __global int* restrict buffer15) {
+    chunkStart += group*17;
+    bufferSize += group*16;
+    int totalChunks = chunkStart[numBuffers];
+    int current = 0;
+    for (int chunk = get_global_id(0); chunk < totalChunks; chunk += get_global_size(0)) {
+        while (chunk >= chunkStart[current+1])
+            current++;
+        __global int4* chunks = (__global int4*) selectAutoclearBuffer(current, buffer0, buffer1, buffer2, buffer3, buffer4, buffer5, buffer6, buffer7, buffer8, buffer9, buffer10, buffer11, buffer12, buffer13, buffer14, buffer15);
+        chunks[chunk-chunkStart[current]] = (int4) 0;
+    }
+    if (get_global_id(0) == 0)
+        for (int i = 0; i < numBuffers; i++) {
+            __global int* buffer = selectAutoclearBuffer(i, buffer0, buffer1, buffer2, buffer3, buffer4, buffer5, buffer6, buffer7, buffer8, buffer9, buffer10, buffer11, buffer12, buffer13, buffer14, buffer15);
+            for (int j = (bufferSize[i]/4)*4; j < bufferSize[i]; j++)
+                buffer[j] = 0;
+        }
 }
 
 /**
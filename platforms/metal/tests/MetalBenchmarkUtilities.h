@@ -0,0 +1,214 @@
+#ifndef OPENMM_METALBENCHMARKUTILITIES_H_
+#define OPENMM_METALBENCHMARKUTILITIES_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#include "MetalContext.h"
+#include "MetalPlatform.h"
+#include "MetalTestSystems.h"
+#include "openmm/OpenMMException.h"
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace OpenMM {
+
+/**
+ * The command line options of a benchmark.  Every benchmark accepts --output=file,
+ * --precision=single|mixed|double, --platform-index=n, and --device-index=n.  Options of its
+ * own are registered with addOption() before calling parse().
+ */
+class MetalBenchmarkOptions {
+public:
+    MetalBenchmarkOptions(const std::string& outputFile) : outputFile(outputFile), precision("single") {
+    }
+    void addOption(const std::string& name, int& value) {
+        intOptions[name] = &value;
+    }
+    void addOption(const std::string& name, double& value) {
+        doubleOptions[name] = &value;
+    }
+    void addOption(const std::string& name, std::string& value) {
+        stringOptions[name] = &value;
+    }
+    void parse(int argc, char* argv[]) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            size_t separator = arg.find('=');
+            std::string key = arg.substr(0, separator);
+            std::string value = (separator == std::string::npos ? "" : arg.substr(separator+1));
+            if (key == "--output")
+                outputFile = value;
+            else if (key == "--precision")
+                precision = value;
+            else if (key == "--platform-index")
+                platformIndex = value;
+            else if (key == "--device-index")
+                deviceIndex = value;
+            else if (intOptions.find(key) != intOptions.end())
+                *intOptions[key] = atoi(value.c_str());
+            else if (doubleOptions.find(key) != doubleOptions.end())
+                *doubleOptions[key] = atof(value.c_str());
+            else if (stringOptions.find(key) != stringOptions.end())
+                *stringOptions[key] = value;
+            else
+                throw OpenMMException("Unknown argument: "+arg);
+        }
+    }
+    /**
+     * Throw an exception if the value of an option is less than the minimum it allows.
+     */
+    static void checkAtLeast(const std::string& name, double value, double minimum) {
+        if (value < minimum) {
+            std::stringstream message;
+            message << "The value of " << name << " must be at least " << minimum;
+            throw OpenMMException(message.str());
+        }
+    }
+    /**
+     * Get the properties to create a Context with.
+     */
+    std::map<std::string, std::string> getProperties() const {
+        std::map<std::string, std::string> properties;
+        properties[MetalPlatform::MetalPrecision()] = precision;
+        if (platformIndex.size() > 0)
+            properties[MetalPlatform::MetalPlatformIndex()] = platformIndex;
+        if (deviceIndex.size() > 0)
+            properties[MetalPlatform::MetalDeviceIndex()] = deviceIndex;
+        return properties;
+    }
+    std::string outputFile, precision, platformIndex, deviceIndex;
+private:
+    std::map<std::string, int*> intOptions;
+    std::map<std::string, double*> doubleOptions;
+    std::map<std::string, std::string*> stringOptions;
+};
+
+/**
+ * Return the average wall clock time in microseconds of calling run() the given number of times.
+ * The queue is drained before starting the clock and after the last call, so work enqueued
+ * earlier is not counted and work enqueued by run() is.
+ */
+template <class F>
+double timeMicroseconds(MetalContext& cl, int repeats, F run) {
+    cl.getQueue().finish();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeats; i++)
+        run();
+    cl.getQueue().finish();
+    return 1e6*std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count()/repeats;
+}
+
+/**
+ * Take a number of steps to equilibrate and compile kernels, then return the average time in
+ * microseconds of each of the following steps.
+ */
+template <class T>
+double timeSteps(MetalContext& cl, T& integrator, int warmupSteps, int steps) {
+    integrator.step(warmupSteps);
+    return timeMicroseconds(cl, 1, [&] () {integrator.step(steps);})/steps;
+}
+
+/**
+ * Writes the results of a benchmark as a JSON object.  Values and nested objects and arrays are
+ * added in order.  Inside an array, objects are begun with an empty key.
+ */
+class MetalBenchmarkWriter {
+public:
+    MetalBenchmarkWriter(const std::string& file) : out(file.c_str()) {
+        if (!out.is_open())
+            throw OpenMMException("Could not open "+file+" for writing");
+        out << "{";
+        isFirst.push_back(true);
+    }
+    ~MetalBenchmarkWriter() {
+        close();
+    }
+    void add(const std::string& key, const std::string& value) {
+        beginValue(key);
+        out << "\"" << value << "\"";
+    }
+    void add(const std::string& key, const char* value) {
+        add(key, std::string(value));
+    }
+    template <class T>
+    void add(const std::string& key, T value) {
+        beginValue(key);
+        out << value;
+    }
+    void beginObject(const std::string& key = "") {
+        beginValue(key);
+        out << "{";
+        isFirst.push_back(true);
+    }
+    void endObject() {
+        end('}');
+    }
+    void beginArray(const std::string& key) {
+        beginValue(key);
+        out << "[";
+        isFirst.push_back(true);
+    }
+    void endArray() {
+        end(']');
+    }
+    /**
+     * Finish the outermost object and close the file.
+     */
+    void close() {
+        if (!out.is_open())
+            return;
+        while (!isFirst.empty())
+            end('}');
+        out << "\n";
+        out.close();
+    }
+private:
+    void beginValue(const std::string& key) {
+        out << (isFirst.back() ? "\n" : ",\n") << std::string(2*isFirst.size(), ' ');
+        isFirst.back() = false;
+        if (key.size() > 0)
+            out << "\"" << key << "\": ";
+    }
+    void end(char bracket) {
+        bool empty = isFirst.back();
+        isFirst.pop_back();
+        if (!empty)
+            out << "\n" << std::string(2*isFirst.size(), ' ');
+        out << bracket;
+    }
+    std::ofstream out;
+    std::vector<bool> isFirst;
+};
+
+} // namespace OpenMM
+
+#endif /*OPENMM_METALBENCHMARKUTILITIES_H_*/
@@ -0,0 +1,128 @@
+#ifndef OPENMM_METALTESTSYSTEMS_H_
+#define OPENMM_METALTESTSYSTEMS_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#include "openmm/HarmonicBondForce.h"
+#include "openmm/NonbondedForce.h"
+#include "openmm/System.h"
+#include "sfmt/SFMT.h"
+#include <vector>
+
+namespace OpenMM {
+
+/**
+ * Create positions on a cubic lattice, each displaced by a random amount of up to jitter/2 along
+ * each axis.  The sites fill the smallest cube of gridSize^3 sites that holds numSites of them,
+ * x varying fastest, and boxSize is set to gridSize*spacing.  The same seed is used every time,
+ * so the positions are reproducible.
+ */
+inline std::vector<Vec3> createJitteredLattice(int numSites, double spacing, double jitter, double& boxSize) {
+    int gridSize = 1;
+    while (gridSize*gridSize*gridSize < numSites)
+        gridSize++;
+    boxSize = gridSize*spacing;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    std::vector<Vec3> positions(numSites);
+    for (int i = 0; i < numSites; i++) {
+        int x = i%gridSize, y = (i/gridSize)%gridSize, z = i/(gridSize*gridSize);
+        Vec3 offset(genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5);
+        positions[i] = Vec3(x, y, z)*spacing+offset*jitter;
+    }
+    return positions;
+}
+
+/**
+ * Add a neutral box of particles with alternating charges on a jittered lattice, with PME, to an
+ * empty System.
+ */
+inline void createChargedBox(System& system, int numAtoms, double spacing, double cutoff, std::vector<Vec3>& positions) {
+    double boxSize;
+    positions = createJitteredLattice(numAtoms, spacing, 0.02, boxSize);
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::PME);
+    nonbonded->setCutoffDistance(cutoff);
+    for (int i = 0; i < numAtoms; i++) {
+        system.addParticle(16.0);
+        nonbonded->addParticle(i%2 == 0 ? 0.5 : -0.5, 0.3, 0.5);
+    }
+    system.addForce(nonbonded);
+}
+
+/**
+ * Add a neutral box of bonded, charged dimers centered on a jittered lattice, with PME, to an
+ * empty System.  Bonds and direct space are in force group 0, and PME reciprocal space is in
+ * force group 1.
+ */
+inline void createDimerBox(System& system, int numMolecules, double cutoff, std::vector<Vec3>& positions) {
+    double boxSize;
+    std::vector<Vec3> centers = createJitteredLattice(numMolecules, 0.44, 0.02, boxSize);
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::PME);
+    nonbonded->setCutoffDistance(cutoff);
+    nonbonded->setReciprocalSpaceForceGroup(1);
+    HarmonicBondForce* bonds = new HarmonicBondForce();
+    positions.clear();
+    for (int i = 0; i < numMolecules; i++) {
+        system.addParticle(16.0);
+        system.addParticle(16.0);
+        nonbonded->addParticle(0.4, 0.3, 0.5);
+        nonbonded->addParticle(-0.4, 0.3, 0.5);
+        nonbonded->addException(2*i, 2*i+1, 0.0, 1.0, 0.0);
+        bonds->addBond(2*i, 2*i+1, 0.15, 50000.0);
+        positions.push_back(centers[i]-Vec3(0.075, 0, 0));
+        positions.push_back(centers[i]+Vec3(0.075, 0, 0));
+    }
+    system.addForce(nonbonded);
+    system.addForce(bonds);
+}
+
+/**
+ * Add a dense box of uncharged Lennard-Jones particles on a jittered lattice to an empty System.
+ * With a long cutoff, nearly every pair of atom blocks interacts, so the first neighbor list
+ * overflows the initial guess at its size.
+ */
+inline void createLennardJonesBox(System& system, int numAtoms, double spacing, double cutoff, std::vector<Vec3>& positions) {
+    double boxSize;
+    positions = createJitteredLattice(numAtoms, spacing, 0.2*spacing, boxSize);
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::CutoffPeriodic);
+    nonbonded->setCutoffDistance(cutoff);
+    for (int i = 0; i < numAtoms; i++) {
+        system.addParticle(20.0);
+        nonbonded->addParticle(0.0, 0.15, 0.2);
+    }
+    system.addForce(nonbonded);
+}
+
+} // namespace OpenMM
+
+#endif /*OPENMM_METALTESTSYSTEMS_H_*/
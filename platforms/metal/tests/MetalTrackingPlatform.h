@@ -0,0 +1,59 @@
+#ifndef OPENMM_METALTRACKINGPLATFORM_H_
+#define OPENMM_METALTRACKINGPLATFORM_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#include "MetalContext.h"
+#include "MetalPlatform.h"
+#include "openmm/internal/ContextImpl.h"
+#include <map>
+#include <string>
+
+namespace OpenMM {
+
+/**
+ * A MetalPlatform that remembers the most recently created context, so tests and benchmarks
+ * can reach the MetalContext behind a Context.
+ */
+class MetalTrackingPlatform : public MetalPlatform {
+public:
+    MetalTrackingPlatform() : lastContext(NULL) {
+    }
+    void contextCreated(ContextImpl& context, const std::map<std::string, std::string>& properties) const {
+        MetalPlatform::contextCreated(context, properties);
+        lastContext = &context;
+    }
+    MetalContext& getMetalContext() const {
+        return *reinterpret_cast<MetalPlatform::PlatformData*>(lastContext->getPlatformData())->contexts[0];
+    }
+private:
+    mutable ContextImpl* lastContext;
+};
+
+} // namespace OpenMM
+
+#endif /*OPENMM_METALTRACKINGPLATFORM_H_*/
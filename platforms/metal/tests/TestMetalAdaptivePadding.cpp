@@ -0,0 +1,105 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests adjusting the neighbor list padding automatically.  Changing the padding recompiles
+ * the neighbor list kernels and rebuilds the list, after which the forces must still match a
+ * context whose padding is fixed.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "MetalContext.h"
+#include "MetalNonbondedUtilities.h"
+#include "MetalPlatform.h"
+#include "MetalTestSystems.h"
+#include "MetalTrackingPlatform.h"
+#include "openmm/Context.h"
+#include "openmm/VerletIntegrator.h"
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+static MetalTrackingPlatform platform;
+
+void compareForces(Context& fixed, Context& adaptive, int numParticles) {
+    State state = adaptive.getState(State::Positions | State::Forces | State::Energy);
+    fixed.setPositions(state.getPositions());
+    State expected = fixed.getState(State::Forces | State::Energy);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(expected.getForces()[i], state.getForces()[i], 1e-4);
+    ASSERT_EQUAL_TOL(expected.getPotentialEnergy(), state.getPotentialEnergy(), 1e-5);
+}
+
+void testPaddingChange() {
+    System system;
+    vector<Vec3> positions;
+    createChargedBox(system, 4096, 0.31, 0.9, positions);
+    VerletIntegrator integrator1(0.002), integrator2(0.002);
+    setenv("OPENMM_METAL_NEIGHBOR_LIST_PADDING", "0.1", 1);
+    Context fixed(system, integrator1, platform);
+    unsetenv("OPENMM_METAL_NEIGHBOR_LIST_PADDING");
+    Context adaptive(system, integrator2, platform);
+    MetalNonbondedUtilities& nb = platform.getMetalContext().getNonbondedUtilities();
+    ASSERT(nb.getUseAdaptivePadding());
+    adaptive.setPositions(positions);
+    adaptive.setVelocitiesToTemperature(300.0, 1);
+    compareForces(fixed, adaptive, system.getNumParticles());
+
+    // The padding is measured for a window of at most 2000 steps, after which it always moves
+    // to a level that has not been measured yet.
+
+    int generation = nb.getPaddingGeneration();
+    double padding = nb.getNeighborListPadding();
+    for (int step = 0; step < 2100 && nb.getPaddingGeneration() == generation; step += 50)
+        integrator2.step(50);
+    ASSERT(nb.getPaddingGeneration() != generation);
+    ASSERT(nb.getNeighborListPadding() != padding);
+
+    // Compare forces right after the change, and again once the list has been rebuilt with the
+    // new padding a few times.
+
+    compareForces(fixed, adaptive, system.getNumParticles());
+    integrator2.step(100);
+    compareForces(fixed, adaptive, system.getNumParticles());
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        if (argc > 1)
+            platform.setPropertyDefaultValue("MetalPrecision", string(argv[1]));
+        testPaddingChange();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
@@ -0,0 +1,108 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests building programs in the background.  Optimization flags requested by the caller
+ * must be used for the build, and a program that fails to build must be reported with the name
+ * of the kernel that needed it and the compiler's log.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "MetalArray.h"
+#include "MetalContext.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/System.h"
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+static MetalPlatform platform;
+
+void testAsyncCompilation() {
+    System system;
+    system.addParticle(1.0);
+    setenv("OPENMM_METAL_ASYNC_COMPILATION", "1", 1);
+    MetalPlatform::PlatformData platformData(system, "", "", platform.getPropertyDefaultValue("MetalPrecision"), "false", "false", 1, NULL);
+    unsetenv("OPENMM_METAL_ASYNC_COMPILATION");
+    MetalContext& context = *platformData.contexts[0];
+    context.initialize();
+
+    // A program built with the caller's flags should run normally.
+
+    string source = "__kernel void fill(__global int* restrict values, int value) {\n"
+                    "    values[get_global_id(0)] = value;\n"
+                    "}\n";
+    MetalArray values(context, 64, sizeof(int), "values");
+    ComputeProgram program = context.compileProgram(source, map<string, string>(), "");
+    ComputeKernel kernel = program->createKernel("fill");
+    kernel->addArg(values);
+    kernel->addArg(7);
+    kernel->execute(64);
+    vector<int> result;
+    values.download(result);
+    for (int value : result)
+        ASSERT_EQUAL(7, value);
+
+    // A program that does not compile is reported when its kernel is created or first run, along
+    // with the build log.
+
+    string broken = "__kernel void broken(__global int* restrict values) {\n"
+                    "    values[get_global_id(0)] = undefinedVariable;\n"
+                    "}\n";
+    ComputeProgram brokenProgram = context.compileProgram(broken);
+    bool threwException = false;
+    try {
+        ComputeKernel brokenKernel = brokenProgram->createKernel("broken");
+        brokenKernel->addArg(values);
+        brokenKernel->execute(64);
+    }
+    catch (OpenMMException& ex) {
+        string message = ex.what();
+        string prefix = "Error compiling the program for kernel broken: Error compiling kernel: ";
+        ASSERT(message.find(prefix) == 0);
+        ASSERT(message.size() > prefix.size());
+        threwException = true;
+    }
+    ASSERT(threwException);
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        if (argc > 1)
+            platform.setPropertyDefaultValue("MetalPrecision", string(argv[1]));
+        testAsyncCompilation();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
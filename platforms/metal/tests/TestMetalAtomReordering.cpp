@@ -0,0 +1,150 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests reordering atoms along space-filling curves.  BenchmarkMetalAtomReordering measures
+ * how each order affects the neighbor list and the time taken by the nonbonded kernel.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "MetalArray.h"
+#include "MetalContext.h"
+#include "MetalNonbondedUtilities.h"
+#include "sfmt/SFMT.h"
+#include "openmm/System.h"
+#include <cmath>
+#include <iostream>
+#include <set>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+static MetalPlatform platform;
+
+/**
+ * Compute the number of pairs found by an interaction that counts them.  The first evaluation
+ * may enlarge the neighbor list, so evaluate it twice.
+ */
+long long countPairs(MetalContext& context) {
+    MetalNonbondedUtilities& nb = context.getNonbondedUtilities();
+    double pairs;
+    for (int i = 0; i < 2; i++) {
+        context.clearAutoclearBuffers();
+        nb.prepareInteractions(1);
+        nb.computeInteractions(1, false, true);
+        pairs = context.reduceEnergy();
+    }
+    return llround(pairs);
+}
+
+void testAtomOrder(int numAtoms) {
+    // Place atoms randomly in a box at roughly the density of water.
+
+    const double cutoff = 1.0;
+    const double width = pow(numAtoms/100.0, 1.0/3.0);
+    System system;
+    for (int i = 0; i < numAtoms; i++)
+        system.addParticle(1.0);
+    system.setDefaultPeriodicBoxVectors(Vec3(width, 0, 0), Vec3(0, width, 0), Vec3(0, 0, width));
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions(numAtoms);
+    for (int i = 0; i < numAtoms; i++)
+        positions[i] = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*width;
+
+    // Count the pairs within the cutoff.  The device works in single precision, so pairs very
+    // close to the cutoff may be counted either way.
+
+    long long minPairs = 0, maxPairs = 0;
+    for (int i = 0; i < numAtoms; i++)
+        for (int j = 0; j < i; j++) {
+            Vec3 delta = positions[i]-positions[j];
+            for (int k = 0; k < 3; k++)
+                delta[k] -= width*floor(delta[k]/width+0.5);
+            double r2 = delta.dot(delta);
+            if (r2 < cutoff*cutoff*(1-1e-5))
+                minPairs++;
+            if (r2 < cutoff*cutoff*(1+1e-5))
+                maxPairs++;
+        }
+
+    // Create a context with an interaction that counts pairs.
+
+    MetalPlatform::PlatformData platformData(system, "", "", platform.getPropertyDefaultValue("MetalPrecision"), "false", "false", 1, NULL);
+    MetalContext& context = *platformData.contexts[0];
+    context.setPeriodicBoxVectors(Vec3(width, 0, 0), Vec3(0, width, 0), Vec3(0, 0, width));
+    vector<vector<int> > exclusions(numAtoms);
+    for (int i = 0; i < numAtoms; i++)
+        exclusions[i].push_back(i);
+    string source = "tempEnergy += (!isExcluded && r2 < MAX_CUTOFF*MAX_CUTOFF ? 1.0f : 0.0f);\n";
+    context.getNonbondedUtilities().addInteraction(true, true, true, cutoff, exclusions, source, 0, true);
+    context.initialize();
+    vector<mm_float4> posq(context.getPaddedNumAtoms(), mm_float4(0, 0, 0, 0));
+    for (int i = 0; i < numAtoms; i++)
+        posq[i] = mm_float4((float) positions[i][0], (float) positions[i][1], (float) positions[i][2], 0);
+    context.getPosq().upload(posq);
+
+    // Compare the original random order to each way of reordering the atoms.
+
+    const MetalContext::AtomOrder orders[] = {MetalContext::MoleculeOrder, MetalContext::MoleculeOrder, MetalContext::HilbertOrder, MetalContext::MortonOrder};
+    for (int i = 0; i < 4; i++) {
+        if (i > 0) {
+            context.setAtomOrder(orders[i]);
+            context.forceReorder();
+            context.reorderAtoms();
+        }
+        long long pairs = countPairs(context);
+        ASSERT(pairs >= minPairs && pairs <= maxPairs);
+
+        // Every atom should still be present, and at its original position.
+
+        const vector<int>& order = context.getAtomIndex();
+        context.getPosq().download(posq);
+        set<int> seen;
+        for (int j = 0; j < numAtoms; j++) {
+            int atom = order[j];
+            ASSERT(atom >= 0 && atom < numAtoms);
+            seen.insert(atom);
+            ASSERT_EQUAL_VEC(positions[atom], Vec3(posq[j].x, posq[j].y, posq[j].z), 1e-5);
+        }
+        ASSERT_EQUAL(numAtoms, seen.size());
+    }
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        if (argc > 1)
+            platform.setPropertyDefaultValue("MetalPrecision", string(argv[1]));
+        testAtomOrder(3000);
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
@@ -0,0 +1,112 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests clearing the buffers registered with addAutoclearBuffer().
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "MetalArray.h"
+#include "MetalContext.h"
+#include "openmm/System.h"
+#include <iostream>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+static MetalPlatform platform;
+
+void fillArray(MetalArray& array, int value) {
+    vector<cl_int> values(array.getSize(), value);
+    array.upload(values);
+}
+
+void checkArray(MetalArray& array, int value) {
+    vector<cl_int> values;
+    array.download(values);
+    for (int i = 0; i < values.size(); i++)
+        ASSERT_EQUAL(value, values[i]);
+}
+
+void testClearBuffers() {
+    System system;
+    system.addParticle(1.0);
+    MetalPlatform::PlatformData platformData(system, "", "", platform.getPropertyDefaultValue("MetalPrecision"), "false", "false", 1, NULL);
+    MetalContext& context = *platformData.contexts[0];
+    context.initialize();
+
+    // Register more buffers than one kernel launch handles, with sizes that are not multiples of 4.
+
+    const int numArrays = 37;
+    vector<MetalArray*> arrays;
+    for (int i = 0; i < numArrays; i++) {
+        int size = 1+(i*i*37)%1001;
+        arrays.push_back(new MetalArray(context, size, sizeof(cl_int), "array"));
+        fillArray(*arrays[i], i+1);
+        context.addAutoclearBuffer(*arrays[i]);
+    }
+    MetalArray unregistered(context, 100, sizeof(cl_int), "unregistered");
+    fillArray(unregistered, 5);
+    context.clearAutoclearBuffers();
+    for (int i = 0; i < numArrays; i++)
+        checkArray(*arrays[i], 0);
+    checkArray(unregistered, 5);
+
+    // Clearing again should reuse the same table.
+
+    for (int i = 0; i < numArrays; i++)
+        fillArray(*arrays[i], 7);
+    context.clearAutoclearBuffers();
+    for (int i = 0; i < numArrays; i++)
+        checkArray(*arrays[i], 0);
+
+    // Adding a buffer should rebuild it.
+
+    context.addAutoclearBuffer(unregistered);
+    for (int i = 0; i < numArrays; i++)
+        fillArray(*arrays[i], 3);
+    context.clearAutoclearBuffers();
+    for (int i = 0; i < numArrays; i++)
+        checkArray(*arrays[i], 0);
+    checkArray(unregistered, 0);
+    for (auto array : arrays)
+        delete array;
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        if (argc > 1)
+            platform.setPropertyDefaultValue("MetalPrecision", string(argv[1]));
+        testClearBuffers();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
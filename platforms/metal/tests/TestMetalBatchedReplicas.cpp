@@ -0,0 +1,234 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests batching several replicas of a system in one context.
+ */
+
+#include "MetalTests.h"
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/CMMotionRemover.h"
+#include "openmm/Context.h"
+#include "openmm/CustomNonbondedForce.h"
+#include "openmm/HarmonicBondForce.h"
+#include "openmm/MonteCarloBarostat.h"
+#include "openmm/NonbondedForce.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "sfmt/SFMT.h"
+#include <iostream>
+#include <map>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+const int NumMolecules = 32;
+const int ReplicaSize = 2*NumMolecules;
+const double BoxSize = 3.0;
+
+/**
+ * Create a System containing several replicas of a box of diatomic molecules.  Alternate
+ * replicas have different charges, so some replicas are identical and others are not.
+ */
+System* createSystem(int numReplicas, NonbondedForce::NonbondedMethod method) {
+    System* system = new System();
+    system->setDefaultPeriodicBoxVectors(Vec3(BoxSize, 0, 0), Vec3(0, BoxSize, 0), Vec3(0, 0, BoxSize));
+    HarmonicBondForce* bonds = new HarmonicBondForce();
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(method);
+    nonbonded->setCutoffDistance(1.0);
+    system->addForce(bonds);
+    system->addForce(nonbonded);
+    for (int replica = 0; replica < numReplicas; replica++) {
+        double charge = (replica%2 == 0 ? 0.2 : 0.25);
+        for (int i = 0; i < NumMolecules; i++) {
+            int first = system->getNumParticles();
+            system->addParticle(10.0);
+            system->addParticle(10.0);
+            nonbonded->addParticle(charge, 0.2, 0.5);
+            nonbonded->addParticle(-charge, 0.2, 0.5);
+            nonbonded->addException(first, first+1, 0.0, 1.0, 0.0);
+            bonds->addBond(first, first+1, 0.1, 10000.0);
+        }
+    }
+    return system;
+}
+
+/**
+ * Create positions for one replica, with the molecules on a jittered grid.
+ */
+vector<Vec3> createPositions(OpenMM_SFMT::SFMT& sfmt) {
+    vector<Vec3> positions;
+    for (int i = 0; i < NumMolecules; i++) {
+        Vec3 pos = Vec3(i%4, (i/4)%4, i/16)*(BoxSize/4);
+        pos += Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*0.2;
+        positions.push_back(pos);
+        positions.push_back(pos+Vec3(0.1, 0, 0));
+    }
+    return positions;
+}
+
+/**
+ * Check that the energy and forces of a batched context match those of each replica computed separately.
+ */
+void compareToSeparateReplicas(Context& batched, int numReplicas, NonbondedForce::NonbondedMethod method) {
+    State batchedState = batched.getState(State::Positions | State::Forces | State::Energy);
+    double expectedEnergy = 0.0;
+    for (int replica = 0; replica < numReplicas; replica++) {
+        System* system = createSystem(numReplicas, method);
+
+        // Build a System containing only this replica.
+
+        System single;
+        single.setDefaultPeriodicBoxVectors(Vec3(BoxSize, 0, 0), Vec3(0, BoxSize, 0), Vec3(0, 0, BoxSize));
+        HarmonicBondForce* bonds = new HarmonicBondForce();
+        NonbondedForce* nonbonded = new NonbondedForce();
+        NonbondedForce* original = dynamic_cast<NonbondedForce*>(&system->getForce(1));
+        nonbonded->setNonbondedMethod(method);
+        nonbonded->setCutoffDistance(1.0);
+        single.addForce(bonds);
+        single.addForce(nonbonded);
+        vector<Vec3> positions;
+        for (int i = 0; i < ReplicaSize; i++) {
+            int index = replica*ReplicaSize+i;
+            double charge, sigma, epsilon;
+            original->getParticleParameters(index, charge, sigma, epsilon);
+            single.addParticle(10.0);
+            nonbonded->addParticle(charge, sigma, epsilon);
+            positions.push_back(batchedState.getPositions()[index]);
+        }
+        for (int i = 0; i < NumMolecules; i++) {
+            nonbonded->addException(2*i, 2*i+1, 0.0, 1.0, 0.0);
+            bonds->addBond(2*i, 2*i+1, 0.1, 10000.0);
+        }
+        delete system;
+        VerletIntegrator integrator(0.001);
+        Context context(single, integrator, platform);
+        context.setPositions(positions);
+        State state = context.getState(State::Forces | State::Energy);
+        expectedEnergy += state.getPotentialEnergy();
+        for (int i = 0; i < ReplicaSize; i++)
+            ASSERT_EQUAL_VEC(state.getForces()[i], batchedState.getForces()[replica*ReplicaSize+i], 1e-4);
+    }
+    ASSERT_EQUAL_TOL(expectedEnergy, batchedState.getPotentialEnergy(), 1e-4);
+}
+
+void testBatchedForces(NonbondedForce::NonbondedMethod method) {
+    const int numReplicas = 3;
+    System* system = createSystem(numReplicas, method);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions;
+    for (int replica = 0; replica < numReplicas; replica++) {
+        vector<Vec3> replicaPositions = createPositions(sfmt);
+        positions.insert(positions.end(), replicaPositions.begin(), replicaPositions.end());
+    }
+    map<string, string> properties;
+    properties[MetalPlatform::MetalReplicas()] = "3";
+    VerletIntegrator integrator(0.001);
+    Context context(*system, integrator, platform, properties);
+    ASSERT_EQUAL("3", platform.getPropertyValue(context, MetalPlatform::MetalReplicas()));
+    context.setPositions(positions);
+    compareToSeparateReplicas(context, numReplicas, method);
+
+    // Run long enough for the atoms to be reordered, which must not move molecules between replicas.
+
+    integrator.step(300);
+    compareToSeparateReplicas(context, numReplicas, method);
+    delete system;
+}
+
+void testInvalidReplicas() {
+    // Each replica must be a whole number of blocks.
+
+    System system;
+    for (int i = 0; i < 96; i++)
+        system.addParticle(1.0);
+    map<string, string> properties;
+    properties[MetalPlatform::MetalReplicas()] = "2";
+    VerletIntegrator integrator(0.001);
+    bool threwException = false;
+    try {
+        Context context(system, integrator, platform, properties);
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+}
+
+/**
+ * Check that creating a batched context fails once a force that computes a quantity for the whole
+ * System is added.
+ */
+void assertRejected(Force* force) {
+    System* system = createSystem(2, NonbondedForce::CutoffPeriodic);
+    system->addForce(force);
+    map<string, string> properties;
+    properties[MetalPlatform::MetalReplicas()] = "2";
+    VerletIntegrator integrator(0.001);
+    bool threwException = false;
+    try {
+        Context context(*system, integrator, platform, properties);
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+    delete system;
+}
+
+void testSystemWideForces() {
+    CustomNonbondedForce* custom = new CustomNonbondedForce("r");
+    custom->setNonbondedMethod(CustomNonbondedForce::CutoffPeriodic);
+    custom->setCutoffDistance(1.0);
+    custom->setUseLongRangeCorrection(true);
+    for (int i = 0; i < 2*ReplicaSize; i++)
+        custom->addParticle();
+    for (int i = 0; i < 2*NumMolecules; i++)
+        custom->addExclusion(2*i, 2*i+1);
+    assertRejected(custom);
+    assertRejected(new CMMotionRemover());
+    assertRejected(new MonteCarloBarostat(1.0, 300.0));
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        initializeTests(argc, argv);
+        testBatchedForces(NonbondedForce::NoCutoff);
+        testBatchedForces(NonbondedForce::CutoffNonPeriodic);
+        testBatchedForces(NonbondedForce::CutoffPeriodic);
+        testInvalidReplicas();
+        testSystemWideForces();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
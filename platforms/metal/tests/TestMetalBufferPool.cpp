@@ -0,0 +1,117 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests the pool that MetalArrays allocate device memory from.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "MetalArray.h"
+#include "MetalBufferPool.h"
+#include "MetalContext.h"
+#include "openmm/System.h"
+#include <iostream>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+static MetalPlatform platform;
+
+void testSizeClasses() {
+    ASSERT_EQUAL(256, MetalBufferPool::getSizeClass(1));
+    ASSERT_EQUAL(256, MetalBufferPool::getSizeClass(256));
+    ASSERT_EQUAL(512, MetalBufferPool::getSizeClass(257));
+    ASSERT_EQUAL(4096, MetalBufferPool::getSizeClass(4096));
+    for (size_t bytes = 4097; bytes < 100000000; bytes = bytes*3/2) {
+        size_t size = MetalBufferPool::getSizeClass(bytes);
+        ASSERT(size >= bytes);
+        ASSERT(size <= bytes+bytes/8);
+        ASSERT_EQUAL(size, MetalBufferPool::getSizeClass(size));
+    }
+}
+
+void testRecycling() {
+    System system;
+    system.addParticle(0.0);
+    MetalPlatform::PlatformData platformData(system, "", "", platform.getPropertyDefaultValue("MetalPrecision"), "false", "false", 1, NULL);
+    MetalContext& context = *platformData.contexts[0];
+    context.initialize();
+    MetalBufferPool& pool = context.getBufferPool();
+    pool.setEnabled(true);
+    size_t initialBytes = pool.getLiveBytes();
+
+    // Creating an array should increase the number of live bytes, and deleting it should
+    // return them to the pool.
+
+    MetalArray* array = MetalArray::create<float>(context, 10000, "array1");
+    size_t arrayBytes = MetalBufferPool::getSizeClass(10000*sizeof(float));
+    ASSERT_EQUAL(initialBytes+arrayBytes, pool.getLiveBytes());
+    delete array;
+    ASSERT_EQUAL(initialBytes, pool.getLiveBytes());
+    ASSERT(pool.getCachedBytes() >= arrayBytes);
+
+    // An array of a similar size should reuse the same buffer.
+
+    long long driverAllocations = pool.getNumDriverAllocations();
+    long long recycledAllocations = pool.getNumRecycledAllocations();
+    MetalArray array2(context, 9990, sizeof(float), "array2");
+    ASSERT_EQUAL(driverAllocations, pool.getNumDriverAllocations());
+    ASSERT_EQUAL(recycledAllocations+1, pool.getNumRecycledAllocations());
+
+    // A recycled buffer must behave like a new one.
+
+    vector<float> data(array2.getSize()), result;
+    for (int i = 0; i < data.size(); i++)
+        data[i] = i;
+    array2.upload(data);
+    array2.download(result);
+    for (int i = 0; i < data.size(); i++)
+        ASSERT_EQUAL(data[i], result[i]);
+
+    // Resizing should release the old storage and track the peak.
+
+    array2.resize(50000);
+    ASSERT_EQUAL(initialBytes+MetalBufferPool::getSizeClass(50000*sizeof(float)), pool.getLiveBytes());
+    ASSERT(pool.getPeakLiveBytes() >= pool.getLiveBytes());
+    pool.trim();
+    ASSERT_EQUAL(0, pool.getCachedBytes());
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        if (argc > 1)
+            platform.setPropertyDefaultValue("MetalPrecision", string(argv[1]));
+        testSizeClasses();
+        testRecycling();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
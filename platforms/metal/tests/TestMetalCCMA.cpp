@@ -0,0 +1,125 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "MetalIntegrationUtilities.h"
+#include "MetalTrackingPlatform.h"
+#include "openmm/Context.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "sfmt/SFMT.h"
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+static MetalTrackingPlatform platform;
+
+/**
+ * Create a chain with enough coupled constraints that CCMA uses multiple kernels.
+ */
+System* createChain(int length, vector<Vec3>& positions) {
+    System* system = new System();
+    for (int i = 0; i < length; i++) {
+        system->addParticle(i%2 == 0 ? 12.0 : 1.008);
+        positions.push_back(Vec3(0.1*i, 0.05*(i%2), 0.0));
+        if (i > 0)
+            system->addConstraint(i-1, i, 0.1);
+    }
+    return system;
+}
+
+void checkConstraints(const System& system, const vector<Vec3>& positions, const vector<Vec3>& velocities, double tol) {
+    for (int i = 0; i < system.getNumConstraints(); i++) {
+        int atom1, atom2;
+        double distance;
+        system.getConstraintParameters(i, atom1, atom2, distance);
+        Vec3 delta = positions[atom2]-positions[atom1];
+        ASSERT_EQUAL_TOL(distance, sqrt(delta.dot(delta)), tol);
+        Vec3 relativeVelocity = velocities[atom2]-velocities[atom1];
+        ASSERT(fabs(relativeVelocity.dot(delta)) < 10*tol);
+    }
+}
+
+void testConvergence(const string& mode, bool suddenChange) {
+    setenv("OPENMM_METAL_CCMA_DEVICE_CONVERGENCE", mode.c_str(), 1);
+    vector<Vec3> positions;
+    System* system = createChain(1500, positions);
+    VerletIntegrator integrator(0.001);
+    Context context(*system, integrator, platform);
+    MetalIntegrationUtilities& integration = platform.getMetalContext().getIntegrationUtilities();
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+
+    // Apply constraints many times to perturbed positions and velocities.  In the device modes,
+    // the number of iterations enqueued adapts to recent calls.  If suddenChange is true, one
+    // call needs many more iterations than the ones before it, which the asynchronous mode
+    // cannot detect in time.  It must then report the failure instead of accepting the result
+    // silently.
+
+    int lastFailures = 0;
+    for (int repeat = 0; repeat < 20; repeat++) {
+        vector<Vec3> perturbed(positions.size()), velocities(positions.size());
+        double scale = (suddenChange && repeat == 15 ? 0.02 : 0.002);
+        for (int i = 0; i < positions.size(); i++) {
+            perturbed[i] = positions[i]+Vec3(genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5)*scale;
+            velocities[i] = Vec3(genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5);
+        }
+        context.setPositions(perturbed);
+        context.setVelocities(velocities);
+        context.applyConstraints(1e-5);
+        context.applyVelocityConstraints(1e-5);
+        State state = context.getState(State::Positions | State::Velocities);
+        int failures = integration.getNumCcmaConvergenceFailures();
+        if (mode != "2")
+            ASSERT_EQUAL(0, failures);
+        if (failures == lastFailures)
+            checkConstraints(*system, state.getPositions(), state.getVelocities(), 1e-4);
+        lastFailures = failures;
+    }
+    delete system;
+    unsetenv("OPENMM_METAL_CCMA_DEVICE_CONVERGENCE");
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        if (argc > 1)
+            platform.setPropertyDefaultValue("MetalPrecision", string(argv[1]));
+        testConvergence("0", true);
+        testConvergence("1", true);
+        testConvergence("2", false);
+        testConvergence("2", true);
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
@@ -31,6 +31,9 @@
 
 #include "MetalTests.h"
 #include "TestCheckpoints.h"
+#include "MetalCheckpoint.h"
+#include <cstdlib>
+#include <cstring>
 
 void testCheckpoint() {
     const int numParticles = 100;
@@ -134,6 +137,157 @@ void testCheckpoint() {
     compareStates(s1, s9);
 }
 
+void testEncoding() {
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int wordSize : {4, 8}) {
+        const int numElements = 1001;
+        const int elementSize = 4*wordSize;
+        vector<char> data(numElements*elementSize), reference(data.size()), decoded(data.size());
+        for (int i = 0; i < numElements*4; i++) {
+            if (wordSize == 4) {
+                float value = (float) (i/4+genrand_real2(sfmt));
+                float refValue = value+(float) (0.001*genrand_real2(sfmt));
+                memcpy(&data[i*wordSize], &value, wordSize);
+                memcpy(&reference[i*wordSize], &refValue, wordSize);
+            }
+            else {
+                double value = i/4+genrand_real2(sfmt);
+                double refValue = value+0.001*genrand_real2(sfmt);
+                memcpy(&data[i*wordSize], &value, wordSize);
+                memcpy(&reference[i*wordSize], &refValue, wordSize);
+            }
+        }
+
+        // Both kinds of reference should reproduce the data exactly.
+
+        vector<char> encoded;
+        MetalCheckpoint::encodeXor(&data[0], NULL, data.size(), wordSize, elementSize, encoded);
+        MetalCheckpoint::decodeXor(&encoded[0], encoded.size(), NULL, data.size(), wordSize, elementSize, &decoded[0]);
+        ASSERT(data == decoded);
+        encoded.clear();
+        MetalCheckpoint::encodeXor(&data[0], &reference[0], data.size(), wordSize, elementSize, encoded);
+        MetalCheckpoint::decodeXor(&encoded[0], encoded.size(), &reference[0], data.size(), wordSize, elementSize, &decoded[0]);
+        ASSERT(data == decoded);
+
+        // Data that matches the reference should take one byte per pair of words.
+
+        encoded.clear();
+        MetalCheckpoint::encodeXor(&data[0], &data[0], data.size(), wordSize, elementSize, encoded);
+        ASSERT_EQUAL(numElements*2, encoded.size());
+    }
+}
+
+System* createSystem(vector<Vec3>& positions) {
+    const int numParticles = 100;
+    const double boxSize = 5.0;
+    System* system = new System();
+    system->setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    system->addForce(nonbonded);
+    nonbonded->setNonbondedMethod(NonbondedForce::CutoffPeriodic);
+    positions.resize(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system->addParticle(1.0);
+        nonbonded->addParticle(i%2 == 0 ? 0.1 : -0.1, 0.2, 0.1);
+        positions[i] = Vec3(0.5*(i%10), 0.5*((i/10)%10), 0.5*boxSize*(i%3)/3.0);
+    }
+    return system;
+}
+
+void testIncrementalCheckpoints() {
+    vector<Vec3> positions;
+    System* system = createSystem(positions);
+    setenv("OPENMM_METAL_INCREMENTAL_CHECKPOINTS", "2", 1);
+    VerletIntegrator integrator(0.001);
+    Context context(*system, integrator, platform);
+    unsetenv("OPENMM_METAL_INCREMENTAL_CHECKPOINTS");
+    context.setPositions(positions);
+    context.setVelocitiesToTemperature(300.0);
+
+    // Create a full checkpoint, followed by two incremental ones.
+
+    vector<stringstream*> streams;
+    vector<State> states;
+    for (int i = 0; i < 4; i++) {
+        integrator.step(10);
+        states.push_back(context.getState(State::Positions | State::Velocities | State::Parameters));
+        streams.push_back(new stringstream(ios_base::out | ios_base::in | ios_base::binary));
+        context.createCheckpoint(*streams[i]);
+    }
+
+    // An incremental checkpoint cannot be loaded without its base.
+
+    VerletIntegrator integrator2(0.001);
+    Context context2(*system, integrator2, platform);
+    bool threwException = false;
+    try {
+        context2.loadCheckpoint(*streams[2]);
+    }
+    catch (OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+
+    // After loading the base, every incremental checkpoint can be loaded in any order.
+
+    streams[0]->seekg(0, streams[0]->beg);
+    context2.loadCheckpoint(*streams[0]);
+    State loaded1 = context2.getState(State::Positions | State::Velocities | State::Parameters);
+    compareStates(states[0], loaded1);
+    streams[2]->seekg(0, streams[2]->beg);
+    context2.loadCheckpoint(*streams[2]);
+    State loaded2 = context2.getState(State::Positions | State::Velocities | State::Parameters);
+    compareStates(states[2], loaded2);
+    streams[1]->seekg(0, streams[1]->beg);
+    context2.loadCheckpoint(*streams[1]);
+    State loaded3 = context2.getState(State::Positions | State::Velocities | State::Parameters);
+    compareStates(states[1], loaded3);
+
+    // The fourth checkpoint is a full one, so it can be loaded into a new Context.
+
+    VerletIntegrator integrator3(0.001);
+    Context context3(*system, integrator3, platform);
+    streams[3]->seekg(0, streams[3]->beg);
+    context3.loadCheckpoint(*streams[3]);
+    State loaded4 = context3.getState(State::Positions | State::Velocities | State::Parameters);
+    compareStates(states[3], loaded4);
+    for (stringstream* stream : streams)
+        delete stream;
+    delete system;
+}
+
+void testVersion3Checkpoint() {
+    vector<Vec3> positions;
+    System* system = createSystem(positions);
+    setenv("OPENMM_METAL_CHECKPOINT_FORMAT", "3", 1);
+    VerletIntegrator integrator(0.001);
+    Context context(*system, integrator, platform);
+    unsetenv("OPENMM_METAL_CHECKPOINT_FORMAT");
+    context.setPositions(positions);
+    context.setVelocitiesToTemperature(300.0);
+    integrator.step(10);
+    State s1 = context.getState(State::Positions | State::Velocities | State::Parameters);
+    stringstream stream(ios_base::out | ios_base::in | ios_base::binary);
+    context.createCheckpoint(stream);
+    int version;
+    stream.read((char*) &version, sizeof(int));
+    ASSERT_EQUAL(3, version);
+
+    // A Context that writes the current format should still load the old one.
+
+    VerletIntegrator integrator2(0.001);
+    Context context2(*system, integrator2, platform);
+    stream.seekg(0, stream.beg);
+    context2.loadCheckpoint(stream);
+    State s2 = context2.getState(State::Positions | State::Velocities | State::Parameters);
+    compareStates(s1, s2);
+    delete system;
+}
+
 void runPlatformTests() {
     testCheckpoint();
+    testEncoding();
+    testIncrementalCheckpoints();
+    testVersion3Checkpoint();
 }
@@ -0,0 +1,163 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "MetalPlatform.h"
+#include "MetalTestSystems.h"
+#include "openmm/Context.h"
+#include "openmm/NonbondedForce.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+static MetalPlatform platform;
+
+const double sigmas[] = {0.25, 0.3, 0.34, 0.37};
+const double epsilons[] = {0.2, 0.5, 0.9, 1.3};
+
+void createSystem(System& system, NonbondedForce*& nonbonded, vector<Vec3>& positions) {
+    const int numAtoms = 729;
+    double boxSize;
+    positions = createJitteredLattice(numAtoms, 0.4, 0.05, boxSize);
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::PME);
+    nonbonded->setCutoffDistance(1.0);
+    nonbonded->setUseSwitchingFunction(true);
+    nonbonded->setSwitchingDistance(0.9);
+    for (int i = 0; i < numAtoms; i++) {
+        int type = i%4;
+        system.addParticle(40.0);
+        nonbonded->addParticle(i%2 == 0 ? 0.3 : -0.3, sigmas[type], epsilons[type]);
+    }
+    system.addForce(nonbonded);
+}
+
+void setCompressedParameters(bool compressed) {
+    setenv("OPENMM_METAL_COMPRESSED_PARAMETERS", compressed ? "1" : "0", 1);
+}
+
+void testAccuracy() {
+    // Half precision sigma and epsilon should change the forces and energy only slightly.
+
+    System system;
+    NonbondedForce* nonbonded;
+    vector<Vec3> positions;
+    createSystem(system, nonbonded, positions);
+    VerletIntegrator integrator1(0.001), integrator2(0.001);
+    setCompressedParameters(false);
+    Context context1(system, integrator1, platform);
+    setCompressedParameters(true);
+    Context context2(system, integrator2, platform);
+    unsetenv("OPENMM_METAL_COMPRESSED_PARAMETERS");
+    context1.setPositions(positions);
+    context2.setPositions(positions);
+    State state1 = context1.getState(State::Forces | State::Energy);
+    State state2 = context2.getState(State::Forces | State::Energy);
+    ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-2);
+    double norm = 0, diff = 0;
+    for (int i = 0; i < system.getNumParticles(); i++) {
+        Vec3 f1 = state1.getForces()[i];
+        Vec3 delta = f1-state2.getForces()[i];
+        norm += f1.dot(f1);
+        diff += delta.dot(delta);
+    }
+    ASSERT(diff < 1e-4*norm);
+
+    // Changing a parameter must update the half precision copy too.
+
+    nonbonded->setParticleParameters(10, 0.3, 0.28, 0.7);
+    nonbonded->updateParametersInContext(context2);
+    VerletIntegrator integrator3(0.001);
+    setCompressedParameters(true);
+    Context context3(system, integrator3, platform);
+    unsetenv("OPENMM_METAL_COMPRESSED_PARAMETERS");
+    context3.setPositions(positions);
+    ASSERT_EQUAL_TOL(context3.getState(State::Energy).getPotentialEnergy(), context2.getState(State::Energy).getPotentialEnergy(), 1e-5);
+}
+
+double computeEnergyDrift(bool compressed, double& kineticEnergy) {
+    // Run constant energy dynamics and return the slope of a linear fit to the total energy.
+
+    System system;
+    NonbondedForce* nonbonded;
+    vector<Vec3> positions;
+    createSystem(system, nonbonded, positions);
+    VerletIntegrator integrator(0.002);
+    setCompressedParameters(compressed);
+    Context context(system, integrator, platform);
+    unsetenv("OPENMM_METAL_COMPRESSED_PARAMETERS");
+    context.setPositions(positions);
+    context.setVelocitiesToTemperature(100.0, 1);
+    integrator.step(500);
+    const int numSamples = 100;
+    double sumT = 0, sumE = 0, sumTT = 0, sumTE = 0;
+    kineticEnergy = 0;
+    for (int i = 0; i < numSamples; i++) {
+        integrator.step(20);
+        State state = context.getState(State::Energy);
+        double t = state.getTime();
+        double energy = state.getPotentialEnergy()+state.getKineticEnergy();
+        sumT += t;
+        sumE += energy;
+        sumTT += t*t;
+        sumTE += t*energy;
+        kineticEnergy += state.getKineticEnergy()/numSamples;
+    }
+    return (numSamples*sumTE-sumT*sumE)/(numSamples*sumTT-sumT*sumT);
+}
+
+void testEnergyDrift() {
+    // Compressed storage leaves the potential conservative, so the energy should drift no
+    // more than it does with full precision storage.
+
+    double kinetic1, kinetic2;
+    double drift1 = computeEnergyDrift(false, kinetic1);
+    double drift2 = computeEnergyDrift(true, kinetic2);
+    const double duration = 4.0;
+    ASSERT(fabs(drift2)*duration < fabs(drift1)*duration+0.01*kinetic2);
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        if (argc > 1)
+            platform.setPropertyDefaultValue("MetalPrecision", string(argv[1]));
+        testAccuracy();
+        testEnergyDrift();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
@@ -0,0 +1,156 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests building the exclusion tiles.  BenchmarkMetalExclusionTiles times it for a system
+ * with over a million atoms.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "MetalArray.h"
+#include "MetalContext.h"
+#include "MetalNonbondedUtilities.h"
+#include "openmm/System.h"
+#include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+static MetalPlatform platform;
+
+/**
+ * Create exclusions for a system of three atom molecules.  Every hundredth molecule is also
+ * excluded from an atom half way through the system, so some flags belong to rows that are
+ * owned by a different thread.
+ */
+vector<vector<int> > createExclusions(int numAtoms) {
+    vector<vector<int> > exclusions(numAtoms);
+    for (int i = 0; i < numAtoms; i++) {
+        int first = i-i%3;
+        for (int j = first; j < first+3 && j < numAtoms; j++)
+            exclusions[i].push_back(j);
+    }
+    for (int i = 0; i < numAtoms/2; i += 300) {
+        exclusions[i].push_back(i+numAtoms/2);
+        exclusions[i+numAtoms/2].push_back(i);
+    }
+    return exclusions;
+}
+
+struct ExclusionData {
+    vector<mm_int2> tiles;
+    vector<cl_uint> flags;
+};
+
+ExclusionData buildExclusions(int numAtoms, int numThreads) {
+    System system;
+    for (int i = 0; i < numAtoms; i++)
+        system.addParticle(1.0);
+    MetalPlatform::PlatformData platformData(system, "", "", platform.getPropertyDefaultValue("MetalPrecision"), "false", "false", numThreads, NULL);
+    MetalContext& context = *platformData.contexts[0];
+    context.getNonbondedUtilities().requestExclusions(createExclusions(numAtoms));
+    context.initialize();
+    ExclusionData data;
+    context.getNonbondedUtilities().getExclusionTiles().download(data.tiles);
+    context.getNonbondedUtilities().getExclusions().download(data.flags);
+    return data;
+}
+
+void testMatchesDirectConstruction() {
+    // Build the flags directly from the exclusion list and compare.
+
+    const int numAtoms = 3000;
+    const int tileSize = MetalContext::TileSize;
+    ExclusionData data = buildExclusions(numAtoms, 4);
+    vector<vector<int> > exclusions = createExclusions(numAtoms);
+    set<pair<int, int> > expectedTiles;
+    for (int atom1 = 0; atom1 < numAtoms; atom1++)
+        for (int atom2 : exclusions[atom1])
+            expectedTiles.insert(make_pair(max(atom1/tileSize, atom2/tileSize), min(atom1/tileSize, atom2/tileSize)));
+    ASSERT_EQUAL(expectedTiles.size(), data.tiles.size());
+    ASSERT_EQUAL(expectedTiles.size()*tileSize, data.flags.size());
+    map<pair<int, int>, int> tileIndex;
+    for (int i = 0; i < (int) data.tiles.size(); i++) {
+        pair<int, int> tile = make_pair(data.tiles[i].x, data.tiles[i].y);
+        ASSERT(expectedTiles.find(tile) != expectedTiles.end());
+        tileIndex[tile] = i;
+    }
+    ASSERT_EQUAL(expectedTiles.size(), tileIndex.size());
+    for (auto& tile : tileIndex) {
+        for (int i = 0; i < tileSize; i++) {
+            for (int j = 0; j < tileSize; j++) {
+                int atom1 = tile.first.first*tileSize+i;
+                int atom2 = tile.first.second*tileSize+j;
+                bool excluded = false;
+                if (atom1 < numAtoms && atom2 < numAtoms) {
+                    for (int k : exclusions[atom1])
+                        excluded |= (k == atom2);
+                    for (int k : exclusions[atom2])
+                        excluded |= (k == atom1);
+                }
+                bool flag = ((data.flags[tile.second*tileSize+i]>>j) & 1);
+                ASSERT_EQUAL(!excluded, flag);
+            }
+        }
+    }
+}
+
+void testThreadCount() {
+    // The result must not depend on the number of threads.  The system is large enough that
+    // every thread's range of atoms spans many tiles, and some flags are deferred to other threads.
+
+    const int numAtoms = 30000;
+    ExclusionData serial = buildExclusions(numAtoms, 1);
+    for (int numThreads : {3, 8}) {
+        ExclusionData parallel = buildExclusions(numAtoms, numThreads);
+        ASSERT_EQUAL(serial.tiles.size(), parallel.tiles.size());
+        for (int i = 0; i < (int) serial.tiles.size(); i++) {
+            ASSERT_EQUAL(serial.tiles[i].x, parallel.tiles[i].x);
+            ASSERT_EQUAL(serial.tiles[i].y, parallel.tiles[i].y);
+        }
+        ASSERT_EQUAL(serial.flags.size(), parallel.flags.size());
+        for (int i = 0; i < (int) serial.flags.size(); i++)
+            ASSERT_EQUAL(serial.flags[i], parallel.flags[i]);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        if (argc > 1)
+            platform.setPropertyDefaultValue("MetalPrecision", string(argv[1]));
+        testMatchesDirectConstruction();
+        testThreadCount();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
@@ -40,6 +40,7 @@
 #include "MetalSort.h"
 #include "sfmt/SFMT.h"
 #include "openmm/System.h"
+#include <algorithm>
 #include <complex>
 #include <iostream>
 #include <cmath>
@@ -55,12 +56,7 @@ using namespace std;
 static MetalPlatform platform;
 
 template <class Real2>
-void testTransform(bool realToComplex, int xsize, int ysize, int zsize) {
-    System system;
-    system.addParticle(0.0);
-    MetalPlatform::PlatformData platformData(system, "", "", platform.getPropertyDefaultValue("MetalPrecision"), "false", "false", 1, NULL);
-    MetalContext& context = *platformData.contexts[0];
-    context.initialize();
+void verifyTransform(MetalContext& context, MetalFFT3D& fft, bool realToComplex, int xsize, int ysize, int zsize) {
     OpenMM_SFMT::SFMT sfmt;
     init_gen_rand(0, sfmt);
     vector<Real2> original(xsize*ysize*zsize);
@@ -79,7 +75,6 @@ void testTransform(bool realToComplex, int xsize, int ysize, int zsize) {
     MetalArray grid1(context, original.size(), sizeof(Real2), "grid1");
     MetalArray grid2(context, original.size(), sizeof(Real2), "grid2");
     grid1.upload(original);
-    MetalFFT3D fft(context, xsize, ysize, zsize, realToComplex);
 
     // Perform a forward FFT, then verify the result is correct.
 
@@ -114,6 +109,67 @@ void testTransform(bool realToComplex, int xsize, int ysize, int zsize) {
     }
 }
 
+template <class Real2>
+void testTransform(bool realToComplex, int xsize, int ysize, int zsize) {
+    System system;
+    system.addParticle(0.0);
+    MetalPlatform::PlatformData platformData(system, "", "", platform.getPropertyDefaultValue("MetalPrecision"), "false", "false", 1, NULL);
+    MetalContext& context = *platformData.contexts[0];
+    context.initialize();
+    MetalFFT3D fft(context, xsize, ysize, zsize, realToComplex);
+    verifyTransform<Real2>(context, fft, realToComplex, xsize, ysize, zsize);
+}
+
+template <class Real2>
+void testCandidatePlans(bool realToComplex, int xsize, int ysize, int zsize) {
+    // Every plan the autotuner might choose should produce correct results.
+
+    System system;
+    system.addParticle(0.0);
+    MetalPlatform::PlatformData platformData(system, "", "", platform.getPropertyDefaultValue("MetalPrecision"), "false", "false", 1, NULL);
+    MetalContext& context = *platformData.contexts[0];
+    context.initialize();
+    vector<MetalFFT3D::Plan> plans = MetalFFT3D::getCandidatePlans(context, xsize, ysize, zsize, realToComplex);
+    ASSERT(plans.size() > 0);
+    for (const MetalFFT3D::Plan& plan : plans) {
+        ASSERT(MetalFFT3D::Plan::fromString(plan.toString()) == plan);
+        MetalFFT3D fft(context, xsize, ysize, zsize, realToComplex, plan);
+        ASSERT(fft.getPlan() == plan);
+        verifyTransform<Real2>(context, fft, realToComplex, xsize, ysize, zsize);
+    }
+}
+
+void testAutotuning() {
+    System system;
+    system.addParticle(0.0);
+    MetalPlatform::PlatformData platformData(system, "", "", platform.getPropertyDefaultValue("MetalPrecision"), "false", "false", 1, NULL);
+    MetalContext& context = *platformData.contexts[0];
+    context.initialize();
+
+    // The fastest plan should be one of the candidates, and it should be remembered.
+
+    vector<MetalFFT3D::Plan> plans = MetalFFT3D::getCandidatePlans(context, 28, 25, 30, true);
+    MetalFFT3D::Plan plan = MetalFFT3D::findFastestPlan(context, 28, 25, 30, true);
+    ASSERT(find(plans.begin(), plans.end(), plan) != plans.end());
+    ASSERT(MetalFFT3D::findFastestPlan(context, 28, 25, 30, true) == plan);
+
+    // The grid may be slightly larger than the minimum, but every dimension must be legal.
+
+    int minimum[] = {25, 31, 61};
+    int size[] = {minimum[0], minimum[1], minimum[2]};
+    MetalFFT3D::findFastestDimensions(context, size[0], size[1], size[2], true);
+    for (int i = 0; i < 3; i++) {
+        int legal = MetalFFT3D::findLegalDimension(minimum[i]);
+        ASSERT(size[i] >= legal);
+        ASSERT(size[i] <= legal+legal/10);
+        ASSERT_EQUAL(size[i], MetalFFT3D::findLegalDimension(size[i]));
+    }
+    int repeated[] = {minimum[0], minimum[1], minimum[2]};
+    MetalFFT3D::findFastestDimensions(context, repeated[0], repeated[1], repeated[2], true);
+    for (int i = 0; i < 3; i++)
+        ASSERT_EQUAL(size[i], repeated[i]);
+}
+
 int main(int argc, char* argv[]) {
     try {
         if (argc > 1)
@@ -124,6 +180,8 @@ int main(int argc, char* argv[]) {
             testTransform<mm_double2>(true, 25, 28, 25);
             testTransform<mm_double2>(true, 25, 25, 28);
             testTransform<mm_double2>(true, 21, 25, 27);
+            testCandidatePlans<mm_double2>(false, 28, 25, 30);
+            testCandidatePlans<mm_double2>(true, 28, 25, 30);
         }
         else {
             testTransform<mm_float2>(false, 28, 25, 30);
@@ -131,7 +189,10 @@ int main(int argc, char* argv[]) {
             testTransform<mm_float2>(true, 25, 28, 25);
             testTransform<mm_float2>(true, 25, 25, 28);
             testTransform<mm_float2>(true, 21, 25, 27);
+            testCandidatePlans<mm_float2>(false, 28, 25, 30);
+            testCandidatePlans<mm_float2>(true, 28, 25, 30);
         }
+        testAutotuning();
     }
     catch(const exception& e) {
         cout << "exception: " << e.what() << endl;
@@ -0,0 +1,242 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests mixed precision, which stores positions and velocities as pairs of floats.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "MetalPlatform.h"
+#include "ReferencePlatform.h"
+#include "openmm/CMMotionRemover.h"
+#include "openmm/Context.h"
+#include "openmm/HarmonicBondForce.h"
+#include "openmm/LangevinIntegrator.h"
+#include "openmm/LangevinMiddleIntegrator.h"
+#include "openmm/NonbondedForce.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "sfmt/SFMT.h"
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+static MetalPlatform platform;
+
+map<string, string> getMixedProperties() {
+    map<string, string> properties;
+    properties[MetalPlatform::MetalPrecision()] = "mixed";
+    return properties;
+}
+
+void testStateRoundTrip() {
+    // Values that need more than 24 bits should come back with far more precision than a float has.
+
+    const int numParticles = 10;
+    System system;
+    vector<Vec3> positions(numParticles), velocities(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        positions[i] = Vec3(1000.0+1.23456789e-5*i, -500.0+9.87654321e-6*i, 250.0+3.14159265e-7*i);
+        velocities[i] = Vec3(1.0+1.1e-9*i, -2.0+2.2e-9*i, 0.5+3.3e-9*i);
+    }
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform, getMixedProperties());
+    context.setPositions(positions);
+    context.setVelocities(velocities);
+    State state = context.getState(State::Positions | State::Velocities);
+    for (int i = 0; i < numParticles; i++) {
+        ASSERT_EQUAL_VEC(positions[i], state.getPositions()[i], 1e-12);
+        ASSERT_EQUAL_VEC(velocities[i], state.getVelocities()[i], 1e-12);
+    }
+
+    // Take some steps, then check that a checkpoint preserves the corrections.
+
+    integrator.step(10);
+    State state1 = context.getState(State::Positions | State::Velocities);
+    stringstream checkpoint;
+    context.createCheckpoint(checkpoint);
+    integrator.step(10);
+    context.loadCheckpoint(checkpoint);
+    State state2 = context.getState(State::Positions | State::Velocities);
+    for (int i = 0; i < numParticles; i++) {
+        ASSERT_EQUAL_VEC(state1.getPositions()[i], state2.getPositions()[i], 1e-14);
+        ASSERT_EQUAL_VEC(state1.getVelocities()[i], state2.getVelocities()[i], 1e-14);
+    }
+}
+
+void testSmallDisplacements() {
+    // Move particles far from the origin by much less than the spacing between floats at each
+    // step.  In single precision they would never move.  A NonbondedForce with no interactions
+    // makes the atoms get reordered, which must keep the corrections with their atoms.
+
+    const int numParticles = 200;
+    const double boxSize = 2000.0;
+    const int numSteps = 1000;
+    const double stepSize = 0.001;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::CutoffPeriodic);
+    nonbonded->setCutoffDistance(1.0);
+    system.addForce(nonbonded);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions(numParticles), velocities(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        nonbonded->addParticle(0.0, 0.1, 0.0);
+        positions[i] = Vec3(100.0+1800.0*genrand_real2(sfmt), 100.0+1800.0*genrand_real2(sfmt), 100.0+1800.0*genrand_real2(sfmt));
+        velocities[i] = Vec3(genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5)*1e-3;
+    }
+    VerletIntegrator integrator(stepSize);
+    Context context(system, integrator, platform, getMixedProperties());
+    context.setPositions(positions);
+    context.setVelocities(velocities);
+    integrator.step(numSteps);
+    State state = context.getState(State::Positions | State::Velocities);
+    for (int i = 0; i < numParticles; i++) {
+        ASSERT_EQUAL_VEC(positions[i]+velocities[i]*(numSteps*stepSize), state.getPositions()[i], 1e-10);
+        ASSERT_EQUAL_VEC(velocities[i], state.getVelocities()[i], 1e-6);
+    }
+}
+
+void testAgainstReference(bool langevin) {
+    // Simulate bonded pairs and compare to the Reference platform.  Forces are still computed in
+    // single precision, so the trajectories slowly diverge.  The friction and temperature are
+    // zero, so LangevinMiddleIntegrator is deterministic.
+
+    const int numPairs = 20;
+    const int numSteps = 500;
+    System system;
+    HarmonicBondForce* bonds = new HarmonicBondForce();
+    system.addForce(bonds);
+    vector<Vec3> positions;
+    for (int i = 0; i < numPairs; i++) {
+        system.addParticle(12.0);
+        system.addParticle(1.0);
+        bonds->addBond(2*i, 2*i+1, 0.1, 100000.0);
+        Vec3 center(0.37*i, -0.21*i, 0.5);
+        positions.push_back(center);
+        positions.push_back(center+Vec3(0.104, 0.003*(i%5), 0.0));
+    }
+    if (langevin) {
+        system.addConstraint(0, 1, 0.1);
+        bonds->setBondParameters(0, 0, 1, 0.1, 0.0);
+    }
+    Integrator* integrator1;
+    Integrator* integrator2;
+    if (langevin) {
+        integrator1 = new LangevinMiddleIntegrator(0.0, 0.0, 0.0005);
+        integrator2 = new LangevinMiddleIntegrator(0.0, 0.0, 0.0005);
+    }
+    else {
+        integrator1 = new VerletIntegrator(0.0005);
+        integrator2 = new VerletIntegrator(0.0005);
+    }
+    integrator1->setConstraintTolerance(1e-8);
+    integrator2->setConstraintTolerance(1e-8);
+    ReferencePlatform reference;
+    Context context1(system, *integrator1, reference);
+    Context context2(system, *integrator2, platform, getMixedProperties());
+    context1.setPositions(positions);
+    context2.setPositions(positions);
+    integrator1->step(numSteps);
+    integrator2->step(numSteps);
+    State state1 = context1.getState(State::Positions | State::Velocities | State::Energy);
+    State state2 = context2.getState(State::Positions | State::Velocities | State::Energy);
+    for (int i = 0; i < system.getNumParticles(); i++) {
+        ASSERT_EQUAL_VEC(state1.getPositions()[i], state2.getPositions()[i], 1e-4);
+        ASSERT_EQUAL_VEC(state1.getVelocities()[i], state2.getVelocities()[i], 1e-3);
+    }
+    ASSERT_EQUAL_TOL(state1.getPotentialEnergy()+state1.getKineticEnergy(), state2.getPotentialEnergy()+state2.getKineticEnergy(), 1e-3);
+    delete integrator1;
+    delete integrator2;
+}
+
+void testCMMotionRemover() {
+    // CMMotionRemover modifies velm without knowing about the corrections, so they must be folded
+    // into it first.  Otherwise the velocities read back would include the stale corrections.
+
+    const int numParticles = 20;
+    System system;
+    system.addForce(new CMMotionRemover(1));
+    vector<Vec3> positions(numParticles), velocities(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0+i%3);
+        positions[i] = Vec3(1000.0+0.3*i, -500.0+0.2*(i%4), 250.0+0.1*(i%7));
+        velocities[i] = Vec3(1.0+1.1e-9*i, -2.0+2.2e-9*i, 0.5+3.3e-9*i);
+    }
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform, getMixedProperties());
+    context.setPositions(positions);
+    context.setVelocities(velocities);
+    integrator.step(5);
+    State state = context.getState(State::Velocities);
+    Vec3 momentum;
+    for (int i = 0; i < numParticles; i++)
+        momentum += state.getVelocities()[i]*system.getParticleMass(i);
+    ASSERT_EQUAL_VEC(Vec3(), momentum, 1e-5);
+}
+
+void testUnsupportedIntegrator() {
+    // Integrators without float-float kernels would ignore the corrections, so they are rejected.
+
+    System system;
+    system.addParticle(1.0);
+    LangevinIntegrator integrator(300.0, 1.0, 0.001);
+    bool threw = false;
+    try {
+        Context context(system, integrator, platform, getMixedProperties());
+    }
+    catch (const OpenMMException& e) {
+        threw = true;
+    }
+    ASSERT(threw);
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        // Every test requests mixed precision itself, so the precision argument is ignored.
+
+        testStateRoundTrip();
+        testSmallDisplacements();
+        testAgainstReference(false);
+        testAgainstReference(true);
+        testCMMotionRemover();
+        testUnsupportedIntegrator();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
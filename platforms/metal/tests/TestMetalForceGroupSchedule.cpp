@@ -0,0 +1,199 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "MetalContext.h"
+#include "MetalForceGroupSchedule.h"
+#include "MetalPlatform.h"
+#include "MetalTestSystems.h"
+#include "MetalTrackingPlatform.h"
+#include "openmm/Context.h"
+#include "openmm/CustomIntegrator.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/RMSDForce.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+static MetalTrackingPlatform platform;
+
+/**
+ * Create a RESPA integrator that evaluates force group 1 once per outer step and force group 0
+ * on each inner step.
+ */
+CustomIntegrator* createIntegrator(int innerSteps) {
+    CustomIntegrator* integrator = new CustomIntegrator(0.004);
+    stringstream inner;
+    inner << "(dt/" << innerSteps << ")";
+    integrator->addComputePerDof("v", "v+0.5*dt*f1/m");
+    for (int i = 0; i < innerSteps; i++) {
+        integrator->addComputePerDof("v", "v+0.5*"+inner.str()+"*f0/m");
+        integrator->addComputePerDof("x", "x+"+inner.str()+"*v");
+        integrator->addComputePerDof("v", "v+0.5*"+inner.str()+"*f0/m");
+    }
+    integrator->addComputePerDof("v", "v+0.5*dt*f1/m");
+    return integrator;
+}
+
+void compareForces(Context& context1, Context& context2, int groups, int numParticles) {
+    State state1 = context1.getState(State::Forces, false, groups);
+    State state2 = context2.getState(State::Forces, false, groups);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1e-4);
+}
+
+void testRespaTrajectory() {
+    System system;
+    vector<Vec3> positions;
+    createDimerBox(system, 512, 0.9, positions);
+    const int innerSteps = 3;
+    CustomIntegrator* integrator1 = createIntegrator(innerSteps);
+    CustomIntegrator* integrator2 = createIntegrator(innerSteps);
+    Context context1(system, *integrator1, platform);
+    setenv("OPENMM_METAL_SLOW_FORCE_GROUPS", "2", 1);
+    setenv("OPENMM_METAL_MTS_INNER_STEPS", "3", 1);
+    Context context2(system, *integrator2, platform);
+    unsetenv("OPENMM_METAL_SLOW_FORCE_GROUPS");
+    unsetenv("OPENMM_METAL_MTS_INNER_STEPS");
+    MetalForceGroupSchedule& schedule = platform.getMetalContext().getForceGroupSchedule();
+    ASSERT_EQUAL(2, schedule.getSlowGroups());
+    ASSERT_EQUAL(3, schedule.getInnerSteps());
+
+    // Taking the slow forces from the cache should give the same trajectory as computing them.
+
+    context1.setPositions(positions);
+    context2.setPositions(positions);
+    context1.setVelocitiesToTemperature(300.0, 1);
+    context2.setVelocitiesToTemperature(300.0, 1);
+    for (int i = 0; i < 10; i++) {
+        integrator1->step(5);
+        integrator2->step(5);
+        State state1 = context1.getState(State::Positions | State::Velocities);
+        State state2 = context2.getState(State::Positions | State::Velocities);
+        for (int j = 0; j < system.getNumParticles(); j++) {
+            ASSERT_EQUAL_VEC(state1.getPositions()[j], state2.getPositions()[j], 1e-4);
+            ASSERT_EQUAL_VEC(state1.getVelocities()[j], state2.getVelocities()[j], 1e-3);
+        }
+    }
+    ASSERT(schedule.getNumCachedEvaluations() > 0);
+    delete integrator1;
+    delete integrator2;
+}
+
+void testCachedForces() {
+    System system;
+    vector<Vec3> positions;
+    createDimerBox(system, 512, 0.9, positions);
+    VerletIntegrator integrator1(0.001), integrator2(0.001);
+    Context context1(system, integrator1, platform);
+    Context context2(system, integrator2, platform);
+    MetalForceGroupSchedule& schedule = platform.getMetalContext().getForceGroupSchedule();
+    schedule.setSchedule(1<<1, 1);
+    context1.setPositions(positions);
+    context2.setPositions(positions);
+
+    // Evaluating the fast group also computes the slow one, and the next request for the slow
+    // group is served from the cache.
+
+    for (int i = 0; i < 3; i++) {
+        compareForces(context1, context2, 1<<0, system.getNumParticles());
+        compareForces(context1, context2, 1<<1, system.getNumParticles());
+    }
+    ASSERT_EQUAL(3, schedule.getNumCachedEvaluations());
+
+    // Setting positions between the two evaluations must discard the cache.
+
+    vector<Vec3> perturbed = positions;
+    for (int i = 0; i < (int) perturbed.size(); i++)
+        perturbed[i] += Vec3(0.01*sin(i), 0.01*cos(i), 0.01*sin(2*i));
+    context2.getState(State::Forces, false, 1<<0);
+    context1.setPositions(perturbed);
+    context2.setPositions(perturbed);
+    compareForces(context1, context2, 1<<1, system.getNumParticles());
+    ASSERT_EQUAL(3, schedule.getNumCachedEvaluations());
+
+    // Energy is never taken from the cache.
+
+    context2.getState(State::Forces, false, 1<<0);
+    State state1 = context1.getState(State::Forces | State::Energy, false, 1<<1);
+    State state2 = context2.getState(State::Forces | State::Energy, false, 1<<1);
+    ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-5);
+    for (int i = 0; i < system.getNumParticles(); i++)
+        ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1e-4);
+    ASSERT_EQUAL(3, schedule.getNumCachedEvaluations());
+}
+
+void testUnskippableForce() {
+    // RMSDForce launches its own kernels, which would still run when the cache is used.
+
+    System system;
+    vector<Vec3> positions;
+    createDimerBox(system, 512, 0.9, positions);
+    RMSDForce* rmsd = new RMSDForce(positions);
+    rmsd->setForceGroup(1);
+    system.addForce(rmsd);
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    MetalForceGroupSchedule& schedule = platform.getMetalContext().getForceGroupSchedule();
+    bool threw = false;
+    try {
+        schedule.setSchedule(1<<1, 1);
+    }
+    catch (const OpenMMException& e) {
+        threw = true;
+    }
+    ASSERT(threw);
+    ASSERT_EQUAL(0, schedule.getSlowGroups());
+
+    // Group 0 only has forces that can skip their work.
+
+    schedule.setSchedule(1<<0, 1);
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        if (argc > 1)
+            platform.setPropertyDefaultValue("MetalPrecision", string(argv[1]));
+        testRespaTrajectory();
+        testCachedForces();
+        testUnskippableForce();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
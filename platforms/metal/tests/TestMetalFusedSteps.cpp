@@ -0,0 +1,99 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests OPENMM_METAL_FUSED_STEPS, which defers the neighbor list count check to the end of
+ * each block of fused steps.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "MetalContext.h"
+#include "MetalNonbondedUtilities.h"
+#include "MetalPlatform.h"
+#include "MetalTestSystems.h"
+#include "MetalTrackingPlatform.h"
+#include "openmm/Context.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+static MetalTrackingPlatform platform;
+
+void testFusedMatchesUnfused() {
+    const int fusedSteps = 10;
+    System system;
+    vector<Vec3> positions;
+    createLennardJonesBox(system, 4096, 0.2, 1.5, positions);
+    VerletIntegrator integrator1(0.002), integrator2(0.002);
+    Context context1(system, integrator1, platform);
+    setenv("OPENMM_METAL_FUSED_STEPS", "10", 1);
+    Context context2(system, integrator2, platform);
+    unsetenv("OPENMM_METAL_FUSED_STEPS");
+    MetalContext& cl = platform.getMetalContext();
+    ASSERT_EQUAL(fusedSteps, cl.getFusedSteps());
+    int initialSize = cl.getNonbondedUtilities().getInteractingTiles().getSize();
+    context1.setPositions(positions);
+    context2.setPositions(positions);
+    context1.setVelocitiesToTemperature(300.0, 1);
+    context2.setVelocities(context1.getState(State::Velocities).getVelocities());
+    for (int block = 0; block < 3; block++) {
+        integrator1.step(fusedSteps);
+        integrator2.step(fusedSteps);
+
+        // The first block overflows the neighbor list.  The interaction kernel falls back to
+        // every tile until the count is checked at the end of the block, which must enlarge it.
+
+        if (block == 0)
+            ASSERT(cl.getNonbondedUtilities().getInteractingTiles().getSize() > initialSize);
+        State state1 = context1.getState(State::Positions | State::Velocities | State::Energy);
+        State state2 = context2.getState(State::Positions | State::Velocities | State::Energy);
+        for (int i = 0; i < system.getNumParticles(); i++) {
+            ASSERT_EQUAL_VEC(state1.getPositions()[i], state2.getPositions()[i], 1e-5);
+            ASSERT_EQUAL_VEC(state1.getVelocities()[i], state2.getVelocities()[i], 1e-4);
+        }
+        ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-4);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        if (argc > 1)
+            platform.setPropertyDefaultValue("MetalPrecision", string(argv[1]));
+        testFusedMatchesUnfused();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
@@ -0,0 +1,193 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests the profiler that records kernel execution times.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "MetalArray.h"
+#include "MetalContext.h"
+#include "MetalKernelProfiler.h"
+#include "openmm/System.h"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+static MetalPlatform platform;
+
+MetalKernelProfiler::Record createRecord(const string& name, double start, double duration) {
+    MetalKernelProfiler::Record record;
+    record.name = name;
+    record.globalSize = 1024;
+    record.blockSize = 128;
+    record.queue = 0;
+    record.startTime = start;
+    record.endTime = start+duration;
+    return record;
+}
+
+void testRingBuffer() {
+    MetalKernelProfiler profiler(false, 10);
+    ASSERT(!profiler.isAvailable());
+    profiler.setEnabled(true);
+    ASSERT(!profiler.isEnabled());
+    for (int i = 0; i < 25; i++)
+        profiler.addRecord(createRecord("kernel", 100.0*i, i+1));
+
+    // Only the most recent records should be kept, in order.
+
+    vector<MetalKernelProfiler::Record> records = profiler.getRecords();
+    ASSERT_EQUAL(10, records.size());
+    for (int i = 0; i < 10; i++)
+        ASSERT_EQUAL_TOL(100.0*(i+15), records[i].startTime, 1e-10);
+
+    // Shrinking the buffer should discard the oldest records.
+
+    profiler.setCapacity(4);
+    records = profiler.getRecords();
+    ASSERT_EQUAL(4, records.size());
+    ASSERT_EQUAL_TOL(100.0*21, records[0].startTime, 1e-10);
+    profiler.addRecord(createRecord("kernel", 2500.0, 26));
+    records = profiler.getRecords();
+    ASSERT_EQUAL(4, records.size());
+    ASSERT_EQUAL_TOL(100.0*22, records[0].startTime, 1e-10);
+    ASSERT_EQUAL_TOL(2500.0, records[3].startTime, 1e-10);
+    profiler.clear();
+    ASSERT_EQUAL(0, profiler.getRecords().size());
+    ASSERT_EQUAL(0, profiler.getStatistics().size());
+}
+
+void testStatistics() {
+    MetalKernelProfiler profiler(false, 1000);
+    for (int i = 1; i <= 100; i++) {
+        profiler.addRecord(createRecord("slow", 0.0, 10.0*i));
+        if (i%2 == 0)
+            profiler.addRecord(createRecord("fast", 0.0, 1.0));
+    }
+    vector<MetalKernelProfiler::Statistics> stats = profiler.getStatistics();
+    ASSERT_EQUAL(2, stats.size());
+    ASSERT_EQUAL("fast", stats[0].name);
+    ASSERT_EQUAL(50, stats[0].count);
+    ASSERT_EQUAL_TOL(50.0, stats[0].totalTime, 1e-10);
+    ASSERT_EQUAL_TOL(1.0, stats[0].medianTime, 1e-10);
+    ASSERT_EQUAL_TOL(1.0, stats[0].p99Time, 1e-10);
+    ASSERT_EQUAL("slow", stats[1].name);
+    ASSERT_EQUAL(100, stats[1].count);
+    ASSERT_EQUAL_TOL(50500.0, stats[1].totalTime, 1e-10);
+    ASSERT_EQUAL_TOL(500.0, stats[1].medianTime, 1e-10);
+    ASSERT_EQUAL_TOL(990.0, stats[1].p99Time, 1e-10);
+
+    // Counts and totals cover every record, but percentiles only cover the ones still in the buffer.
+
+    profiler.setCapacity(10);
+    stats = profiler.getStatistics();
+    ASSERT_EQUAL(100, stats[1].count);
+    ASSERT(stats[1].medianTime > 500.0);
+}
+
+void testOutput() {
+    MetalKernelProfiler profiler(false);
+    int numCallbacks = 0;
+    profiler.setCallback([&] (const MetalKernelProfiler::Record& record) {
+        numCallbacks++;
+    });
+    string path = "TestMetalKernelProfiler.json";
+    profiler.setOutputFile(path);
+    profiler.addRecord(createRecord("first", 1000.0, 500.0));
+    profiler.addRecord(createRecord("second", 2000.0, 250.0));
+    profiler.setOutputFile("");
+    profiler.addRecord(createRecord("third", 3000.0, 100.0));
+    ASSERT_EQUAL(3, numCallbacks);
+
+    // The file should contain one complete trace event for each record written while it was open.
+
+    ifstream file(path.c_str());
+    stringstream contents;
+    contents << file.rdbuf();
+    file.close();
+    remove(path.c_str());
+    string trace = contents.str();
+    ASSERT(trace.find("\"name\":\"first\"") != string::npos);
+    ASSERT(trace.find("\"name\":\"second\"") != string::npos);
+    ASSERT(trace.find("\"name\":\"third\"") == string::npos);
+    ASSERT(trace.find("\"globalSize\":1024") != string::npos);
+    ASSERT_EQUAL('[', trace[0]);
+    ASSERT(trace.find(']') != string::npos);
+}
+
+void testContextProfiler() {
+    System system;
+    system.addParticle(1.0);
+    MetalPlatform::PlatformData platformData(system, "", "", platform.getPropertyDefaultValue("MetalPrecision"), "false", "false", 1, NULL);
+    MetalContext& context = *platformData.contexts[0];
+    context.initialize();
+    MetalKernelProfiler& profiler = context.getKernelProfiler();
+    profiler.clear();
+    MetalArray array(context, 1000, sizeof(float), "array");
+    context.clearBuffer(array);
+    profiler.flush();
+    if (profiler.isAvailable()) {
+        // Profiling was enabled through the environment, so the launch should have been recorded.
+
+        vector<MetalKernelProfiler::Record> records = profiler.getRecords();
+        ASSERT(records.size() > 0);
+        ASSERT_EQUAL("clearBuffer", records.back().name);
+        ASSERT(records.back().endTime >= records.back().startTime);
+
+        // Pausing the profiler should stop recording.
+
+        profiler.setEnabled(false);
+        int numRecords = records.size();
+        context.clearBuffer(array);
+        profiler.flush();
+        ASSERT_EQUAL(numRecords, profiler.getRecords().size());
+    }
+    else
+        ASSERT_EQUAL(0, profiler.getRecords().size());
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        if (argc > 1)
+            platform.setPropertyDefaultValue("MetalPrecision", string(argv[1]));
+        testRingBuffer();
+        testStatistics();
+        testOutput();
+        testContextProfiler();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
@@ -0,0 +1,111 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests checking the size of the neighbor list only every few steps.  When the list
+ * overflows between checks, the interaction kernel must fall back to computing every tile, so
+ * the forces must match a context that checks the size every step.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "MetalContext.h"
+#include "MetalNonbondedUtilities.h"
+#include "MetalPlatform.h"
+#include "MetalTestSystems.h"
+#include "MetalTrackingPlatform.h"
+#include "openmm/Context.h"
+#include "openmm/VerletIntegrator.h"
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+static MetalTrackingPlatform platform;
+
+void compareStates(Context& context1, Context& context2, int numParticles) {
+    State state1 = context1.getState(State::Forces | State::Energy);
+    State state2 = context2.getState(State::Forces | State::Energy);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1e-4);
+    ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-5);
+}
+
+void testOverflowBetweenChecks() {
+    const int checkInterval = 10;
+    System system;
+    vector<Vec3> positions;
+    createLennardJonesBox(system, 4096, 0.2, 1.5, positions);
+    VerletIntegrator integrator1(0.002), integrator2(0.002);
+    Context context1(system, integrator1, platform);
+    setenv("OPENMM_METAL_NEIGHBOR_LIST_CHECK_INTERVAL", "10", 1);
+    Context context2(system, integrator2, platform);
+    unsetenv("OPENMM_METAL_NEIGHBOR_LIST_CHECK_INTERVAL");
+    MetalNonbondedUtilities& nb = platform.getMetalContext().getNonbondedUtilities();
+    if (!nb.getUseLazyCountCheck()) {
+        cout << "The neighbor list size is checked every step on this device; skipping test." << endl;
+        return;
+    }
+    int initialSize = nb.getInteractingTiles().getSize();
+
+    // The first evaluation overflows the neighbor list, which is only noticed when the count is
+    // checked.  Until then, every tile is computed.
+
+    context1.setPositions(positions);
+    context2.setPositions(positions);
+    compareStates(context1, context2, system.getNumParticles());
+
+    // Downloading the positions checks the count if nothing else has, so the list must have grown.
+
+    context2.getState(State::Positions);
+    ASSERT(nb.getInteractingTiles().getSize() > initialSize);
+
+    // Take steps between and across count checks, then compare forces at the same positions.
+
+    context2.setVelocitiesToTemperature(300.0, 1);
+    for (int steps : {checkInterval/2, checkInterval, checkInterval+3}) {
+        integrator2.step(steps);
+        State state = context2.getState(State::Positions);
+        context1.setPositions(state.getPositions());
+        compareStates(context1, context2, system.getNumParticles());
+    }
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        if (argc > 1)
+            platform.setPropertyDefaultValue("MetalPrecision", string(argv[1]));
+        testOverflowBetweenChecks();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
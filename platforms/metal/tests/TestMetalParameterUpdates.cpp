@@ -0,0 +1,130 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests updating the parameters of a NonbondedForce when only some of them change.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "MetalPlatform.h"
+#include "openmm/Context.h"
+#include "openmm/NonbondedForce.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "sfmt/SFMT.h"
+#include <iostream>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+static MetalPlatform platform;
+
+void compareToNewContext(System& system, Context& context, const vector<Vec3>& positions) {
+    // The updated context should match one created from scratch with the same parameters.
+
+    VerletIntegrator integrator(0.001);
+    Context expectedContext(system, integrator, platform);
+    expectedContext.setPositions(positions);
+    State expected = expectedContext.getState(State::Forces | State::Energy);
+    State state = context.getState(State::Forces | State::Energy);
+    for (int i = 0; i < system.getNumParticles(); i++)
+        ASSERT_EQUAL_VEC(expected.getForces()[i], state.getForces()[i], 1e-4);
+    ASSERT_EQUAL_TOL(expected.getPotentialEnergy(), state.getPotentialEnergy(), 1e-5);
+}
+
+void testPartialUpdates() {
+    const int numMolecules = 300;
+    const double boxSize = 3.0;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::PME);
+    nonbonded->setCutoffDistance(0.9);
+    nonbonded->setUseDispersionCorrection(true);
+    vector<Vec3> positions;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numMolecules; i++) {
+        system.addParticle(1.0);
+        system.addParticle(1.0);
+        nonbonded->addParticle(-0.5, 0.3, 0.5);
+        nonbonded->addParticle(0.5, 0.2, 0.4);
+        nonbonded->addException(2*i, 2*i+1, 0.1, 0.25, 0.3);
+        Vec3 pos(boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt));
+        positions.push_back(pos);
+        positions.push_back(pos+Vec3(0.15, 0, 0));
+    }
+    system.addForce(nonbonded);
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+    context.getState(State::Energy);
+
+    // Change a single particle.
+
+    nonbonded->setParticleParameters(10, -0.3, 0.35, 0.6);
+    nonbonded->updateParametersInContext(context);
+    compareToNewContext(system, context, positions);
+
+    // Change a particle and an exception in one update, then another particle's charge in a second
+    // update before the forces are computed.
+
+    nonbonded->setParticleParameters(100, 0.7, 0.2, 0.4);
+    nonbonded->setExceptionParameters(20, 40, 41, 0.2, 0.3, 0.5);
+    nonbonded->updateParametersInContext(context);
+    nonbonded->setParticleParameters(501, 0.1, 0.2, 0.4);
+    nonbonded->updateParametersInContext(context);
+    compareToNewContext(system, context, positions);
+
+    // An update that changes nothing should leave the results unchanged.
+
+    nonbonded->updateParametersInContext(context);
+    compareToNewContext(system, context, positions);
+
+    // Change most of the particles, so all parameters are recomputed.
+
+    for (int i = 0; i < system.getNumParticles(); i += 2)
+        nonbonded->setParticleParameters(i, -0.4, 0.3, 0.5);
+    for (int i = 0; i < numMolecules; i += 3)
+        nonbonded->setExceptionParameters(i, 2*i, 2*i+1, 0.05, 0.25, 0.3);
+    nonbonded->updateParametersInContext(context);
+    compareToNewContext(system, context, positions);
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        if (argc > 1)
+            platform.setPropertyDefaultValue("MetalPrecision", string(argv[1]));
+        testPartialUpdates();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
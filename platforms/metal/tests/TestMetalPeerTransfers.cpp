@@ -0,0 +1,146 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests splitting the force computation between two devices, with positions and forces
+ * copied either directly between devices that share a cl::Context or through host memory.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "MetalContext.h"
+#include "MetalPlatform.h"
+#include "openmm/Context.h"
+#include "openmm/HarmonicBondForce.h"
+#include "openmm/NonbondedForce.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "sfmt/SFMT.h"
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+static MetalPlatform platform;
+
+int countDevices() {
+    vector<cl::Platform> platforms;
+    cl::Platform::get(&platforms);
+    if (platforms.size() == 0)
+        return 0;
+    vector<cl::Device> devices;
+    try {
+        platforms[0].getDevices(CL_DEVICE_TYPE_ALL, &devices);
+    }
+    catch (...) {
+        return 0;
+    }
+    return devices.size();
+}
+
+vector<State> computeStates(System& system, const vector<Vec3>& positions, const string& devices, const string& peerTransfers) {
+    setenv("OPENMM_METAL_PEER_TRANSFERS", peerTransfers.c_str(), 1);
+    map<string, string> properties;
+    properties[MetalPlatform::MetalPlatformIndex()] = "0";
+    properties[MetalPlatform::MetalDeviceIndex()] = devices;
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform, properties);
+    unsetenv("OPENMM_METAL_PEER_TRANSFERS");
+
+    // Evaluate several conformations, so positions are copied to the devices more than once.
+
+    vector<State> states;
+    for (int i = 0; i < 3; i++) {
+        vector<Vec3> shifted(positions);
+        for (Vec3& pos : shifted)
+            pos += Vec3(0.01*i, 0.02*i, -0.01*i);
+        context.setPositions(shifted);
+        states.push_back(context.getState(State::Forces | State::Energy));
+    }
+    return states;
+}
+
+void testSplitForces() {
+    const int numMolecules = 600;
+    const double boxSize = 4.0;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::CutoffPeriodic);
+    nonbonded->setCutoffDistance(1.0);
+    HarmonicBondForce* bonds = new HarmonicBondForce();
+    vector<Vec3> positions;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numMolecules; i++) {
+        Vec3 center(boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt));
+        system.addParticle(1.0);
+        system.addParticle(1.0);
+        nonbonded->addParticle(-0.5, 0.2, 0.2);
+        nonbonded->addParticle(0.5, 0.2, 0.2);
+        nonbonded->addException(2*i, 2*i+1, 0.0, 1.0, 0.0);
+        bonds->addBond(2*i, 2*i+1, 0.1, 1000.0);
+        positions.push_back(center);
+        positions.push_back(center+Vec3(0.1, 0, 0));
+    }
+    system.addForce(nonbonded);
+    system.addForce(bonds);
+
+    // Splitting the work between devices changes the order forces are summed in, but nothing else.
+
+    vector<State> reference = computeStates(system, positions, "0", "1");
+    vector<State> peer = computeStates(system, positions, "0,1", "1");
+    vector<State> staged = computeStates(system, positions, "0,1", "0");
+    for (int i = 0; i < (int) reference.size(); i++) {
+        for (int j = 0; j < system.getNumParticles(); j++) {
+            ASSERT_EQUAL_VEC(reference[i].getForces()[j], peer[i].getForces()[j], 1e-4);
+            ASSERT_EQUAL_VEC(reference[i].getForces()[j], staged[i].getForces()[j], 1e-4);
+        }
+        ASSERT_EQUAL_TOL(reference[i].getPotentialEnergy(), peer[i].getPotentialEnergy(), 1e-5);
+        ASSERT_EQUAL_TOL(reference[i].getPotentialEnergy(), staged[i].getPotentialEnergy(), 1e-5);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        if (argc > 1)
+            platform.setPropertyDefaultValue("MetalPrecision", string(argv[1]));
+        if (countDevices() < 2) {
+            cout << "Skipping: this test needs two devices on the first platform." << endl;
+            cout << "Done" << endl;
+            return 0;
+        }
+        testSplitForces();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
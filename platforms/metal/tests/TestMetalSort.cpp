@@ -59,7 +59,18 @@ class SortTrait : public MetalSort::SortTrait {
     const char* getSortKey() const {return "value";}
 };
 
-void verifySorting(vector<float> array, bool uniform) {
+class PairTrait : public MetalSort::SortTrait {
+    int getDataSize() const {return 8;}
+    int getKeySize() const {return 4;}
+    const char* getDataType() const {return "int2";}
+    const char* getKeyType() const {return "int";}
+    const char* getMinKey() const {return "INT_MIN";}
+    const char* getMaxKey() const {return "INT_MAX";}
+    const char* getMaxValue() const {return "(int2) (INT_MAX, INT_MAX)";}
+    const char* getSortKey() const {return "value.y";}
+};
+
+void verifySorting(vector<float> array, bool uniform, MetalSort::SortEngine engine=MetalSort::AutomaticSort) {
     // Sort the array.
 
     System system;
@@ -69,7 +80,9 @@ void verifySorting(vector<float> array, bool uniform) {
     context.initialize();
     MetalArray data(context, array.size(), sizeof(float), "sortData");
     data.upload(array);
-    MetalSort sort(context, new SortTrait(), array.size(), uniform);
+    MetalSort sort(context, new SortTrait(), array.size(), uniform, engine);
+    if (engine != MetalSort::AutomaticSort)
+        ASSERT(sort.getEngine() == engine);
     sort.sort(data);
     vector<float> sorted;
     data.download(sorted);
@@ -119,6 +132,74 @@ void testShortList() {
     verifySorting(array, false);
 }
 
+void testRadixSort() {
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+
+    // Sort floats of both signs.
+
+    vector<float> array(10000);
+    for (int i = 0; i < (int) array.size(); i++)
+        array[i] = (float) log(genrand_real2(sfmt))*(genrand_real2(sfmt) < 0.5 ? -1 : 1);
+    verifySorting(array, true, MetalSort::RadixSort);
+    array.resize(500);
+    verifySorting(array, true, MetalSort::RadixSort);
+
+    // Sort pairs by a signed integer key with many duplicates, and make sure the sort
+    // is stable.
+
+    System system;
+    system.addParticle(0.0);
+    MetalPlatform::PlatformData platformData(system, "", "", platform.getPropertyDefaultValue("MetalPrecision"), "false", "false", 1, NULL);
+    MetalContext& context = *platformData.contexts[0];
+    context.initialize();
+    vector<mm_int2> pairs(20000);
+    for (int i = 0; i < (int) pairs.size(); i++)
+        pairs[i] = mm_int2(i, (int) (2000*genrand_real2(sfmt))-1000);
+    MetalArray data(context, pairs.size(), sizeof(mm_int2), "sortData");
+    data.upload(pairs);
+    MetalSort sort(context, new PairTrait(), pairs.size(), true, MetalSort::RadixSort);
+    sort.sort(data);
+    vector<mm_int2> sorted;
+    data.download(sorted);
+    vector<int> count(pairs.size(), 0);
+    for (int i = 0; i < (int) sorted.size(); i++) {
+        ASSERT(sorted[i].y == pairs[sorted[i].x].y);
+        count[sorted[i].x]++;
+        if (i > 0) {
+            ASSERT(sorted[i-1].y <= sorted[i].y);
+            if (sorted[i-1].y == sorted[i].y)
+                ASSERT(sorted[i-1].x < sorted[i].x);
+        }
+    }
+    for (int i = 0; i < (int) count.size(); i++)
+        ASSERT_EQUAL(1, count[i]);
+}
+
+void testEngines() {
+    // Both engines should sort keys with distributions that favor one or the other.
+    // BenchmarkMetalUtilities compares their speed on larger arrays.
+
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int length : {500, 10000}) {
+        vector<float> uniform(length), clustered(length), presorted(length);
+        for (int i = 0; i < length; i++) {
+            uniform[i] = (float) genrand_real2(sfmt);
+            if (genrand_real2(sfmt) < 0.001)
+                clustered[i] = (float) (1000*genrand_real2(sfmt));
+            else
+                clustered[i] = (float) ((int) (8*genrand_real2(sfmt)) + 1e-4*genrand_real2(sfmt));
+            presorted[i] = (float) i;
+        }
+        for (MetalSort::SortEngine engine : {MetalSort::BucketSort, MetalSort::RadixSort}) {
+            verifySorting(uniform, true, engine);
+            verifySorting(clustered, false, engine);
+            verifySorting(presorted, true, engine);
+        }
+    }
+}
+
 int main(int argc, char* argv[]) {
     try {
         if (argc > 1)
@@ -126,6 +207,8 @@ int main(int argc, char* argv[]) {
         testUniformValues();
         testLogValues();
         testShortList();
+        testRadixSort();
+        testEngines();
     }
     catch(const exception& e) {
         cout << "exception: " << e.what() << endl;
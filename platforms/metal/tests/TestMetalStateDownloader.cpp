@@ -0,0 +1,145 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "MetalArray.h"
+#include "MetalContext.h"
+#include "MetalStateDownloader.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/System.h"
+#include <iostream>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+static MetalPlatform platform;
+
+void uploadState(MetalContext& context, int numParticles, double offset) {
+    int paddedNumAtoms = context.getPaddedNumAtoms();
+    if (context.getUseDoublePrecision()) {
+        vector<mm_double4> posq(paddedNumAtoms, mm_double4(0, 0, 0, 0));
+        for (int i = 0; i < numParticles; i++)
+            posq[i] = mm_double4(i+offset, 2*i+offset, 3*i+offset, 0);
+        context.getPosq().upload(posq);
+    }
+    else {
+        vector<mm_float4> posq(paddedNumAtoms, mm_float4(0, 0, 0, 0));
+        for (int i = 0; i < numParticles; i++)
+            posq[i] = mm_float4(i+offset, 2*i+offset, 3*i+offset, 0);
+        context.getPosq().upload(posq);
+    }
+    if (context.getUseDoublePrecision() || context.getUseMixedPrecision()) {
+        vector<mm_double4> velm(paddedNumAtoms, mm_double4(0, 0, 0, 0));
+        for (int i = 0; i < numParticles; i++)
+            velm[i] = mm_double4(-i-offset, offset, i, 1);
+        context.getVelm().upload(velm);
+    }
+    else {
+        vector<mm_float4> velm(paddedNumAtoms, mm_float4(0, 0, 0, 0));
+        for (int i = 0; i < numParticles; i++)
+            velm[i] = mm_float4(-i-offset, offset, i, 1);
+        context.getVelm().upload(velm);
+    }
+}
+
+void checkSnapshot(const MetalStateDownloader::Snapshot& snapshot, int numParticles, double offset, long long stepCount) {
+    ASSERT_EQUAL(stepCount, snapshot.stepCount);
+    ASSERT_EQUAL(numParticles, snapshot.positions.size());
+    ASSERT_EQUAL(numParticles, snapshot.velocities.size());
+    ASSERT_EQUAL(0, snapshot.forces.size());
+    for (int i = 0; i < numParticles; i++) {
+        ASSERT_EQUAL_VEC(Vec3(i+offset, 2*i+offset, 3*i+offset), snapshot.positions[i], 1e-5);
+        ASSERT_EQUAL_VEC(Vec3(-i-offset, offset, i), snapshot.velocities[i], 1e-5);
+    }
+}
+
+void testDoubleBuffering() {
+    const int numParticles = 1000;
+    System system;
+    for (int i = 0; i < numParticles; i++)
+        system.addParticle(1.0);
+    MetalPlatform::PlatformData platformData(system, "", "", platform.getPropertyDefaultValue("MetalPrecision"), "false", "false", 1, NULL);
+    MetalContext& context = *platformData.contexts[0];
+    context.initialize();
+    MetalStateDownloader& downloader = context.getStateDownloader();
+    ASSERT_EQUAL(0, downloader.getNumPendingSnapshots());
+    ASSERT(!downloader.isSnapshotReady());
+    int types = MetalStateDownloader::Positions | MetalStateDownloader::Velocities;
+
+    // Start a snapshot, modify the state, and start another one.
+
+    uploadState(context, numParticles, 0.5);
+    context.setStepCount(10);
+    downloader.startSnapshot(types);
+    uploadState(context, numParticles, 7.25);
+    context.setStepCount(20);
+    downloader.startSnapshot(types);
+    ASSERT_EQUAL(2, downloader.getNumPendingSnapshots());
+
+    // Both staging buffers are in use, so a third snapshot cannot be started.
+
+    bool threwException = false;
+    try {
+        downloader.startSnapshot(types);
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+
+    // Each snapshot should reflect the state at the time it was started.
+
+    MetalStateDownloader::Snapshot snapshot;
+    downloader.finishSnapshot(snapshot);
+    checkSnapshot(snapshot, numParticles, 0.5, 10);
+    downloader.finishSnapshot(snapshot);
+    checkSnapshot(snapshot, numParticles, 7.25, 20);
+    ASSERT_EQUAL(0, downloader.getNumPendingSnapshots());
+
+    // The buffers should be reusable.
+
+    uploadState(context, numParticles, 3.0);
+    downloader.startSnapshot(types);
+    context.getQueue().finish();
+    ASSERT(downloader.isSnapshotReady());
+    downloader.finishSnapshot(snapshot);
+    checkSnapshot(snapshot, numParticles, 3.0, 20);
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        if (argc > 1)
+            platform.setPropertyDefaultValue("MetalPrecision", string(argv[1]));
+        testDoubleBuffering();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
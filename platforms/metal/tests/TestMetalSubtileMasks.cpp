@@ -0,0 +1,106 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "MetalContext.h"
+#include "MetalNonbondedUtilities.h"
+#include "MetalPlatform.h"
+#include "MetalTestSystems.h"
+#include "MetalTrackingPlatform.h"
+#include "openmm/Context.h"
+#include "openmm/VerletIntegrator.h"
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+static MetalTrackingPlatform platform;
+
+void compareStates(Context& context1, Context& context2, int numParticles) {
+    State state1 = context1.getState(State::Forces | State::Energy);
+    State state2 = context2.getState(State::Forces | State::Energy);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1e-4);
+    ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-5);
+}
+
+void testSubtileMasks() {
+    System system;
+    vector<Vec3> positions;
+    createChargedBox(system, 4096, 0.31, 0.9, positions);
+    VerletIntegrator integrator1(0.001), integrator2(0.001);
+    setenv("OPENMM_METAL_SUBTILE_MASKS", "0", 1);
+    Context context1(system, integrator1, platform);
+    setenv("OPENMM_METAL_SUBTILE_MASKS", "1", 1);
+    Context context2(system, integrator2, platform);
+    unsetenv("OPENMM_METAL_SUBTILE_MASKS");
+    MetalNonbondedUtilities& nb = platform.getMetalContext().getNonbondedUtilities();
+    if (!nb.getUseSubtileMasks()) {
+        cout << "Sub-tile masks are not supported on this device; skipping test." << endl;
+        return;
+    }
+
+    // Skipping empty sub-tiles should not change the forces or energy.
+
+    context1.setPositions(positions);
+    context2.setPositions(positions);
+    compareStates(context1, context2, system.getNumParticles());
+
+    // Let the atoms move so the neighbor list is rebuilt, then compare again.
+
+    context1.setVelocitiesToTemperature(300.0, 1);
+    integrator1.step(200);
+    State state = context1.getState(State::Positions);
+    context2.setPositions(state.getPositions());
+    compareStates(context1, context2, system.getNumParticles());
+
+    // Every pair within the cutoff must be in a sub-tile that is computed, so the masks can
+    // only remove pairs beyond the cutoff.
+
+    long long pairsWithinCutoff, pairsInTiles, pairsInSubtiles;
+    nb.getNeighborListPairCounts(pairsWithinCutoff, pairsInTiles, pairsInSubtiles);
+    ASSERT(pairsWithinCutoff > 0);
+    ASSERT(pairsWithinCutoff <= pairsInSubtiles);
+    ASSERT(pairsInSubtiles <= pairsInTiles);
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        if (argc > 1)
+            platform.setPropertyDefaultValue("MetalPrecision", string(argv[1]));
+        testSubtileMasks();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
@@ -0,0 +1,174 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Philip Turner                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Lesser General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public License   *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ * -------------------------------------------------------------------------- */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "MetalArray.h"
+#include "MetalContext.h"
+#include "MetalTrajectoryBuffer.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/System.h"
+#include <iostream>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+static MetalPlatform platform;
+
+const int numParticles = 200;
+
+void uploadPositions(MetalContext& context, double offset) {
+    int paddedNumAtoms = context.getPaddedNumAtoms();
+    if (context.getUseDoublePrecision()) {
+        vector<mm_double4> posq(paddedNumAtoms, mm_double4(0, 0, 0, 0));
+        for (int i = 0; i < numParticles; i++)
+            posq[i] = mm_double4(0.01*i+offset, 0.02*i, 0.015*i, 0);
+        context.getPosq().upload(posq);
+    }
+    else {
+        vector<mm_float4> posq(paddedNumAtoms, mm_float4(0, 0, 0, 0));
+        for (int i = 0; i < numParticles; i++)
+            posq[i] = mm_float4(0.01*i+offset, 0.02*i, 0.015*i, 0);
+        context.getPosq().upload(posq);
+    }
+}
+
+void simulateSteps(MetalContext& context, int numSteps) {
+    // Call the post computations the way a force evaluation does, twice per step to make sure
+    // each step is only captured once.
+
+    for (int step = 0; step < numSteps; step++) {
+        uploadPositions(context, 0.001*context.getStepCount());
+        for (int i = 0; i < 2; i++)
+            for (auto computation : context.getPostComputations())
+                computation->computeForceAndEnergy(true, false, -1);
+        context.setStepCount(context.getStepCount()+1);
+    }
+}
+
+void testCapture(bool quantize) {
+    System system;
+    for (int i = 0; i < numParticles; i++)
+        system.addParticle(1.0);
+    MetalPlatform::PlatformData platformData(system, "", "", platform.getPropertyDefaultValue("MetalPrecision"), "false", "false", 1, NULL);
+    MetalContext& context = *platformData.contexts[0];
+    context.initialize();
+    Vec3 a(4, 0, 0), b(0.5, 5, 0), c(-1, 0.5, 6);
+    context.setPeriodicBoxVectors(a, b, c);
+    vector<int> atoms;
+    for (int i = numParticles-1; i >= 0; i -= 3)
+        atoms.push_back(i);
+    MetalTrajectoryBuffer& buffer = context.createTrajectoryBuffer(atoms, 5, 4, quantize);
+    ASSERT_EQUAL(0, buffer.getNumFrames());
+
+    // Run 17 steps.  Frames should be captured at steps 0, 5, 10, and 15.
+
+    simulateSteps(context, 17);
+    ASSERT_EQUAL(4, buffer.getNumFrames());
+    ASSERT_EQUAL(0, buffer.getNumDroppedFrames());
+    vector<MetalTrajectoryBuffer::Frame> frames;
+    buffer.getFrames(frames);
+    ASSERT_EQUAL(4, frames.size());
+    ASSERT_EQUAL(0, buffer.getNumFrames());
+    double tol = (quantize ? 1e-3 : 1e-5);
+    for (int i = 0; i < 4; i++) {
+        MetalTrajectoryBuffer::Frame& frame = frames[i];
+        ASSERT_EQUAL(5*i, frame.stepCount);
+        ASSERT_EQUAL(atoms.size(), frame.positions.size());
+        double offset = 0.001*frame.stepCount;
+        for (int j = 0; j < atoms.size(); j++) {
+            int atom = atoms[j];
+            Vec3 expected(0.01*atom+offset, 0.02*atom, 0.015*atom);
+            if (quantize) {
+                // Quantized positions are wrapped into the box, so compare the offset between
+                // them modulo the box vectors.
+
+                Vec3 delta = frame.positions[j]-expected;
+                delta -= c*round(delta[2]/c[2]);
+                delta -= b*round(delta[1]/b[1]);
+                delta -= a*round(delta[0]/a[0]);
+                ASSERT_EQUAL_VEC(Vec3(0, 0, 0), delta, tol);
+            }
+            else
+                ASSERT_EQUAL_VEC(expected, frame.positions[j], tol);
+        }
+    }
+
+    // Overflow the buffer.  The oldest frames should be dropped.
+
+    buffer.setEnabled(false);
+    simulateSteps(context, 10);
+    ASSERT_EQUAL(0, buffer.getNumFrames());
+    buffer.setEnabled(true);
+    simulateSteps(context, 30);
+    ASSERT_EQUAL(4, buffer.getNumFrames());
+    ASSERT_EQUAL(2, buffer.getNumDroppedFrames());
+    buffer.getFrames(frames);
+    ASSERT_EQUAL(4, frames.size());
+    for (int i = 0; i < 4; i++)
+        ASSERT_EQUAL(40+5*i, frames[i].stepCount);
+}
+
+void testInvalidAtoms() {
+    System system;
+    for (int i = 0; i < 10; i++)
+        system.addParticle(1.0);
+    MetalPlatform::PlatformData platformData(system, "", "", platform.getPropertyDefaultValue("MetalPrecision"), "false", "false", 1, NULL);
+    MetalContext& context = *platformData.contexts[0];
+    context.initialize();
+    bool threwException = false;
+    try {
+        context.createTrajectoryBuffer({1, 2, 1}, 1, 10, false);
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+    threwException = false;
+    try {
+        context.createTrajectoryBuffer({10}, 1, 10, false);
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        if (argc > 1)
+            platform.setPropertyDefaultValue("MetalPrecision", string(argv[1]));
+        testCapture(false);
+        testCapture(true);
+        testInvalidAtoms();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}